@@ -1,206 +1,515 @@
+"""PeerBridge signaling server.
+
+Clients speak JSON text frames. Newer ones announce the "binary" and "batch" features when they
+register, from then on they get MessagePack binary frames, and whatever queued up for them while
+the last frame was being written goes out as one "batch" message. The binary frames are the same
+maps with the same string keys, smaller on the wire but no cheaper to take apart; signaling runs a
+few messages per peer event, far from where that would show.
+
+All users and sessions live in one Directory, indexed by username and by connection. With
+--workers N the websocket connections are spread over N processes sharing the port (SO_REUSEPORT);
+they do the socket work, framing and (de)coding, and pass the decoded messages to the directory
+in the parent process over a socket pair. The directory itself stays one process, so lookups and
+session bookkeeping don't scale with the workers.
+"""
+import argparse
 import asyncio
-import websockets
 import json
-import uuid
+import logging
+import os
+import socket
+import struct
+
+import msgpack
+import websockets
+
+log = logging.getLogger("signaling")
+
+# Public address clients reach the UDP relay at, the relay stays off when unset
+RELAY_HOST = os.environ.get("PEERBRIDGE_RELAY_HOST")
+RELAY_IP = socket.gethostbyname(RELAY_HOST) if RELAY_HOST else None
 
 class User:
-    def __init__(self, websocket, username, ip, port):
-        self.websocket = websocket
+    def __init__(self, conn, username, ip, port, ip6=None, port6=None):
+        self.conn = conn
         self.username = username
         self.ip = ip
         self.port = port
+        # Second candidate on dual-stack hosts, peers race it against the IPv4 one
+        self.ip6 = ip6
+        self.port6 = port6
         self.pending_chat_request = None
+        self.session = None
 
-# Store connected users
-connected_users = {}
-# Map usernames to users for faster lookups
-username_to_user = {}
+class RelayLeg(asyncio.DatagramProtocol):
+    """One member's end of a relayed pair, what it sends here leaves through the other end.
 
-async def handler(websocket):
-    print(f"[+] New connection from {websocket.remote_address}")
-    user = None
-    client_id = str(uuid.uuid4())[:8]
+    Datagrams are forwarded as they are, sealed end to end; the peers only see the relay's ports.
+    """
 
-    try:
-        async for message in websocket:
-            print(f"[Client {client_id}] -> [Server] {message}")
-            try:
-                data = json.loads(message)
-            except json.JSONDecodeError:
-                print(f"[!] Error: Invalid JSON received from client {client_id}")
-                continue
-
-            msg_type = data.get("type")
-
-            if msg_type == "greeting":
-                # Respond to greeting message
-                await websocket.send(json.dumps({
-                    "type": "greet-back",
-                    "message": "Hello from the signaling server!"
-                }))
-            
-            elif msg_type == "register":
-                username = data.get("username")
-                ip = data.get("ip")
-                port = data.get("port")
-                
-                # Check if username already exists
-                if username in username_to_user:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"Username '{username}' is already taken."
-                    }))
-                    continue
-                
-                if username and ip and port:
-                    user = User(websocket, username, ip, port)
-                    connected_users[websocket] = user
-                    username_to_user[username] = user
-                    print(f"[+] Registered {username} @ {ip}:{port}")
-                    await websocket.send(json.dumps({
-                        "type": "register-ack",
-                        "message": f"Registered as {username}"
-                    }))
-            
-            elif msg_type == "get-name":
-                if user:
-                    await websocket.send(json.dumps({
-                        "type": "your-name",
-                        "username": user.username
-                    }))
-                else:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": "You are not registered yet."
-                    }))
-            
-            elif msg_type == "get-peer":
-                target = data.get("username")
-                peer = username_to_user.get(target)
-                
-                if peer:
-                    await websocket.send(json.dumps({
-                        "type": "peer-info",
-                        "username": peer.username,
-                        "ip": peer.ip,
-                        "port": peer.port
-                    }))
-                else:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"User '{target}' not found or not online."
-                    }))
-            
-            elif msg_type == "start-chat":
-                if not user:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": "You must register before starting a chat."
-                    }))
-                    continue
-                
-                target_username = data.get("target")
-                target_user = username_to_user.get(target_username)
-                
-                if not target_user:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"User '{target_username}' not found or not online."
-                    }))
-                    continue
-                
-                # Send chat request to target user
-                try:
-                    await target_user.websocket.send(json.dumps({
-                        "type": "chat-request",
-                        "from": user.username
-                    }))
-                    
-                    # Store pending request
-                    target_user.pending_chat_request = user.username
-                    
-                    print(f"[+] Chat request from {user.username} to {target_username}")
-                except Exception as e:
-                    print(f"[!] Error sending chat request: {e}")
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"Failed to send chat request to {target_username}."
-                    }))
-            
-            elif msg_type == "chat-accept":
-                if not user or not user.pending_chat_request:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": "No pending chat request to accept."
-                    }))
-                    continue
-                
-                requester_username = user.pending_chat_request
-                requester = username_to_user.get(requester_username)
-                
-                if not requester:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"User '{requester_username}' is no longer online."
-                    }))
-                    user.pending_chat_request = None
+    def __init__(self, user):
+        self.user = user
+        self.transport = None
+        self.address = None  # Learned from the member's own datagrams, its NAT picks the port
+        self.other = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        # Anyone can find the port, only the member's public IP gets through
+        if addr[0] != self.user.ip:
+            return
+        self.address = addr
+        other = self.other
+        if other and other.address and other.transport:
+            other.transport.sendto(data, other.address)
+
+    def port(self):
+        return self.transport.get_extra_info("sockname")[1]
+
+    def close(self):
+        if self.transport:
+            self.transport.close()
+
+class Session:
+    """A mesh of peers sharing one virtual network, each member gets its own host index"""
+    MAX_MEMBERS = 16
+
+    def __init__(self):
+        self.members = {}  # username -> host index in 10.0.0.0/24
+        self.relays = {}   # frozenset of two usernames -> {username: RelayLeg}
+
+    def join(self, username):
+        if username in self.members:
+            return self.members[username]
+        used = set(self.members.values())
+        index = next(i for i in range(1, 255) if i not in used)
+        self.members[username] = index
+        return index
+
+    def leave(self, username):
+        self.members.pop(username, None)
+        for pair in [pair for pair in self.relays if username in pair]:
+            for leg in self.relays.pop(pair).values():
+                leg.close()
+
+    async def relay(self, a, b):
+        """Relay legs for a and b, by username, opened the first time the pair is introduced"""
+        if not RELAY_IP:
+            return None
+        pair = frozenset((a.username, b.username))
+        legs = self.relays.get(pair)
+        if legs is None:
+            loop = asyncio.get_running_loop()
+            _, leg_a = await loop.create_datagram_endpoint(lambda: RelayLeg(a), local_addr=("0.0.0.0", 0))
+            _, leg_b = await loop.create_datagram_endpoint(lambda: RelayLeg(b), local_addr=("0.0.0.0", 0))
+            leg_a.other = leg_b
+            leg_b.other = leg_a
+            legs = self.relays[pair] = {a.username: leg_a, b.username: leg_b}
+        # A member that registered again is a new user object
+        legs[a.username].user = a
+        legs[b.username].user = b
+        return legs
+
+def with_ipv6(message, peer):
+    # Left out for IPv4-only peers, older clients never see it either way
+    if peer.ip6 and peer.port6:
+        message["ip6"] = peer.ip6
+        message["port6"] = peer.port6
+    return message
+
+def chat_init(peer, self_index, peer_index, relay_leg=None):
+    message = with_ipv6({
+        "type": "chat-init",
+        "username": peer.username,
+        "ip": peer.ip,
+        "port": peer.port,
+        "self_index": self_index,
+        "peer_index": peer_index
+    }, peer)
+    # The recipient's own leg, it starts there and keeps trying the direct address
+    if relay_leg:
+        message["relay_ip"] = RELAY_IP
+        message["relay_port"] = relay_leg.port()
+    return message
+
+def peer_info(peer):
+    return with_ipv6({
+        "type": "peer-info",
+        "username": peer.username,
+        "ip": peer.ip,
+        "port": peer.port
+    }, peer)
+
+def error(message):
+    return {"type": "error", "message": message}
+
+class Directory:
+    """Every user and session. Connections are opaque keys, `deliver(conn, message)` queues a
+    message for one and never blocks, so a slow client can't hold up anyone else."""
+
+    def __init__(self, deliver):
+        self.deliver = deliver
+        self.users = {}    # username -> User
+        self.by_conn = {}  # connection -> User
+
+    def send_to_session(self, user, message):
+        for name in list(user.session.members):
+            member = self.users.get(name)
+            if member and member is not user:
+                self.deliver(member.conn, message)
+
+    def leave_session(self, user):
+        if user.session:
+            session = user.session
+            session.leave(user.username)
+            user.session = None
+            # Told in the same batch as anything else on its way to them
+            for name in list(session.members):
+                member = self.users.get(name)
+                if member:
+                    self.deliver(member.conn, {"type": "presence", "username": user.username, "online": False})
+
+    def disconnected(self, conn):
+        user = self.by_conn.pop(conn, None)
+        if not user:
+            return
+        log.info("[-] Removing user %s", user.username)
+        self.leave_session(user)
+        if self.users.get(user.username) is user:
+            del self.users[user.username]
+
+    async def handle(self, conn, data):
+        msg_type = data.get("type")
+        user = self.by_conn.get(conn)
+        send = lambda message: self.deliver(conn, message)
+
+        if msg_type == "greeting":
+            # Respond to greeting message
+            send({"type": "greet-back", "message": "Hello from the signaling server!"})
+
+        elif msg_type == "register":
+            username = data.get("username")
+            ip = data.get("ip")
+            port = data.get("port")
+
+            # Check if username already exists
+            if username in self.users:
+                send(error(f"Username '{username}' is already taken."))
+                return
+
+            if username and ip and port:
+                user = User(conn, username, ip, port, data.get("ip6"), data.get("port6"))
+                self.by_conn[conn] = user
+                self.users[username] = user
+                log.info("[+] Registered %s @ %s:%s%s", username, ip, port,
+                         f" and [{user.ip6}]:{user.port6}" if user.ip6 else "")
+                send({"type": "register-ack", "message": f"Registered as {username}"})
+
+        elif msg_type == "get-name":
+            if user:
+                send({"type": "your-name", "username": user.username})
+            else:
+                send(error("You are not registered yet."))
+
+        elif msg_type == "get-peer":
+            target = data.get("username")
+            peer = self.users.get(target)
+            if peer:
+                send(peer_info(peer))
+            else:
+                send(error(f"User '{target}' not found or not online."))
+
+        elif msg_type == "get-peers":
+            # Many lookups in one round trip, whoever isn't online is left out
+            peers = [self.users[name] for name in data.get("usernames", []) if name in self.users]
+            send({"type": "peers-info", "peers": [peer_info(peer) for peer in peers]})
+
+        elif msg_type == "start-chat":
+            if not user:
+                send(error("You must register before starting a chat."))
+                return
+
+            target_username = data.get("target")
+            target_user = self.users.get(target_username)
+            if not target_user:
+                send(error(f"User '{target_username}' not found or not online."))
+                return
+
+            # Send chat request to target user, and store it as pending
+            self.deliver(target_user.conn, {"type": "chat-request", "from": user.username})
+            target_user.pending_chat_request = user.username
+            log.info("[+] Chat request from %s to %s", user.username, target_username)
+
+        elif msg_type == "chat-accept":
+            if not user or not user.pending_chat_request:
+                send(error("No pending chat request to accept."))
+                return
+
+            requester_username = user.pending_chat_request
+            requester = self.users.get(requester_username)
+            if not requester:
+                send(error(f"User '{requester_username}' is no longer online."))
+                user.pending_chat_request = None
+                return
+
+            # Both end up in one session, the accepter's if it already has one
+            if user.session and requester.session and user.session is not requester.session:
+                send(error(f"User '{requester_username}' is already in another session."))
+                user.pending_chat_request = None
+                return
+
+            session = user.session or requester.session or Session()
+            existing = [name for name in session.members if name not in (user.username, requester.username)]
+            newcomers = [u for u in (user, requester) if u.username not in session.members]
+            if len(session.members) + len(newcomers) > Session.MAX_MEMBERS:
+                send(error("Session is full."))
+                user.pending_chat_request = None
+                return
+            user_index = session.join(user.username)
+            requester_index = session.join(requester.username)
+            user.session = session
+            requester.session = session
+
+            legs = await session.relay(user, requester) or {}
+
+            # Send connection info to requester, then to accepter
+            self.deliver(requester.conn, chat_init(user, requester_index, user_index, legs.get(requester.username)))
+            send(chat_init(requester, user_index, requester_index, legs.get(user.username)))
+
+            # Whoever is new connects to the rest of the mesh as well
+            for name in existing:
+                member = self.users.get(name)
+                if not member or member.session is not session:
                     continue
-                
-                # Send connection info to requester
-                await requester.websocket.send(json.dumps({
-                    "type": "chat-init",
+                for joined in newcomers:
+                    index = session.members[joined.username]
+                    legs = await session.relay(member, joined) or {}
+                    self.deliver(joined.conn, chat_init(member, index, session.members[name], legs.get(joined.username)))
+                    self.deliver(member.conn, chat_init(joined, session.members[name], index, legs.get(member.username)))
+
+            log.info("[+] Chat initialized between %s and %s", user.username, requester_username)
+            user.pending_chat_request = None
+
+        elif msg_type == "chat-decline":
+            if not user or not user.pending_chat_request:
+                send(error("No pending chat request to decline."))
+                return
+
+            requester_username = user.pending_chat_request
+            requester = self.users.get(requester_username)
+            if requester:
+                self.deliver(requester.conn, error(f"{user.username} declined your chat request."))
+
+            log.info("[-] Chat request from %s to %s declined", requester_username, user.username)
+            user.pending_chat_request = None
+
+        elif msg_type == "key-exchange":
+            # Per-connection public keys, only relayed between members of the same session
+            target = self.users.get(data.get("to"))
+            if not user or not target or not user.session or target.session is not user.session:
+                send(error("Key exchange target is not in your session."))
+                return
+
+            self.deliver(target.conn, {
+                "type": "key-exchange",
+                "from": user.username,
+                "public_key": data.get("public_key", ""),
+                "aes": bool(data.get("aes", False))
+            })
+
+        elif msg_type == "update-address":
+            # Network switch or NAT rebinding, the rest of the session is told where to find us
+            if not user:
+                return
+            user.ip = data.get("ip", user.ip)
+            user.port = data.get("port", user.port)
+            log.info("[~] %s moved to %s:%s", user.username, user.ip, user.port)
+
+            if user.session:
+                self.send_to_session(user, {
+                    "type": "peer-moved",
                     "username": user.username,
                     "ip": user.ip,
                     "port": user.port
-                }))
-                
-                # Send connection info to accepter
-                await user.websocket.send(json.dumps({
-                    "type": "chat-init",
-                    "username": requester.username,
-                    "ip": requester.ip,
-                    "port": requester.port
-                }))
-                
-                print(f"[+] Chat initialized between {user.username} and {requester_username}")
-                user.pending_chat_request = None
-            
-            elif msg_type == "chat-decline":
-                if not user or not user.pending_chat_request:
-                    await websocket.send(json.dumps({
-                        "type": "error",
-                        "message": "No pending chat request to decline."
-                    }))
+                })
+
+        elif msg_type == "leave-session":
+            if user:
+                self.leave_session(user)
+
+class Connection:
+    """One websocket. Messages are queued and written by the connection's own task, everything
+    queued while a write is under way goes out together."""
+
+    def __init__(self, websocket):
+        self.websocket = websocket
+        self.binary = False
+        self.batch = False
+        self.outbox = []
+        self.wake = asyncio.Event()
+
+    def push(self, message):
+        self.outbox.append(message)
+        self.wake.set()
+
+    def encode(self, message):
+        return msgpack.packb(message) if self.binary else json.dumps(message)
+
+    async def writer(self):
+        while True:
+            await self.wake.wait()
+            self.wake.clear()
+            messages, self.outbox = self.outbox, []
+            if self.batch and len(messages) > 1:
+                messages = [{"type": "batch", "messages": messages}]
+            try:
+                for message in messages:
+                    await self.websocket.send(self.encode(message))
+            except websockets.exceptions.ConnectionClosed:
+                return
+
+class Gateway:
+    """Websocket side of the server: accepts connections, decodes their messages and writes
+    what the directory queues for them. `forward(conn, data)` and `gone(conn)` reach the
+    directory, in this process or the parent."""
+
+    def __init__(self, worker, forward, gone):
+        self.worker = worker
+        self.forward = forward
+        self.gone = gone
+        self.connections = {}  # connection -> Connection
+        self.next_id = 0
+
+    def deliver(self, conn, message):
+        connection = self.connections.get(conn)
+        if connection:
+            connection.push(message)
+
+    async def handler(self, websocket):
+        self.next_id += 1
+        conn = (self.worker, self.next_id)
+        connection = self.connections[conn] = Connection(websocket)
+        writer = asyncio.create_task(connection.writer())
+        log.info("[+] New connection from %s", websocket.remote_address)
+
+        try:
+            async for frame in websocket:
+                try:
+                    if isinstance(frame, bytes):
+                        data = msgpack.unpackb(frame, raw=False)
+                        connection.binary = True
+                    else:
+                        data = json.loads(frame)
+                except (ValueError, msgpack.UnpackException):
+                    log.warning("[!] Undecodable message from %s", websocket.remote_address)
                     continue
-                
-                requester_username = user.pending_chat_request
-                requester = username_to_user.get(requester_username)
-                
-                if requester:
-                    await requester.websocket.send(json.dumps({
-                        "type": "error",
-                        "message": f"{user.username} declined your chat request."
-                    }))
-                
-                print(f"[-] Chat request from {requester_username} to {user.username} declined")
-                user.pending_chat_request = None
+                if not isinstance(data, dict):
+                    continue
+                log.debug("[Client %s] -> [Server] %s", conn, data)
+
+                # Answers to the registration already use what the client says it understands
+                if data.get("type") == "register":
+                    features = data.get("features", [])
+                    connection.binary = connection.binary or "binary" in features
+                    connection.batch = "batch" in features
+                await self.forward(conn, data)
+
+        except websockets.exceptions.ConnectionClosed:
+            pass
+        finally:
+            log.info("[-] Disconnected: %s", websocket.remote_address)
+            writer.cancel()
+            del self.connections[conn]
+            await self.gone(conn)
+
+# --- Workers: length-prefixed MessagePack over a socket pair to the parent --- #
+
+async def read_frame(reader):
+    header = await reader.readexactly(4)
+    return msgpack.unpackb(await reader.readexactly(struct.unpack("!I", header)[0]), raw=False)
+
+def write_frame(writer, frame):
+    body = msgpack.packb(frame)
+    # Not drained per frame, the transport writes whatever piled up in one go
+    writer.write(struct.pack("!I", len(body)) + body)
+
+async def run_worker(worker, link, port):
+    reader, writer = await asyncio.open_connection(sock=link)
+
+    async def forward(conn, data):
+        write_frame(writer, ["message", conn[1], data])
 
-    except websockets.exceptions.ConnectionClosed:
-        print(f"[-] Disconnected: {websocket.remote_address}")
-    finally:
-        if websocket in connected_users:
-            user = connected_users[websocket]
-            print(f"[-] Removing user {user.username}")
-            
-            # Clean up user data
-            if user.username in username_to_user:
-                del username_to_user[user.username]
-            del connected_users[websocket]
-
-async def main():
-    async with websockets.serve(handler, "0.0.0.0", 5000):
-        print("WebSocket Signaling Server running on port 8080...")
+    async def gone(conn):
+        write_frame(writer, ["gone", conn[1]])
+
+    gateway = Gateway(worker, forward, gone)
+    async with websockets.serve(gateway.handler, "0.0.0.0", port, reuse_port=True):
+        while True:
+            local_id, message = await read_frame(reader)
+            gateway.deliver((worker, local_id), message)
+
+async def serve_workers(links):
+    writers = {}
+
+    def deliver(conn, message):
+        writer = writers.get(conn[0])
+        if writer:
+            write_frame(writer, [conn[1], message])
+
+    directory = Directory(deliver)
+
+    async def pump(worker, link):
+        reader, writers[worker] = await asyncio.open_connection(sock=link)
+        while True:
+            frame = await read_frame(reader)
+            conn = (worker, frame[1])
+            if frame[0] == "message":
+                await directory.handle(conn, frame[2])
+            else:
+                directory.disconnected(conn)
+
+    await asyncio.gather(*(pump(worker, link) for worker, link in enumerate(links)))
+
+async def serve(port):
+    async def forward(conn, data):
+        await directory.handle(conn, data)
+
+    async def gone(conn):
+        directory.disconnected(conn)
+
+    gateway = Gateway(0, forward, gone)
+    directory = Directory(gateway.deliver)
+    async with websockets.serve(gateway.handler, "0.0.0.0", port):
         await asyncio.Future()  # Run forever
 
+def main():
+    parser = argparse.ArgumentParser(description="PeerBridge signaling server")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--workers", type=int, default=1,
+                        help="processes accepting websocket connections, the directory stays in this one")
+    args = parser.parse_args()
+    logging.basicConfig(level=os.environ.get("PEERBRIDGE_LOG_LEVEL", "INFO").upper(),
+                        format="%(asctime)s %(process)d %(message)s")
+
+    log.info("WebSocket Signaling Server running on port %d with %d worker(s)...", args.port, args.workers)
+    if args.workers <= 1:
+        asyncio.run(serve(args.port))
+        return
+
+    links = []
+    for worker in range(args.workers):
+        parent, child = socket.socketpair()
+        if os.fork() == 0:
+            parent.close()
+            for other in links:
+                other.close()
+            asyncio.run(run_worker(worker, child, args.port))
+            os._exit(0)
+        child.close()
+        links.append(parent)
+    asyncio.run(serve_workers(links))
+
 if __name__ == "__main__":
-    asyncio.run(main())
\ No newline at end of file
+    main()
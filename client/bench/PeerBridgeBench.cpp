@@ -0,0 +1,634 @@
+// Data plane microbenchmarks and an in-process loopback run of two UDPNetwork instances.
+// Build with -DBUILD_BENCHMARKS=ON, run peerbridge_bench [--seconds=S] [--out=FILE]
+//
+// Results go to stdout (or FILE) as one JSON document, so runs of two releases can be diffed.
+// Progress goes to stderr.
+#include "NetworkingModule.hpp"
+#include "P2PSystem.hpp"
+#include "Crypto.hpp"
+#include "Compression.hpp"
+#include "TrafficScheduler.hpp"
+#include "SpscRing.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using boost::asio::ip::udp;
+
+// Reaches the private paths the benchmarks time, see the friend declarations
+struct BenchAccess
+{
+    static constexpr size_t HEADER_SIZE = UDPNetwork::HEADER_SIZE;
+
+    // MESSAGE header in either wire version, returns its size
+    static size_t writeHeader(uint8_t* out, uint8_t version, uint32_t seq, uint32_t length)
+    {
+        wire::Header header;
+        header.version = version;
+        header.type = static_cast<uint8_t>(UDPNetwork::PacketType::MESSAGE);
+        header.seq = seq;
+        header.length = length;
+        return wire::encode(out, header);
+    }
+
+    static void receive(UDPNetwork& network, PacketBuffer packet, const udp::endpoint& sender)
+    {
+        network.processReceivedData(std::move(packet), sender);
+    }
+
+    // Runs what the IO thread handed the shards, on this thread since no worker was started
+    static size_t runShards(UDPNetwork& network)
+    {
+        size_t handlers = 0;
+        for (std::unique_ptr<UDPNetwork::Shard>& shard : network.shards)
+        {
+            if (shard->context.stopped())
+                shard->context.restart();
+            handlers += shard->context.poll();
+        }
+        return handlers;
+    }
+
+    static void setRoute(P2PSystem& system, uint8_t hostIndex, PeerId peer)
+    {
+        system.routes[hostIndex].store(peer, std::memory_order_relaxed);
+        system.routedPeers.fetch_or(1u << peer, std::memory_order_relaxed);
+    }
+
+    // The per-packet decision of P2PSystem::handlePacketsFromTun, without the send
+    static PeerId filter(const P2PSystem& system, const PacketBuffer& packet)
+    {
+        if (!P2PSystem::isIpPacket(packet))
+            return NO_PEER;
+        PeerId peer = system.routeFor(packet);
+        if (peer == NO_PEER && P2PSystem::isFlooded(packet))
+            return 0;
+        return peer;
+    }
+};
+
+namespace {
+constexpr size_t IP_HEADER = 20;
+constexpr size_t UDP_HEADER = 8;
+// Send time rides in the first bytes of the UDP payload
+constexpr size_t STAMP_OFFSET = IP_HEADER + UDP_HEADER;
+constexpr size_t MIN_PACKET = STAMP_OFFSET + sizeof(int64_t);
+
+struct MicroResult
+{
+    std::string name;
+    size_t iterations;
+    double nanosPerOp;
+};
+
+struct LoopbackResult
+{
+    size_t packetSize;
+    uint64_t sent;
+    uint64_t delivered;
+    double seconds;
+    double p50, p99, p999;  // Microseconds
+};
+
+// Keeps the compiler from dropping a result nobody reads
+template <typename T>
+inline void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <typename F>
+void measure(std::vector<MicroResult>& results, const std::string& name, size_t iterations, F&& body)
+{
+    // Warm up caches and the branch predictor before timing
+    for (size_t i = 0; i < iterations / 10 + 1; ++i)
+        body(i);
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        body(i);
+    double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    results.push_back({name, iterations, nanos / iterations});
+    std::fprintf(stderr, "%-28s %12.1f ns/op\n", name.c_str(), nanos / iterations);
+}
+
+int64_t nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void put32(uint8_t* out, uint32_t value)
+{
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+// IPv4 / UDP from 10.0.0.1 to `dstIp` with `size` bytes in total. Text-like payload when
+// `compressible`, random otherwise.
+void writeIpPacket(uint8_t* packet, size_t size, uint32_t dstIp, uint8_t protocol, bool compressible, std::mt19937& random)
+{
+    std::memset(packet, 0, IP_HEADER + UDP_HEADER);
+    packet[0] = 0x45;
+    packet[2] = (size >> 8) & 0xFF;
+    packet[3] = size & 0xFF;
+    packet[8] = 64;
+    packet[9] = protocol;
+    put32(packet + 12, 0x0A000001);
+    put32(packet + 16, dstIp);
+    packet[20] = 0xC0;  // Source port 49152
+    packet[22] = 0x1F;  // Destination port 8080
+    packet[23] = 0x90;
+
+    static const char TEXT[] = "GET /index.html HTTP/1.1\r\nHost: 10.0.0.2\r\nAccept: text/html\r\n\r\n";
+    for (size_t i = IP_HEADER + UDP_HEADER; i < size; ++i)
+        packet[i] = compressible ? static_cast<uint8_t>(TEXT[i % (sizeof(TEXT) - 1)]) : static_cast<uint8_t>(random());
+}
+
+double percentile(const std::vector<uint32_t>& sorted, double quantile)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(quantile * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+std::unique_ptr<udp::socket> loopbackSocket(boost::asio::io_context& context)
+{
+    return std::make_unique<udp::socket>(context, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+}
+
+/*
+* Microbenchmarks
+*/
+
+void benchHeader(std::vector<MicroResult>& results, size_t iterations)
+{
+    uint8_t header[BenchAccess::HEADER_SIZE];
+    for (uint8_t version : {wire::V1, wire::V2})
+    {
+        std::string suffix = version == wire::V1 ? "_v1" : "_v2";
+        measure(results, "header_encode" + suffix, iterations, [&](size_t i)
+        {
+            BenchAccess::writeHeader(header, version, static_cast<uint32_t>(i), 0);
+            keep(header);
+        });
+
+        // Seqs as a long session has them, v2 spends its full four bytes
+        size_t size = BenchAccess::writeHeader(header, version, 0x01000000, 0);
+        measure(results, "header_decode" + suffix, iterations, [&](size_t i)
+        {
+            std::optional<wire::Header> decoded = wire::decode(header, size + (i & 1));
+            keep(decoded);
+        });
+    }
+}
+
+void benchReceivePath(std::vector<MicroResult>& results, size_t iterations)
+{
+    // A peer at the discard port, its packets go from header checks to the message callback
+    boost::asio::io_context context;
+    std::shared_ptr<PacketPool> pool = std::make_shared<PacketPool>();
+    UDPNetwork network(loopbackSocket(context), context, std::make_shared<SystemStateManager>(), pool);
+    network.setEncryptionRequired(false);
+    network.setCongestionControl(CongestionMode::OFF);
+
+    uint64_t delivered = 0;
+    network.setMessageCallback([&delivered](PacketBuffer, size_t) { ++delivered; });
+    udp::endpoint peer(boost::asio::ip::address_v4::loopback(), 9);
+    network.connectToPeer("127.0.0.1", 9);
+
+    std::mt19937 random(1);
+    const size_t payloadSize = 512;
+    std::vector<uint8_t> payload(payloadSize);
+    writeIpPacket(payload.data(), payloadSize, 0x0A000001, 17, false, random);
+    measure(results, "receive_path_512", iterations, [&](size_t i)
+    {
+        PacketBuffer datagram = pool->acquire(BenchAccess::HEADER_SIZE + payloadSize, PacketPool::HEADROOM);
+        uint8_t* data = datagram.data();
+        BenchAccess::writeHeader(data, wire::V1, static_cast<uint32_t>(i), static_cast<uint32_t>(payloadSize));
+        std::memcpy(data + BenchAccess::HEADER_SIZE, payload.data(), payloadSize);
+        BenchAccess::receive(network, std::move(datagram), peer);
+        // One hand-off per burst, like the IO thread's receive batches
+        if ((i & 31) == 31)
+            BenchAccess::runShards(network);
+    });
+    BenchAccess::runShards(network);
+    keep(delivered);
+    network.shutdown();
+}
+
+void benchFilter(std::vector<MicroResult>& results, size_t iterations)
+{
+    P2PSystem system;
+    for (uint8_t host = 2; host < 10; ++host)
+        BenchAccess::setRoute(system, host, static_cast<PeerId>(host - 2));
+
+    // Mostly routed unicast, some broadcast / multicast and some off the virtual network
+    PacketPool pool;
+    std::mt19937 random(2);
+    std::vector<PacketBuffer> corpus;
+    for (size_t i = 0; i < 1024; ++i)
+    {
+        uint32_t dstIp = 0x0A000002 + static_cast<uint32_t>(random() % 8);
+        if (i % 16 == 0)
+            dstIp = 0xEFFFFFFA;     // SSDP
+        else if (i % 16 == 1)
+            dstIp = 0x0A0000FF;
+        else if (i % 16 == 2)
+            dstIp = 0x08080808;
+        size_t size = 64 + random() % 1336;
+        PacketBuffer packet = pool.acquire(size);
+        writeIpPacket(packet.data(), size, dstIp, (i & 1) ? 17 : 6, false, random);
+        corpus.push_back(std::move(packet));
+    }
+
+    measure(results, "ip_filter", iterations, [&](size_t i)
+    {
+        const PacketBuffer& packet = corpus[i & 1023];
+        PeerId peer = BenchAccess::filter(system, packet);
+        TrafficClass trafficClass = classifyTraffic(packet);
+        keep(peer);
+        keep(trafficClass);
+    });
+}
+
+void benchHandoff(std::vector<MicroResult>& results, size_t iterations)
+{
+    // Producer hands pooled buffers to a consumer thread, as the shards do to the TUN send thread
+    PacketPool pool;
+    SpscRing<PacketBuffer> ring(1024);
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> consumed{0};
+    std::thread consumer([&]()
+    {
+        while (!done.load(std::memory_order_acquire) || !ring.empty())
+        {
+            size_t drained = ring.drain([](PacketBuffer&&) {}, 64);
+            if (drained)
+                consumed.fetch_add(drained, std::memory_order_relaxed);
+            else
+                std::this_thread::yield();
+        }
+    });
+
+    measure(results, "spsc_handoff", iterations, [&](size_t)
+    {
+        // A refused push leaves the packet with us, try again once the consumer caught up
+        PacketBuffer packet = pool.acquire(64);
+        while (ring.push(std::move(packet)) != SpscRing<PacketBuffer>::PushResult::PUSHED)
+            std::this_thread::yield();
+    });
+    done.store(true, std::memory_order_release);
+    consumer.join();
+}
+
+void benchPool(std::vector<MicroResult>& results, size_t iterations)
+{
+    PacketPool pool;
+    measure(results, "pool_acquire_release", iterations, [&](size_t)
+    {
+        PacketBuffer packet = pool.acquire(1400);
+        keep(packet);
+    });
+}
+
+void benchCrypto(std::vector<MicroResult>& results, size_t iterations)
+{
+    uint8_t rxKey[crypto::KEY_SIZE];
+    uint8_t txKey[crypto::KEY_SIZE];
+    randombytes_buf(rxKey, sizeof(rxKey));
+    randombytes_buf(txKey, sizeof(txKey));
+
+    std::vector<CipherSuite> suites;
+    if (crypto::aesAvailable())
+        suites.push_back(CipherSuite::AES256_GCM);
+    suites.push_back(CipherSuite::CHACHA20_POLY1305);
+
+    for (CipherSuite suite : suites)
+    {
+        // Our tx key is the far side's rx key, so a second cipher opens what the first sealed
+        PacketCipher sender;
+        PacketCipher receiver;
+        sender.init(suite, rxKey, txKey);
+        receiver.init(suite, txKey, rxKey);
+
+        for (size_t size : {64, 1400})
+        {
+            std::vector<uint8_t> plain(size);
+            std::vector<uint8_t> sealed(size + crypto::TAG_SIZE);
+            std::vector<uint8_t> opened(size);
+            randombytes_buf(plain.data(), size);
+            uint8_t header[wire::V1_SIZE] = {};
+            std::string suffix = std::string("_") + crypto::suiteName(suite) + "_" + std::to_string(size);
+
+            measure(results, "seal" + suffix, iterations, [&](size_t i)
+            {
+                sender.seal(sealed.data(), plain.data(), size, 3, static_cast<uint32_t>(i), header, sizeof(header));
+            });
+            sender.seal(sealed.data(), plain.data(), size, 3, 7, header, sizeof(header));
+            measure(results, "open" + suffix, iterations, [&](size_t)
+            {
+                bool ok = receiver.open(opened.data(), sealed.data(), sealed.size(), 3, 7, header, sizeof(header));
+                keep(ok);
+            });
+        }
+    }
+}
+
+void benchCompression(std::vector<MicroResult>& results, size_t iterations)
+{
+    PacketPool pool;
+    PacketCompressor compressor;
+    PacketDecompressor decompressor;
+    std::mt19937 random(3);
+
+    const size_t size = 1400;
+    std::vector<uint8_t> original(size);
+    writeIpPacket(original.data(), size, 0x0A000002, 6, true, random);
+
+    PacketBuffer frame;
+    measure(results, "compress_1400", iterations, [&](size_t)
+    {
+        PacketBuffer packet = pool.acquire(size);
+        std::memcpy(packet.data(), original.data(), size);
+        compressor.compress(packet, pool);
+        frame = std::move(packet);
+    });
+
+    if (!compression::isFrame(frame))
+    {
+        std::fprintf(stderr, "decompress_1400: sample did not compress, skipped\n");
+        return;
+    }
+    measure(results, "decompress_1400", iterations, [&](size_t)
+    {
+        PacketBuffer packet = decompressor.decompress(frame, pool);
+        keep(packet);
+    });
+}
+
+/*
+* Loopback
+*/
+
+// Two UDPNetwork instances on 127.0.0.1 with sealed traffic between them. This thread is the
+// TUN source of one side, the other side's message callback is its TUN sink.
+class Loopback
+{
+public:
+    Loopback()
+        : senderPool(std::make_shared<PacketPool>())
+        , receiverPool(std::make_shared<PacketPool>())
+        , sender(loopbackSocket(senderContext), senderContext, std::make_shared<SystemStateManager>(), senderPool)
+        , receiver(loopbackSocket(receiverContext), receiverContext, std::make_shared<SystemStateManager>(), receiverPool)
+    {
+        latencies.reserve(1 << 24);
+    }
+
+    ~Loopback()
+    {
+        sender.shutdown();
+        receiver.shutdown();
+    }
+
+    bool connect()
+    {
+        // Raw transport throughput, pacing would cap it at what BBR measures
+        sender.setCongestionControl(CongestionMode::OFF);
+        receiver.setCongestionControl(CongestionMode::OFF);
+        receiver.setMessageCallback([this](PacketBuffer packet, size_t) { onDelivered(packet); });
+        receiver.setMessageBatchCallback([this](PacketBatch& packets, size_t)
+        {
+            for (PacketBuffer& packet : packets)
+            {
+                if (packet)
+                    onDelivered(packet);
+            }
+        });
+
+        if (!sender.startListening(0) || !receiver.startListening(0))
+            return false;
+        std::optional<PeerId> toReceiver = sender.connectToPeer("127.0.0.1", receiver.getLocalPort());
+        std::optional<PeerId> toSender = receiver.connectToPeer("127.0.0.1", sender.getLocalPort());
+        if (!toReceiver || !toSender)
+            return false;
+        peer = *toReceiver;
+
+        auto deadline = Clock::now() + std::chrono::seconds(5);
+        while (!sender.isPeerConnected(*toReceiver) || !receiver.isPeerConnected(*toSender))
+        {
+            if (Clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        uint8_t rxKey[crypto::KEY_SIZE];
+        uint8_t txKey[crypto::KEY_SIZE];
+        randombytes_buf(rxKey, sizeof(rxKey));
+        randombytes_buf(txKey, sizeof(txKey));
+        CipherSuite suite = crypto::aesAvailable() ? CipherSuite::AES256_GCM : CipherSuite::CHACHA20_POLY1305;
+        return sender.setPeerCipher(*toReceiver, suite, rxKey, txKey) &&
+               receiver.setPeerCipher(*toSender, suite, txKey, rxKey);
+    }
+
+    LoopbackResult run(size_t packetSize, double seconds)
+    {
+        // Closed loop, at most WINDOW packets in flight so a full socket buffer shows up as
+        // lower throughput rather than as loss
+        constexpr uint64_t WINDOW = 2048;
+        constexpr size_t BATCH = 32;
+
+        latencies.clear();
+        delivered.store(0, std::memory_order_relaxed);
+        std::mt19937 random(4);
+        std::vector<uint8_t> templatePacket(packetSize);
+        writeIpPacket(templatePacket.data(), packetSize, 0x0A000002, 17, false, random);
+
+        PacketBatch batch;
+        batch.reserve(BATCH);
+        uint64_t sent = 0;
+        uint64_t givenUp = 0;
+        auto start = Clock::now();
+        auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        auto stalledSince = Clock::time_point{};
+        while (Clock::now() < end)
+        {
+            uint64_t inFlight = sent - givenUp - delivered.load(std::memory_order_acquire);
+            if (inFlight + BATCH > WINDOW)
+            {
+                // Whatever hasn't arrived after a while is lost, stop waiting for it
+                if (stalledSince == Clock::time_point{})
+                    stalledSince = Clock::now();
+                else if (Clock::now() - stalledSince > std::chrono::milliseconds(20))
+                    givenUp += inFlight;
+                std::this_thread::yield();
+                continue;
+            }
+            stalledSince = Clock::time_point{};
+
+            for (size_t i = 0; i < BATCH; ++i)
+            {
+                PacketBuffer packet = senderPool->acquire(packetSize);
+                if (!packet)
+                    break;
+                std::memcpy(packet.data(), templatePacket.data(), packetSize);
+                int64_t stamp = nowNanos();
+                std::memcpy(packet.data() + STAMP_OFFSET, &stamp, sizeof(stamp));
+                batch.push_back(std::move(packet));
+                ++sent;
+            }
+            sender.sendMessages(peer, batch);
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Stragglers still in the receiver's queues
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        // The sink filled the first `arrived` samples before publishing the count
+        uint64_t arrived = delivered.load(std::memory_order_acquire);
+        const uint32_t* samples = latencies.data();
+        std::vector<uint32_t> sorted(samples, samples + std::min<size_t>(arrived, latencies.capacity()));
+        std::sort(sorted.begin(), sorted.end());
+        return LoopbackResult{packetSize, sent, arrived, elapsed,
+            percentile(sorted, 0.50), percentile(sorted, 0.99), percentile(sorted, 0.999)};
+    }
+
+private:
+    // Receiver's worker thread only, published through `delivered`
+    void onDelivered(const PacketBuffer& packet)
+    {
+        if (packet.size() >= MIN_PACKET)
+        {
+            int64_t stamp;
+            std::memcpy(&stamp, packet.data() + STAMP_OFFSET, sizeof(stamp));
+            int64_t latency = nowNanos() - stamp;
+            if (latencies.size() < latencies.capacity())
+                latencies.push_back(static_cast<uint32_t>(std::clamp<int64_t>(latency, 0, UINT32_MAX)));
+        }
+        delivered.fetch_add(1, std::memory_order_release);
+    }
+
+    boost::asio::io_context senderContext;
+    boost::asio::io_context receiverContext;
+    std::shared_ptr<PacketPool> senderPool;
+    std::shared_ptr<PacketPool> receiverPool;
+    UDPNetwork sender;
+    UDPNetwork receiver;
+    PeerId peer = NO_PEER;
+
+    std::vector<uint32_t> latencies;    // Nanoseconds
+    std::atomic<uint64_t> delivered{0};
+};
+
+std::string toJson(const std::vector<MicroResult>& micro, const std::vector<LoopbackResult>& loopback)
+{
+    std::string out = "{\n  \"micro\": [";
+    char line[512];
+    for (size_t i = 0; i < micro.size(); ++i)
+    {
+        std::snprintf(line, sizeof(line), "%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.2f}",
+            i ? "," : "", micro[i].name.c_str(), micro[i].iterations, micro[i].nanosPerOp);
+        out += line;
+    }
+    out += "\n  ],\n  \"loopback\": [";
+    for (size_t i = 0; i < loopback.size(); ++i)
+    {
+        const LoopbackResult& result = loopback[i];
+        double seconds = result.seconds > 0 ? result.seconds : 1.0;
+        double mpps = result.delivered / seconds / 1e6;
+        double gbps = result.delivered * result.packetSize * 8.0 / seconds / 1e9;
+        double loss = result.sent ? 1.0 - static_cast<double>(result.delivered) / result.sent : 0.0;
+        std::snprintf(line, sizeof(line),
+            "%s\n    {\"packet_size\": %zu, \"sent\": %llu, \"delivered\": %llu, \"seconds\": %.3f, "
+            "\"mpps\": %.4f, \"gbps\": %.4f, \"loss\": %.6f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f}",
+            i ? "," : "", result.packetSize,
+            static_cast<unsigned long long>(result.sent), static_cast<unsigned long long>(result.delivered),
+            result.seconds, mpps, gbps, loss, result.p50, result.p99, result.p999);
+        out += line;
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = 2.0;
+    std::string outPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--seconds=", 0) == 0)
+            seconds = std::max(0.1, std::atof(arg.c_str() + 10));
+        else if (arg.rfind("--out=", 0) == 0)
+            outPath = arg.substr(6);
+        else
+            std::fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+    }
+
+    initLogging();
+    if (init_crypto() < 0)
+    {
+        std::fprintf(stderr, "libsodium failed to initialize\n");
+        return 1;
+    }
+
+    std::vector<MicroResult> micro;
+    benchHeader(micro, 10000000);
+    benchReceivePath(micro, 200000);
+    benchFilter(micro, 10000000);
+    benchHandoff(micro, 2000000);
+    benchPool(micro, 10000000);
+    benchCrypto(micro, 200000);
+    benchCompression(micro, 100000);
+
+    std::vector<LoopbackResult> loopback;
+    {
+        Loopback harness;
+        if (harness.connect())
+        {
+            for (size_t size : {64, 512, 1400})
+            {
+                LoopbackResult result = harness.run(size, seconds);
+                std::fprintf(stderr, "loopback %4zu B: %llu / %llu delivered, p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+                    size, static_cast<unsigned long long>(result.delivered), static_cast<unsigned long long>(result.sent),
+                    result.p50, result.p99, result.p999);
+                loopback.push_back(result);
+            }
+        }
+        else
+        {
+            std::fprintf(stderr, "loopback: peers did not connect, skipped\n");
+        }
+    }
+
+    std::string json = toJson(micro, loopback);
+    if (outPath.empty())
+    {
+        std::fputs(json.c_str(), stdout);
+    }
+    else
+    {
+        FILE* file = std::fopen(outPath.c_str(), "wb");
+        if (!file)
+        {
+            std::fprintf(stderr, "Could not write %s\n", outPath.c_str());
+            return 1;
+        }
+        std::fputs(json.c_str(), file);
+        std::fclose(file);
+    }
+    return 0;
+}
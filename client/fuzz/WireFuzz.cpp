@@ -0,0 +1,161 @@
+// wire::decode and findExtension over arbitrary datagrams, aborting on anything the decoder lets
+// through that it shouldn't. Build with -DBUILD_FUZZERS=ON.
+//
+// With Clang it's a libFuzzer target: wire_fuzz [corpus dir] [libFuzzer flags]. Elsewhere (MinGW)
+// the plain main below replays the files given, or with none mutates a few valid headers,
+// wire_fuzz [--runs=N] [file...].
+#include "WireHeader.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "wire_fuzz: %s\n", what);
+        std::abort();
+    }
+}
+
+bool sameFields(const wire::Header& a, const wire::Header& b)
+{
+    return a.version == b.version && a.type == b.type && a.flags == b.flags && a.seq == b.seq &&
+        a.length == b.length && a.sessionId == b.sessionId && a.extensionsSize == b.extensionsSize &&
+        (a.extensionsSize == 0 || std::memcmp(a.extensions, b.extensions, a.extensionsSize) == 0);
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::optional<wire::Header> header = wire::decode(data, size);
+    if (!header)
+        return 0;
+
+    check(header->size >= wire::MIN_SIZE && header->size <= size, "header size outside the datagram");
+    check(header->length <= size - header->size, "payload outside the datagram");
+    if (header->extensionsSize)
+    {
+        check(header->extensions >= data && header->extensions + header->extensionsSize <= data + header->size,
+            "extensions outside the header");
+    }
+
+    // Every TLV found has to lie within the extensions
+    for (unsigned tag = 0; tag < 256; ++tag)
+    {
+        std::optional<wire::Extension> extension = wire::findExtension(*header, static_cast<uint8_t>(tag));
+        if (!extension)
+            continue;
+        check(extension->tag == tag, "extension with another tag");
+        check(extension->value >= header->extensions &&
+            extension->value + extension->length <= header->extensions + header->extensionsSize,
+            "extension value outside the extensions");
+    }
+
+    // What we'd send for it decodes to the same fields
+    std::vector<uint8_t> encoded(wire::encodedSize(*header) + header->length);
+    size_t encodedSize = wire::encode(encoded.data(), *header);
+    check(encodedSize == wire::encodedSize(*header), "encode wrote other than encodedSize");
+    std::optional<wire::Header> again = wire::decode(encoded.data(), encoded.size());
+    check(again && again->size == encodedSize && sameFields(*header, *again), "re-encoded header differs");
+    return 0;
+}
+
+#ifndef PEERBRIDGE_LIBFUZZER
+namespace {
+// Valid headers of both versions to start mutating from
+std::vector<std::vector<uint8_t>> seeds()
+{
+    std::vector<std::vector<uint8_t>> created;
+    const uint8_t extensions[] = {0x01, 0x04, 0xDE, 0xAD, 0xBE, 0xEF, 0x02, 0x00};
+
+    wire::Header header;
+    header.type = 0x03;
+    header.seq = 0xDEADBEEF;
+    header.length = 8;
+    for (uint8_t version : {wire::V1, wire::V2})
+    {
+        header.version = version;
+        for (bool extended : {false, true})
+        {
+            header.sessionId = extended ? std::optional<uint32_t>(0xCAFEF00D) : std::nullopt;
+            header.extensions = extended ? extensions : nullptr;
+            header.extensionsSize = extended ? sizeof(extensions) : 0;
+            std::vector<uint8_t> seed(wire::encodedSize(header) + header.length, 0xA5);
+            wire::encode(seed.data(), header);
+            created.push_back(std::move(seed));
+        }
+    }
+    return created;
+}
+
+void mutate(std::vector<uint8_t>& input, std::mt19937& random)
+{
+    switch (random() % 4)
+    {
+    case 0:
+        input[random() % input.size()] ^= static_cast<uint8_t>(1u << (random() % 8));
+        break;
+    case 1:
+        input[random() % input.size()] = static_cast<uint8_t>(random());
+        break;
+    case 2:
+        input.resize(random() % (input.size() + 1));
+        break;
+    default:
+        input.push_back(static_cast<uint8_t>(random()));
+        break;
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long runs = 1000000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--runs=", 0) == 0)
+            runs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+        else
+            files.push_back(arg);
+    }
+
+    if (!files.empty())
+    {
+        for (const std::string& file : files)
+        {
+            std::ifstream in(file, std::ios::binary);
+            if (!in)
+            {
+                std::fprintf(stderr, "wire_fuzz: can't read %s\n", file.c_str());
+                return 1;
+            }
+            std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        std::printf("%zu inputs, no failures\n", files.size());
+        return 0;
+    }
+
+    std::mt19937 random(std::random_device{}());
+    std::vector<std::vector<uint8_t>> corpus = seeds();
+    for (unsigned long run = 0; run < runs; ++run)
+    {
+        std::vector<uint8_t> input = corpus[random() % corpus.size()];
+        for (unsigned mutations = 1 + random() % 4; mutations > 0 && !input.empty(); --mutations)
+            mutate(input, random);
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    std::printf("%lu runs, no failures\n", runs);
+    return 0;
+}
+#endif
@@ -0,0 +1,139 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+// What an ACK carries: the highest seq seen, a cumulative point and a SACK bitmap.
+// Bit i of sackBitmap set means seq (largest - 1 - i) arrived.
+struct AckFrame
+{
+    uint32_t largest = 0;
+    uint32_t cumulative = 0;
+    uint64_t sackBitmap = 0;
+
+    static constexpr size_t WIRE_SIZE = 16;
+
+    void encode(uint8_t*) const;
+    static AckFrame decode(const uint8_t*);
+};
+
+// Outcome of applying one AckFrame to the send window
+struct AckResult
+{
+    uint32_t newlyAcked = 0;
+    uint32_t newlyLost = 0;
+    uint64_t ackedBytes = 0;
+    uint64_t lostBytes = 0;
+    std::optional<std::chrono::microseconds> rttSample;
+    // Bytes per second delivered since the last ack before the newest acked packet went out,
+    // 0 without an RTT sample.
+    // App-limited when the sender had nothing else queued, the rate then says little about the path.
+    uint64_t deliveryRate = 0;
+    bool appLimited = false;
+};
+
+// Acknowledgement state for one peer, both directions.
+//
+// Receive side (IO thread): records MESSAGE seqs and publishes the latest frame through
+// a seqlock, so the send path can piggyback it without taking a lock.
+// Send side: a fixed ring indexed by seq holds send times, the sending thread writes
+// slots and the IO thread marks them acked or lost when an ACK comes in. Slots are
+// reused as the window wraps, so nothing is allocated and stale entries can't pile up.
+class AckTracker
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    // Told about every send slot an ACK settles, acked or declared lost
+    using ResolveCallback = std::function<void(uint32_t seq, bool acked)>;
+
+    static constexpr size_t WINDOW_SIZE = 1024;        // Send slots, power of two
+    static constexpr uint32_t SACK_RANGE = 64;         // Seqs covered by the bitmap
+    static constexpr uint32_t ACK_EVERY_PACKETS = 32;  // Ack right away after this many, keeps every seq inside some bitmap
+    static constexpr uint32_t REORDER_THRESHOLD = 3;   // Missing this far below largest counts as lost
+
+    AckTracker();
+
+    // Forget what was received, on a new connection the peer's seqs start over. IO thread only.
+    void resetReceive();
+
+    // Receive side, IO thread only. Returns true once enough packets arrived that the ACK shouldn't wait.
+    bool onReceive(uint32_t seq);
+
+    // Claim the pending ACK, if any. Any thread, only one caller gets it.
+    bool takeAck(AckFrame&);
+    bool ackPending() const { return pending.load(std::memory_order_relaxed); }
+
+    // Send side, one writer per seq (the sending thread, or the IO thread for retransmits).
+    // `bytes` is the datagram size, what drives the in-flight count and delivery rate.
+    void onSend(uint32_t seq, Clock::time_point, size_t bytes = 0);
+    // Nothing else was queued behind `seq`, its delivery rate sample is app-limited. Its sender only.
+    void markAppLimited(uint32_t seq);
+    // Settle every outstanding send, for a new connection on the slot. IO thread, sends stopped.
+    void resetSend();
+
+    // Apply a frame from the peer, IO thread only
+    AckResult onAck(const AckFrame&, Clock::time_point);
+    void setResolveCallback(ResolveCallback);
+
+    // Stats
+    std::chrono::microseconds smoothedRtt() const;
+    std::chrono::microseconds rttVariance() const;
+    uint64_t sentCount() const { return sent.load(std::memory_order_relaxed); }
+    uint64_t ackedCount() const { return acked.load(std::memory_order_relaxed); }
+    uint64_t lostCount() const { return lost.load(std::memory_order_relaxed); }
+    // Bytes sent and neither acked nor declared lost yet
+    uint64_t bytesInFlight() const;
+
+private:
+    enum SlotState : uint8_t { EMPTY, SENT, ACKED, LOST };
+
+    struct SendSlot
+    {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<int64_t> sentAt{0};
+        std::atomic<uint8_t> state{EMPTY};
+        std::atomic<uint32_t> bytes{0};
+        std::atomic<uint64_t> deliveredAtSend{0};    // deliveredBytes when it went out
+        std::atomic<int64_t> deliveredTimeAtSend{0}; // and when that count last moved
+        std::atomic<bool> appLimited{false};
+    };
+
+    // Mark one seq if its slot still holds it, returns the slot when it was newly acked
+    const SendSlot* markAcked(uint32_t seq, AckResult&);
+    void updateRtt(std::chrono::microseconds);
+    bool receivedLocked(uint32_t seq) const;
+
+    // Receive side, written by the IO thread
+    bool haveReceived = false;
+    uint32_t rxLargest = 0;
+    uint32_t rxCumulative = 0;
+    uint64_t rxBitmap = 0;
+    uint32_t sinceLastAck = 0;
+
+    // Published copy for takeAck
+    std::atomic<uint32_t> version{0};
+    std::atomic<uint32_t> publishedLargest{0};
+    std::atomic<uint32_t> publishedCumulative{0};
+    std::atomic<uint64_t> publishedBitmap{0};
+    std::atomic<bool> pending{false};
+
+    // Send side
+    std::unique_ptr<SendSlot[]> slots;
+    ResolveCallback onResolve;
+    bool haveLossCursor = false;
+    uint32_t lossCursor = 0; // IO thread
+
+    std::atomic<int64_t> srttMicros{0};
+    std::atomic<int64_t> rttVarMicros{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> acked{0};
+    std::atomic<uint64_t> lost{0};
+    std::atomic<uint64_t> sentBytes{0};
+    std::atomic<uint64_t> deliveredBytes{0};
+    std::atomic<int64_t> deliveredTime{0};
+    std::atomic<uint64_t> lostBytes{0};
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "PacketPool.hpp"
+
+struct z_stream_s;
+
+// Per-packet deflate for tunneled IP packets, applied to the plaintext before it is sealed.
+//
+// A compressed payload is a frame: [tag:1][original length:2][raw deflate stream]. The tag's
+// high nibble is no IP version, so a frame can be told apart from an IP packet even where the
+// datagram header flagging it is gone (FEC recovery, reliable retransmits).
+//
+// Each packet is compressed on its own, any of them may be lost. Flows that don't compress
+// (TLS, media) are spotted from a byte sample and left alone for a growing number of packets
+// before they're tried again.
+namespace compression
+{
+static constexpr uint8_t FRAME_TAG = 0xC1;
+static constexpr size_t FRAME_HEADER_SIZE = 3;
+
+inline bool isFrame(const PacketBuffer& payload)
+{
+    return payload.size() > FRAME_HEADER_SIZE && payload[0] == FRAME_TAG;
+}
+}
+
+// Sending side, used by the sending thread only
+class PacketCompressor
+{
+public:
+    static constexpr size_t MIN_SIZE = 128;      // Below this the frame and the deflate block don't pay off
+    static constexpr size_t SAMPLE_SIZE = 256;   // Bytes looked at for the entropy estimate
+    static constexpr size_t FLOW_SLOTS = 256;    // Flows tracked, power of two
+    static constexpr uint8_t MAX_STRIKES = 6;    // Backoff cap, 16 << 6 packets between probes
+
+    PacketCompressor();
+    ~PacketCompressor();
+    PacketCompressor(const PacketCompressor&) = delete;
+    PacketCompressor& operator=(const PacketCompressor&) = delete;
+
+    // Swap an IP packet for its compressed frame if its flow compresses and the frame is
+    // smaller by at least 1/16, true if it was swapped
+    bool compress(PacketBuffer& packet, PacketPool&);
+
+private:
+    struct FlowState
+    {
+        uint32_t key = 0;
+        uint32_t skip = 0;     // Packets left before the flow is probed again
+        uint8_t strikes = 0;   // Failed probes in a row
+    };
+
+    // Addresses, protocol and ports folded together, zero for none
+    static uint32_t flowKey(const PacketBuffer&, size_t& payloadOffset);
+    // Shannon estimate over a strided sample, bits per byte
+    static float sampleEntropy(const uint8_t*, size_t);
+    static void strike(FlowState&);
+
+    std::unique_ptr<z_stream_s> stream;
+    std::array<FlowState, FLOW_SLOTS> flows{};
+};
+
+// Receiving side, one per receiving thread
+class PacketDecompressor
+{
+public:
+    PacketDecompressor();
+    ~PacketDecompressor();
+    PacketDecompressor(const PacketDecompressor&) = delete;
+    PacketDecompressor& operator=(const PacketDecompressor&) = delete;
+
+    // Inflate a frame into a buffer of its own, empty if the frame is corrupt
+    PacketBuffer decompress(const PacketBuffer& frame, PacketPool&);
+
+private:
+    std::unique_ptr<z_stream_s> stream;
+};
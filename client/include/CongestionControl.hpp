@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "AckTracker.hpp"
+
+// Which controller paces the traffic to a peer, picked once at startup
+enum class CongestionMode : uint8_t {
+    OFF,    // Datagrams go out as soon as they are sent
+    BBR,    // Model based, paces at the measured bottleneck rate and keeps the queue near empty
+    LEDBAT  // Delay based scavenger, yields as soon as queueing delay passes a target
+};
+
+// Sender side congestion control for one peer, fed from the ACK stream.
+//
+// BBR-like: a max filter over delivery rate samples (last BANDWIDTH_ROUNDS rounds) estimates the
+// bottleneck bandwidth, a min filter over RTT samples the path delay. The pacing rate is a gain
+// times the bandwidth, cycled above and below 1 to probe for more and drain what the probe queued;
+// data in flight is capped at two bandwidth-delay products. Rounds with heavy loss lower the estimate.
+// LEDBAT: the window grows while RTT stays within LEDBAT_TARGET of its minimum and shrinks with
+// the delay above it, halves on loss; paced at the window per smoothed RTT.
+//
+// Updated on the peer's shard, rate and window are published for the sending thread.
+class CongestionController
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint64_t MAX_DATAGRAM = 1472;
+    static constexpr uint64_t MIN_WINDOW = 4 * MAX_DATAGRAM;
+    static constexpr uint64_t INITIAL_WINDOW = 32 * MAX_DATAGRAM;
+    static constexpr uint64_t MIN_RATE = 64 * 1024;          // Bytes per second, floor for a bad estimate
+    static constexpr uint64_t INITIAL_RATE = 1250000;        // 10 Mbit/s until the first samples
+    static constexpr size_t BANDWIDTH_ROUNDS = 10;
+    static constexpr std::chrono::seconds MIN_RTT_WINDOW{10};
+    static constexpr std::chrono::milliseconds PROBE_RTT_TIME{200};
+    static constexpr std::chrono::milliseconds LEDBAT_TARGET{25};
+    static constexpr std::chrono::minutes LEDBAT_BASE_WINDOW{2};
+
+    CongestionController();
+
+    // Start over in `mode`, for a new connection on the slot. Shard, or before any traffic.
+    void reset(CongestionMode);
+    void reset() { reset(currentMode); }
+
+    // Shard, after every ACK frame. `bytesInFlight` is what is still out after it was applied.
+    void onAck(const AckResult&, uint64_t bytesInFlight, Clock::time_point now);
+
+    // Any thread
+    CongestionMode mode() const { return currentMode; }
+    uint64_t pacingRate() const { return publishedRate.load(std::memory_order_relaxed); }
+    uint64_t congestionWindow() const { return publishedWindow.load(std::memory_order_relaxed); }
+
+private:
+    enum class Phase : uint8_t { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+    void onAckBbr(const AckResult&, uint64_t bytesInFlight, Clock::time_point now);
+    void onAckLedbat(const AckResult&, Clock::time_point now);
+    // Close the current round once a min RTT has passed, true if it did
+    bool advanceRound(Clock::time_point now);
+    void updateMinRtt(std::chrono::microseconds sample, Clock::time_point now);
+    uint64_t bandwidth() const;
+    uint64_t bdp(double gain) const;
+    void publish(uint64_t rate, uint64_t window);
+
+    CongestionMode currentMode = CongestionMode::BBR;
+    std::atomic<uint64_t> publishedRate{INITIAL_RATE};
+    std::atomic<uint64_t> publishedWindow{INITIAL_WINDOW};
+
+    // Path model, both modes
+    std::chrono::microseconds minRtt{0};
+    Clock::time_point minRttStamp;
+    std::chrono::microseconds smoothedRtt{0};
+
+    // BBR
+    Phase phase = Phase::STARTUP;
+    std::array<uint64_t, BANDWIDTH_ROUNDS> roundBandwidth{};
+    size_t round = 0;
+    Clock::time_point roundStart;
+    uint64_t roundAcked = 0;
+    uint64_t roundLost = 0;
+    uint64_t fullBandwidth = 0;
+    uint8_t fullBandwidthRounds = 0;
+    bool filledPipe = false;
+    uint8_t cycleIndex = 0;
+    Clock::time_point cycleStart;
+    Clock::time_point probeRttDone;
+    std::chrono::microseconds probeRttMin{0};
+
+    // LEDBAT
+    uint64_t window = INITIAL_WINDOW;
+    Clock::time_point lastWindowCut;
+};
@@ -0,0 +1,125 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "PacketPool.hpp"
+
+// Group geometry, k data packets protected by m parity packets
+struct FecParams
+{
+    uint8_t k = 0;
+    uint8_t m = 0;
+
+    bool enabled() const { return k > 0 && m > 0; }
+};
+
+// Systematic Reed-Solomon over GF(2^8) with a Cauchy generator, so any k of the k + m
+// packets of a group rebuild the rest.
+//
+// A symbol is a MESSAGE payload with its 16-bit length in front ([len16][payload]), which is
+// exactly the last two header bytes plus the payload, so both ends use views into the
+// datagram instead of copies. Symbols of one group may differ in length, shorter ones count
+// as zero padded.
+//
+// Parity payload: [member bitmap:8][k:1][m:1][index:1][reserved:1][parity symbol]
+// Bit i of the bitmap set means datagram seq (base + i) is member number popcount(bits below i).
+namespace fec
+{
+static constexpr size_t PARITY_HEADER_SIZE = 12;
+static constexpr uint32_t MAX_SPAN = 64;     // Members sit within 64 seqs of the base
+static constexpr uint8_t MAX_DATA = 32;
+static constexpr uint8_t MAX_PARITY = 8;
+
+// Pick group geometry for a measured loss rate (0..1)
+FecParams paramsForLoss(double lossRate);
+}
+
+// Sending side, used by the sending thread only (params may be changed from any thread).
+class FecEncoder
+{
+public:
+    struct Parity
+    {
+        uint32_t baseSeq;
+        PacketBuffer payload; // Parity header and symbol, headroom left for our header
+    };
+
+    void setParams(FecParams);
+    FecParams params() const;
+
+    // Add the symbol sent as datagram seq. A full group is encoded into `ready`.
+    void add(uint32_t seq, PacketBuffer symbol, PacketPool&, std::vector<Parity>& ready);
+
+    // Close the open group early (end of a send batch), parity count scales with its size
+    void flush(PacketPool&, std::vector<Parity>& ready);
+
+private:
+    void encode(PacketPool&, std::vector<Parity>& ready);
+
+    std::atomic<uint8_t> k{0};
+    std::atomic<uint8_t> m{0};
+
+    uint32_t baseSeq = 0;
+    uint64_t members = 0;
+    std::vector<PacketBuffer> symbols;
+};
+
+// Receiving side, IO thread only.
+class FecDecoder
+{
+public:
+    static constexpr size_t DATA_WINDOW = 256;  // Recent symbols kept for recovery, power of two
+    static constexpr size_t GROUP_SLOTS = 16;   // Groups waiting on more packets
+
+    // A rebuilt datagram payload and the seq it was sent under
+    struct Recovered
+    {
+        uint32_t seq;
+        PacketBuffer payload;
+    };
+
+    FecDecoder();
+
+    // A data packet arrived, `symbol` is a view of [len16][payload]. Recovered packets are appended.
+    void onData(uint32_t seq, const PacketBuffer& symbol, PacketPool&, std::vector<Recovered>& recovered);
+
+    // The original of an already rebuilt packet showed up late, drop it
+    bool wasRecovered(uint32_t seq) const;
+
+    // A parity packet arrived, `payload` is a view past our header. Recovered packets are appended.
+    void onParity(uint32_t baseSeq, const PacketBuffer& payload, PacketPool&, std::vector<Recovered>& recovered);
+
+    void reset();
+
+    uint64_t recoveredCount() const { return recoveredTotal; }
+
+private:
+    struct DataSlot
+    {
+        uint32_t seq = 0;
+        bool valid = false;
+        bool recovered = false;
+        PacketBuffer symbol;
+    };
+
+    struct Group
+    {
+        bool active = false;
+        uint32_t baseSeq = 0;
+        uint64_t members = 0;
+        uint8_t k = 0;
+        uint8_t m = 0;
+        std::vector<PacketBuffer> parities; // Indexed by parity index, empty if not received
+        uint8_t parityCount = 0;
+    };
+
+    const DataSlot* findData(uint32_t seq) const;
+    void tryRecover(Group&, PacketPool&, std::vector<Recovered>& recovered);
+
+    std::unique_ptr<DataSlot[]> data;
+    Group groups[GROUP_SLOTS];
+    size_t nextGroup = 0;
+    uint64_t recoveredTotal = 0;
+};
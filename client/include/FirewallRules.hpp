@@ -0,0 +1,21 @@
+#pragma once
+#include <windows.h>
+#include <ifdef.h>
+
+// Windows Firewall rules for the virtual network, through the firewall COM API.
+//
+// The rules are persistent: they are created the first time PeerBridge runs and found by name
+// afterwards, so a session start costs a few lookups instead of a netsh process per rule.
+// Any thread, each call brings up COM on it for its own duration.
+namespace firewall
+{
+// Create whichever of our rules is missing, enable File and Printer Sharing on private networks
+bool ensureRules();
+// Delete our rules, for uninstalling
+void removeRules();
+
+// Put the adapter's network in the Private category, where discovery and sharing are allowed.
+// Windows only lists the network a moment after the adapter has an address, so this retries
+// for up to `waitMs`.
+bool setNetworkPrivate(const NET_LUID&, unsigned waitMs = 5000);
+}
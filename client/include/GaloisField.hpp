@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// GF(2^8) arithmetic for the FEC codec, polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D).
+// Region kernels pick SSSE3 / AVX2 split-nibble lookups at runtime when the CPU has them.
+namespace gf
+{
+uint8_t mul(uint8_t a, uint8_t b);
+uint8_t inv(uint8_t a); // a != 0
+
+// dst[i] ^= c * src[i]
+void mulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length);
+
+// dst[i] = c * dst[i]
+void mulRegion(uint8_t* dst, uint8_t c, size_t length);
+
+// Name of the region kernel in use ("avx2", "ssse3" or "scalar")
+const char* kernelName();
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Process wide counters, gauges and latency histograms.
+//
+// Every thread records into a block of its own, so recording is a relaxed load and store on a
+// cache line no other thread writes: a few nanoseconds and no lock. Blocks are only summed when
+// someone reads (/stats, the Prometheus endpoint). A thread that exits folds its block into the
+// totals and leaves it for the next thread to reuse.
+namespace metrics
+{
+enum class Counter : uint16_t {
+    // Series of one family stay next to each other, the exposition relies on it
+    UDP_TX_PACKETS,
+    UDP_RX_PACKETS,
+    UDP_TX_BYTES,
+    UDP_RX_BYTES,
+    TUN_RX_PACKETS,         // Read from the adapter, on their way to a peer
+    TUN_TX_PACKETS,         // Written to the adapter, from a peer
+    TUN_RX_BYTES,
+    TUN_TX_BYTES,
+    HEARTBEATS_RX,
+    RETRANSMITS,
+    FEC_RECOVERED,
+    // Drops by reason
+    DROP_UNKNOWN_SENDER,
+    DROP_MALFORMED,
+    DROP_UNENCRYPTED,
+    DROP_NO_KEYS,
+    DROP_DECRYPT,
+    DROP_REPLAY,            // Authenticated before, or older than the replay window
+    DROP_POOL_EXHAUSTED,
+    DROP_SEND_BUFFER,
+    DROP_SEND_ERROR,
+    DROP_NO_ROUTE,
+    DROP_TUN_QUEUE,         // Injection ring to the adapter was full
+    DROP_TUN_ADAPTER,       // Wintun ring was full
+    DROP_NO_SUBSCRIBER,     // Multicast group no peer joined
+    DROP_DUPLICATE_BEACON,  // Same broadcast / multicast packet again within the duplicate window
+    DROP_PARITY_OVERSIZE,   // FEC parity that would have gone past the path MTU
+    // Pacer queue full, one per TrafficClass in its order
+    DROP_QUEUE_CONTROL,
+    DROP_QUEUE_INTERACTIVE,
+    DROP_QUEUE_STANDARD,
+    DROP_QUEUE_BULK,
+    COUNT
+};
+
+// Levels kept as per thread deltas, so producer and consumer may sit on different threads
+enum class Gauge : uint16_t {
+    // Packets waiting in the pacers, one per TrafficClass in its order
+    QUEUED_CONTROL,
+    QUEUED_INTERACTIVE,
+    QUEUED_STANDARD,
+    QUEUED_BULK,
+    COUNT
+};
+
+enum class Histogram : uint16_t {
+    ACK_RTT_US,             // RTT samples from ACK frames
+    PACER_WAIT_US,          // Time a packet spent in its pacer
+    TUN_READ_BATCH,         // Packets per adapter read
+    UDP_SEND_BATCH,         // Datagrams per batched send
+    COUNT
+};
+
+constexpr size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+constexpr size_t GAUGES = static_cast<size_t>(Gauge::COUNT);
+constexpr size_t HISTOGRAMS = static_cast<size_t>(Histogram::COUNT);
+
+// Log-linear buckets in the HDR histogram manner: exact below 16, above that 8 buckets per
+// power of two, so any recorded value is known to within 12.5%.
+constexpr size_t LINEAR_BUCKETS = 16;
+constexpr size_t SUB_BUCKETS = 8;
+constexpr size_t HISTOGRAM_BUCKETS = LINEAR_BUCKETS + (64 - 4) * SUB_BUCKETS;
+
+inline size_t bucketOf(uint64_t value)
+{
+    if (value < LINEAR_BUCKETS)
+        return static_cast<size_t>(value);
+    size_t exponent = 63 - static_cast<size_t>(__builtin_clzll(value));
+    size_t sub = static_cast<size_t>(value >> (exponent - 3)) & (SUB_BUCKETS - 1);
+    return LINEAR_BUCKETS + (exponent - 4) * SUB_BUCKETS + sub;
+}
+
+// Smallest value that falls into `bucket`
+uint64_t bucketFloor(size_t bucket);
+
+// One thread's share, written by that thread only
+struct alignas(64) ThreadBlock
+{
+    struct HistogramCells
+    {
+        std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> buckets;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+    };
+
+    std::array<std::atomic<uint64_t>, COUNTERS> counters;
+    std::array<std::atomic<int64_t>, GAUGES> gauges;
+    std::array<HistogramCells, HISTOGRAMS> histograms;
+
+    ThreadBlock();
+    void reset();
+};
+
+// This thread's block, attached on first use
+ThreadBlock& attach();
+inline ThreadBlock& local()
+{
+    thread_local ThreadBlock* block = nullptr;
+    if (!block)
+        block = &attach();
+    return *block;
+}
+
+namespace detail
+{
+// Single writer, no read-modify-write needed
+template <typename T>
+inline void bump(std::atomic<T>& cell, T delta)
+{
+    cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+}
+
+inline void add(Counter counter, uint64_t amount = 1)
+{
+    detail::bump(local().counters[static_cast<size_t>(counter)], amount);
+}
+
+inline void adjust(Gauge gauge, int64_t delta)
+{
+    detail::bump(local().gauges[static_cast<size_t>(gauge)], delta);
+}
+
+inline void record(Histogram histogram, uint64_t value)
+{
+    ThreadBlock::HistogramCells& cells = local().histograms[static_cast<size_t>(histogram)];
+    detail::bump(cells.buckets[bucketOf(value)], uint64_t{1});
+    detail::bump(cells.count, uint64_t{1});
+    detail::bump(cells.sum, value);
+    if (value > cells.max.load(std::memory_order_relaxed))
+        cells.max.store(value, std::memory_order_relaxed);
+}
+
+// Family and label of a counter / gauge / histogram in the exposition, e.g.
+// peerbridge_drops_total{reason="decrypt"}
+struct Descriptor
+{
+    const char* name;
+    const char* labels;     // Empty for none
+    const char* help;
+};
+const Descriptor& describe(Counter);
+const Descriptor& describe(Gauge);
+const Descriptor& describe(Histogram);
+
+// Value read from somewhere else when a snapshot is taken, for state that is safe to look at
+// from any thread (ring sizes). Runs under the registry lock, keep it short.
+using Sampler = std::function<double()>;
+uint32_t addSampler(Descriptor, Sampler);
+void removeSampler(uint32_t id);
+
+struct HistogramSnapshot
+{
+    std::array<uint64_t, HISTOGRAM_BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    // Value below which `quantile` of the samples lie, to bucket resolution
+    uint64_t percentile(double quantile) const;
+};
+
+struct Snapshot
+{
+    std::array<uint64_t, COUNTERS> counters{};
+    std::array<int64_t, GAUGES> gauges{};
+    std::array<HistogramSnapshot, HISTOGRAMS> histograms{};
+    std::vector<std::pair<Descriptor, double>> sampled;
+};
+
+// Sums every thread's block, any thread. Values of a live thread may be a moment old.
+Snapshot snapshot();
+
+// Human readable lines for the console
+std::vector<std::string> formatText(const Snapshot&);
+// Prometheus text exposition format 0.0.4
+std::string formatPrometheus(const Snapshot&);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <boost/asio.hpp>
+
+// Local HTTP endpoint for Prometheus, answers GET /metrics with metrics::formatPrometheus().
+//
+// Listens on the loopback address only and runs on a thread of its own, so a slow scraper never
+// holds up the data plane. One request per connection, then it's closed.
+class MetricsServer
+{
+public:
+    MetricsServer();
+    ~MetricsServer();
+
+    bool start(uint16_t port);
+    void stop();
+    bool isRunning() const { return running; }
+
+private:
+    struct Connection;
+
+    void startAccept();
+    void handleRequest(const std::shared_ptr<Connection>&);
+
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "PacketPool.hpp"
+
+// Which peers of the session get a broadcast / multicast packet from the adapter.
+//
+// Peers' hosts send IGMP reports and leaves like on any LAN, they are flooded to us and noted
+// here on the receive path, so a group outside 224.0.0.0/24 only goes to the peers that joined
+// it. A peer we never saw IGMP from gets every group, its stack may not report (or a firewall
+// eats the reports). Broadcast, link-local groups (mDNS, LLMNR) and IGMP itself go to everyone.
+// A beacon identical to one sent within the duplicate window is dropped: apps announcing on
+// every interface, or repeating a search in quick succession, cost the uplink once per peer.
+//
+// There is no querier on the virtual network, so memberships don't age out; they last until
+// the host leaves the group or the peer leaves the session.
+//
+// IPv6 multicast goes to every peer: MLD reports sit behind a hop-by-hop header, which the
+// fixed-offset parsing here doesn't walk, and nearly all of it is link-scoped discovery anyway.
+// Duplicate beacons are dropped the same way for both families.
+class MulticastFanout
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    // Bit per peer table slot
+    using PeerMask = uint32_t;
+
+    static constexpr std::chrono::milliseconds DEFAULT_DUPLICATE_WINDOW{200};
+
+    // Any thread, zero keeps every beacon
+    void setDuplicateWindow(std::chrono::milliseconds window) { duplicateWindowMicros = window.count() * 1000; }
+
+    // Receive lanes, any thread: an IGMP packet `peer`'s host sent, the rest (IPv6 too) is ignored
+    void observe(size_t peer, const PacketBuffer&);
+    // Peer left the session, its memberships go with it
+    void forgetPeer(size_t peer);
+    void clear();
+
+    // TUN receive thread: who among `routed` gets a broadcast / multicast packet of either family
+    // (its header already checked), 0 if nobody joined the group or it's a duplicate
+    PeerMask targets(const PacketBuffer&, PeerMask routed, Clock::time_point now = Clock::now());
+
+private:
+    static constexpr uint32_t LINK_LOCAL_NETWORK = 0xE0000000;  // 224.0.0.0/24
+    static constexpr uint32_t LINK_LOCAL_NETMASK = 0xFFFFFF00;
+    static constexpr uint8_t IGMP_PROTOCOL = 2;
+    static constexpr size_t IPV6_HEADER_SIZE = 40;
+    static constexpr size_t RECENT_BEACONS = 32;
+
+    void join(size_t peer, uint32_t group);
+    void leave(size_t peer, uint32_t group);
+    // Same beacon within the window, remembered otherwise
+    bool duplicate(const PacketBuffer&, Clock::time_point now);
+
+    // Written by the receive lanes, read for every multicast packet from the adapter; both are
+    // rare next to unicast, so a plain mutex will do
+    std::mutex membershipMutex;
+    std::unordered_map<uint32_t, PeerMask> groups;
+    PeerMask reportingPeers = 0;
+
+    // TUN receive thread
+    struct Beacon
+    {
+        uint64_t hash = 0;
+        Clock::time_point sentAt;
+    };
+    std::array<Beacon, RECENT_BEACONS> recent{};
+    size_t nextBeacon = 0;
+    std::atomic<int64_t> duplicateWindowMicros{DEFAULT_DUPLICATE_WINDOW.count() * 1000};
+};
@@ -8,122 +8,479 @@
 #include <queue>
 #include <chrono>
 #include <optional>
+#include <array>
 #include <unordered_map>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/executor_work_guard.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include "SystemStateManager.hpp"
+#include "PacketPool.hpp"
+#include "UDPBatchIO.hpp"
+#include "RIOTransport.hpp"
+#include "AckTracker.hpp"
+#include "ReliableChannel.hpp"
+#include "FecCodec.hpp"
+#include "PeerTable.hpp"
+#include "Compression.hpp"
+#include "CongestionControl.hpp"
+#include "Pacer.hpp"
+#include "Stun.hpp"
+#include "WireHeader.hpp"
 
 class UDPNetwork {
 public:
-    using MessageCallback = std::function<void(const std::vector<uint8_t>)>;
+    // Payload plus the lane (worker) delivering it, lanes call in concurrently
+    // but each one only ever from its own thread
+    using MessageCallback = std::function<void(PacketBuffer, size_t)>;
+    // Packets that arrived together (a bundle), same lane rules; the callee consumes the batch
+    using MessageBatchCallback = std::function<void(PacketBatch&, size_t)>;
+
+    // Data plane workers, each owns a share of the peers
+    static constexpr size_t MAX_WORKERS = PeerTable::MAX_PEERS;
+    // Half the cores, the socket and TUN threads need some too
+    static size_t defaultWorkers();
     
     UDPNetwork(
         std::unique_ptr<boost::asio::ip::udp::socket>,
         boost::asio::io_context&,
-        std::shared_ptr<SystemStateManager>);
+        std::shared_ptr<SystemStateManager>,
+        std::shared_ptr<PacketPool>,
+        UdpBackend = UdpBackend::ASIO,
+        size_t workers = 1);
     ~UDPNetwork();
     
     // Setup and connection
     bool startListening(int port);
-    bool connectToPeer(const std::string& ip, int port);
+    // Add a peer and start hole punching to it, returns its slot in the peer table.
+    // With a relay the session starts there; the direct address is probed in the background and
+    // taken over once it answers faster.
+    // A peer with an IPv6 address too is tried on both families, IPv6 first and IPv4 a moment
+    // later (happy eyeballs); the first one to answer becomes the session's path.
+    std::optional<PeerId> connectToPeer(const std::string& ip, int port,
+        const std::optional<boost::asio::ip::udp::endpoint>& relay = std::nullopt,
+        const std::optional<boost::asio::ip::udp::endpoint>& ipv6 = std::nullopt);
     
     // Disconnet and shutdown
+    void disconnectPeer(PeerId);
     void stopConnection();
     void shutdown();
     
+    // Any peer connected
     bool isConnected() const;
+    bool isPeerConnected(PeerId) const;
+    // Slot holds a peer, connected or still punching
+    bool hasPeer(PeerId) const;
+    size_t connectedPeerCount() const;
     
-    // Async operations, sending to peer, called from TUNInterface
-    bool sendMessage(const std::vector<uint8_t>& data);
+    // Async operations, sending to a peer, called from TUNInterface
+    // Header is written into the buffer's headroom, payload is not copied
+    bool sendMessage(PeerId, PacketBuffer data);
+    // Same for a whole TUN batch, handed to the kernel in as few syscalls as the platform allows.
+    // Called from the TUN receive thread only, consumes the batch.
+    bool sendMessages(PeerId, PacketBatch&);
+    // Same as sendMessage, but lost packets are retransmitted and delivered in order on the far side.
+    // Meant for loss-sensitive flows (TCP), called from the TUN receive thread only.
+    bool sendReliable(PeerId, PacketBuffer data);
     void setMessageCallback(MessageCallback callback);
+    void setMessageBatchCallback(MessageBatchCallback callback);
+
+    // Parity protection for best-effort MESSAGE traffic, off by default since older peers drop
+    // the parity packets. With `adaptive` the geometry follows the measured loss rate.
+    void setFec(FecParams, bool adaptive);
+
+    // Hold small best-effort packets for up to `deadline` and bundle them into one datagram,
+    // zero (default) sends each on its own. Peers on older builds drop bundles.
+    // Not applied to peers we send parity to, bundles aren't FEC protected.
+    void setAggregation(std::chrono::microseconds deadline);
+    // TUN receive thread, whenever its ring runs dry: sends the bundles that came due,
+    // true while packets are still held (keep polling instead of sleeping)
+    bool flushAggregates();
+
+    // Pace data to each peer at what its path carries, BBR (default) or LEDBAT, OFF sends every
+    // packet right away. Takes effect for peers that connect after the call.
+    void setCongestionControl(CongestionMode);
+    // TUN receive thread, whenever its ring runs dry: releases what the pacers hold as tokens and
+    // acks come in. Time until the next pacer is due, none while nothing waits.
+    std::optional<std::chrono::microseconds> servicePacers();
+
+    // Seal data to / open data from a peer with keys from the key exchange, any thread.
+    // Without keys a peer's data is dropped when encryption is required (default), sent in clear otherwise.
+    bool setPeerCipher(PeerId, CipherSuite, const uint8_t* rxKey, const uint8_t* txKey);
+    void setEncryptionRequired(bool);
+
+    // Deflate compressible flows before sealing them (default off). Compressed packets from the
+    // peer are read either way, so each side can turn it on for its own uplink.
+    void setCompression(bool);
     
-    // Graceful disconnection
+    // Connection migration. The server STUN last answered from is asked again, over our own socket,
+    // whenever the local network changes; the address it reported is what that's compared against.
+    void setStunServer(const boost::asio::ip::udp::endpoint&, const std::string& publicIp, int publicPort);
+    // Signaling says the peer can be reached at another address, it's only adopted once it answers
+    void probePeerAddress(PeerId, const std::string& ip, int port);
+    // Local addresses or routes changed, any thread (the OS notification calls it)
+    void notifyNetworkChange();
+
+    // Graceful disconnection, every connected peer. Repeated from the IO thread, the caller doesn't wait.
     void sendDisconnectNotification();
     
     // Get local information
     int getLocalPort() const;
     std::string getLocalAddress() const;
+    size_t workerCount() const;
+    // Largest IP packet the paths to every connected peer carry inside our datagrams, what the
+    // TUN adapter's MTU should be. Peers still searching don't count, with none it's the base size.
+    // With FEC on, the parity of a full packet has to fit as well.
+    uint32_t tunnelMtu() const;
 
 private:
-     // Packet types
+    // bench/PeerBridgeBench.cpp times the header and receive paths directly
+    friend struct BenchAccess;
+
+     // Packet types, v2 has four bits for them (wire::versionOf sends anything past 0x0F as v1)
     enum class PacketType : uint8_t {
         HOLE_PUNCH = 0x01,
         HEARTBEAT = 0x02,
         MESSAGE = 0x03,
         ACK = 0x04,
-        DISCONNECT = 0x05
+        DISCONNECT = 0x05,
+        RELIABLE = 0x06,    // MESSAGE with a reliable seq in front of the payload
+        FEC_PARITY = 0x07,  // Parity over a group of MESSAGE packets, seq is the group's base seq
+        AGGREGATE = 0x08,   // Length-prefixed small packets, see PacketAggregator
+        MTU_PROBE = 0x09,   // Token, padded to the size under test, never fragmented (DF)
+        MTU_PROBE_ACK = 0x0A, // Seq is the probe size that arrived, the probe's token follows
+        MIGRATE = 0x0B,     // Receiver's session id, then the sender's sealed, see sendMigrate
+        PATH_PROBE = 0x0C   // Same, plus the probe seq answered (0 for a probe), see probePaths
+    };
+
+    // One data plane worker, a single-threaded io_context on a pinned thread.
+    // Every peer belongs to exactly one shard; its receive path, acks, retransmits and timers
+    // run there, so per-peer state needs no lock and packets of a peer stay in order.
+    // That is the limit too: one peer's traffic, however many flows it carries, is received on one
+    // core, so more workers scale a mesh, not a single tunnel.
+    struct Shard
+    {
+        explicit Shard(size_t shard_index) : index(shard_index), context(1) {}
+
+        // Datagram the IO thread routed to this shard
+        struct Inbound
+        {
+            PacketBuffer packet;
+            wire::Header header;   // Decoded by the IO thread
+            boost::asio::ip::udp::endpoint sender;
+            PeerId peer;
+            uint32_t generation;
+        };
+
+        const size_t index;
+        boost::asio::io_context context;
+        std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+        std::thread thread;
+
+        // Filled by the IO thread, swapped out whole by the worker, the lock is held for a push or a swap
+        std::mutex inboxMutex;
+        std::vector<Inbound> inbox;
+        std::vector<Inbound> processing;
+        // Read once per drained burst, what the burst's packets stamp their peer's activity with
+        std::chrono::steady_clock::time_point now;
+
+        // Scratch shared by the shard's peers
+        std::vector<ReliableChannel::Retransmit> retransmitBatch;
+        std::vector<PacketBuffer> reliableDeliveries;
+        std::vector<FecDecoder::Recovered> fecRecovered;
+        PacketBatch bundleDeliveries;
+        PacketDecompressor decompressor;
     };
 
+    static std::vector<std::unique_ptr<Shard>> makeShards(size_t);
+    std::vector<boost::asio::io_context*> shardContexts() const;
+    Shard& shardOf(const PeerSession& session) { return *shards[session.shard]; }
+    void startWorkers();
+    void stopWorkers();
+
     // Async operations, receiving from peer, sending to TUNInterface
     void startAsyncReceive();
-    void handleReceiveFrom(
-        const boost::system::error_code&,
-        std::size_t, 
-        std::shared_ptr<std::vector<uint8_t>>, 
-        std::shared_ptr<boost::asio::ip::udp::endpoint>);
-    void processReceivedData(
-        std::size_t, 
-        std::shared_ptr<std::vector<uint8_t>>, 
-        std::shared_ptr<boost::asio::ip::udp::endpoint>);
-    void processMessage(std::vector<uint8_t>, const boost::asio::ip::udp::endpoint&);
-    void handleSendComplete(const boost::system::error_code&, std::size_t, uint32_t);
+    void handleReceiveFrom(const boost::system::error_code&, std::size_t);
+    // IO thread, validates the header and hands the datagram to the sender's shard
+    void processReceivedData(PacketBuffer, const boost::asio::ip::udp::endpoint&);
+    void routeToShard(PeerSession&, PacketBuffer, const wire::Header&, const boost::asio::ip::udp::endpoint&);
+    // Shard, everything past the routing
+    void drainInbox(Shard&);
+    void processPeerPacket(Shard&, PeerSession&, PacketBuffer, const wire::Header&, const boost::asio::ip::udp::endpoint&);
+    void processMessage(PacketBuffer, size_t lane);
+    // Inner packets of a bundle, handed over as one batch
+    void processBundle(Shard&, PeerSession&, const PacketBuffer&);
+    void handleSendComplete(const boost::system::error_code&, std::size_t, uint32_t, PeerId, PacketBuffer&);
+
+    // Send helpers, prepareMessage seals the payload, writes the header in place and returns the seq.
+    // With keepPlaintext the buffer is swapped for a sealed copy, the original stays as it was.
+    // `compressed` flags a payload that is (or, for RELIABLE, ends in) a compressed frame.
+    std::optional<uint32_t> prepareMessage(PeerSession&, PacketBuffer&, PacketType = PacketType::MESSAGE, bool keepPlaintext = false, bool compressed = false);
+    // Sending thread, compresses the payload if its flow is worth it, true if it goes out as a frame
+    bool compressPayload(PacketBuffer&);
+    // Shard, frame back to the IP packet it was made from, false if it's corrupt
+    bool inflatePayload(PeerSession&, PacketBuffer&);
+    // Reliable seq in front, tracked for retransmits and sealed into a copy; with the reliable
+    // window full it goes out as a plain MESSAGE. Sending thread.
+    std::optional<uint32_t> prepareReliable(PeerSession&, PacketBuffer&);
+
+    // Pacing, sending thread. Packets wait in the peer's pacer and are prepared as they're released,
+    // the timing wheel says when to look at a pacer again.
+    bool pacing() const { return congestionMode.load(std::memory_order_relaxed) != CongestionMode::OFF; }
+    bool pace(PeerSession&, PacketBuffer, Pacer::Kind);
+    void paceBundles(PeerSession&);
+    void servicePacer(PeerSession&, std::chrono::steady_clock::time_point now);
+    // Prepares the entry (and any parity it completes) into outgoingBatch, the seq if it went in
+    std::optional<uint32_t> stagePaced(PeerSession&, Pacer::Entry&);
+    // outgoingBatch to the socket, the async path takes what the batch path didn't
+    void submitPaced(PeerSession&);
+
+    // Aggregation, sending thread. Small packets move from the batch into the peer's aggregator,
+    // what it lets go of (full or due) lands in readyBundles.
+    struct ReadyBundle
+    {
+        PacketBuffer payload;
+        bool bundled;   // AGGREGATE, otherwise a lone packet that goes out as MESSAGE
+    };
+    bool aggregating(const PeerSession&) const;
+    void holdSmallPackets(PeerSession&, PacketBatch&);
+    void releaseAggregate(PeerSession&);
+    std::optional<uint32_t> prepareBundle(PeerSession&, ReadyBundle&);
+    // What rides with a data payload: from the header and trailers in the clear, from the descriptor
+    // inside the seal otherwise. The trailers point into the payload's slab.
+    struct PayloadExtras
+    {
+        bool compressed = false;
+        const uint8_t* ack = nullptr;       // AckFrame
+        const uint8_t* stamps = nullptr;    // tracing::Trailer
+    };
+    // Authenticated payload of a data datagram, decrypted in place unless keepDatagram (FEC holds a view of it)
+    bool openPayload(PeerSession&, const PacketBuffer&, const wire::Header&, bool keepDatagram, PacketBuffer& payload, PayloadExtras&);
+    // Splits an opened payload from the trailers and descriptor sealed behind it, false if malformed
+    static bool takeSealedTrailers(PacketBuffer&, PayloadExtras&);
+    void transmitMessage(PeerSession&, PacketBuffer, uint32_t);
+    // RIO when available, otherwise the async socket
+    void dispatchMessage(PeerSession&, PacketBuffer, uint32_t);
+
+    // Pull whatever else is queued on the socket before re-arming the async receive
+    void drainReceiveQueue();
+
+    // Acknowledgements, shard
+    void scheduleAck(PeerSession&);
+    void sendAck(PeerSession&);
+    void handleAckFrame(PeerSession&, const AckFrame&);
+
+    // Reliable channel upkeep (retransmits, reorder timeouts), shard
+    void armReliableTimer(PeerSession&);
+    void handleReliableTimer(PeerSession&, const boost::system::error_code&);
+    void sendRetransmits(PeerSession&);
+    void deliverReliable(PeerSession&);
+
+    // Forward error correction, encoder on the sending thread, decoder on the shard
+    void protectMessage(PeerSession&, const PacketBuffer&, uint32_t);
+    bool prepareParity(PeerSession&, FecEncoder::Parity&);
+    void sendParity(PeerSession&);
+    void adaptFec(PeerSession&);
+    void deliverRecovered(PeerSession&);
     
-    // Internal disconnect handler
-    void handleDisconnect();
+    // Internal disconnect handler, drops the peer from the table, shard
+    void handleDisconnect(PeerSession&);
+
+    // Path MTU discovery, shard. Both families' DF on a dual-stack socket.
+    bool setDontFragment();
+    void probePathMtu(PeerSession&);
+    void sendPathMtuProbe(PeerSession&, uint16_t size);
+    void sendPathMtuAck(PeerSession&, uint16_t size, uint32_t token);
+    void finishPathMtuSearch(PeerSession&);
+    // Largest datagram to the peer that won't be fragmented, the base size until its search is done
+    static size_t datagramLimit(const PeerSession&);
+    void sendControlPacket(PeerSession&, PacketBuffer);
+    void sendControlPacket(const boost::asio::ip::udp::endpoint&, PacketBuffer);
+
+    // Connection migration, shard. A peer writing from a new address is found by our session id
+    // and moved there once its sealed id authenticates, nothing above the socket notices.
+    void sendMigrate(PeerSession&);
+    void sendMigrate(PeerSession&, const boost::asio::ip::udp::endpoint&);
+    void handleMigrate(PeerSession&, const PacketBuffer&, const wire::Header&, const boost::asio::ip::udp::endpoint&);
+    // Relay fallback, shard: both paths of a relayed session are probed every keep-alive sweep,
+    // the direct one wins once its round trip beats the relay's
+    void probePaths(PeerSession&);
+    void sendPathProbe(PeerSession&, const boost::asio::ip::udp::endpoint&, uint32_t answering);
+    void handlePathProbe(PeerSession&, const PacketBuffer&, const wire::Header&, const boost::asio::ip::udp::endpoint&);
+    // Both name the receiver's session in the clear: the v2 header's session id, in v1 ahead of the payload
+    static wire::Header sessionHeader(const PeerSession&, PacketType, uint32_t seq, uint32_t remoteId, size_t sealedSize);
+    static std::optional<uint32_t> receiverSessionId(const wire::Header&, const uint8_t* payload);
+    static size_t sealedOffset(const wire::Header& header) { return header.sessionId ? 0 : SESSION_ID_SIZE; }
+    void leaveRelay(PeerSession&, const boost::asio::ip::udp::endpoint&);
+    // IO thread: the local network changed, every peer hears from our new address and STUN is asked again
+    void watchNetworkChanges();
+    void unwatchNetworkChanges();
+    void onNetworkChange();
+    void handleStunResponse(const PacketBuffer&);
 
     // UDP hole punching
-    void startHolePunchingProcess(const boost::asio::ip::udp::endpoint&);
-    void sendHolePunchPacket();
+    void startHolePunchingProcess(PeerSession&);
+    void continueHolePunching(PeerSession&);
+    void sendHolePunchPacket(PeerSession&);
+    void sendHolePunchPacket(PeerSession&, const boost::asio::ip::udp::endpoint&);
+    // The address as this socket's family writes it, IPv4 is v4-mapped on a dual-stack socket
+    boost::asio::ip::udp::endpoint socketEndpoint(const boost::asio::ip::address&, unsigned short port) const;
+    struct DisconnectNotice
+    {
+        boost::asio::ip::udp::endpoint to;
+        PacketBuffer packet;
+    };
+    void repeatDisconnectNotification(std::vector<DisconnectNotice>);
     
-    // Connection management
-    void checkAllConnections();
-    void notifyConnectionEvent(NetworkEvent, const std::string& = "");
+    // Connection management, the keep-alive sweep runs it for every peer on the peer's shard
+    void keepAlivePeer(PeerSession&);
+    void checkConnection(PeerSession&);
+    void notifyConnectionEvent(NetworkEvent, const std::string& = "", int = -1);
 
     // Keep-alive functionality
     void startKeepAliveTimer();
     void stopKeepAliveTimer();
     void handleKeepAlive(const boost::system::error_code&);
 
-    // Custom header
-    uint32_t attachCustomHeader(
-        const std::shared_ptr<std::vector<uint8_t>>&,
-        PacketType,
-        std::optional<uint32_t> = std::nullopt);
+    // Custom header, in the wire version `session` reads; v1 to everyone without one
+    static wire::Header makeHeader(const PeerSession*, PacketType, uint32_t seq, size_t length = 0, uint8_t flags = 0);
+    // Written in front of the payload `header.length` describes, HEADER_SIZE of headroom is enough
+    // unless it carries extensions
+    static void attachCustomHeader(PacketBuffer&, const wire::Header&);
+    // What a seal authenticates besides its plaintext: type, flags, seq and length in their v1 encoding,
+    // the same bytes for a v2 header and for a payload rebuilt from parity (FEC symbols carry no header)
+    static std::array<uint8_t, wire::V1_SIZE> sealedAd(const wire::Header&);
+    // Seq of a datagram we built
+    static uint32_t sentSeq(const PacketBuffer&);
+
+    // ACK and DISCONNECT: sealed under seqs of their own once there are keys, in the clear with
+    // `clearSeq` before that. Opening takes up to `capacity` payload bytes into `out`, nothing
+    // unsealed is taken while there are keys.
+    PacketBuffer makeSessionControl(PeerSession&, PacketType, uint32_t clearSeq, const uint8_t* payload, size_t length);
+    std::optional<size_t> openSessionControl(PeerSession&, const PacketBuffer&, const wire::Header&, uint8_t* out, size_t capacity);
     
     // Constants
     static constexpr size_t MAX_PACKET_SIZE = 65507; // Max UDP packet size
-    static constexpr uint16_t PROTOCOL_VERSION = 1;
-    static constexpr uint32_t MAGIC_NUMBER = 0x12345678;
+    // Largest header we write, v1's; v2 peers get 4 to 12 bytes of it
+    static constexpr size_t HEADER_SIZE = wire::MAX_SIZE;
+    // Highest wire version we read, told to peers after the session id in our hole punches
+    static constexpr uint8_t WIRE_VERSION = wire::V2;
+    // Header flags (v1 byte 7, v2's low bits next to the type)
+    static constexpr uint8_t FLAG_ACK_TRAILER = 0x01; // AckFrame follows the MESSAGE payload
+    static constexpr uint8_t FLAG_ENCRYPTED = 0x02;   // Payload is sealed, msg_len covers the tag
+    static constexpr uint8_t FLAG_COMPRESSED = 0x04;  // Opened payload is a compressed frame (after the reliable seq)
+    static constexpr uint8_t FLAG_TRACED = 0x08;      // tracing::Trailer follows the payload and any ack trailer
+    // A sealed data payload has only FLAG_ENCRYPTED in its header. The other three describe it from
+    // a descriptor byte sealed after it and its trailers, [payload][ack][stamps][descriptor].
+    static constexpr size_t SEALED_DESCRIPTOR_SIZE = 1;
+    static constexpr size_t SEAL_OVERHEAD = SEALED_DESCRIPTOR_SIZE + crypto::TAG_SIZE;
+    // v2 header extensions
+    static constexpr uint8_t EXT_TRACE = 0x01;        // tracing::Trailer, what v2 peers send instead of FLAG_TRACED
+    // Longest an ACK waits for a data packet to ride on
+    static constexpr std::chrono::milliseconds ACK_DELAY{5};
+    // Retransmit / reorder timeout check interval while reliable packets are outstanding
+    static constexpr std::chrono::milliseconds RELIABLE_TICK{10};
+    // Fewest sends per keep-alive interval before the loss rate is trusted for FEC adaptation
+    static constexpr uint64_t FEC_MIN_SAMPLE = 200;
+    // Bounds one drain so a flooding peer can't starve the rest of the IO context
+    static constexpr size_t MAX_RECEIVE_ROUNDS = 4;
+    // Hole punching when a peer is added: quick at first for a peer that's already punching,
+    // then backing off for one that starts late. Stops at the first valid packet from it.
+    static constexpr int HOLE_PUNCH_BURST = 12;
+    static constexpr std::chrono::milliseconds HOLE_PUNCH_INTERVAL{20};
+    static constexpr std::chrono::milliseconds HOLE_PUNCH_MAX_INTERVAL{500};
+    // Head start of the peer's preferred family before its other address is punched as well
+    static constexpr std::chrono::milliseconds HAPPY_EYEBALLS_DELAY{50};
+    // Disconnect notices, sent a few times to increase chance of delivery
+    static constexpr int DISCONNECT_REPEATS = 3;
+    static constexpr std::chrono::milliseconds DISCONNECT_INTERVAL{50};
+    // Pacer re-check while the socket is full or the window is used up (acks come in on the shards)
+    static constexpr std::chrono::microseconds PACER_STALL_RETRY{500};
+    static constexpr std::chrono::microseconds PACER_WINDOW_RECHECK{250};
+    // Path MTU probe tick, and how long a settled search stands before probing upwards again
+    static constexpr std::chrono::milliseconds PATH_MTU_PROBE_INTERVAL{250};
+    static constexpr std::chrono::minutes PATH_MTU_RESEARCH_INTERVAL{10};
+    // Interfaces flap a few times while a network comes up, act once it settles
+    static constexpr std::chrono::milliseconds NETWORK_CHANGE_SETTLE{100};
+    // Session ids on the wire: receiver's in the clear (see sessionHeader), then the sender's sealed
+    static constexpr size_t SESSION_ID_SIZE = 4;
+    static constexpr size_t MIGRATE_SEALED_SIZE = SESSION_ID_SIZE + crypto::TAG_SIZE;
+    static constexpr size_t PATH_PROBE_SEALED_SIZE = SESSION_ID_SIZE + sizeof(uint32_t) + crypto::TAG_SIZE;
+    // Random token leading an MTU_PROBE's padding, echoed as the MTU_PROBE_ACK payload
+    static constexpr size_t MTU_TOKEN_SIZE = 4;
+    // Our bytes around an IP packet: header, descriptor and tag, reliable seq (ack trailers only ride where they fit)
+    static constexpr size_t TUNNEL_OVERHEAD = HEADER_SIZE + SEAL_OVERHEAD + ReliableChannel::PREFIX_SIZE;
+    // What FEC_PARITY adds on top of the largest packet it covers: its parity header and the symbol's length
+    static constexpr size_t PARITY_OVERHEAD = fec::PARITY_HEADER_SIZE + 2;
+    // Silence after which a peer is dropped, connected or still being punched to
+    static constexpr int PEER_TIMEOUT_SECONDS = 20;
 
     std::atomic<bool> running;
     int localPort;
     std::string localAddress;
+    // Socket takes IPv6 and v4-mapped IPv4, set once listening
+    bool dualStack = false;
 
-    // ASIO and IO context objects
+    // ASIO and IO context objects, the shared context runs the socket and the keep-alive sweep
     std::unique_ptr<boost::asio::ip::udp::socket> socket;
     boost::asio::io_context& ioContext;
     std::thread ioThread;
+    std::vector<std::unique_ptr<Shard>> shards;
     boost::asio::steady_timer keepAliveTimer;
-    
-    // Ack tracking
-    std::atomic<uint32_t> nextSeqNumber;
-    std::unordered_map<uint32_t, std::chrono::time_point<std::chrono::steady_clock>> pendingAcks;
-    std::mutex pendingAcksMutex;
-    
-    // Peer connection management
-    boost::asio::ip::udp::endpoint peerEndpoint;
-    PeerConnectionInfo peerConnection;
-    // TODO: FOR *1, SEE HOW THIS WILL CHANGE FOR MULTIPLE PEERS
-    std::string currentPeerEndpoint;
-
-    // TODO: FOR *1, USE MAP, maybe from std::endpoint to PeerConnectionInfo?
-    // Maybe fromm std::string to PeerConnectionInfo?
-    // Maybe PeerConnectionInfo holds endpoint or string?
+    // Spaces out the disconnect notices, rounds left is what shutdown waits on
+    boost::asio::steady_timer disconnectTimer;
+    std::atomic<int> disconnectRoundsLeft;
+
+    // Connection migration, IO thread. The OS callback only posts onto the context.
+    boost::asio::steady_timer networkChangeTimer;
+    void* networkChangeHandle = nullptr;
+    std::optional<boost::asio::ip::udp::endpoint> stunServer;
+    std::optional<StunClient::TransactionId> stunTransaction;
+    std::string publicAddress;
+
+    // Packet buffers, one receive is in flight at a time so its state lives here.
+    // Datagrams larger than a small slab spill into receiveOverflow.
+    std::shared_ptr<PacketPool> packetPool;
+    PacketBuffer receiveBuffer;
+    boost::asio::ip::udp::endpoint receiveEndpoint;
+    std::unique_ptr<uint8_t[]> receiveOverflow;
+
+    // Batched send / receive on the native socket, falls back to the async path when unsupported
+    std::unique_ptr<UDPBatchIO> batchIO;
+    std::vector<OutgoingDatagram> outgoingBatch;
+    std::vector<ReceivedDatagram> receivedBatch;
+
+    // Registered I/O data path, only set when RIO was requested and came up
+    UdpBackend backend;
+    std::unique_ptr<RIOTransport> rio;
+
+    // Every peer of the mesh with its ack / reliable / FEC state, declared after the shards it lives on
+    PeerTable peers;
+
+    // Sending thread scratch
+    std::vector<FecEncoder::Parity> parityBatch;
+    PacketCompressor compressor;
+    std::atomic<bool> compressionEnabled;
+    std::vector<ReadyBundle> readyBundles;
+    std::atomic<int64_t> aggregationDeadlineMicros;
+    TimingWheel pacingWheel;
+    std::atomic<CongestionMode> congestionMode;
+    // Some async send handed a datagram back to its pacer
+    std::atomic<bool> pacerHandBack;
+
+    // FEC settings, applied to every peer
+    FecParams fecParams;
+    std::atomic<bool> fecAdaptive;
+
+    std::atomic<bool> encryptionRequired;
     
     // State manager for event queuing
     std::shared_ptr<SystemStateManager> stateManager;
     
     // Callbacks
     MessageCallback onMessageCallback;
+    MessageBatchCallback onMessageBatchCallback;
+
+    // Connected peer count in the metrics
+    uint32_t peersSampler = 0;
 };
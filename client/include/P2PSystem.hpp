@@ -5,6 +5,8 @@
 #include "TUNInterface.hpp"
 #include "NetworkConfigManager.hpp"
 #include "SystemStateManager.hpp"
+#include "MetricsServer.hpp"
+#include "MulticastFanout.hpp"
 #include <string>
 #include <atomic>
 #include <thread>
@@ -12,9 +14,14 @@
 #include <queue>
 #include <functional>
 #include <unordered_map>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <future>
 
 // Forward declarations
 struct IPPacket;
+struct IPv6Packet;
 
 class P2PSystem
 {
@@ -23,14 +30,12 @@ public:
     ~P2PSystem();
     
     // Initialization
-    // TODO: REFACTORIZE FOR *1
     bool initialize(const std::string&, const std::string&, int = 0);
     
-    // Connection
+    // Connection, can be called again to add more peers to the session
     bool connectToPeer(const std::string&);
     
-    // Disconnect and complete shutdown
-    // TODO: FOR *1, maybe make a peer-based stopConnection
+    // Disconnect every peer / complete shutdown
     void stopConnection();
     void shutdown();
     
@@ -43,39 +48,115 @@ public:
     bool isRunning() const;
     bool getIsHost() const;
     void setRunning();
+
+    // Transport for data packets, takes effect on the next initialize()
+    void setUdpBackend(UdpBackend);
+    // Data plane worker threads, 0 picks from the core count; takes effect on the next initialize()
+    void setDataPlaneWorkers(size_t);
+    // Send TCP over the reliable channel (default on)
+    void setReliableTcp(bool);
+    // Parity for best-effort traffic, fixed geometry or adaptive (default off)
+    void setFec(FecParams, bool adaptive);
+    // Seal peer traffic with keys exchanged over signaling (default on), off sends and accepts cleartext
+    void setEncryption(bool);
+    // Deflate compressible flows to peers (default off), takes effect on the next initialize()
+    void setCompression(bool);
+    // Bundle small packets to a peer, held for at most `deadline` (0, the default, turns it off)
+    void setAggregation(std::chrono::microseconds deadline);
+    // Pace traffic to each peer, BBR (default) or LEDBAT, OFF sends as fast as packets come in
+    void setCongestionControl(CongestionMode);
+    // Serve Prometheus metrics on 127.0.0.1:`port` from the next initialize(), 0 (default) doesn't
+    void setMetricsPort(uint16_t port);
     
-    // Connection request handling
-    // TODO: REMOVE FOR *1
+    // Connection request handling. Still one request at a time: a newer one replaces the pending
+    // request, and accepting adds that one peer to the session.
     void acceptIncomingRequest();
     void rejectIncomingRequest();
     
     // Connection monitoring
-    void monitorLoop();
     void handleNetworkEvent(const NetworkEventData&);
     
 private:
+    // bench/PeerBridgeBench.cpp times the TUN filter directly
+    friend struct BenchAccess;
+
     // Network discovery
     bool discoverPublicAddress();
     
     // Handler methods
     void handleConnectionRequest(const std::string&);
     void handlePeerInfo(const std::string&, const std::string&, int);
-    void handleConnectionInit(const std::string&, const std::string&, int);
-    void handleNetworkData(std::vector<uint8_t>);
-    void handlePacketFromTun(const std::vector<uint8_t>&);
+    void handleConnectionInit(const std::string&, const std::string&, int, int, int, const std::string&, int,
+        const std::string&, int);
+    void handleKeyExchange(const std::string&, const std::string&, bool);
+    // A member's public address moved, its session follows once it answers there
+    void handlePeerMoved(const std::string&, const std::string&, int);
+    void handleNetworkData(PacketBuffer, size_t lane);
+    void handleNetworkBatch(PacketBatch&, size_t lane);
+    void handlePacketsFromTun(PacketBatch&);
+    void handlePacketFromTun(PacketBuffer);
     
     // IP helpers
-    void assignIPAddresses();
+    static std::string virtualIpFor(uint8_t hostIndex);
+
+    // Mesh bookkeeping, virtual IP -> peer routes
+    void addMeshPeer(PeerId, const std::string& username, uint8_t hostIndex);
+    void removeMeshPeer(PeerId);
+    void clearMesh();
+
+    // Per-connection keys, our half goes out over signaling once the peer has a slot
+    void startKeyExchange(PeerId);
+    // meshMutex held
+    void completeKeyExchange(PeerId, const std::string& publicKeyHex, bool peerAes);
     
-    // Packet analysis and forwarding
-    bool forwardPacketToPeer(const std::vector<uint8_t>&);
-    bool deliverPacketToTun(std::vector<uint8_t>);
+    // Packet analysis and forwarding. Both families are read at fixed offsets, options and
+    // extension headers are never walked.
+    bool forwardPacketToPeer(PacketBuffer);
+    // Long enough for the fixed header of its version, IPv4 or IPv6
+    static bool isIpPacket(const PacketBuffer&);
+    // Peer owning the destination address, NO_PEER if none does. The virtual /24 and /64 share
+    // the route table, host index n is 10.0.0.n and fd50:6272:6467::n alike.
+    PeerId routeFor(const PacketBuffer&) const;
+    PeerId routeFor(uint32_t dstIp) const;
+    // Destination classes, plain integer compares so the per-packet path never formats an address
+    static bool isFlooded(const PacketBuffer&);
+    static bool isFlooded(uint32_t dstIp);
+    bool isLocal(const PacketBuffer&) const;
+    bool isLocal(uint32_t dstIp) const;
+    void queueForPeer(PeerId, PacketBuffer);
+    PacketBuffer copyPacket(const PacketBuffer&);
+    bool needsReliableDelivery(const PacketBuffer&) const;
+    bool deliverPacketToTun(PacketBuffer, size_t lane);
+    // Receive lanes: IGMP from a peer, who joined which group
+    void observeMembership(const PacketBuffer&);
 
     // Virtual network configuration
     static constexpr const char* VIRTUAL_NETWORK = "10.0.0.0";
     static constexpr const char* VIRTUAL_NETMASK = "255.255.255.0";
-    static constexpr const char* HOST_IP = "10.0.0.1";
-    static constexpr const char* CLIENT_IP = "10.0.0.2";
+    static constexpr uint32_t VIRTUAL_NETWORK_ADDR = 0x0A000000;  // 10.0.0.0
+    static constexpr uint32_t VIRTUAL_NETMASK_ADDR = 0xFFFFFF00;  // /24
+    static constexpr uint32_t VIRTUAL_BROADCAST_ADDR = VIRTUAL_NETWORK_ADDR | ~VIRTUAL_NETMASK_ADDR;  // 10.0.0.255
+    static constexpr uint32_t LIMITED_BROADCAST_ADDR = 0xFFFFFFFF;  // 255.255.255.255
+    static constexpr uint32_t MULTICAST_NETWORK_ADDR = 0xE0000000;  // 224.0.0.0
+    static constexpr uint32_t MULTICAST_NETMASK_ADDR = 0xF0000000;  // /4
+    // IPv6 side of the same network, a ULA /64; the last byte is the host index
+    static constexpr std::array<uint8_t, 16> VIRTUAL_NETWORK6_ADDR = {
+        0xFD, 0x50, 0x62, 0x72, 0x64, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};  // fd50:6272:6467::
+    static constexpr uint8_t MULTICAST6_PREFIX = 0xFF;  // ff00::/8
+    // Used when the signaling server doesn't assign addresses, the accepting side is the host
+    static constexpr uint8_t HOST_INDEX = 1;
+    static constexpr uint8_t CLIENT_INDEX = 2;
+
+    // One member of the session, indexed by its slot in the UDP peer table
+    struct MeshPeer
+    {
+        bool used = false;
+        std::string username;
+        std::string virtualIp;
+        uint8_t hostIndex = 0;
+        // Our ephemeral pair until the peer's half arrives
+        std::unique_ptr<KeyExchange> keyExchange;
+    };
 
     // Data
     std::string username;
@@ -84,11 +165,33 @@ private:
     std::atomic<bool> isHost;
     
     std::string localVirtualIp;
-    // TODO: REFACTORIZE FOR *1, KEEP virtual_ip -> public_ip map
-    std::string peerVirtualIp;
+    // Same address as an integer, what the receive path filters on
+    std::atomic<uint32_t> localVirtualAddr;
+    uint8_t localIndex;
+    // Interface addressed and routed for the current session
+    bool interfaceConfigured;
+    // Interface configuration, run alongside hole punching. interfaceReady resolves once the
+    // address and routes are up, interfaceSetup once the network category is settled too.
+    std::future<void> interfaceSetup;
+    std::shared_future<bool> interfaceReady;
+    // Persistent firewall rules, checked once at startup
+    std::future<void> firewallSetup;
 
     std::string publicIp;
     int publicPort;
+    // IPv6 candidate on dual-stack hosts, empty otherwise
+    std::string publicIp6;
+    int publicPort6;
+    UdpBackend udpBackend;
+    size_t dataPlaneWorkers;
+    bool reliableTcp;
+    FecParams fecParams;
+    bool fecAdaptive;
+    bool encryption;
+    bool compression;
+    std::chrono::microseconds aggregationDeadline;
+    CongestionMode congestionMode;
+    uint16_t metricsPort;
 
     std::string peerUsername;
     std::string peerIp;
@@ -96,7 +199,23 @@ private:
 
     // State management
     std::shared_ptr<SystemStateManager> stateManager;
-    std::thread monitorThread;
+
+    // Packet buffers shared by the TUN and UDP paths, must outlive both
+    std::shared_ptr<PacketPool> packetPool;
+    // Packets from one TUN batch, one batch per peer, touched by the TUN receive thread only
+    std::array<PacketBatch, PeerTable::MAX_PEERS> forwardBatches;
+
+    // Session members, written under meshMutex (signaling / event dispatcher threads)
+    std::mutex meshMutex;
+    std::array<MeshPeer, PeerTable::MAX_PEERS> meshPeers;
+    // Username -> (public key, AES capable) that overtook the chat-init for that peer
+    std::unordered_map<std::string, std::pair<std::string, bool>> pendingKeys;
+    // Host index in the virtual /24 -> peer, read lock-free by the TUN thread
+    std::array<std::atomic<PeerId>, 256> routes;
+    // Bit per peer with a route, who gets broadcast / multicast
+    std::atomic<uint32_t> routedPeers;
+    // Narrows that down to the peers that joined the group, and drops repeated beacons
+    MulticastFanout multicast;
     
     // Components
     NetworkConfigManager networkConfigManager;
@@ -104,4 +223,5 @@ private:
     StunClient stunService;
     std::unique_ptr<UDPNetwork> networkModule;
     std::unique_ptr<TunInterface> tunInterface;
+    MetricsServer metricsServer;
 }; 
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "PacketPool.hpp"
+#include "TrafficScheduler.hpp"
+
+// Sender side queue for one peer, released at the congestion controller's rate.
+//
+// Packets wait here as they came from the TUN adapter and are only sealed on the way out, so
+// seqs go on the wire in order and a dropped packet costs nothing. Which one goes next is up to
+// the TrafficScheduler. A token bucket holding at most BURST worth of the rate spaces the
+// datagrams out.
+//
+// Sending thread only, except handBack().
+class Pacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // What the packet is sent as once it leaves
+    enum class Kind : uint8_t { MESSAGE, RELIABLE, AGGREGATE };
+
+    struct Entry
+    {
+        PacketBuffer packet;
+        Kind kind;
+        Clock::time_point queuedAt{};   // Set by enqueue()
+    };
+
+    static constexpr std::chrono::microseconds BURST{2000};
+    static constexpr size_t MIN_BURST = 2 * 1500;
+
+    // Dropped (false) if the class is full and drops new arrivals
+    bool enqueue(TrafficClass, Entry);
+    // Next packet by class priority, nullptr when nothing waits in the queues
+    Entry* front() { return scheduler.front(); }
+    void pop();
+    bool empty() const { return stalledDatagrams.empty() && scheduler.empty(); }
+    size_t queued() const { return stalledDatagrams.size() + scheduler.queued(); }
+    const TrafficScheduler<Entry>& classes() const { return scheduler; }
+
+    // Datagrams that were sealed and sent but the socket refused, they go ahead of any queue
+    std::deque<PacketBuffer>& stalled() { return stalledDatagrams; }
+    // Any thread, an async send came back with a full buffer. Picked up by takeHandedBack().
+    void handBack(PacketBuffer);
+    void takeHandedBack();
+
+    // Token bucket at `rate` bytes per second
+    void refill(Clock::time_point now, uint64_t rate);
+    // Tokens left, a datagram may go out while this is positive and takes the bucket below zero
+    bool mayRelease() const { return tokens > 0.0; }
+    void charge(size_t bytes) { tokens -= static_cast<double>(bytes); }
+    // Time until mayRelease() at `rate`
+    std::chrono::microseconds delay(uint64_t rate) const;
+
+    // Window limit, the pacer remembers since when it waits for acks
+    std::optional<Clock::time_point> windowBlockedSince;
+
+    // Drop everything, the peer went away. `generation` is the session's current one.
+    void clear(uint32_t generation);
+    // Forget what an earlier occupant of the slot left behind
+    void adopt(uint32_t session_generation)
+    {
+        if (generation != session_generation)
+            clear(session_generation);
+    }
+    uint32_t generation = 0;
+
+    // Sending thread bookkeeping for the timing wheel
+    bool scheduled = false;
+
+private:
+    TrafficScheduler<Entry> scheduler;
+    std::deque<PacketBuffer> stalledDatagrams;
+    double tokens = 0.0;
+    Clock::time_point lastRefill;
+
+    std::mutex handBackMutex;
+    std::vector<PacketBuffer> handedBack;
+    std::atomic<bool> hasHandedBack{false};  // Checked without the lock first
+};
+
+// One timer wheel for every pacer of the sending thread. A peer due in `delay` goes into the
+// slot that many ticks ahead; later than the horizon lands in the last slot and is looked at early.
+class TimingWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SLOTS = 256;
+    static constexpr std::chrono::microseconds TICK{100};
+
+    // Look at `id` again `delay` from now, each id should be in the wheel at most once
+    void schedule(uint8_t id, std::chrono::microseconds delay, Clock::time_point now);
+
+    // Call `fire(id)` for everything due by `now`, entries it schedules again land in later slots
+    template <typename F>
+    void advance(Clock::time_point now, F&& fire)
+    {
+        if (!count)
+        {
+            cursorTime = now;
+            return;
+        }
+        while (cursorTime <= now && count)
+        {
+            std::vector<uint8_t>& slot = slots[cursor];
+            firing.swap(slot);
+            count -= firing.size();
+            cursor = (cursor + 1) % SLOTS;
+            cursorTime += TICK;
+            for (uint8_t id : firing)
+                fire(id);
+            firing.clear();
+        }
+        if (!count)
+            cursorTime = now;
+    }
+
+    // Time until the earliest occupied slot, none when the wheel is empty
+    std::optional<std::chrono::microseconds> nextDue(Clock::time_point now) const;
+    bool empty() const { return count == 0; }
+
+private:
+    std::array<std::vector<uint8_t>, SLOTS> slots;
+    std::vector<uint8_t> firing;
+    size_t cursor = 0;
+    Clock::time_point cursorTime;   // Start of the cursor's slot
+    size_t count = 0;
+};
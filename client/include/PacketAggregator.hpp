@@ -0,0 +1,59 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PacketPool.hpp"
+
+// Bundles small best-effort packets to one peer into a single datagram, so a stream of
+// 40-200 byte game / voice packets pays for one header, one seal, one syscall and one ack.
+//
+// Bundle payload: [len16][packet][len16][packet]... Inner packets are IP packets or compressed
+// frames, the receiver tells them apart by their first byte. A held packet waits at most for
+// the flush deadline, a bundle that only ever got one packet goes out as a plain MESSAGE.
+//
+// Sending thread only.
+class PacketAggregator
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t LENGTH_SIZE = 2;
+    static constexpr size_t MAX_PACKET = 256;      // Larger packets go out on their own
+    static constexpr size_t MAX_PACKETS = 32;
+    static constexpr size_t DEFAULT_CAPACITY = 1200; // Bundle payload, fits any sane path MTU
+
+    // Worth holding back for company
+    static bool accepts(const PacketBuffer& packet) { return packet.size() <= MAX_PACKET; }
+
+    // Payload bytes one bundle may grow to
+    void setCapacity(size_t bytes) { capacity = bytes; }
+
+    // The packet doesn't fit next to what is already held, take() first
+    bool full(const PacketBuffer& packet) const
+    {
+        return held.size() >= MAX_PACKETS || bundleSize + LENGTH_SIZE + packet.size() > capacity;
+    }
+    void add(PacketBuffer, Clock::time_point now);
+
+    bool empty() const { return held.empty(); }
+    // Oldest held packet waited `deadline` or longer
+    bool due(Clock::time_point now, std::chrono::microseconds deadline) const
+    {
+        return !held.empty() && now - firstHeld >= deadline;
+    }
+
+    // Whatever is held, as a bundle (`bundled` set) or as the single packet it was.
+    // Empty if the pool ran dry, the held packets are dropped then.
+    PacketBuffer take(PacketPool&, bool& bundled);
+    void clear();
+
+    // Receive side: views of the inner packets into the bundle's slab, false if it is malformed
+    static bool split(const PacketBuffer& bundle, std::vector<PacketBuffer>& packets);
+
+private:
+    std::vector<PacketBuffer> held;
+    size_t bundleSize = 0;
+    size_t capacity = DEFAULT_CAPACITY;
+    Clock::time_point firstHeld;
+};
@@ -0,0 +1,205 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class PacketPool;
+
+// Fixed-size slab owned by a PacketPool, never freed while the pool lives
+struct PacketSlab
+{
+    PacketPool* pool;
+    uint8_t* base;
+    uint32_t capacity;
+    uint32_t index;
+    uint8_t sizeClass;
+    std::atomic<uint32_t> refs;
+    // tracing:: id of a sampled packet, 0 when not traced. Shared by every view of the slab.
+    uint32_t trace;
+};
+
+// Move-only handle to a pooled slab, with a [offset, offset + length) view into it.
+// Room in front of the view (headroom) is used to prepend our protocol header in place.
+class PacketBuffer
+{
+public:
+    PacketBuffer() = default;
+    ~PacketBuffer() { reset(); }
+
+    PacketBuffer(PacketBuffer&& other) noexcept
+        : slab(other.slab), offset(other.offset), length(other.length)
+    {
+        other.slab = nullptr;
+        other.offset = 0;
+        other.length = 0;
+    }
+
+    PacketBuffer& operator=(PacketBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            slab = other.slab;
+            offset = other.offset;
+            length = other.length;
+            other.slab = nullptr;
+            other.offset = 0;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    PacketBuffer(const PacketBuffer&) = delete;
+    PacketBuffer& operator=(const PacketBuffer&) = delete;
+
+    explicit operator bool() const { return slab != nullptr; }
+
+    uint8_t* data() { return slab->base + offset; }
+    const uint8_t* data() const { return slab->base + offset; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    uint8_t& operator[](size_t i) { return slab->base[offset + i]; }
+    const uint8_t& operator[](size_t i) const { return slab->base[offset + i]; }
+
+    size_t headroom() const { return offset; }
+    size_t tailroom() const { return slab ? slab->capacity - offset - length : 0; }
+    size_t capacity() const { return slab ? slab->capacity : 0; }
+
+    // Grow the view towards the front (e.g. to write a header), caller checks headroom()
+    uint8_t* push(size_t bytes)
+    {
+        offset -= static_cast<uint32_t>(bytes);
+        length += static_cast<uint32_t>(bytes);
+        return data();
+    }
+
+    // Strip bytes from the front of the view (e.g. a parsed header)
+    void pull(size_t bytes)
+    {
+        offset += static_cast<uint32_t>(bytes);
+        length -= static_cast<uint32_t>(bytes);
+    }
+
+    // Set the view length, caller checks against size() + tailroom()
+    void resize(size_t bytes) { length = static_cast<uint32_t>(bytes); }
+
+    // Where the view sits in the pool's backing memory, see PacketPool::region()
+    size_t regionIndex() const { return slab->sizeClass; }
+    size_t regionOffset() const { return static_cast<size_t>(slab->index) * slab->capacity + offset; }
+
+    // Latency trace the packet belongs to, carried over by whoever copies it into a new buffer
+    uint32_t trace() const { return slab ? slab->trace : 0; }
+    void setTrace(uint32_t id) { slab->trace = id; }
+
+    // Another handle to the same slab and view, slab returns to the pool once all handles are gone.
+    // Views share memory, so only one holder may write to it once shared.
+    PacketBuffer share() const
+    {
+        PacketBuffer copy;
+        if (slab)
+        {
+            slab->refs.fetch_add(1, std::memory_order_relaxed);
+            copy.slab = slab;
+            copy.offset = offset;
+            copy.length = length;
+        }
+        return copy;
+    }
+
+    inline void reset();
+
+private:
+    friend class PacketPool;
+
+    PacketSlab* slab = nullptr;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// Packets moved between stages in one go, reserved once so batching never allocates
+using PacketBatch = std::vector<PacketBuffer>;
+
+// Preallocated slab pool shared by TunInterface and UDPNetwork.
+// Two size classes, small slabs fit a regular MTU sized packet plus our header,
+// large slabs fit any UDP datagram. Free lists are lock-free, so acquire / release
+// never takes a lock or touches the heap.
+class PacketPool
+{
+public:
+    // Room reserved in front of every payload for the custom protocol header
+    // plus per-feature prefixes (reliable seq)
+    static constexpr size_t HEADROOM = 32;
+
+    static constexpr size_t SMALL_SLAB_SIZE = 2048;
+    static constexpr size_t LARGE_SLAB_SIZE = 66 * 1024;
+
+    static constexpr size_t DEFAULT_SMALL_SLABS = 4096; // 8 MiB
+    static constexpr size_t DEFAULT_LARGE_SLABS = 128;  // ~8 MiB
+
+    explicit PacketPool(
+        size_t smallSlabs = DEFAULT_SMALL_SLABS,
+        size_t largeSlabs = DEFAULT_LARGE_SLABS);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Get a buffer with a payload view of `size` bytes, placed `headroom` bytes into the slab.
+    // Uses the smallest class that fits, returns an empty handle if the pool is exhausted.
+    PacketBuffer acquire(size_t size, size_t headroom = HEADROOM);
+
+    // Backing memory of one size class, contiguous so it can be registered with the OS once
+    struct Region
+    {
+        uint8_t* base;
+        size_t size;
+    };
+    static constexpr size_t REGION_COUNT = 2;
+    Region region(size_t index) const;
+
+    // Stats
+    size_t available() const;
+    uint64_t exhaustedCount() const;
+
+private:
+    friend class PacketBuffer;
+
+    static constexpr uint32_t NO_SLAB = 0xFFFFFFFF;
+
+    struct SizeClass
+    {
+        size_t slabSize = 0;
+        size_t slabCount = 0;
+        std::unique_ptr<uint8_t[]> memory;
+        std::unique_ptr<PacketSlab[]> slabs;
+        std::unique_ptr<std::atomic<uint32_t>[]> next;
+        // Low 32 bits: index of free list head, high 32 bits: ABA tag
+        alignas(64) std::atomic<uint64_t> freeHead{NO_SLAB};
+        std::atomic<size_t> freeCount{0};
+    };
+
+    void initClass(SizeClass&, uint8_t, size_t, size_t);
+    PacketSlab* pop(SizeClass&);
+    void push(SizeClass&, PacketSlab*);
+    void release(PacketSlab*);
+
+    SizeClass classes[2];
+    std::atomic<uint64_t> exhausted{0};
+};
+
+inline void PacketBuffer::reset()
+{
+    if (slab)
+    {
+        if (slab->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            slab->pool->release(slab);
+        }
+        slab = nullptr;
+        offset = 0;
+        length = 0;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Datagram-layer path MTU search for one peer, in the spirit of RFC 8899.
+//
+// Probes are padded datagrams of the size under test, sent with DF set so nothing on the way
+// fragments them; the peer echoes the size it received and the probe's random token, an ack
+// for a probe we didn't send is ignored. Sizes are UDP payload bytes, our header included. The search bisects between a size every path is assumed to carry and the Ethernet
+// limit, a size counts as too big once MAX_ATTEMPTS probes of it went unanswered.
+//
+// Shard only.
+class PathMtuProber
+{
+public:
+    static constexpr uint16_t BASE_DATAGRAM = 1232;  // IPv6 minimum MTU less IPv6 + UDP headers
+    static constexpr uint16_t MAX_DATAGRAM = 1472;   // 1500 byte Ethernet MTU less IPv4 + UDP headers
+    static constexpr uint16_t GRANULARITY = 8;       // Search ends once the bounds are this close
+    static constexpr uint8_t MAX_ATTEMPTS = 2;
+    // Probes an ack is still taken for, late answers to earlier ones count too
+    static constexpr size_t HISTORY = 4;
+
+    // Back to the base size, for a new peer
+    void reset();
+    // Search again above what's confirmed, the path may have changed
+    void restart();
+
+    // Size to probe next, the one in flight again while it has attempts left. None once done.
+    std::optional<uint16_t> nextProbe();
+    // The probe of `size` went out carrying `token`
+    void onSent(uint16_t size, uint32_t token);
+    // A probe of `size` came back with `token`, true if that raised the confirmed size
+    bool onAck(uint16_t size, uint32_t token);
+    // The probe in flight wasn't answered within a probe interval
+    void onTimeout();
+
+    bool searching() const { return ceiling - confirmed >= GRANULARITY; }
+    uint16_t confirmedSize() const { return confirmed; }
+
+private:
+    uint16_t confirmed = BASE_DATAGRAM;
+    uint16_t ceiling = MAX_DATAGRAM;
+    uint16_t probing = 0;
+    uint8_t attempts = 0;
+
+    struct Probe
+    {
+        uint16_t size = 0;
+        uint32_t token = 0;
+    };
+    Probe sent[HISTORY];
+    size_t nextSent = 0;
+};
@@ -0,0 +1,247 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "SystemStateManager.hpp"
+#include "AckTracker.hpp"
+#include "ReliableChannel.hpp"
+#include "FecCodec.hpp"
+#include "Crypto.hpp"
+#include "PacketAggregator.hpp"
+#include "PathMtu.hpp"
+#include "CongestionControl.hpp"
+#include "Pacer.hpp"
+#include "WireHeader.hpp"
+
+// Slot index of a peer in the PeerTable, stable for as long as the peer stays in the table
+using PeerId = uint8_t;
+inline constexpr PeerId NO_PEER = 0xFF;
+
+// Everything UDPNetwork keeps per peer. Sessions are allocated once with the table and reused,
+// so the sending thread can hold a pointer to one without reference counting.
+// Receive-side state and the timers belong to the session's shard, one worker thread, so
+// nothing in here is locked; the sending thread only touches the parts built for it.
+struct PeerSession
+{
+    PeerSession(PeerId, uint8_t shard_index, boost::asio::io_context&);
+
+    const PeerId id;
+    // Worker that owns this session, its timers run on that worker's context
+    const uint8_t shard;
+    // Where the peer is. Moved by its shard (NAT rebinding, migration) while other threads read it,
+    // so readers get a copy, and a new address goes into the slot not in use once no copy is being
+    // taken from it, the same way as the cipher slots.
+    boost::asio::ip::udp::endpoint endpoint() const;
+    std::string endpointString() const;
+    void setEndpoint(const boost::asio::ip::udp::endpoint&);
+
+    // Our id for the session, random per claim, and the peer's for its side (0 until it tells us).
+    // Packets from an address we don't know find the session by ours.
+    std::atomic<uint32_t> localSessionId{0};
+    std::atomic<uint32_t> remoteSessionId{0};
+    // Header version the peer reads, from its hole punches; v1 until one says more
+    std::atomic<uint8_t> wireVersion{wire::V1};
+    // MIGRATE seqs, ours sent and the newest of the peer's that authenticated, shard
+    uint32_t migrateSent = 0;
+    uint32_t migrateSeen = 0;
+    // Seqs of sealed ACKs, ours sent and the newest of the peer's that authenticated, shard.
+    // DISCONNECTs are sealed under their own, built on whichever thread ends the session.
+    uint32_t ackSent = 0;
+    uint32_t ackSeen = 0;
+    std::atomic<uint32_t> disconnectSent{0};
+
+    // Relay fallback. A session that starts on the relay keeps probing the peer's direct address,
+    // shard, and moves there once that answers faster than the relay does. Read by the IO thread
+    // when adopting ports, the relay never remaps them.
+    std::atomic<bool> relayed{false};
+    boost::asio::ip::udp::endpoint directEndpoint;
+    struct PathProbe
+    {
+        uint32_t seq = 0;   // Outstanding probe, 0 once answered
+        std::chrono::steady_clock::time_point sentAt;
+        std::chrono::microseconds rtt{0};   // Latest answer, 0 until there is one
+    };
+    PathProbe relayProbe;
+    PathProbe directProbe;
+    // The peer's address in the other family, punched alongside endpoint() until one answers
+    // (or probed in turns with directEndpoint while relayed). Unset (port 0) for single-stack peers.
+    boost::asio::ip::udp::endpoint alternateEndpoint;
+    // PATH_PROBE seqs, probes and answers alike
+    uint32_t probeSent = 0;
+
+    PeerConnectionInfo connection;
+    std::atomic<bool> active{false};
+    // Set by remove() until the slot is released, packets still in flight to the shard are dropped
+    std::atomic<bool> closing{false};
+    // Bumped on every claim, work queued for an earlier occupant of the slot is recognised by it
+    std::atomic<uint32_t> generation{0};
+
+    // Packet numbers of our datagrams to this peer, MESSAGE / RELIABLE packets only. The low 32 bits
+    // are the seq on the wire, all 64 go into the nonce.
+    std::atomic<uint64_t> nextSeqNumber{0};
+    // Highest of the peer's packet numbers that authenticated, its seqs are widened against it. Shard.
+    uint64_t rxPacketNumber = 0;
+    // Those of them already taken, a datagram is opened once
+    crypto::ReplayWindow replayWindow;
+    AckTracker ackTracker;
+    boost::asio::steady_timer ackTimer;
+    bool ackTimerArmed = false;
+
+    ReliableChannel reliableChannel;
+    boost::asio::steady_timer reliableTimer;
+    std::atomic<bool> reliableTimerArmed{false};
+
+    FecEncoder fecEncoder;
+    FecDecoder fecDecoder;
+    bool fecReceiving = false;  // Peer sends parity, keep symbols around for recovery
+    uint64_t fecLastSent = 0;
+    uint64_t fecLastLost = 0;
+
+    // Small packets waiting to be bundled, sending thread
+    PacketAggregator aggregator;
+
+    // Pacing: the controller learns from acks on the shard, the pacer releases on the sending thread
+    CongestionController congestion;
+    Pacer pacer;
+
+    // Payload keys, published once the key exchange with the peer completed (any thread reads).
+    // A new pair goes into the slot not in use, senders may still hold the current one.
+    PacketCipher cipherSlots[2];
+    std::atomic<const PacketCipher*> cipher{nullptr};
+    // Seals and opens hold a CipherPin; a slot is only rewritten or wiped once none is left
+    std::atomic<uint32_t> cipherReaders{0};
+    void waitForCipherReaders() const;
+    uint8_t nextCipherSlot = 0;     // Thread installing keys (signaling)
+    std::atomic<bool> warnedNoKeys{false};
+
+    // Path MTU search, shard. The size it settles on is published for the sending thread.
+    PathMtuProber pathMtu;
+    boost::asio::steady_timer pathMtuTimer;
+    std::atomic<uint16_t> pathDatagram{0};   // 0 until the first search finished
+
+    // Initial hole punching burst, shard
+    boost::asio::steady_timer holePunchTimer;
+    int holePunchRemaining = 0;
+    std::chrono::steady_clock::time_point holePunchStarted;
+
+private:
+    struct Address
+    {
+        boost::asio::ip::udp::endpoint endpoint;
+        std::string text;
+    };
+    Address addresses[2];
+    std::atomic<uint8_t> addressSlot{0};
+    // Copies being taken, see endpoint()
+    mutable std::atomic<uint32_t> addressReaders{0};
+};
+
+// The session's keys for the scope. Whatever slot they're in isn't rewritten or wiped before the
+// pin goes, so hold it around the seal / open only.
+class CipherPin
+{
+public:
+    explicit CipherPin(PeerSession& session) : readers(session.cipherReaders)
+    {
+        // Counted before the load, a writer that sees no readers knows later loads get its pointer
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        cipher = session.cipher.load(std::memory_order_seq_cst);
+    }
+    ~CipherPin() { readers.fetch_sub(1, std::memory_order_release); }
+    CipherPin(const CipherPin&) = delete;
+    CipherPin& operator=(const CipherPin&) = delete;
+
+    const PacketCipher* get() const { return cipher; }
+
+private:
+    std::atomic<uint32_t>& readers;
+    const PacketCipher* cipher;
+};
+
+// Fixed table of up to MAX_PEERS sessions, spread over the shards round-robin.
+// Slots are claimed and released under a mutex (signaling / IO threads, rare). The receive
+// path finds sessions by endpoint through a hash map owned by the IO thread, the TUN path
+// goes straight to a slot by PeerId; neither takes a lock.
+class PeerTable
+{
+public:
+    static constexpr size_t MAX_PEERS = 16;
+
+    // `control` runs the socket and owns the endpoint index, slot i lives on shards[i % size]
+    PeerTable(boost::asio::io_context& control, const std::vector<boost::asio::io_context*>& shards);
+
+    // Claim a slot for the peer at `endpoint`, or return the one it already has. Any thread.
+    std::optional<PeerId> add(const boost::asio::ip::udp::endpoint&);
+    // Tear the session down on its shard, the slot is released on the IO thread right after
+    void remove(PeerSession&);
+    // Free every slot at once, only once no thread runs the contexts anymore
+    void clear();
+
+    // IO thread
+    PeerSession* find(const boost::asio::ip::udp::endpoint&) const;
+    // A peer that hasn't answered yet, at the same address but behind a remapped port.
+    // Only the index follows it here, the shard rebinds the endpoint with the first packet.
+    PeerSession* adoptPending(const boost::asio::ip::udp::endpoint&);
+    // By our session id, for a peer writing from an address we don't know yet
+    PeerSession* findBySession(uint32_t localSessionId) const;
+    // Index the peer under the address it migrated to, once the shard authenticated it
+    void addEndpoint(PeerSession&, const boost::asio::ip::udp::endpoint&);
+
+    // Any thread, nullptr if the slot is free
+    PeerSession* get(PeerId id) const
+    {
+        if (id >= MAX_PEERS)
+            return nullptr;
+        PeerSession* session = sessions[id].get();
+        return session->active.load(std::memory_order_acquire) ? session : nullptr;
+    }
+
+    // The slot whether claimed or not, for sending thread state left behind by a peer that went away
+    PeerSession& slot(PeerId id) const { return *sessions[id]; }
+
+    // Same as get(), but only once the peer has answered
+    PeerSession* connected(PeerId id) const
+    {
+        PeerSession* session = get(id);
+        return session && session->connection.isConnected() ? session : nullptr;
+    }
+
+    // Visit every claimed slot
+    template <typename F>
+    void forEach(F&& callback) const
+    {
+        for (const std::unique_ptr<PeerSession>& session : sessions)
+        {
+            if (session->active.load(std::memory_order_acquire))
+                callback(*session);
+        }
+    }
+
+    size_t activeCount() const;
+    size_t connectedCount() const;
+
+private:
+    struct EndpointHash
+    {
+        size_t operator()(const boost::asio::ip::udp::endpoint&) const;
+    };
+
+    void teardown(PeerSession&);
+    void release(PeerSession&);
+
+    boost::asio::io_context& ioContext;
+    std::mutex slotMutex;
+    std::array<std::unique_ptr<PeerSession>, MAX_PEERS> sessions;
+    std::unordered_map<boost::asio::ip::udp::endpoint, PeerId, EndpointHash> byEndpoint;
+};
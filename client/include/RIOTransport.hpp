@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <boost/asio.hpp>
+#include "PacketPool.hpp"
+#include "UDPBatchIO.hpp"
+
+// Which transport UDPNetwork uses for data packets, picked once at startup
+enum class UdpBackend : uint8_t {
+    ASIO,   // Overlapped sockets through Boost.Asio
+    RIO     // Windows Registered I/O, falls back to ASIO if unavailable
+};
+
+// Windows Registered I/O data path for the UDP socket.
+// The whole packet pool is registered once, so sends and receives point the kernel
+// straight at pooled slabs with no per-operation buffer locking. Receive completions
+// are signalled to the io_context through an event and dequeued on the IO thread,
+// send completions are polled by the sending thread before each submission.
+// Control traffic keeps going through the Asio socket, which is given the same handle.
+class RIOTransport
+{
+public:
+    using ReceiveHandler = std::function<void(PacketBuffer, const boost::asio::ip::udp::endpoint&)>;
+
+    static constexpr size_t RECEIVE_DEPTH = 512; // Receives kept posted
+    static constexpr size_t SEND_DEPTH = 1024;   // Sends in flight
+
+    RIOTransport(boost::asio::io_context&, std::shared_ptr<PacketPool>);
+    ~RIOTransport();
+
+    // Swap the socket's handle for a registered I/O socket bound to the same local endpoint,
+    // so the NAT binding survives. On failure the socket is left (or put back) as it was.
+    bool open(boost::asio::ip::udp::socket&);
+
+    // Post receives and start dispatching datagrams to the handler on the IO thread
+    void start(ReceiveHandler);
+
+    // Queue datagrams without blocking, returns how many were taken (the rest stay with the caller).
+    // Only one thread may send.
+    size_t send(OutgoingDatagram*, size_t);
+
+    // Release queues and registrations, call once the socket is closed and the IO thread is gone
+    void close();
+
+    bool isOpen() const { return opened; }
+
+private:
+    void armReceiveNotification();
+    void handleReceiveCompletions();
+    bool postReceive(uint32_t slot, unsigned long flags);
+    void reclaimSendSlots();
+
+    boost::asio::io_context& ioContext;
+    std::shared_ptr<PacketPool> packetPool;
+    ReceiveHandler onReceive;
+    bool opened = false;
+
+    // Winsock / RIO state
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "PacketPool.hpp"
+#include "AckTracker.hpp"
+
+// Link-level recovery for flows that take loss badly (TCP).
+//
+// Reliable packets carry a second, per-channel seq in front of the IP packet and still
+// take a regular MESSAGE seq for the datagram, so AckTracker's SACK loss detection drives
+// fast retransmit. Each retransmission gets a new datagram seq. The receiver holds
+// out-of-order packets for a short while and hands them over in order.
+//
+// Send side is shared by the sending thread (track / onTransmit) and the IO thread
+// (ack resolution, retransmits) under one mutex; the best-effort path never touches it.
+// Receive side is IO thread only.
+class ReliableChannel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t PREFIX_SIZE = 4;           // Reliable seq in front of the payload
+    static constexpr uint32_t SEND_WINDOW = 512;       // Unacked packets kept for retransmit, power of two
+    static constexpr uint32_t REORDER_WINDOW = 256;    // Out-of-order packets held on receive, power of two
+    static constexpr uint8_t MAX_TRANSMISSIONS = 8;    // Then the packet is left to end-to-end recovery
+    static constexpr std::chrono::milliseconds MIN_RTO{20};
+    static constexpr std::chrono::milliseconds MAX_RTO{1000};
+    static constexpr std::chrono::milliseconds HOLD_TIMEOUT{100}; // Longest a gap blocks delivery
+
+    struct Retransmit
+    {
+        uint32_t reliableSeq;
+        PacketBuffer payload; // Shared view of the original IP packet
+    };
+
+    ReliableChannel();
+
+    // Send side
+    // Take a packet into the window, returns its reliable seq or nothing if the window is full
+    std::optional<uint32_t> track(const PacketBuffer& payload);
+    // A (re)transmission of reliableSeq went out as datagram seq
+    void onTransmit(uint32_t reliableSeq, uint32_t seq, Clock::time_point);
+    // AckTracker settled a datagram seq, IO thread
+    void onResolved(uint32_t seq, bool acked);
+    // Due retransmits: declared lost, or unacked for longer than rto. IO thread.
+    void collectRetransmits(Clock::time_point, std::chrono::microseconds rto, std::vector<Retransmit>&);
+    // Lock-free check, lets callers skip the channel while no reliable flow is active
+    bool hasInFlight() const { return inFlight.load(std::memory_order_relaxed) != 0; }
+    // Drop everything in flight, the peer is gone. Reliable seqs carry on from where they were.
+    void resetSend();
+
+    // Receive side, IO thread
+    // Appends whatever became deliverable, in order
+    void onReceive(uint32_t reliableSeq, PacketBuffer payload, Clock::time_point, std::vector<PacketBuffer>& deliver);
+    // Give up on gaps older than HOLD_TIMEOUT
+    void flushExpired(Clock::time_point, std::vector<PacketBuffer>& deliver);
+    bool hasHeld() const { return heldCount > 0; }
+    void resetReceive();
+
+    // RTO from RFC 6298 estimates, clamped
+    static std::chrono::microseconds retransmitTimeout(std::chrono::microseconds srtt, std::chrono::microseconds rttVar);
+
+    // Stats
+    uint64_t retransmitCount() const { return retransmits; }
+    uint64_t abandonedCount() const { return abandoned; }
+
+private:
+    struct SendEntry
+    {
+        PacketBuffer payload;
+        uint32_t reliableSeq = 0;
+        uint32_t lastSeq = 0;
+        Clock::time_point lastSent;
+        uint8_t transmissions = 0;
+        bool inUse = false;
+        bool lost = false;
+    };
+
+    // Datagram seq back to the reliable seq it carried, same size as the ack window
+    struct SeqMapping
+    {
+        uint32_t seq = 0;
+        uint32_t reliableSeq = 0;
+        bool valid = false;
+    };
+
+    struct HeldPacket
+    {
+        PacketBuffer payload;
+        Clock::time_point arrived;
+    };
+
+    void releaseEntry(SendEntry&);
+    void advanceSendBase();
+    void deliverInOrder(std::vector<PacketBuffer>& deliver);
+
+    // Send side, guarded by sendMutex
+    mutable std::mutex sendMutex;
+    std::unique_ptr<SendEntry[]> sendEntries;
+    std::unique_ptr<SeqMapping[]> seqMap;
+    uint32_t sendBase = 0;
+    uint32_t nextReliableSeq = 0;
+    uint64_t retransmits = 0;
+    uint64_t abandoned = 0;
+    std::atomic<uint32_t> inFlight{0};
+
+    // Receive side
+    std::unique_ptr<HeldPacket[]> held;
+    bool haveExpected = false;
+    uint32_t expected = 0;
+    uint32_t heldCount = 0;
+};
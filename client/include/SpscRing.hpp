@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// What push() does when the ring is full
+enum class OverflowPolicy : uint8_t {
+    DROP_NEWEST,    // Reject the incoming item
+    DROP_OLDEST,    // Evict the oldest queued item to make room
+    BACKPRESSURE    // Wait for the consumer, drop the incoming item after a timeout
+};
+
+// Bounded lock-free ring for one producer thread and one consumer thread.
+// Every slot carries a sequence number, so producer and consumer never touch
+// a shared lock. The consumer claims slots with a CAS on head, which lets the
+// producer act as a second consumer under DROP_OLDEST without extra locking.
+template <typename T>
+class SpscRing {
+public:
+    enum class PushResult : uint8_t { PUSHED, DROPPED_NEWEST, DROPPED_OLDEST };
+
+    explicit SpscRing(
+        size_t capacity,
+        OverflowPolicy policy = OverflowPolicy::DROP_NEWEST,
+        std::chrono::microseconds backpressureTimeout = std::chrono::milliseconds(5))
+        : overflowPolicy(policy)
+        , backpressureTimeout(backpressureTimeout)
+    {
+        // Round capacity up to a power of two so indices can be masked
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+
+        slots = std::make_unique<Slot[]>(size);
+        for (size_t i = 0; i < size; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~SpscRing()
+    {
+        clear();
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only
+    PushResult push(T&& item)
+    {
+        if (tryPush(item))
+            return PushResult::PUSHED;
+
+        switch (overflowPolicy)
+        {
+            case OverflowPolicy::DROP_OLDEST:
+                for (;;)
+                {
+                    if (popWith([](T&&) {}))
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                    if (tryPush(item))
+                        return PushResult::DROPPED_OLDEST;
+                    // Consumer is mid-pop on the only full slot, it frees up right away
+                    std::this_thread::yield();
+                }
+
+            case OverflowPolicy::BACKPRESSURE:
+            {
+                auto deadline = std::chrono::steady_clock::now() + backpressureTimeout;
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    std::this_thread::yield();
+                    if (tryPush(item))
+                        return PushResult::PUSHED;
+                }
+                break;
+            }
+
+            case OverflowPolicy::DROP_NEWEST:
+            default:
+                break;
+        }
+
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return PushResult::DROPPED_NEWEST;
+    }
+
+    // Consumer only
+    bool tryPop(T& out)
+    {
+        return popWith([&out](T&& item) { out = std::move(item); });
+    }
+
+    // Consumer only, hands up to maxItems to the callback, returns how many were popped
+    template <typename F>
+    size_t drain(F&& callback, size_t maxItems = SIZE_MAX)
+    {
+        size_t count = 0;
+        while (count < maxItems && popWith(callback))
+            ++count;
+        return count;
+    }
+
+    // Discard everything currently queued
+    void clear()
+    {
+        while (popWith([](T&&) {}))
+        {
+        }
+    }
+
+    size_t size() const
+    {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return t >= h ? t - h : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mask + 1; }
+    OverflowPolicy policy() const { return overflowPolicy; }
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* item() { return std::launder(reinterpret_cast<T*>(&storage)); }
+    };
+
+    bool tryPush(T& item)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot& slot = slots[pos & mask];
+
+        // Slot is free once the consumer has bumped its sequence to our position
+        if (slot.sequence.load(std::memory_order_acquire) != pos)
+            return false;
+
+        ::new (static_cast<void*>(&slot.storage)) T(std::move(item));
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename F>
+    bool popWith(F&& callback)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = slots[pos & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    T* item = slot.item();
+                    callback(std::move(*item));
+                    item->~T();
+                    // Hand the slot back to the producer for the next lap
+                    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Empty
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    OverflowPolicy overflowPolicy;
+    std::chrono::microseconds backpressureTimeout;
+
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<uint64_t> dropped{0};
+};
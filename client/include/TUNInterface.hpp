@@ -6,12 +6,13 @@
 #include <functional>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <optional>
 #include <memory>
 #include <vector>
-#include <mutex>
-#include <condition_variable>
-#include <queue>
 #include <boost/asio.hpp>
+#include "PacketPool.hpp"
+#include "SpscRing.hpp"
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,26 +27,55 @@ BOOL WINAPI WintunGetAdapterLUID(_In_ WINTUN_ADAPTER_HANDLE Adapter, _Out_ NET_L
 }
 #endif
 
+// Wintun ring size, must be a power of two between WINTUN_MIN_RING_CAPACITY and WINTUN_MAX_RING_CAPACITY
+inline constexpr DWORD WINTUN_RING_CAPACITY = 0x800000; // 8 MiB
+
+// Per-session tuning for the Wintun adapter
+struct TunSessionOptions
+{
+    DWORD ringCapacity = WINTUN_RING_CAPACITY;
+
+    // Max packets pulled from / pushed to the Wintun ring per wake-up
+    size_t receiveBatchSize = 64;
+    size_t sendBatchSize = 64;
+
+    // Outgoing (injection) queue bound and what to do when it fills up
+    size_t sendQueueCapacity = 4096;
+    OverflowPolicy sendQueueOverflow = OverflowPolicy::DROP_OLDEST;
+
+    // One injection queue per producing thread, each stays single producer
+    size_t sendQueues = 1;
+};
+
 class TunInterface {
 public:
-    TunInterface();
+    TunInterface(std::shared_ptr<PacketPool>);
     ~TunInterface();
 
-    // Callback types
-    using PacketCallback = std::function<void(const std::vector<uint8_t>&)>;
+    // Callback types, packets extracted in one pass are handed over together.
+    // The callback takes ownership of the buffers, the batch is cleared afterwards.
+    using PacketCallback = std::function<void(PacketBatch&)>;
+    // Called on the receive thread whenever the ring runs dry. Returns how soon the consumer has
+    // packets it holds back (bundles, pacing) coming due, none if it holds nothing. The thread
+    // keeps polling below IDLE_SPIN_LIMIT and otherwise waits no longer than that.
+    using IdleCallback = std::function<std::optional<std::chrono::microseconds>()>;
+    static constexpr std::chrono::microseconds IDLE_SPIN_LIMIT{1000};
 
     // Initialize TUN adapter with a device name
-    bool initialize(const std::string&);
+    bool initialize(const std::string&, const TunSessionOptions& = TunSessionOptions{});
 
     // Start and stop packet processing
     bool startPacketProcessing();
     void stopPacketProcessing();
 
-    // Add a packet to injection queue
-    bool sendPacket(std::vector<uint8_t>);
+    // Add a packet to an injection queue, one producer thread per queue (the data plane workers)
+    bool sendPacket(PacketBuffer, size_t queue = 0);
+    // Same for packets that arrived together, one wake-up for all of them. Consumes the batch.
+    bool sendPackets(PacketBatch&, size_t queue = 0);
 
     // Set callback for extracted packets
     void setPacketCallback(PacketCallback callback);
+    void setIdleCallback(IdleCallback callback);
 
     // Check if the interface is running
     bool isRunning() const;
@@ -56,6 +86,8 @@ public:
     // Getter for adapter alias
     // We use this to make sure we get the exact name of the adapter
     std::string getNarrowAlias() const;
+    // Adapter's LUID, what the IP Helper configuration is keyed on
+    bool getLuid(NET_LUID&) const;
 
 private:
     // Wintun session and adapter
@@ -92,9 +124,18 @@ private:
 
     // State management
     std::atomic<bool> running{false};
-    std::mutex packetQueueMutex;
-    std::condition_variable packetConditionVariable;
-    std::queue<std::vector<uint8_t>> outgoingPackets;
+    TunSessionOptions sessionOptions;
+
+    // Outgoing packets, data plane workers -> send thread, a ring per worker.
+    // The send thread only sleeps on sendWakeEvent once every ring is drained.
+    std::vector<std::unique_ptr<SpscRing<PacketBuffer>>> outgoingPackets;
+    HANDLE sendWakeEvent = nullptr;
+    std::atomic<bool> sendThreadIdle{false};
+    // Their occupancy in the metrics while processing runs
+    uint32_t queueSampler = 0;
+
+    // Shared packet buffers
+    std::shared_ptr<PacketPool> packetPool;
     
     // Thread for packet processing
     std::thread receiveThread;
@@ -102,6 +143,7 @@ private:
     
     // Callback for received packets
     PacketCallback packetCallback;
+    IdleCallback idleCallback;
     
     // Interface management
     bool loadWintunFunctions(HMODULE);
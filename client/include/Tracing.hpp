@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sampled per packet latency tracing.
+//
+// One in every N packets read from the adapter gets a trace id, kept on its slab (PacketBuffer::trace)
+// and stamped with the steady clock at each stage it passes. The sender's stamps ride along to the
+// peer in a small trailer, so the peer's record covers the whole path: our adapter to its adapter.
+// Finished traces land in a lock-free ring, overwritten oldest first, which is dumped as Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev).
+namespace tracing
+{
+enum class Stage : uint8_t {
+    TUN_DEQUEUE,    // Copied out of the Wintun ring
+    FILTER,         // Routed to a peer by P2PSystem
+    UDP_SUBMIT,     // Header written, handed to the socket
+    PEER_RECEIVE,   // Picked up by the peer's shard
+    TUN_INJECT,     // Copied into the peer's Wintun ring
+    COUNT
+};
+constexpr size_t STAGES = static_cast<size_t>(Stage::COUNT);
+
+const char* stageName(Stage);
+
+// Carried after the payload (and ack trailer) of a MESSAGE with FLAG_TRACED, inside the seal once
+// there are keys:
+// [trace id 4][filter offset us 4][submit offset us 4], offsets from TUN_DEQUEUE
+struct Trailer
+{
+    static constexpr size_t WIRE_SIZE = 12;
+
+    uint32_t id = 0;
+    uint32_t filterMicros = 0;
+    uint32_t submitMicros = 0;
+
+    void encode(uint8_t* out) const;
+    static Trailer decode(const uint8_t* in);
+};
+
+// 1 in `everyN` packets is traced, 0 turns tracing off
+void setSampleRate(uint32_t everyN);
+uint32_t sampleRate();
+
+// Trace id for the next packet off the adapter if it is sampled, 0 otherwise. Adapter thread only.
+uint32_t begin(size_t bytes);
+
+// Record reaching `stage` (now). Ids that were evicted or never began are ignored.
+void stamp(uint32_t id, Stage);
+
+// Record reaching the sender's last stage and publish it, returns what the peer needs to know
+bool submit(uint32_t id, Trailer& trailer);
+
+// Start the receiving half of a peer's trace. The network stretch is estimated as half
+// the smoothed RTT, the two clocks aren't comparable.
+uint32_t beginRemote(const Trailer&, std::chrono::microseconds oneWay, size_t bytes);
+
+// Record reaching `stage` and publish the trace
+void finish(uint32_t id, Stage);
+
+// A finished trace, stamps in steady clock nanoseconds, 0 for stages it never reached
+struct Trace
+{
+    uint32_t id = 0;
+    uint32_t remote = 0;    // Sender's id for a trace started by a peer, 0 for our own
+    uint32_t bytes = 0;
+    std::array<int64_t, STAGES> at{};
+};
+
+// Traces in the ring, oldest first
+std::vector<Trace> collect();
+
+// Chrome trace event format, one row per trace and one slice per stage to stage stretch
+std::string formatChromeTrace(const std::vector<Trace>&);
+bool dumpChromeTrace(const std::string& path);
+
+// Per stretch p50 / p99 / max for the console
+std::vector<std::string> formatSummary(const std::vector<Trace>&);
+}
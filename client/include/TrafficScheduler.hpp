@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include "PacketPool.hpp"
+
+// Scheduling class of an outgoing packet, highest priority first
+enum class TrafficClass : uint8_t {
+    CONTROL,        // Network control (CS6/CS7)
+    INTERACTIVE,    // EF, AF4x, CS4/CS5, ICMP, DNS, known voice / game ports, small packets
+    STANDARD,       // Default, AF2x/AF3x, whatever isn't marked
+    BULK,           // Lower effort: LE, CS1, AF1x, file transfer and SMB ports
+    COUNT
+};
+
+const char* trafficClassName(TrafficClass);
+
+// From the IP header the TUN adapter handed over: DSCP first, then protocol and ports for
+// unmarked traffic, finally size (TCP acks, game state updates).
+TrafficClass classifyTraffic(const PacketBuffer&);
+
+// Per-class queues in front of the UDP send path.
+//
+// CONTROL and INTERACTIVE are served with strict priority, so a small packet never waits behind
+// a bulk burst. STANDARD and BULK share what is left by deficit round robin, STANDARD getting
+// three times the bytes while both are backlogged and BULK never starving. Every class is
+// bounded; INTERACTIVE drops its oldest packet when full (a fresh update beats a stale one),
+// the others refuse the new one (TCP takes that as its congestion signal, a reliable message
+// reports it to the caller).
+//
+// `Entry` is anything with a `packet` PacketBuffer member. Single thread.
+template <typename Entry>
+class TrafficScheduler
+{
+public:
+    static constexpr size_t CLASSES = static_cast<size_t>(TrafficClass::COUNT);
+    static constexpr std::array<size_t, CLASSES> LIMITS{64, 256, 512, 1024};
+    // Bytes per round robin visit, STANDARD : BULK = 3 : 1
+    static constexpr std::array<size_t, CLASSES> QUANTA{0, 0, 3 * 1500, 1500};
+    static constexpr size_t FIRST_SHARED = static_cast<size_t>(TrafficClass::STANDARD);
+
+    // False if the entry itself was dropped
+    bool enqueue(TrafficClass trafficClass, Entry entry)
+    {
+        size_t index = static_cast<size_t>(trafficClass);
+        std::deque<Entry>& queue = queues[index];
+        if (queue.size() >= LIMITS[index])
+        {
+            ++drops[index];
+            if (trafficClass != TrafficClass::INTERACTIVE)
+                return false;
+            queue.pop_front();
+        }
+        queue.push_back(std::move(entry));
+        return true;
+    }
+
+    // Next entry to send, nullptr when all queues are empty. Stays the same until pop().
+    Entry* front()
+    {
+        for (size_t index = 0; index < FIRST_SHARED; ++index)
+        {
+            if (!queues[index].empty())
+            {
+                selected = index;
+                return &queues[index].front();
+            }
+        }
+
+        bool backlogged = false;
+        for (size_t index = FIRST_SHARED; index < CLASSES; ++index)
+            backlogged |= !queues[index].empty();
+        if (!backlogged)
+            return nullptr;
+
+        // A class gets its quantum once per visit and is served while its deficit covers the head
+        for (;;)
+        {
+            std::deque<Entry>& queue = queues[visiting];
+            if (queue.empty())
+            {
+                deficits[visiting] = 0;
+                nextVisit();
+                continue;
+            }
+            if (!credited)
+            {
+                deficits[visiting] += QUANTA[visiting];
+                credited = true;
+            }
+            if (deficits[visiting] >= queue.front().packet.size())
+            {
+                selected = visiting;
+                return &queue.front();
+            }
+            nextVisit();
+        }
+    }
+
+    // Removes what front() returned, the class it came from
+    TrafficClass pop()
+    {
+        std::deque<Entry>& queue = queues[selected];
+        if (queue.empty())
+            return static_cast<TrafficClass>(selected);
+        if (selected >= FIRST_SHARED)
+        {
+            deficits[selected] -= std::min(deficits[selected], queue.front().packet.size());
+            if (queue.size() == 1)
+                deficits[selected] = 0;
+        }
+        queue.pop_front();
+        return static_cast<TrafficClass>(selected);
+    }
+
+    bool empty() const
+    {
+        for (const std::deque<Entry>& queue : queues)
+        {
+            if (!queue.empty())
+                return false;
+        }
+        return true;
+    }
+
+    size_t queued() const
+    {
+        size_t total = 0;
+        for (const std::deque<Entry>& queue : queues)
+            total += queue.size();
+        return total;
+    }
+
+    size_t queued(TrafficClass trafficClass) const { return queues[static_cast<size_t>(trafficClass)].size(); }
+    uint64_t dropped(TrafficClass trafficClass) const { return drops[static_cast<size_t>(trafficClass)]; }
+
+    void clear()
+    {
+        for (std::deque<Entry>& queue : queues)
+            queue.clear();
+        deficits.fill(0);
+        visiting = FIRST_SHARED;
+        credited = false;
+        selected = 0;
+    }
+
+private:
+    void nextVisit()
+    {
+        visiting = visiting + 1 < CLASSES ? visiting + 1 : FIRST_SHARED;
+        credited = false;
+    }
+
+    std::array<std::deque<Entry>, CLASSES> queues;
+    std::array<size_t, CLASSES> deficits{};
+    std::array<uint64_t, CLASSES> drops{};
+    size_t visiting = FIRST_SHARED;
+    bool credited = false;
+    size_t selected = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <boost/asio.hpp>
+#include "PacketPool.hpp"
+
+// Datagram ready to go out, header already written
+struct OutgoingDatagram
+{
+    PacketBuffer packet;
+    boost::asio::ip::udp::endpoint endpoint;
+};
+
+// Datagram pulled off the socket, still carrying our header
+struct ReceivedDatagram
+{
+    PacketBuffer packet;
+    boost::asio::ip::udp::endpoint sender;
+};
+
+// Synchronous, non-blocking multi-datagram I/O on the native handle of the UDP socket.
+// Windows uses WSASendMsg with UDP segmentation offload (USO) for runs of equal sized datagrams
+// and drains queued datagrams without going through IOCP. Linux uses sendmmsg / recvmmsg with
+// UDP_SEGMENT. Elsewhere nothing is supported and callers stay on the regular async path.
+class UDPBatchIO
+{
+public:
+    static constexpr size_t MAX_BATCH = 64;
+
+    // Per kernel submission limits for segmentation offload
+    static constexpr size_t MAX_SEGMENTS = 64;
+    static constexpr size_t MAX_SEGMENTED_BYTES = 65000;
+
+    struct Capabilities
+    {
+        bool multiSend = false;        // Synchronous batch send path available
+        bool segmentOffload = false;   // Equal sized datagrams as one super-datagram (USO / GSO)
+        bool multiReceive = false;     // Synchronous batch receive path available
+    };
+
+    UDPBatchIO(boost::asio::ip::udp::socket&, std::shared_ptr<PacketPool>);
+    ~UDPBatchIO();
+
+    // Detect what the platform offers and enable it on the socket, call after the socket is open
+    Capabilities probe();
+    const Capabilities& capabilities() const { return caps; }
+
+    bool canSendBatch() const { return caps.multiSend; }
+    bool canReceiveBatch() const { return caps.multiReceive; }
+
+    // Send as many datagrams as the socket takes without blocking, in order.
+    // Returns how many went out; the caller owns the rest (would-block or error).
+    // Only one thread may call this at a time.
+    size_t sendBatch(OutgoingDatagram*, size_t);
+
+    // Pull up to `max` queued datagrams without blocking. Only one thread may call this at a time.
+    size_t receiveBatch(ReceivedDatagram*, size_t max);
+
+private:
+    // Count leading datagrams that can share one segmented submission
+    size_t segmentRun(const OutgoingDatagram*, size_t) const;
+
+    boost::asio::ip::udp::socket& socket;
+    std::shared_ptr<PacketPool> packetPool;
+    Capabilities caps;
+
+    // Scratch for datagrams that spill past a small slab, one region per batch slot
+    std::unique_ptr<uint8_t[]> spillArena;
+
+    // Platform state (message headers, staging slabs)
+    struct Platform;
+    std::unique_ptr<Platform> platform;
+};
@@ -0,0 +1,261 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Our datagram header, both wire versions. Header-only and constexpr, encoding and decoding fold
+// into a few loads and stores where they're used.
+//
+// v1, 16 bytes: [magic 4][version 2][type 1][flags 1][seq 4][length 4]
+// v2, 4 bytes and up:
+//   [form 1]            10 S X LL 00: S a session id follows, X extensions follow, LL the seq's size
+//   [type 4 | flags 4]
+//   [seq 0/1/2/4]       big endian, leading zero bytes dropped, a zero seq takes none
+//   [session id 4]      if S
+//   [extensions]        if X: [size 1] then [tag 1][length 1][value] TLVs filling it
+//   [length 2]          payload bytes after the header, trailers not counted
+//
+// Both versions end in the payload length's low 16 bits, so [len16][payload] is an FEC symbol in
+// place. v1 starts with 0x12 and STUN with two zero bits, the form byte's top bits tell all three
+// apart. Every build reads both; who is sent v2 is negotiated in the hole punch (UDPNetwork).
+namespace wire
+{
+inline constexpr uint8_t V1 = 1;
+inline constexpr uint8_t V2 = 2;
+inline constexpr uint32_t V1_MAGIC = 0x12345678;
+inline constexpr size_t V1_SIZE = 16;
+// v2 without a seq, the smallest header there is
+inline constexpr size_t MIN_SIZE = 4;
+// Largest header without extensions, v2 never outgrows v1
+inline constexpr size_t MAX_SIZE = V1_SIZE;
+
+inline constexpr uint8_t FORM_MASK = 0xC0;
+inline constexpr uint8_t FORM_V2 = 0x80;
+inline constexpr uint8_t FORM_SESSION = 0x20;
+inline constexpr uint8_t FORM_EXTENSIONS = 0x10;
+inline constexpr uint8_t FORM_SEQ_SHIFT = 2;
+inline constexpr uint8_t FORM_RESERVED = 0x03;
+// Type and flags share a byte in v2
+inline constexpr uint8_t V2_FIELD_LIMIT = 0x10;
+
+struct Header
+{
+    uint8_t version = V1;
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t seq = 0;
+    // Payload bytes after the header, checked against the datagram by decode()
+    uint32_t length = 0;
+    // v2 only
+    std::optional<uint32_t> sessionId;
+    // v2 only, the TLVs as they sit on the wire (decode points into the datagram)
+    const uint8_t* extensions = nullptr;
+    uint8_t extensionsSize = 0;
+    // Bytes on the wire, set by decode()
+    uint16_t size = 0;
+};
+
+struct Extension
+{
+    uint8_t tag = 0;
+    uint8_t length = 0;
+    const uint8_t* value = nullptr;
+};
+
+constexpr bool isV2(uint8_t form)
+{
+    return (form & FORM_MASK) == FORM_V2;
+}
+
+constexpr size_t seqSize(uint32_t seq)
+{
+    return seq == 0 ? 0 : seq < 0x100 ? 1 : seq < 0x10000 ? 2 : 4;
+}
+
+// A type or flag v2 has no room for goes out as v1
+constexpr uint8_t versionOf(const Header& header)
+{
+    return header.version == V2 && header.type < V2_FIELD_LIMIT && header.flags < V2_FIELD_LIMIT &&
+        header.length <= 0xFFFF ? V2 : V1;
+}
+
+// What encode() writes
+constexpr size_t encodedSize(const Header& header)
+{
+    if (versionOf(header) == V1)
+        return V1_SIZE;
+    return MIN_SIZE + seqSize(header.seq) + (header.sessionId ? 4 : 0) +
+        (header.extensionsSize ? 1 + header.extensionsSize : 0);
+}
+
+constexpr uint32_t load32(const uint8_t* in)
+{
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | in[3];
+}
+
+constexpr uint16_t load16(const uint8_t* in)
+{
+    return static_cast<uint16_t>((in[0] << 8) | in[1]);
+}
+
+constexpr void store32(uint8_t* out, uint32_t value)
+{
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+constexpr void store16(uint8_t* out, uint16_t value)
+{
+    out[0] = static_cast<uint8_t>(value >> 8);
+    out[1] = static_cast<uint8_t>(value);
+}
+
+// Writes encodedSize(header) bytes at `out`, returns that
+constexpr size_t encode(uint8_t* out, const Header& header)
+{
+    if (versionOf(header) == V1)
+    {
+        store32(out, V1_MAGIC);
+        store16(out + 4, V1);
+        out[6] = header.type;
+        out[7] = header.flags;
+        store32(out + 8, header.seq);
+        store32(out + 12, header.length);
+        return V1_SIZE;
+    }
+
+    size_t seqBytes = seqSize(header.seq);
+    uint8_t seqCode = static_cast<uint8_t>(seqBytes == 4 ? 3 : seqBytes);
+    out[0] = static_cast<uint8_t>(FORM_V2 | (seqCode << FORM_SEQ_SHIFT) |
+        (header.sessionId ? FORM_SESSION : 0) | (header.extensionsSize ? FORM_EXTENSIONS : 0));
+    out[1] = static_cast<uint8_t>((header.type << 4) | header.flags);
+    size_t offset = 2;
+    for (size_t i = seqBytes; i > 0; --i)
+        out[offset++] = static_cast<uint8_t>(header.seq >> (8 * (i - 1)));
+    if (header.sessionId)
+    {
+        store32(out + offset, *header.sessionId);
+        offset += 4;
+    }
+    if (header.extensionsSize)
+    {
+        out[offset++] = header.extensionsSize;
+        for (size_t i = 0; i < header.extensionsSize; ++i)
+            out[offset++] = header.extensions[i];
+    }
+    store16(out + offset, static_cast<uint16_t>(header.length));
+    return offset + 2;
+}
+
+// Header of an untrusted datagram. Nothing is read past `size`; a header that is cut short,
+// has reserved bits set, TLVs that don't exactly fill their space, or a length running past
+// the datagram is rejected.
+constexpr std::optional<Header> decode(const uint8_t* in, size_t size)
+{
+    if (size < MIN_SIZE)
+        return std::nullopt;
+
+    Header header;
+    if (!isV2(in[0]))
+    {
+        if (size < V1_SIZE || load32(in) != V1_MAGIC || load16(in + 4) != V1)
+            return std::nullopt;
+        header.type = in[6];
+        header.flags = in[7];
+        header.seq = load32(in + 8);
+        header.length = load32(in + 12);
+        header.size = V1_SIZE;
+    }
+    else
+    {
+        uint8_t form = in[0];
+        if (form & FORM_RESERVED)
+            return std::nullopt;
+
+        constexpr size_t SEQ_SIZES[4] = {0, 1, 2, 4};
+        size_t seqBytes = SEQ_SIZES[(form >> FORM_SEQ_SHIFT) & 0x03];
+        bool hasSession = (form & FORM_SESSION) != 0;
+        bool hasExtensions = (form & FORM_EXTENSIONS) != 0;
+        // Everything but the TLVs themselves, one check covers the fixed fields
+        size_t fixed = MIN_SIZE + seqBytes + (hasSession ? 4 : 0) + (hasExtensions ? 1 : 0);
+        if (size < fixed)
+            return std::nullopt;
+
+        header.version = V2;
+        header.type = in[1] >> 4;
+        header.flags = in[1] & 0x0F;
+        size_t offset = 2;
+        for (size_t i = 0; i < seqBytes; ++i)
+            header.seq = (header.seq << 8) | in[offset++];
+        if (hasSession)
+        {
+            header.sessionId = load32(in + offset);
+            offset += 4;
+        }
+        if (hasExtensions)
+        {
+            size_t total = in[offset++];
+            if (total == 0 || size - fixed < total)
+                return std::nullopt;
+            for (size_t at = 0; at < total;)
+            {
+                if (total - at < 2)
+                    return std::nullopt;
+                at += 2 + in[offset + at + 1];
+                if (at > total)
+                    return std::nullopt;
+            }
+            header.extensions = in + offset;
+            header.extensionsSize = static_cast<uint8_t>(total);
+            offset += total;
+        }
+        header.length = load16(in + offset);
+        header.size = static_cast<uint16_t>(offset + 2);
+    }
+
+    if (header.length > size - header.size)
+        return std::nullopt;
+    return header;
+}
+
+// First extension with `tag` in a decoded header, unknown tags are simply never asked for
+constexpr std::optional<Extension> findExtension(const Header& header, uint8_t tag)
+{
+    for (size_t at = 0; at < header.extensionsSize; at += 2 + header.extensions[at + 1])
+    {
+        if (header.extensions[at] == tag)
+            return Extension{tag, header.extensions[at + 1], header.extensions + at + 2};
+    }
+    return std::nullopt;
+}
+
+namespace detail
+{
+constexpr bool roundTrips(uint8_t version, uint8_t type, uint8_t flags, uint32_t seq, uint32_t length,
+    std::optional<uint32_t> sessionId = std::nullopt)
+{
+    Header header;
+    header.version = version;
+    header.type = type;
+    header.flags = flags;
+    header.seq = seq;
+    header.length = length;
+    header.sessionId = sessionId;
+
+    uint8_t buffer[64] = {};
+    size_t size = encode(buffer, header);
+    std::optional<Header> decoded = decode(buffer, size + length);
+    return size == encodedSize(header) && decoded && decoded->size == size &&
+        decoded->version == versionOf(header) && decoded->type == type && decoded->flags == flags &&
+        decoded->seq == seq && decoded->length == length && decoded->sessionId == sessionId;
+}
+}
+
+static_assert(detail::roundTrips(V1, 0x03, 0x0A, 0xDEADBEEF, 20));
+static_assert(detail::roundTrips(V2, 0x03, 0x0A, 0x1234, 20));
+static_assert(detail::roundTrips(V2, 0x01, 0x00, 0, 0, 0xCAFEF00D));
+// Past v2's four bits, sent as v1
+static_assert(detail::roundTrips(V2, 0x12, 0x00, 7, 0));
+}
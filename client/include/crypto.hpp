@@ -1,3 +1,103 @@
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sodium.h>
 
-int init_crypto();
\ No newline at end of file
+int init_crypto();
+
+// AEAD sealing tunnel payloads. AES-256-GCM runs on AES-NI / CLMUL where both ends have it,
+// ChaCha20-Poly1305 everywhere else; libsodium picks the vector implementation at init.
+enum class CipherSuite : uint8_t { NONE, AES256_GCM, CHACHA20_POLY1305 };
+
+namespace crypto
+{
+inline constexpr size_t KEY_SIZE = 32;
+inline constexpr size_t PUBLIC_KEY_SIZE = crypto_kx_PUBLICKEYBYTES;
+inline constexpr size_t TAG_SIZE = 16;
+inline constexpr size_t NONCE_SIZE = 12;
+
+// Hardware AES-GCM on this machine, only valid after init_crypto()
+bool aesAvailable();
+const char* suiteName(CipherSuite);
+// Both ends run this on the same pair of flags and land on the same suite
+CipherSuite negotiate(bool localAes, bool peerAes);
+
+// The 64-bit packet number nearest `largest` (the highest one that authenticated) with `seq` as
+// its low bits, the wire only carries those
+uint64_t widenSeq(uint64_t largest, uint32_t seq);
+
+// Packet numbers that authenticated, the highest one and the WINDOW below it. Asked before
+// open(), told after it succeeded, so a forgery can't move the window.
+class ReplayWindow
+{
+public:
+    static constexpr size_t WORDS = 16;
+    // The word holding the highest number is only partly behind it
+    static constexpr uint64_t WINDOW = (WORDS - 1) * 64;
+
+    // Not seen yet and not too old to tell
+    bool fresh(uint64_t packetNumber) const;
+    void mark(uint64_t packetNumber);
+    void reset();
+
+private:
+    // A ring, bit n % 64 of word n / 64 % WORDS
+    std::array<uint64_t, WORDS> words{};
+    uint64_t highest = 0;
+};
+
+std::string toHex(const uint8_t*, size_t);
+bool fromHex(const std::string&, uint8_t*, size_t);
+}
+
+// Ephemeral X25519 pair for one peer connection, the secret is wiped with it
+struct KeyExchange
+{
+    std::array<uint8_t, crypto_kx_PUBLICKEYBYTES> publicKey;
+    std::array<uint8_t, crypto_kx_SECRETKEYBYTES> secretKey;
+
+    KeyExchange();
+    ~KeyExchange();
+    KeyExchange(const KeyExchange&) = delete;
+    KeyExchange& operator=(const KeyExchange&) = delete;
+
+    // Receive / transmit keys for our side, the side with the smaller public key takes the client role
+    bool deriveSessionKeys(const uint8_t* peerPublicKey, uint8_t* rxKey, uint8_t* txKey) const;
+};
+
+// Keys of one peer, one per direction, expanded once so sealing a packet is just the AEAD pass.
+// The nonce is the 64-bit packet number together with the packet type. Datagrams carry the number's
+// low 32 bits as their seq, so the nonce doesn't repeat when that wraps (about 90 minutes at
+// 800k packets per second); numbers start over only with new keys, which no connection carries over.
+// seal() / open() are const and safe to call from the sending and receiving threads at once.
+class PacketCipher
+{
+public:
+    PacketCipher() = default;
+    ~PacketCipher();
+    PacketCipher(const PacketCipher&) = delete;
+    PacketCipher& operator=(const PacketCipher&) = delete;
+
+    void init(CipherSuite, const uint8_t* rxKey, const uint8_t* txKey);
+    void clear();
+    CipherSuite suite() const { return cipherSuite; }
+
+    // Seal `length` bytes of `in` into `out` (may be the same buffer), TAG_SIZE bytes are appended.
+    // `ad` is authenticated along with them but not encrypted, open() has to be given the same bytes.
+    void seal(uint8_t* out, const uint8_t* in, size_t length, uint8_t type, uint64_t packetNumber,
+        const uint8_t* ad, size_t adLength) const;
+    // Open `length` sealed bytes (tag included) of `in` into `out` (may be the same buffer), false if forged
+    bool open(uint8_t* out, const uint8_t* in, size_t length, uint8_t type, uint64_t packetNumber,
+        const uint8_t* ad, size_t adLength) const;
+
+private:
+    static void makeNonce(uint8_t* nonce, uint8_t type, uint64_t packetNumber);
+
+    CipherSuite cipherSuite = CipherSuite::NONE;
+    crypto_aead_aes256gcm_state aesRx;
+    crypto_aead_aes256gcm_state aesTx;
+    uint8_t chachaRx[crypto::KEY_SIZE];
+    uint8_t chachaTx[crypto::KEY_SIZE];
+};
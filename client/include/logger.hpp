@@ -4,8 +4,6 @@
 #include <mutex>
 #include <string>
 
-static bool shouldLogNetTraffic = false;
-
 class ConditionalLogger {
 public:
     // Singleton
@@ -64,69 +62,223 @@ private:
 
 #include <quill/Logger.h>
 #include <quill/LogMacros.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Lowest level each subsystem compiles in, sites below it expand to nothing (arguments included).
+// Set through CMake's PEERBRIDGE_LOG_LEVEL, DEBUG for Debug builds and INFO otherwise. What's compiled
+// in is filtered again at runtime by setLogLevel(). The traffic log is only built in at DEBUG.
+#define PEERBRIDGE_LOG_LEVEL_DEBUG 0
+#define PEERBRIDGE_LOG_LEVEL_INFO 1
+#define PEERBRIDGE_LOG_LEVEL_WARNING 2
+#define PEERBRIDGE_LOG_LEVEL_ERROR 3
+#define PEERBRIDGE_LOG_LEVEL_NONE 4
+
+#ifndef PEERBRIDGE_LOG_LEVEL
+#define PEERBRIDGE_LOG_LEVEL PEERBRIDGE_LOG_LEVEL_INFO
+#endif
+#ifndef PEERBRIDGE_SYSTEM_LOG_LEVEL
+#define PEERBRIDGE_SYSTEM_LOG_LEVEL PEERBRIDGE_LOG_LEVEL
+#endif
+#ifndef PEERBRIDGE_NETWORK_LOG_LEVEL
+#define PEERBRIDGE_NETWORK_LOG_LEVEL PEERBRIDGE_LOG_LEVEL
+#endif
+
+inline std::atomic<bool> shouldLogNetTraffic{false};
 
+// Token bucket, refilled at maxLogsPerSec and holding as many. Lock-free: the bucket is kept as the
+// time it would be full again, one CAS per log that gets through.
 class TrafficLogLimiter
 {
 public:
     TrafficLogLimiter(double maxLogsPerSec)
-    : capacity(maxLogsPerSec),
-    tokens(capacity),
-    rate(maxLogsPerSec),
-    lastTime(std::chrono::steady_clock::now())
+    : interval(static_cast<int64_t>(1e9 / maxLogsPerSec)),
+    burst(static_cast<int64_t>(maxLogsPerSec) * interval),
+    fullAt(0)
     {}
 
     bool tryLog() noexcept
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto now = std::chrono::steady_clock::now();
-        std::chrono::duration<double> delta = now - lastTime;
-        lastTime = now;
-        tokens = std::min(capacity, tokens + (delta.count() * rate));
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t current = fullAt.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            int64_t next = (current > now ? current : now) + interval;
+            // Taking a token would push the bucket past empty
+            if (next - now > burst)
+                return false;
+            if (fullAt.compare_exchange_weak(current, next, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+private:
+    const int64_t interval;   // ns per token
+    const int64_t burst;      // ns worth of tokens the bucket holds
+    std::atomic<int64_t> fullAt;
+};
+
+// One log site that may fire per packet: the first occurrence is logged, then at most one line a
+// second carrying how many there were since. Lock-free, the count is approximate under contention.
+// A burst that stops before its second is up is reported by flushPending().
+class LogSummary
+{
+public:
+    static constexpr int64_t INTERVAL_NS = 1000000000;
+    // Logs `count` held back occurrences of the site with format string `format`
+    using Flush = void (*)(const char* format, uint64_t count);
 
-        if (tokens < 1.0)
-            return false;
+    // Sites are statics, each one joins the list flushPending() walks on its first occurrence
+    LogSummary(const char* site_format, Flush site_flush) noexcept
+        : format(site_format), flush(site_flush), next(sites().load(std::memory_order_relaxed))
+    {
+        while (!sites().compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    LogSummary(const LogSummary&) = delete;
+    LogSummary& operator=(const LogSummary&) = delete;
 
-        tokens -= 1.0;
-        return true;
+    // Occurrences to report now (this one included), 0 while the site stays quiet
+    uint64_t add() noexcept
+    {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        return take(nowNs());
     }
 
+    // Reports every site holding back occurrences past its interval, from a periodic tick
+    static void flushPending() noexcept;
+
 private:
-    double capacity;
-    double rate;
-    double tokens;
-    std::chrono::steady_clock::time_point lastTime;
-    std::mutex mutex_;
+    static std::atomic<LogSummary*>& sites() noexcept;
+
+    static int64_t nowNs() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t take(int64_t now) noexcept
+    {
+        int64_t last = lastReport.load(std::memory_order_relaxed);
+        if (now - last < INTERVAL_NS || !lastReport.compare_exchange_strong(last, now, std::memory_order_relaxed))
+            return 0;
+        return pending.exchange(0, std::memory_order_relaxed);
+    }
+
+    const char* const format;
+    const Flush flush;
+    LogSummary* next;
+    std::atomic<uint64_t> pending{0};
+    std::atomic<int64_t> lastReport{-INTERVAL_NS};
 };
 
 void initLogging();
 quill::Logger* sysLogger();
 quill::Logger* netLogger();
 
+// Runtime filter per subsystem, on top of what was compiled in
+enum class LogSubsystem
+{
+    SYSTEM,
+    NETWORK
+};
+void setLogLevel(LogSubsystem, quill::LogLevel);
+// "debug", "info", "warning", "error" or "none"
+std::optional<quill::LogLevel> parseLogLevel(const std::string&);
+
 inline TrafficLogLimiter& logLimiter()
 {
     static TrafficLogLimiter limiter(6.0);
     return limiter;
 }
 
+// Disabled site: the arguments sit in an unevaluated operand, nothing runs and nothing is emitted,
+// but they still count as used
+template <typename... Args>
+inline int logDiscarded(const char*, const Args&...) { return 0; }
+#define PEERBRIDGE_LOG_OFF(fmt, ...) do { (void)sizeof(logDiscarded(fmt, ##__VA_ARGS__)); } while (0)
+
+// Logged once, then once a second with the count, see LogSummary
+#define PEERBRIDGE_LOG_SUMMARY(log, fmt, ...)                                   \
+    do {                                                                        \
+        static LogSummary logSummary_(fmt, [](const char* logFormat_, uint64_t logCount_) \
+        {                                                                       \
+            log("{} more since the last report of: {}", logCount_, logFormat_); \
+        });                                                                     \
+        if (uint64_t logCount_ = logSummary_.add())                             \
+            log(fmt " ({} since the last report)", ##__VA_ARGS__, logCount_);   \
+    } while (0)
+
+#if PEERBRIDGE_SYSTEM_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_DEBUG
+#define SYSTEM_LOG_DEBUG(fmt, ...) QUILL_LOG_DEBUG(sysLogger(), fmt, ##__VA_ARGS__)
+#else
+#define SYSTEM_LOG_DEBUG(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_SYSTEM_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_INFO
 #define SYSTEM_LOG_INFO(fmt, ...) QUILL_LOG_INFO(sysLogger(), fmt, ##__VA_ARGS__)
+#else
+#define SYSTEM_LOG_INFO(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_SYSTEM_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_WARNING
 #define SYSTEM_LOG_WARNING(fmt, ...) QUILL_LOG_WARNING(sysLogger(), fmt, ##__VA_ARGS__)
+#define SYSTEM_LOG_WARNING_SUMMARY(fmt, ...) PEERBRIDGE_LOG_SUMMARY(SYSTEM_LOG_WARNING, fmt, ##__VA_ARGS__)
+#else
+#define SYSTEM_LOG_WARNING(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#define SYSTEM_LOG_WARNING_SUMMARY(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_SYSTEM_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_ERROR
 #define SYSTEM_LOG_ERROR(fmt, ...) QUILL_LOG_ERROR(sysLogger(), fmt, ##__VA_ARGS__)
+#define SYSTEM_LOG_ERROR_SUMMARY(fmt, ...) PEERBRIDGE_LOG_SUMMARY(SYSTEM_LOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define SYSTEM_LOG_ERROR(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#define SYSTEM_LOG_ERROR_SUMMARY(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
 
-// Too lazy to make this look better :/
-#define NETWORK_TRAFFIC_LOG(fmt, ...)                               \
-    do {                                                            \
-        if (shouldLogNetTraffic && logLimiter().tryLog())           \
-            QUILL_LOG_INFO(netLogger(), fmt, ##__VA_ARGS__);        \
-    } while (0);
-
+#if PEERBRIDGE_NETWORK_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_DEBUG
+#define NETWORK_LOG_DEBUG(fmt, ...) QUILL_LOG_DEBUG(netLogger(), fmt, ##__VA_ARGS__)
+// Sampled packet contents, off unless turned on at runtime and capped by logLimiter()
+#define NETWORK_TRAFFIC_LOG(fmt, ...)                                                       \
+    do {                                                                                    \
+        if (shouldLogNetTraffic.load(std::memory_order_relaxed) && logLimiter().tryLog())   \
+            QUILL_LOG_INFO(netLogger(), fmt, ##__VA_ARGS__);                                \
+    } while (0)
+#else
+#define NETWORK_LOG_DEBUG(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#define NETWORK_TRAFFIC_LOG(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_NETWORK_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_INFO
 #define NETWORK_LOG_INFO(fmt, ...) QUILL_LOG_INFO(netLogger(), fmt, ##__VA_ARGS__)
+#else
+#define NETWORK_LOG_INFO(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_NETWORK_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_WARNING
 #define NETWORK_LOG_WARNING(fmt, ...) QUILL_LOG_WARNING(netLogger(), fmt, ##__VA_ARGS__)
+#define NETWORK_LOG_WARNING_SUMMARY(fmt, ...) PEERBRIDGE_LOG_SUMMARY(NETWORK_LOG_WARNING, fmt, ##__VA_ARGS__)
+#else
+#define NETWORK_LOG_WARNING(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#define NETWORK_LOG_WARNING_SUMMARY(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if PEERBRIDGE_NETWORK_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_ERROR
 #define NETWORK_LOG_ERROR(fmt, ...) QUILL_LOG_ERROR(netLogger(), fmt, ##__VA_ARGS__)
+#define NETWORK_LOG_ERROR_SUMMARY(fmt, ...) PEERBRIDGE_LOG_SUMMARY(NETWORK_LOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define NETWORK_LOG_ERROR(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#define NETWORK_LOG_ERROR_SUMMARY(fmt, ...) PEERBRIDGE_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
 
 // Don't ask why it's here
 inline void setShouldLogTraffic(bool shouldLog)
 {
     shouldLogNetTraffic = shouldLog;
-    if (shouldLogNetTraffic)
+#if PEERBRIDGE_NETWORK_LOG_LEVEL <= PEERBRIDGE_LOG_LEVEL_DEBUG
+    if (shouldLog)
         SYSTEM_LOG_WARNING("[System] P2P Traffic will be logged to file, connection may be slower!");
-}
\ No newline at end of file
+#else
+    if (shouldLog)
+        SYSTEM_LOG_WARNING("[System] Traffic logging is not built into this binary, configure with PEERBRIDGE_LOG_LEVEL=DEBUG");
+#endif
+}
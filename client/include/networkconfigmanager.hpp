@@ -1,7 +1,12 @@
 #include <string>
+#include <vector>
 #include <guiddef.h>
 #include <cstdint>
+#include <mutex>
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <iphlpapi.h>
+#include <netioapi.h>
 
 namespace NetworkConstants
 {
@@ -9,7 +14,16 @@ inline constexpr const wchar_t* INTERFACE_NAME = L"PeerBridge";
 inline constexpr const wchar_t* TUNNEL_TYPE = L"WINTUN";
 
 inline constexpr char const* NET_MASK = "255.255.255.0";
-inline constexpr char const* MULTICAST_SUBNET_RANGE = "224.0.0.0/4";
+inline constexpr char const* MULTICAST_PREFIX = "224.0.0.0";
+inline constexpr uint8_t MULTICAST_PREFIX_LENGTH = 4;
+
+// IPv6 side of the virtual network, host index n is IPV6_PREFIX + n
+inline constexpr char const* IPV6_PREFIX = "fd50:6272:6467::";
+inline constexpr uint8_t IPV6_PREFIX_LENGTH = 64;
+inline constexpr char const* IPV6_MULTICAST_PREFIX = "ff00::";
+inline constexpr uint8_t IPV6_MULTICAST_PREFIX_LENGTH = 8;
+// Least any IPv6 link carries, the adapter can't go below it for IPv6
+inline constexpr uint32_t IPV6_MIN_MTU = 1280;
 
 inline constexpr uint8_t START_IP_INDEX = 1;
 inline constexpr uint8_t BASE_IP_INDEX = 0;
@@ -35,33 +49,67 @@ public:
 
     struct ConnectionConfig
     {
-        // TODO: TO BE MODIFIED FOR *1
+        // Our host index in the virtual network
         uint8_t selfIndex;
-        // TODO: TO BE MODIFIED FOR *1
-        // For now, it will always equal 1
+        // First peer of the session, the rest go through addPeerRoute
         std::string peerVirtualIp;
     };
 
     // TODO: Once config file implemented,
     // Do static FILE_PATH, staic SET_FILE_PATH or something similar
 
+    // Configured through IP Helper on the adapter's LUID, no netsh processes. Every call is
+    // safe from any thread, the session's setup runs alongside hole punching.
     NetworkConfigManager();
 
     bool configureInterface(const ConnectionConfig&);
     bool setupRouting(const ConnectionConfig&);
+    // Firewall rules are persistent, this only creates the ones that are missing
     void setupFirewall();
+    // Private category for the adapter's network, waits for Windows to list it
+    void setupNetworkCategory();
+
+    // Peers joining an already configured interface, only routed one by one in fallback mode
+    bool addPeerRoute(const std::string&);
+    void removePeerRoute(const std::string&);
 
-    void resetInterfaceConfiguration(const std::string&);
-    bool removeRouting(const std::string&);
+    // Adapter MTU, so the OS sizes packets to what the tunnel carries unfragmented.
+    // Skipped when it's already set to that. IPv6 never goes below IPV6_MIN_MTU.
+    bool setInterfaceMtu(uint32_t);
+
+    // Leaves the firewall rules in place for the next session
+    void resetInterfaceConfiguration();
+    bool removeRouting();
+    // Uninstall, drops the persistent firewall rules
     void removeFirewall();
 
-    void setNarrowAlias(const std::string&);
+    void setInterfaceLuid(const NET_LUID&);
 
 private:
+    // Serializes the calls, held for the whole of a configuration or reset
+    std::mutex configMutex;
     RouteConfigApproach routeApproach = RouteConfigApproach::GENERIC_ROUTE;
-    std::string narrowAlias;
+    NET_LUID interfaceLuid{};
     SetupConfig setupConfig;
-
-    bool executeNetshCommand(const std::string& command);
+    // Per-peer /32 routes added under FALLBACK_ROUTE_ALL
+    std::vector<std::string> peerRoutes;
+    // Last MTU put on the adapter, 0 before the first
+    uint32_t interfaceMtu = 0;
+    // What the adapter had before our first change, put back on reset
+    uint32_t originalMtu = 0;
+    uint32_t originalMtu6 = 0;
+    // IPv6 address and routes came up, they're optional next to the IPv4 ones
+    bool ipv6Configured = false;
+
+    // Either family, told apart by the address text
+    bool setAddress(const std::string& ip, uint8_t prefixLength);
+    // Both families
+    bool clearAddresses();
+    bool addRoute(const std::string& prefix, uint8_t prefixLength);
+    bool deleteRoute(const std::string& prefix, uint8_t prefixLength);
+    // Forwarding and a fixed metric, or back to the defaults
+    bool setForwarding(bool enabled, ADDRESS_FAMILY = AF_INET);
+    // IPv6 address, subnet and multicast routes, best-effort next to IPv4
+    bool setupIpv6(uint8_t selfIndex);
 
 };
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include <atomic>
 #include <functional>
 #include <string>
+#include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <nlohmann/json.hpp>
 
 class SignalingClient {
@@ -13,7 +15,15 @@ public:
     using ConnectCallback = std::function<void(bool)>;
     using ChatRequestCallback = std::function<void(const std::string&)>;
     using PeerInfoCallback = std::function<void(const std::string&, const std::string&, int)>;
-    using ChatInitCallback = std::function<void(const std::string&, const std::string&, int)>;
+    // Peer username, ip, port, then our and the peer's host index in the virtual network (0 if the server doesn't assign them),
+    // then the relay address we reach the peer through (empty, 0 if the server runs no relay),
+    // then the peer's IPv6 address and port (empty, 0 if it only has IPv4)
+    using ChatInitCallback = std::function<void(const std::string&, const std::string&, int, int, int, const std::string&, int,
+        const std::string&, int)>;
+    // Peer username, its hex X25519 public key for this connection and whether it has hardware AES
+    using KeyExchangeCallback = std::function<void(const std::string&, const std::string&, bool)>;
+    // Peer username and the ip, port its public address moved to
+    using PeerMovedCallback = std::function<void(const std::string&, const std::string&, int)>;
     
     SignalingClient();
     ~SignalingClient();
@@ -25,31 +35,49 @@ public:
     
     // Server communication
     void sendGreeting();
-    void registerUser(const std::string& username, const std::string& ip, int port);
+    // Dual-stack hosts pass their IPv6 address too, peers try both
+    void registerUser(const std::string& username, const std::string& ip, int port,
+        const std::string& ip6 = "", int port6 = 0);
     void requestUsername();
     void requestPeerInfo(const std::string& username);
+    // Several at once, answered in one message; each peer that's online comes to the peer info callback
+    void requestPeerInfo(const std::vector<std::string>& usernames);
     void sendChatRequest(const std::string& username);
     void acceptChatRequest();
     void declineChatRequest();
+    void leaveSession();
+    void sendKeyExchange(const std::string& username, const std::string& publicKey, bool aes);
+    // Our public address moved, the server passes it on to the members of our session
+    void updateAddress(const std::string& ip, int port);
     
     // Callback setters
     void setConnectCallback(ConnectCallback callback);
     void setChatRequestCallback(ChatRequestCallback callback);
     void setPeerInfoCallback(PeerInfoCallback callback);
     void setChatInitCallback(ChatInitCallback callback);
+    void setKeyExchangeCallback(KeyExchangeCallback callback);
+    void setPeerMovedCallback(PeerMovedCallback callback);
     
 private:
     void setupMessageHandlers();
     void handleMessage(const ix::WebSocketMessagePtr& msg);
     void handleJsonMessage(const nlohmann::json& data);
+    // MessagePack once the server answered in it, JSON text until then
+    void send(const nlohmann::json& message);
     
     std::unique_ptr<ix::WebSocket> ws_;
     std::atomic<bool> connected_;
+    // Server speaks the binary format, it answers our registration in it when it does
+    std::atomic<bool> binary_;
     std::mutex mutex_;
+    // Wakes connect() as soon as the socket opens
+    std::condition_variable connectedCv_;
     
     // Callbacks
     ConnectCallback onConnect_;
     ChatRequestCallback onChatRequest_;
     PeerInfoCallback onPeerInfo_;
     ChatInitCallback onChatInit_;
+    KeyExchangeCallback onKeyExchange_;
+    PeerMovedCallback onPeerMoved_;
 };
\ No newline at end of file
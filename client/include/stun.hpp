@@ -1,29 +1,56 @@
 #pragma once
 #include <string>
 #include <optional>
+#include <vector>
+#include <array>
 #include <boost/asio.hpp>
 
 struct PublicAddress {
     std::string ip;
     int port;
+    bool ipv6 = false;
+};
+
+struct StunServer {
+    std::string host;
+    std::string port;
 };
 
 class StunClient {
 public:
-    StunClient(const std::string& server = "stun.l.google.com", const std::string& port = "19302");
-    
-    // Get public IP and port
+    // Every server is asked at once, from the one socket, and the first answer wins
+    StunClient(std::vector<StunServer> servers = defaultServers());
+
+    // Get public IP and port. The socket is dual-stack where the host allows it, servers are
+    // asked over both families and the IPv4 answer is the one returned when there is one.
     std::optional<PublicAddress> discoverPublicAddress();
-    
-    // Set STUN server (possible custom configuration)
+    // Our IPv6 candidate from the last discovery, if a server answered over IPv6
+    std::optional<PublicAddress> publicAddress6() const;
+
+    // Set STUN server (possible custom configuration), replaces the list
     void setStunServer(const std::string& server, const std::string& port = "19302");
+    void addStunServer(const std::string& server, const std::string& port = "19302");
 
     std::unique_ptr<boost::asio::ip::udp::socket> getSocket();
     boost::asio::io_context& getContext();
 
+    static std::vector<StunServer> defaultServers();
+    // Server that gave the last answer, asked again when the address may have moved
+    std::optional<boost::asio::ip::udp::endpoint> answeredBy() const;
+
+    // Wire format, for asking over a socket that has been handed on
+    using TransactionId = std::array<uint8_t, 12>;
+    static constexpr size_t HEADER_SIZE = 20;
+    static std::array<uint8_t, HEADER_SIZE> bindingRequest(const TransactionId&);
+    // Mapped address in a binding success answering `transaction`
+    static std::optional<PublicAddress> parseBindingResponse(const uint8_t*, size_t, const TransactionId&);
+    // Bytes 4..7 of every STUN message, where our own header has its version and type
+    static bool isStunMessage(const uint8_t*, size_t);
+
 private:
-    std::string stunServer;
-    std::string stunPort;
+    std::vector<StunServer> stunServers;
+    std::optional<boost::asio::ip::udp::endpoint> lastServer;
+    std::optional<PublicAddress> lastAddress6;
     std::unique_ptr<boost::asio::ip::udp::socket> scoket;
     boost::asio::io_context ioContext;
-};
\ No newline at end of file
+};
@@ -6,6 +6,10 @@
 #include <optional>
 #include <variant>
 #include <string>
+#include <thread>
+#include <functional>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
 
 // System states
 enum class SystemState {
@@ -18,7 +22,10 @@ enum class SystemState {
 // Network event types, used for transitions
 enum class NetworkEvent {
     PEER_CONNECTED,
+    PEER_DISCONNECTED,
     ALL_PEERS_DISCONNECTED,
+    PATH_MTU_CHANGED,   // A peer's path MTU search settled, UDPNetwork::tunnelMtu() may have moved
+    PUBLIC_ADDRESS_CHANGED, // Our mapped address moved (network switch, NAT rebinding), data is "ip:port"
     SHUTDOWN_REQUESTED
 };
 
@@ -27,10 +34,15 @@ struct NetworkEventData {
     NetworkEvent event;
     std::variant<std::string, std::monostate> data;
     std::chrono::steady_clock::time_point timestamp; // UNUSED
+    int peer = -1; // Peer table slot for per-peer events
     
     // Constructor for events with string data
     NetworkEventData(NetworkEvent e, const std::string& endpoint) 
         : event(e), data(endpoint), timestamp(std::chrono::steady_clock::now()) {}
+
+    // Constructor for per-peer events
+    NetworkEventData(NetworkEvent e, const std::string& endpoint, int peer_id) 
+        : event(e), data(endpoint), timestamp(std::chrono::steady_clock::now()), peer(peer_id) {}
     
     // Constructor for events without data
     NetworkEventData(NetworkEvent e) 
@@ -41,22 +53,28 @@ struct NetworkEventData {
 class SystemStateManager {
 public:
     SystemStateManager();
+    ~SystemStateManager();
 
     // System state management
     void setState(SystemState state);
     SystemState getState() const;
     bool isInState(SystemState state) const;
 
-    // Event queue
+    // Events are handed to the handler on the dispatcher thread as soon as they're queued, in order.
+    // Events queued before the dispatcher starts wait for it.
+    using EventHandler = std::function<void(const NetworkEventData&)>;
+    void startDispatcher(EventHandler);
+    // The event being handled finishes, the rest are dropped. Safe to call from a handler.
+    void stopDispatcher();
     void queueEvent(const NetworkEventData& event);
-    std::optional<NetworkEventData> getNextEvent();
-    bool hasEvents() const;
     
 private:
     std::atomic<SystemState> currentState;
 
-    std::queue<NetworkEventData> eventQueue;
-    mutable std::mutex eventMutex;
+    boost::asio::io_context dispatcher;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> dispatcherWork;
+    std::thread dispatcherThread;
+    EventHandler eventHandler;
 
     bool isValidTransition(SystemState from, SystemState to) const;
 };
@@ -66,8 +84,10 @@ class PeerConnectionInfo {
 public:
     PeerConnectionInfo();
     
-    // Last active time (receive timestamp)
+    // Last active time (receive timestamp). The receive path passes the time its shard read
+    // once for the whole burst, every packet of a peer in it lands in one store.
     void updateActivity();
+    void updateActivity(std::chrono::steady_clock::time_point);
     bool hasTimedOut(int = 10) const;
     
     // Connection state
@@ -78,6 +98,7 @@ public:
     std::chrono::steady_clock::time_point getLastActivity() const;
     
 private:
-    std::atomic<std::chrono::steady_clock::time_point> lastActivity;
+    // Clock ticks, only the peer's shard writes it
+    std::atomic<std::chrono::steady_clock::rep> lastActivity;
     std::atomic<bool> connected;
 };
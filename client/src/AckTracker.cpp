@@ -0,0 +1,322 @@
+#include "AckTracker.hpp"
+#include <algorithm>
+
+namespace
+{
+// Signed distance a - b, correct across seq wraparound
+inline int32_t seqDiff(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b);
+}
+
+void writeU32(uint8_t* out, uint32_t value)
+{
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+uint32_t readU32(const uint8_t* in)
+{
+    return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+           (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+}
+
+void AckFrame::encode(uint8_t* out) const
+{
+    writeU32(out, largest);
+    writeU32(out + 4, cumulative);
+    writeU32(out + 8, static_cast<uint32_t>(sackBitmap >> 32));
+    writeU32(out + 12, static_cast<uint32_t>(sackBitmap));
+}
+
+AckFrame AckFrame::decode(const uint8_t* in)
+{
+    AckFrame frame;
+    frame.largest = readU32(in);
+    frame.cumulative = readU32(in + 4);
+    frame.sackBitmap = (static_cast<uint64_t>(readU32(in + 8)) << 32) | readU32(in + 12);
+    return frame;
+}
+
+AckTracker::AckTracker()
+    : slots(std::make_unique<SendSlot[]>(WINDOW_SIZE))
+{
+}
+
+void AckTracker::resetReceive()
+{
+    haveReceived = false;
+    rxLargest = rxCumulative = 0;
+    rxBitmap = 0;
+    sinceLastAck = 0;
+    pending.store(false, std::memory_order_relaxed);
+}
+
+bool AckTracker::receivedLocked(uint32_t seq) const
+{
+    int32_t distance = seqDiff(rxLargest, seq);
+    if (distance == 0)
+        return true;
+    if (distance < 0 || distance > static_cast<int32_t>(SACK_RANGE))
+        return false;
+    return (rxBitmap >> (distance - 1)) & 1;
+}
+
+bool AckTracker::onReceive(uint32_t seq)
+{
+    if (!haveReceived)
+    {
+        haveReceived = true;
+        rxLargest = seq;
+        rxCumulative = seq;
+        rxBitmap = 0;
+    }
+    else
+    {
+        int32_t distance = seqDiff(seq, rxLargest);
+        if (distance > 0)
+        {
+            // New largest, old largest becomes bit distance - 1
+            uint32_t shift = static_cast<uint32_t>(distance);
+            rxBitmap = shift >= SACK_RANGE ? 0 : (rxBitmap << shift);
+            if (shift <= SACK_RANGE)
+                rxBitmap |= 1ull << (shift - 1);
+            rxLargest = seq;
+        }
+        else if (distance < 0 && -distance <= static_cast<int32_t>(SACK_RANGE))
+        {
+            rxBitmap |= 1ull << (-distance - 1);
+        }
+        else
+        {
+            return false; // Duplicate or older than anything we can still report
+        }
+    }
+
+    // Everything below the bitmap can't be reported anymore, give up on those holes
+    if (seqDiff(rxLargest, rxCumulative) > static_cast<int32_t>(SACK_RANGE))
+        rxCumulative = rxLargest - SACK_RANGE;
+    while (seqDiff(rxLargest, rxCumulative) > 0 && receivedLocked(rxCumulative + 1))
+        ++rxCumulative;
+
+    // Publish for the send path
+    uint32_t v = version.load(std::memory_order_relaxed);
+    version.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    publishedLargest.store(rxLargest, std::memory_order_relaxed);
+    publishedCumulative.store(rxCumulative, std::memory_order_relaxed);
+    publishedBitmap.store(rxBitmap, std::memory_order_relaxed);
+    version.store(v + 2, std::memory_order_release);
+    pending.store(true, std::memory_order_release);
+
+    if (++sinceLastAck >= ACK_EVERY_PACKETS)
+    {
+        sinceLastAck = 0;
+        return true;
+    }
+    return false;
+}
+
+bool AckTracker::takeAck(AckFrame& frame)
+{
+    if (!pending.exchange(false, std::memory_order_acq_rel))
+        return false;
+
+    for (;;)
+    {
+        uint32_t before = version.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        frame.largest = publishedLargest.load(std::memory_order_relaxed);
+        frame.cumulative = publishedCumulative.load(std::memory_order_relaxed);
+        frame.sackBitmap = publishedBitmap.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (version.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+}
+
+void AckTracker::onSend(uint32_t seq, Clock::time_point now, size_t bytes)
+{
+    SendSlot& slot = slots[seq & (WINDOW_SIZE - 1)];
+
+    // An unacked entry a full window back is reclaimed as lost
+    if (slot.state.exchange(EMPTY, std::memory_order_acq_rel) == SENT)
+    {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        lostBytes.fetch_add(slot.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    slot.seq.store(seq, std::memory_order_relaxed);
+    slot.sentAt.store(
+        std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count(),
+        std::memory_order_relaxed);
+    slot.bytes.store(static_cast<uint32_t>(bytes), std::memory_order_relaxed);
+    slot.deliveredAtSend.store(deliveredBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.deliveredTimeAtSend.store(deliveredTime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.appLimited.store(false, std::memory_order_relaxed);
+    slot.state.store(SENT, std::memory_order_release);
+    sent.fetch_add(1, std::memory_order_relaxed);
+    sentBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void AckTracker::markAppLimited(uint32_t seq)
+{
+    SendSlot& slot = slots[seq & (WINDOW_SIZE - 1)];
+    if (slot.seq.load(std::memory_order_relaxed) == seq)
+        slot.appLimited.store(true, std::memory_order_relaxed);
+}
+
+void AckTracker::resetSend()
+{
+    for (size_t i = 0; i < WINDOW_SIZE; ++i)
+    {
+        SendSlot& slot = slots[i];
+        if (slot.state.exchange(EMPTY, std::memory_order_acq_rel) == SENT)
+            lostBytes.fetch_add(slot.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    haveLossCursor = false;
+}
+
+uint64_t AckTracker::bytesInFlight() const
+{
+    // Settled counts first, a send racing in between only makes the result larger
+    uint64_t settled = deliveredBytes.load(std::memory_order_acquire) + lostBytes.load(std::memory_order_acquire);
+    uint64_t total = sentBytes.load(std::memory_order_acquire);
+    return total > settled ? total - settled : 0;
+}
+
+const AckTracker::SendSlot* AckTracker::markAcked(uint32_t seq, AckResult& result)
+{
+    SendSlot& slot = slots[seq & (WINDOW_SIZE - 1)];
+    if (slot.state.load(std::memory_order_acquire) != SENT ||
+        slot.seq.load(std::memory_order_relaxed) != seq)
+    {
+        return nullptr;
+    }
+
+    uint8_t expected = SENT;
+    if (!slot.state.compare_exchange_strong(expected, ACKED, std::memory_order_acq_rel))
+        return nullptr;
+
+    uint32_t bytes = slot.bytes.load(std::memory_order_relaxed);
+    ++result.newlyAcked;
+    result.ackedBytes += bytes;
+    acked.fetch_add(1, std::memory_order_relaxed);
+    deliveredBytes.fetch_add(bytes, std::memory_order_release);
+    if (onResolve)
+        onResolve(seq, true);
+    return &slot;
+}
+
+AckResult AckTracker::onAck(const AckFrame& frame, Clock::time_point now)
+{
+    AckResult result;
+
+    const SendSlot* newest = markAcked(frame.largest, result);
+
+    for (uint32_t bit = 0; bit < SACK_RANGE; ++bit)
+    {
+        if ((frame.sackBitmap >> bit) & 1)
+            markAcked(frame.largest - 1 - bit, result);
+    }
+
+    int64_t nowMicros = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    if (newest)
+    {
+        std::chrono::microseconds sample(nowMicros - newest->sentAt.load(std::memory_order_relaxed));
+        updateRtt(sample);
+        result.rttSample = sample;
+
+        // Over the time since the ack it went out behind (or its own flight, whichever is longer),
+        // a queue building up or acks arriving in a burst can't make the path look faster
+        uint64_t delivered = deliveredBytes.load(std::memory_order_relaxed) - newest->deliveredAtSend.load(std::memory_order_relaxed);
+        int64_t since = newest->deliveredTimeAtSend.load(std::memory_order_relaxed);
+        int64_t interval = std::max<int64_t>(sample.count(), since ? nowMicros - since : 0);
+        if (interval > 0)
+            result.deliveryRate = delivered * 1000000 / static_cast<uint64_t>(interval);
+        result.appLimited = newest->appLimited.load(std::memory_order_relaxed);
+    }
+
+    // Walk everything old enough to have been reported: below the cumulative point it arrived,
+    // past the reorder threshold without a SACK bit it's lost
+    if (!haveLossCursor || seqDiff(frame.largest, lossCursor) > static_cast<int32_t>(WINDOW_SIZE))
+    {
+        lossCursor = frame.largest - std::min<uint32_t>(WINDOW_SIZE, frame.largest - frame.cumulative + SACK_RANGE);
+        haveLossCursor = true;
+    }
+
+    while (seqDiff(frame.largest, lossCursor) > static_cast<int32_t>(REORDER_THRESHOLD))
+    {
+        SendSlot& slot = slots[lossCursor & (WINDOW_SIZE - 1)];
+        if (slot.state.load(std::memory_order_acquire) == SENT &&
+            slot.seq.load(std::memory_order_relaxed) == lossCursor)
+        {
+            bool arrived = seqDiff(frame.cumulative, lossCursor) >= 0;
+            uint8_t expected = SENT;
+            if (slot.state.compare_exchange_strong(expected, arrived ? ACKED : LOST, std::memory_order_acq_rel))
+            {
+                uint32_t bytes = slot.bytes.load(std::memory_order_relaxed);
+                if (arrived)
+                {
+                    ++result.newlyAcked;
+                    result.ackedBytes += bytes;
+                    acked.fetch_add(1, std::memory_order_relaxed);
+                    deliveredBytes.fetch_add(bytes, std::memory_order_release);
+                }
+                else
+                {
+                    ++result.newlyLost;
+                    result.lostBytes += bytes;
+                    lost.fetch_add(1, std::memory_order_relaxed);
+                    lostBytes.fetch_add(bytes, std::memory_order_release);
+                }
+                if (onResolve)
+                    onResolve(lossCursor, arrived);
+            }
+        }
+        ++lossCursor;
+    }
+
+    if (result.newlyAcked)
+        deliveredTime.store(nowMicros, std::memory_order_relaxed);
+    return result;
+}
+
+void AckTracker::setResolveCallback(ResolveCallback callback)
+{
+    onResolve = std::move(callback);
+}
+
+void AckTracker::updateRtt(std::chrono::microseconds sample)
+{
+    // RFC 6298 smoothing
+    int64_t rtt = sample.count();
+    int64_t srtt = srttMicros.load(std::memory_order_relaxed);
+    if (srtt == 0)
+    {
+        srttMicros.store(rtt, std::memory_order_relaxed);
+        rttVarMicros.store(rtt / 2, std::memory_order_relaxed);
+        return;
+    }
+
+    int64_t rttVar = rttVarMicros.load(std::memory_order_relaxed);
+    int64_t delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+    rttVarMicros.store((3 * rttVar + delta) / 4, std::memory_order_relaxed);
+    srttMicros.store((7 * srtt + rtt) / 8, std::memory_order_relaxed);
+}
+
+std::chrono::microseconds AckTracker::smoothedRtt() const
+{
+    return std::chrono::microseconds(srttMicros.load(std::memory_order_relaxed));
+}
+
+std::chrono::microseconds AckTracker::rttVariance() const
+{
+    return std::chrono::microseconds(rttVarMicros.load(std::memory_order_relaxed));
+}
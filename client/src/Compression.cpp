@@ -0,0 +1,224 @@
+#include "Compression.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <zlib.h>
+
+namespace
+{
+// Raw deflate, no zlib header. A 4 KiB window covers an MTU sized packet and keeps the
+// match tables in L2; the decoder takes any window up to 32 KiB.
+constexpr int DEFLATE_WINDOW_BITS = -12;
+constexpr int INFLATE_WINDOW_BITS = -15;
+constexpr int DEFLATE_MEM_LEVEL = 8;
+// Fraction of the sample's maximum entropy above which a flow counts as incompressible
+constexpr float ENTROPY_LIMIT = 7.0f / 8.0f;
+// Payloads shorter than this (pure TCP acks and the like) are not worth a deflate pass
+constexpr size_t MIN_PAYLOAD = 64;
+
+inline uint32_t readU32(const uint8_t* in)
+{
+    return (static_cast<uint32_t>(in[0]) << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+// c * log2(c) for every count a sample can reach
+const std::array<float, PacketCompressor::SAMPLE_SIZE + 1>& countLogTable()
+{
+    static const auto table = []()
+    {
+        std::array<float, PacketCompressor::SAMPLE_SIZE + 1> values{};
+        for (size_t c = 1; c < values.size(); ++c)
+            values[c] = static_cast<float>(c) * std::log2(static_cast<float>(c));
+        return values;
+    }();
+    return table;
+}
+}
+
+PacketCompressor::PacketCompressor()
+    : stream(std::make_unique<z_stream_s>())
+{
+    std::memset(stream.get(), 0, sizeof(z_stream_s));
+    if (deflateInit2(stream.get(), Z_BEST_SPEED, Z_DEFLATED, DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        stream.reset();
+}
+
+PacketCompressor::~PacketCompressor()
+{
+    if (stream)
+        deflateEnd(stream.get());
+}
+
+uint32_t PacketCompressor::flowKey(const PacketBuffer& packet, size_t& payloadOffset)
+{
+    const uint8_t* ip = packet.data();
+    size_t headerLength;
+    uint8_t protocol;
+    uint32_t key;
+    // Only the first fragment carries the ports
+    bool firstFragment;
+    if ((ip[0] >> 4) == 4)
+    {
+        headerLength = (ip[0] & 0x0F) * 4;
+        if (headerLength < 20 || packet.size() < headerLength)
+            return 0;
+        protocol = ip[9];
+        key = readU32(ip + 12) * 0x9E3779B1u ^ readU32(ip + 16) * 0x85EBCA6Bu ^ protocol;
+        firstFragment = ((ip[6] & 0x1F) | ip[7]) == 0;
+    }
+    else if ((ip[0] >> 4) == 6 && packet.size() >= 40)
+    {
+        // Fixed header only, traffic behind extension headers (fragments among it) is a flow
+        // per address pair and next header
+        headerLength = 40;
+        protocol = ip[6];
+        uint32_t src = readU32(ip + 8) ^ readU32(ip + 12) ^ readU32(ip + 16) ^ readU32(ip + 20);
+        uint32_t dst = readU32(ip + 24) ^ readU32(ip + 28) ^ readU32(ip + 32) ^ readU32(ip + 36);
+        key = src * 0x9E3779B1u ^ dst * 0x85EBCA6Bu ^ protocol;
+        firstFragment = true;
+    }
+    else
+    {
+        return 0;
+    }
+    payloadOffset = headerLength;
+
+    const uint8_t* transport = ip + headerLength;
+    if (firstFragment && protocol == 6 && packet.size() >= headerLength + 20)
+    {
+        key ^= readU32(transport) * 0xC2B2AE35u;
+        payloadOffset = headerLength + (transport[12] >> 4) * 4;
+    }
+    else if (firstFragment && protocol == 17 && packet.size() >= headerLength + 8)
+    {
+        key ^= readU32(transport) * 0xC2B2AE35u;
+        payloadOffset = headerLength + 8;
+    }
+
+    payloadOffset = std::min(payloadOffset, packet.size());
+    return key ? key : 1;
+}
+
+float PacketCompressor::sampleEntropy(const uint8_t* data, size_t size)
+{
+    // Strided so a long packet is judged by more than its first bytes
+    size_t samples = std::min(size, SAMPLE_SIZE);
+    size_t stride = size / samples;
+
+    uint16_t counts[256] = {};
+    for (size_t i = 0; i < samples; ++i)
+        ++counts[data[i * stride]];
+
+    const auto& table = countLogTable();
+    float sum = 0.0f;
+    for (uint16_t count : counts)
+        sum += table[count];
+    return std::log2(static_cast<float>(samples)) - sum / samples;
+}
+
+void PacketCompressor::strike(FlowState& flow)
+{
+    flow.strikes = std::min<uint8_t>(flow.strikes + 1, MAX_STRIKES);
+    flow.skip = 16u << flow.strikes;
+}
+
+bool PacketCompressor::compress(PacketBuffer& packet, PacketPool& pool)
+{
+    if (!stream || packet.size() < MIN_SIZE || packet.size() > 0xFFFF)
+        return false;
+
+    size_t payloadOffset = 0;
+    uint32_t key = flowKey(packet, payloadOffset);
+    if (!key)
+        return false;
+
+    FlowState& flow = flows[(key ^ (key >> 16)) & (FLOW_SLOTS - 1)];
+    if (flow.key != key)
+        flow = FlowState{key};
+
+    // Known incompressible, a plain countdown until the next probe
+    if (flow.skip)
+    {
+        --flow.skip;
+        return false;
+    }
+
+    size_t payloadSize = packet.size() - payloadOffset;
+    if (payloadSize < MIN_PAYLOAD)
+        return false;
+
+    // Encrypted or already compressed data sits close to 8 bits per byte
+    float limit = ENTROPY_LIMIT * std::log2(static_cast<float>(std::min(payloadSize, SAMPLE_SIZE)));
+    if (sampleEntropy(packet.data() + payloadOffset, payloadSize) > limit)
+    {
+        strike(flow);
+        return false;
+    }
+
+    // Deflate stops as soon as the output wouldn't be worth sending
+    size_t frameLimit = packet.size() - packet.size() / 16;
+    PacketBuffer frame = pool.acquire(frameLimit);
+    if (!frame)
+        return false;
+
+    deflateReset(stream.get());
+    stream->next_in = const_cast<Bytef*>(packet.data());
+    stream->avail_in = static_cast<uInt>(packet.size());
+    stream->next_out = frame.data() + compression::FRAME_HEADER_SIZE;
+    stream->avail_out = static_cast<uInt>(frameLimit - compression::FRAME_HEADER_SIZE);
+    if (deflate(stream.get(), Z_FINISH) != Z_STREAM_END)
+    {
+        strike(flow);
+        return false;
+    }
+
+    uint8_t* header = frame.data();
+    header[0] = compression::FRAME_TAG;
+    header[1] = (packet.size() >> 8) & 0xFF;
+    header[2] = packet.size() & 0xFF;
+    frame.resize(compression::FRAME_HEADER_SIZE + stream->total_out);
+
+    flow.strikes = 0;
+    frame.setTrace(packet.trace());
+    packet = std::move(frame);
+    return true;
+}
+
+PacketDecompressor::PacketDecompressor()
+    : stream(std::make_unique<z_stream_s>())
+{
+    std::memset(stream.get(), 0, sizeof(z_stream_s));
+    if (inflateInit2(stream.get(), INFLATE_WINDOW_BITS) != Z_OK)
+        stream.reset();
+}
+
+PacketDecompressor::~PacketDecompressor()
+{
+    if (stream)
+        inflateEnd(stream.get());
+}
+
+PacketBuffer PacketDecompressor::decompress(const PacketBuffer& frame, PacketPool& pool)
+{
+    if (!stream || !compression::isFrame(frame))
+        return PacketBuffer();
+
+    size_t originalSize = (frame[1] << 8) | frame[2];
+    if (originalSize == 0)
+        return PacketBuffer();
+
+    PacketBuffer packet = pool.acquire(originalSize);
+    if (!packet)
+        return PacketBuffer();
+
+    inflateReset(stream.get());
+    stream->next_in = const_cast<Bytef*>(frame.data() + compression::FRAME_HEADER_SIZE);
+    stream->avail_in = static_cast<uInt>(frame.size() - compression::FRAME_HEADER_SIZE);
+    stream->next_out = packet.data();
+    stream->avail_out = static_cast<uInt>(originalSize);
+
+    // Has to end exactly at the length the sender announced
+    if (inflate(stream.get(), Z_FINISH) != Z_STREAM_END || stream->avail_out != 0)
+        return PacketBuffer();
+    return packet;
+}
@@ -0,0 +1,235 @@
+#include "CongestionControl.hpp"
+#include <algorithm>
+
+namespace
+{
+// 2 / ln 2, the smallest gain that still doubles the delivery rate every round in startup
+constexpr double STARTUP_GAIN = 2.885;
+constexpr double WINDOW_GAIN = 2.0;
+// One phase per min RTT: probe above the estimate, drain what that queued, then cruise
+constexpr std::array<double, 8> PROBE_GAINS{1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+// Startup is over once three rounds in a row couldn't raise the bandwidth by a quarter
+constexpr double FULL_BANDWIDTH_GROWTH = 1.25;
+constexpr uint8_t FULL_BANDWIDTH_ROUNDS = 3;
+// A round losing more than this share of its bytes takes the bandwidth estimate down
+constexpr double LOSS_THRESHOLD = 0.02;
+constexpr double LOSS_BACKOFF = 0.85;
+// Round length until there is an RTT sample
+constexpr std::chrono::microseconds DEFAULT_ROUND{100000};
+// The peer acks every ACK_EVERY_PACKETS datagrams, the window has to cover that on top of the BDP
+constexpr uint64_t ACK_ALLOWANCE = AckTracker::ACK_EVERY_PACKETS * CongestionController::MAX_DATAGRAM;
+// LEDBAT: datagrams of window growth per window acked at zero queueing delay, pacing headroom
+constexpr double LEDBAT_GAIN = 1.0;
+constexpr double LEDBAT_PACING_GAIN = 1.25;
+}
+
+CongestionController::CongestionController()
+{
+    reset(CongestionMode::BBR);
+}
+
+void CongestionController::reset(CongestionMode mode)
+{
+    currentMode = mode;
+    minRtt = probeRttMin = smoothedRtt = std::chrono::microseconds(0);
+    minRttStamp = roundStart = cycleStart = probeRttDone = lastWindowCut = Clock::time_point();
+
+    phase = Phase::STARTUP;
+    roundBandwidth.fill(0);
+    round = 0;
+    roundAcked = roundLost = 0;
+    fullBandwidth = 0;
+    fullBandwidthRounds = 0;
+    filledPipe = false;
+    cycleIndex = 0;
+
+    window = INITIAL_WINDOW;
+    publish(INITIAL_RATE, INITIAL_WINDOW);
+}
+
+void CongestionController::onAck(const AckResult& result, uint64_t bytesInFlight, Clock::time_point now)
+{
+    if (currentMode == CongestionMode::OFF)
+        return;
+
+    if (result.rttSample)
+    {
+        updateMinRtt(*result.rttSample, now);
+        smoothedRtt = smoothedRtt.count() ? (7 * smoothedRtt + *result.rttSample) / 8 : *result.rttSample;
+    }
+
+    if (currentMode == CongestionMode::LEDBAT)
+        onAckLedbat(result, now);
+    else
+        onAckBbr(result, bytesInFlight, now);
+}
+
+void CongestionController::updateMinRtt(std::chrono::microseconds sample, Clock::time_point now)
+{
+    if (phase == Phase::PROBE_RTT && (!probeRttMin.count() || sample < probeRttMin))
+        probeRttMin = sample;
+
+    // LEDBAT forgets its base delay by itself, BBR refreshes it in PROBE_RTT
+    bool expired = currentMode == CongestionMode::LEDBAT && now - minRttStamp > LEDBAT_BASE_WINDOW;
+    if (!minRtt.count() || sample <= minRtt || expired)
+    {
+        minRtt = sample;
+        minRttStamp = now;
+    }
+}
+
+bool CongestionController::advanceRound(Clock::time_point now)
+{
+    if (roundStart == Clock::time_point())
+    {
+        roundStart = now;
+        return false;
+    }
+    if (now - roundStart < (minRtt.count() ? minRtt : DEFAULT_ROUND))
+        return false;
+
+    roundStart = now;
+    ++round;
+    roundBandwidth[round % BANDWIDTH_ROUNDS] = 0;
+    return true;
+}
+
+uint64_t CongestionController::bandwidth() const
+{
+    return *std::max_element(roundBandwidth.begin(), roundBandwidth.end());
+}
+
+uint64_t CongestionController::bdp(double gain) const
+{
+    return static_cast<uint64_t>(gain * static_cast<double>(bandwidth()) * minRtt.count() / 1e6);
+}
+
+void CongestionController::onAckBbr(const AckResult& result, uint64_t bytesInFlight, Clock::time_point now)
+{
+    roundAcked += result.ackedBytes;
+    roundLost += result.lostBytes;
+
+    // An app-limited sample only counts if it shows more than we knew, a quiet sender proves nothing
+    uint64_t& current = roundBandwidth[round % BANDWIDTH_ROUNDS];
+    if (result.deliveryRate && (!result.appLimited || result.deliveryRate > bandwidth()))
+        current = std::max(current, result.deliveryRate);
+
+    if (advanceRound(now))
+    {
+        uint64_t total = roundAcked + roundLost;
+        if (total && static_cast<double>(roundLost) > LOSS_THRESHOLD * static_cast<double>(total))
+        {
+            for (uint64_t& sample : roundBandwidth)
+                sample = static_cast<uint64_t>(static_cast<double>(sample) * LOSS_BACKOFF);
+            filledPipe = true;
+        }
+        roundAcked = roundLost = 0;
+
+        if (!filledPipe)
+        {
+            uint64_t estimate = bandwidth();
+            if (static_cast<double>(estimate) >= FULL_BANDWIDTH_GROWTH * static_cast<double>(fullBandwidth))
+            {
+                fullBandwidth = estimate;
+                fullBandwidthRounds = 0;
+            }
+            else if (++fullBandwidthRounds >= FULL_BANDWIDTH_ROUNDS)
+            {
+                filledPipe = true;
+            }
+        }
+    }
+
+    std::chrono::microseconds cycleLength = minRtt.count() ? minRtt : DEFAULT_ROUND;
+    switch (phase)
+    {
+    case Phase::STARTUP:
+        if (filledPipe)
+            phase = Phase::DRAIN;
+        break;
+    case Phase::DRAIN:
+        if (bytesInFlight <= bdp(1.0))
+        {
+            phase = Phase::PROBE_BW;
+            cycleIndex = 2;
+            cycleStart = now;
+        }
+        break;
+    case Phase::PROBE_BW:
+        if (now - cycleStart >= cycleLength)
+        {
+            cycleIndex = static_cast<uint8_t>((cycleIndex + 1) % PROBE_GAINS.size());
+            cycleStart = now;
+        }
+        break;
+    case Phase::PROBE_RTT:
+        if (now >= probeRttDone)
+        {
+            if (probeRttMin.count())
+                minRtt = probeRttMin;
+            minRttStamp = now;
+            phase = filledPipe ? Phase::PROBE_BW : Phase::STARTUP;
+            cycleStart = now;
+        }
+        break;
+    }
+
+    // Min RTT went stale, empty the queue for a moment so the path delay can be measured again
+    if (phase != Phase::PROBE_RTT && minRtt.count() && now - minRttStamp > MIN_RTT_WINDOW)
+    {
+        phase = Phase::PROBE_RTT;
+        probeRttMin = std::chrono::microseconds(0);
+        probeRttDone = now + std::max<Clock::duration>(PROBE_RTT_TIME, minRtt);
+    }
+
+    if (!bandwidth() || !minRtt.count())
+    {
+        publish(INITIAL_RATE, INITIAL_WINDOW);
+        return;
+    }
+
+    double pacingGain = 1.0;
+    if (phase == Phase::STARTUP)
+        pacingGain = STARTUP_GAIN;
+    else if (phase == Phase::DRAIN)
+        pacingGain = 1.0 / STARTUP_GAIN;
+    else if (phase == Phase::PROBE_BW)
+        pacingGain = PROBE_GAINS[cycleIndex];
+
+    uint64_t rate = std::max(MIN_RATE, static_cast<uint64_t>(pacingGain * static_cast<double>(bandwidth())));
+    uint64_t windowBytes = phase == Phase::PROBE_RTT
+        ? MIN_WINDOW
+        : std::max(MIN_WINDOW, bdp(phase == Phase::PROBE_BW ? WINDOW_GAIN : STARTUP_GAIN) + ACK_ALLOWANCE);
+    publish(rate, windowBytes);
+}
+
+void CongestionController::onAckLedbat(const AckResult& result, Clock::time_point now)
+{
+    // Once per RTT at most, the losses of one burst are one congestion event
+    if (result.lostBytes)
+    {
+        if (now - lastWindowCut > smoothedRtt)
+        {
+            window = std::max(MIN_WINDOW, window / 2);
+            lastWindowCut = now;
+        }
+    }
+    else if (result.ackedBytes && minRtt.count())
+    {
+        double queueing = static_cast<double>((smoothedRtt - minRtt).count());
+        double target = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(LEDBAT_TARGET).count());
+        double offTarget = std::max(-1.0, (target - queueing) / target);
+        double growth = LEDBAT_GAIN * offTarget * static_cast<double>(result.ackedBytes) * MAX_DATAGRAM / static_cast<double>(window);
+        window = static_cast<uint64_t>(std::max(static_cast<double>(MIN_WINDOW), static_cast<double>(window) + growth));
+    }
+
+    std::chrono::microseconds rtt = smoothedRtt.count() ? smoothedRtt : DEFAULT_ROUND;
+    uint64_t rate = static_cast<uint64_t>(LEDBAT_PACING_GAIN * static_cast<double>(window) * 1e6 / rtt.count());
+    publish(std::max(MIN_RATE, rate), window + ACK_ALLOWANCE);
+}
+
+void CongestionController::publish(uint64_t rate, uint64_t windowBytes)
+{
+    publishedRate.store(rate, std::memory_order_relaxed);
+    publishedWindow.store(windowBytes, std::memory_order_relaxed);
+}
@@ -0,0 +1,429 @@
+#include "FecCodec.hpp"
+#include "GaloisField.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Cauchy matrix entry for parity row j and data column i, rows and columns use disjoint points
+inline uint8_t coefficient(uint32_t parityIndex, uint32_t dataIndex)
+{
+    return gf::inv(static_cast<uint8_t>((255 - parityIndex) ^ dataIndex));
+}
+
+inline int popcount64(uint64_t value)
+{
+    int count = 0;
+    while (value)
+    {
+        value &= value - 1;
+        ++count;
+    }
+    return count;
+}
+
+void writeU64(uint8_t* out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out[i] = static_cast<uint8_t>(value >> (56 - 8 * i));
+}
+
+uint64_t readU64(const uint8_t* in)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+// Invert an n x n matrix in place, n <= MAX_PARITY. Returns false if singular.
+bool invertMatrix(uint8_t (*a)[fec::MAX_PARITY], uint8_t (*out)[fec::MAX_PARITY], size_t n)
+{
+    for (size_t r = 0; r < n; ++r)
+        for (size_t c = 0; c < n; ++c)
+            out[r][c] = r == c ? 1 : 0;
+
+    for (size_t col = 0; col < n; ++col)
+    {
+        size_t pivot = col;
+        while (pivot < n && a[pivot][col] == 0)
+            ++pivot;
+        if (pivot == n)
+            return false;
+
+        if (pivot != col)
+        {
+            for (size_t c = 0; c < n; ++c)
+            {
+                std::swap(a[pivot][c], a[col][c]);
+                std::swap(out[pivot][c], out[col][c]);
+            }
+        }
+
+        uint8_t scale = gf::inv(a[col][col]);
+        for (size_t c = 0; c < n; ++c)
+        {
+            a[col][c] = gf::mul(a[col][c], scale);
+            out[col][c] = gf::mul(out[col][c], scale);
+        }
+
+        for (size_t r = 0; r < n; ++r)
+        {
+            uint8_t factor = a[r][col];
+            if (r == col || factor == 0)
+                continue;
+            for (size_t c = 0; c < n; ++c)
+            {
+                a[r][c] ^= gf::mul(factor, a[col][c]);
+                out[r][c] ^= gf::mul(factor, out[col][c]);
+            }
+        }
+    }
+    return true;
+}
+}
+
+namespace fec
+{
+FecParams paramsForLoss(double lossRate)
+{
+    // Enough parity to cover roughly 2-3x the expected losses per group
+    if (lossRate < 0.005)
+        return FecParams{MAX_DATA, 1};
+    if (lossRate < 0.02)
+        return FecParams{16, 1};
+    if (lossRate < 0.05)
+        return FecParams{10, 2};
+    if (lossRate < 0.10)
+        return FecParams{8, 3};
+    if (lossRate < 0.20)
+        return FecParams{6, 4};
+    return FecParams{4, 4};
+}
+}
+
+/*
+* ENCODER
+*/
+
+void FecEncoder::setParams(FecParams params)
+{
+    k.store(std::min(params.k, fec::MAX_DATA), std::memory_order_relaxed);
+    m.store(std::min(params.m, fec::MAX_PARITY), std::memory_order_relaxed);
+}
+
+FecParams FecEncoder::params() const
+{
+    return FecParams{k.load(std::memory_order_relaxed), m.load(std::memory_order_relaxed)};
+}
+
+void FecEncoder::add(uint32_t seq, PacketBuffer symbol, PacketPool& pool, std::vector<Parity>& ready)
+{
+    FecParams current = params();
+    if (!current.enabled())
+    {
+        symbols.clear();
+        return;
+    }
+
+    // Members must stay within the bitmap, reliable packets in between spread them out
+    if (!symbols.empty() && seq - baseSeq >= fec::MAX_SPAN)
+        encode(pool, ready);
+
+    if (symbols.empty())
+    {
+        baseSeq = seq;
+        members = 0;
+    }
+
+    members |= 1ull << (seq - baseSeq);
+    symbols.push_back(std::move(symbol));
+
+    if (symbols.size() >= current.k)
+        encode(pool, ready);
+}
+
+void FecEncoder::flush(PacketPool& pool, std::vector<Parity>& ready)
+{
+    if (!symbols.empty())
+        encode(pool, ready);
+}
+
+void FecEncoder::encode(PacketPool& pool, std::vector<Parity>& ready)
+{
+    FecParams current = params();
+    size_t count = symbols.size();
+
+    // A short group gets proportionally fewer parity packets, at least one
+    size_t parityCount = current.k ? (current.m * count + current.k - 1) / current.k : 0;
+    parityCount = std::max<size_t>(1, std::min<size_t>(parityCount, current.m));
+
+    size_t symbolLength = 0;
+    for (const PacketBuffer& symbol : symbols)
+        symbolLength = std::max(symbolLength, symbol.size());
+
+    for (size_t j = 0; j < parityCount && current.m > 0; ++j)
+    {
+        PacketBuffer parity = pool.acquire(fec::PARITY_HEADER_SIZE + symbolLength);
+        if (!parity)
+            break;
+
+        uint8_t* header = parity.data();
+        writeU64(header, members);
+        header[8] = static_cast<uint8_t>(count);
+        header[9] = static_cast<uint8_t>(parityCount);
+        header[10] = static_cast<uint8_t>(j);
+        header[11] = 0;
+
+        uint8_t* out = header + fec::PARITY_HEADER_SIZE;
+        std::memset(out, 0, symbolLength);
+        for (size_t i = 0; i < count; ++i)
+        {
+            gf::mulAddRegion(out, symbols[i].data(), coefficient(static_cast<uint32_t>(j), static_cast<uint32_t>(i)), symbols[i].size());
+        }
+
+        ready.push_back(Parity{baseSeq, std::move(parity)});
+    }
+
+    symbols.clear();
+    members = 0;
+}
+
+/*
+* DECODER
+*/
+
+FecDecoder::FecDecoder()
+    : data(std::make_unique<DataSlot[]>(DATA_WINDOW))
+{
+    for (Group& group : groups)
+        group.parities.resize(fec::MAX_PARITY);
+}
+
+const FecDecoder::DataSlot* FecDecoder::findData(uint32_t seq) const
+{
+    const DataSlot& slot = data[seq & (DATA_WINDOW - 1)];
+    return slot.valid && slot.seq == seq ? &slot : nullptr;
+}
+
+bool FecDecoder::wasRecovered(uint32_t seq) const
+{
+    const DataSlot* slot = findData(seq);
+    return slot && slot->recovered;
+}
+
+void FecDecoder::onData(uint32_t seq, const PacketBuffer& symbol, PacketPool& pool, std::vector<FecDecoder::Recovered>& recovered)
+{
+    DataSlot& slot = data[seq & (DATA_WINDOW - 1)];
+    slot.seq = seq;
+    slot.valid = true;
+    slot.recovered = false;
+    slot.symbol = symbol.share();
+
+    // A late member may be what a waiting group was short of
+    for (Group& group : groups)
+    {
+        if (!group.active || group.parityCount == 0)
+            continue;
+        uint32_t offset = seq - group.baseSeq;
+        if (offset < fec::MAX_SPAN && ((group.members >> offset) & 1))
+            tryRecover(group, pool, recovered);
+    }
+}
+
+void FecDecoder::onParity(uint32_t baseSeq, const PacketBuffer& payload, PacketPool& pool, std::vector<FecDecoder::Recovered>& recovered)
+{
+    if (payload.size() < fec::PARITY_HEADER_SIZE + 2)
+        return;
+
+    const uint8_t* header = payload.data();
+    uint64_t members = readU64(header);
+    uint8_t count = header[8];
+    uint8_t parityCount = header[9];
+    uint8_t index = header[10];
+
+    // Untrusted input, all of it has to agree before anything is indexed with it
+    if (count == 0 || count > fec::MAX_DATA || popcount64(members) != count ||
+        parityCount == 0 || parityCount > fec::MAX_PARITY || index >= parityCount)
+    {
+        return;
+    }
+
+    Group* group = nullptr;
+    for (Group& candidate : groups)
+    {
+        if (candidate.active && candidate.baseSeq == baseSeq && candidate.members == members)
+        {
+            group = &candidate;
+            break;
+        }
+    }
+
+    if (!group)
+    {
+        // Oldest slot goes, its packets are long overdue
+        group = &groups[nextGroup];
+        nextGroup = (nextGroup + 1) % GROUP_SLOTS;
+        for (PacketBuffer& parity : group->parities)
+            parity.reset();
+        group->active = true;
+        group->baseSeq = baseSeq;
+        group->members = members;
+        group->k = count;
+        group->m = parityCount;
+        group->parityCount = 0;
+    }
+
+    if (group->m != parityCount || group->parities[index])
+        return;
+
+    // Every parity of a group has the same length
+    for (const PacketBuffer& other : group->parities)
+    {
+        if (other && other.size() != payload.size())
+            return;
+    }
+
+    group->parities[index] = payload.share();
+    ++group->parityCount;
+    tryRecover(*group, pool, recovered);
+}
+
+void FecDecoder::tryRecover(Group& group, PacketPool& pool, std::vector<FecDecoder::Recovered>& recovered)
+{
+    // Member index and seq of everything still missing
+    uint8_t missingIndex[fec::MAX_PARITY];
+    uint32_t missingSeq[fec::MAX_PARITY];
+    size_t missing = 0;
+
+    uint8_t memberIndex = 0;
+    for (uint32_t bit = 0; bit < fec::MAX_SPAN; ++bit)
+    {
+        if (!((group.members >> bit) & 1))
+            continue;
+
+        if (!findData(group.baseSeq + bit))
+        {
+            if (missing == group.parityCount)
+                return; // More holes than parity so far
+            missingIndex[missing] = memberIndex;
+            missingSeq[missing] = group.baseSeq + bit;
+            ++missing;
+        }
+        ++memberIndex;
+    }
+
+    auto finish = [&group]()
+    {
+        for (PacketBuffer& parity : group.parities)
+            parity.reset();
+        group.active = false;
+    };
+
+    if (missing == 0)
+    {
+        finish();
+        return;
+    }
+
+    size_t symbolLength = 0;
+    uint8_t rows[fec::MAX_PARITY];
+    size_t rowCount = 0;
+    for (uint8_t j = 0; j < group.m && rowCount < missing; ++j)
+    {
+        if (group.parities[j])
+        {
+            rows[rowCount++] = j;
+            symbolLength = group.parities[j].size() - fec::PARITY_HEADER_SIZE;
+        }
+    }
+
+    // Take the known data out of each parity, what's left is the missing data times the matrix
+    PacketBuffer syndromes[fec::MAX_PARITY];
+    for (size_t r = 0; r < missing; ++r)
+    {
+        syndromes[r] = pool.acquire(symbolLength, 0);
+        if (!syndromes[r])
+            return;
+        std::memcpy(syndromes[r].data(), group.parities[rows[r]].data() + fec::PARITY_HEADER_SIZE, symbolLength);
+    }
+
+    memberIndex = 0;
+    for (uint32_t bit = 0; bit < fec::MAX_SPAN; ++bit)
+    {
+        if (!((group.members >> bit) & 1))
+            continue;
+
+        const DataSlot* slot = findData(group.baseSeq + bit);
+        if (slot)
+        {
+            if (slot->symbol.size() > symbolLength)
+            {
+                finish(); // Doesn't belong to this group
+                return;
+            }
+            for (size_t r = 0; r < missing; ++r)
+            {
+                gf::mulAddRegion(syndromes[r].data(), slot->symbol.data(), coefficient(rows[r], memberIndex), slot->symbol.size());
+            }
+        }
+        ++memberIndex;
+    }
+
+    uint8_t matrix[fec::MAX_PARITY][fec::MAX_PARITY];
+    uint8_t inverse[fec::MAX_PARITY][fec::MAX_PARITY];
+    for (size_t r = 0; r < missing; ++r)
+        for (size_t c = 0; c < missing; ++c)
+            matrix[r][c] = coefficient(rows[r], missingIndex[c]);
+
+    if (!invertMatrix(matrix, inverse, missing))
+    {
+        finish();
+        return;
+    }
+
+    for (size_t c = 0; c < missing; ++c)
+    {
+        PacketBuffer symbol = pool.acquire(symbolLength, 0);
+        if (!symbol)
+            break;
+
+        std::memset(symbol.data(), 0, symbolLength);
+        for (size_t r = 0; r < missing; ++r)
+        {
+            gf::mulAddRegion(symbol.data(), syndromes[r].data(), inverse[c][r], symbolLength);
+        }
+
+        size_t length = (symbol[0] << 8) | symbol[1];
+        if (length + 2 > symbolLength)
+            continue;
+        symbol.resize(length + 2);
+
+        DataSlot& slot = data[missingSeq[c] & (DATA_WINDOW - 1)];
+        slot.seq = missingSeq[c];
+        slot.valid = true;
+        slot.recovered = true;
+        slot.symbol = symbol.share();
+
+        symbol.pull(2);
+        recovered.push_back(Recovered{missingSeq[c], std::move(symbol)});
+        ++recoveredTotal;
+    }
+
+    finish();
+}
+
+void FecDecoder::reset()
+{
+    for (size_t i = 0; i < DATA_WINDOW; ++i)
+    {
+        data[i].valid = false;
+        data[i].symbol.reset();
+    }
+    for (Group& group : groups)
+    {
+        for (PacketBuffer& parity : group.parities)
+            parity.reset();
+        group.active = false;
+    }
+}
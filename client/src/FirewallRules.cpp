@@ -0,0 +1,290 @@
+#include "FirewallRules.hpp"
+#include "Logger.hpp"
+#include <objbase.h>
+#include <oleauto.h>
+#include <netfw.h>
+#include <netlistmgr.h>
+#include <iphlpapi.h>
+#include <thread>
+#include <chrono>
+#include <cwchar>
+
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "oleaut32.lib")
+
+namespace
+{
+constexpr const wchar_t* RULE_GROUP = L"PeerBridge";
+constexpr const wchar_t* REMOTE_ADDRESSES = L"10.0.0.0/255.255.255.0,fd50:6272:6467::/64";
+// "File and Printer Sharing", by resource id so it matches on every display language
+constexpr const wchar_t* FILE_SHARING_GROUP = L"@FirewallAPI.dll,-28502";
+
+constexpr LONG ANY_PROTOCOL = NET_FW_IP_PROTOCOL_ANY;
+constexpr LONG ICMPV4_PROTOCOL = 1;
+constexpr LONG IGMP_PROTOCOL = 2;
+constexpr LONG ICMPV6_PROTOCOL = 58;
+
+struct RuleSpec
+{
+    const wchar_t* name;
+    NET_FW_RULE_DIRECTION direction;
+    LONG protocol;
+};
+
+constexpr RuleSpec RULES[] = {
+    {L"PeerBridge IN", NET_FW_RULE_DIR_IN, ANY_PROTOCOL},
+    {L"PeerBridge OUT", NET_FW_RULE_DIR_OUT, ANY_PROTOCOL},
+    {L"PeerBridge ICMP", NET_FW_RULE_DIR_IN, ICMPV4_PROTOCOL},
+    {L"PeerBridge ICMPv6", NET_FW_RULE_DIR_IN, ICMPV6_PROTOCOL},
+    {L"PeerBridge IGMP IN", NET_FW_RULE_DIR_IN, IGMP_PROTOCOL},
+    {L"PeerBridge IGMP OUT", NET_FW_RULE_DIR_OUT, IGMP_PROTOCOL},
+};
+
+// COM for the calling thread, for as long as the scope lives
+class ComScope
+{
+public:
+    ComScope()
+    {
+        HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        // Someone already set this thread up in another mode, COM is usable all the same
+        ok = SUCCEEDED(hr) || hr == RPC_E_CHANGED_MODE;
+        owned = SUCCEEDED(hr);
+    }
+    ~ComScope()
+    {
+        if (owned)
+            CoUninitialize();
+    }
+    ComScope(const ComScope&) = delete;
+    ComScope& operator=(const ComScope&) = delete;
+
+    bool ok;
+
+private:
+    bool owned;
+};
+
+// Released interface pointer
+template <typename T>
+class ComRef
+{
+public:
+    ComRef() = default;
+    ~ComRef() { reset(); }
+    ComRef(const ComRef&) = delete;
+    ComRef& operator=(const ComRef&) = delete;
+
+    T* operator->() const { return ptr; }
+    T* get() const { return ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    T** put()
+    {
+        reset();
+        return &ptr;
+    }
+    void** putVoid() { return reinterpret_cast<void**>(put()); }
+
+    void reset()
+    {
+        if (ptr)
+            ptr->Release();
+        ptr = nullptr;
+    }
+
+private:
+    T* ptr = nullptr;
+};
+
+// Freed BSTR
+class Bstr
+{
+public:
+    explicit Bstr(const wchar_t* text) : str(SysAllocString(text)) {}
+    ~Bstr() { SysFreeString(str); }
+    Bstr(const Bstr&) = delete;
+    Bstr& operator=(const Bstr&) = delete;
+
+    operator BSTR() const { return str; }
+
+private:
+    BSTR str;
+};
+
+bool openPolicy(ComRef<INetFwPolicy2>& policy, ComRef<INetFwRules>& rules)
+{
+    HRESULT hr = CoCreateInstance(__uuidof(NetFwPolicy2), nullptr, CLSCTX_INPROC_SERVER,
+        __uuidof(INetFwPolicy2), policy.putVoid());
+    if (FAILED(hr))
+    {
+        SYSTEM_LOG_ERROR("[Firewall] Failed to open the firewall policy. HRESULT: {:#x}", static_cast<uint32_t>(hr));
+        return false;
+    }
+    hr = policy->get_Rules(rules.put());
+    if (FAILED(hr))
+    {
+        SYSTEM_LOG_ERROR("[Firewall] Failed to list firewall rules. HRESULT: {:#x}", static_cast<uint32_t>(hr));
+        return false;
+    }
+    return true;
+}
+
+bool hasRule(INetFwRules* rules, const wchar_t* name)
+{
+    ComRef<INetFwRule> rule;
+    return SUCCEEDED(rules->Item(Bstr(name), rule.put()));
+}
+
+// Rules from an older install cover IPv4 only, they're widened in place
+void refreshRule(INetFwRules* rules, const wchar_t* name)
+{
+    ComRef<INetFwRule> rule;
+    if (FAILED(rules->Item(Bstr(name), rule.put())))
+        return;
+    BSTR current = nullptr;
+    if (SUCCEEDED(rule->get_RemoteAddresses(&current)) && current && wcscmp(current, REMOTE_ADDRESSES) != 0)
+        rule->put_RemoteAddresses(Bstr(REMOTE_ADDRESSES));
+    SysFreeString(current);
+}
+
+bool addRule(INetFwRules* rules, const RuleSpec& spec)
+{
+    ComRef<INetFwRule> rule;
+    HRESULT hr = CoCreateInstance(__uuidof(NetFwRule), nullptr, CLSCTX_INPROC_SERVER,
+        __uuidof(INetFwRule), rule.putVoid());
+    if (FAILED(hr))
+        return false;
+
+    rule->put_Name(Bstr(spec.name));
+    rule->put_Grouping(Bstr(RULE_GROUP));
+    rule->put_Direction(spec.direction);
+    rule->put_Action(NET_FW_ACTION_ALLOW);
+    rule->put_Protocol(spec.protocol);
+    rule->put_RemoteAddresses(Bstr(REMOTE_ADDRESSES));
+    rule->put_Profiles(NET_FW_PROFILE2_ALL);
+    rule->put_Enabled(VARIANT_TRUE);
+
+    hr = rules->Add(rule.get());
+    if (FAILED(hr))
+    {
+        SYSTEM_LOG_WARNING("[Firewall] Failed to add rule. HRESULT: {:#x}", static_cast<uint32_t>(hr));
+        return false;
+    }
+    return true;
+}
+}
+
+namespace firewall
+{
+bool ensureRules()
+{
+    ComScope com;
+    if (!com.ok)
+    {
+        SYSTEM_LOG_ERROR("[Firewall] Failed to initialize COM");
+        return false;
+    }
+
+    ComRef<INetFwPolicy2> policy;
+    ComRef<INetFwRules> rules;
+    if (!openPolicy(policy, rules))
+        return false;
+
+    bool success = true;
+    int added = 0;
+    for (const RuleSpec& spec : RULES)
+    {
+        if (hasRule(rules.get(), spec.name))
+        {
+            refreshRule(rules.get(), spec.name);
+            continue;
+        }
+        if (addRule(rules.get(), spec))
+            ++added;
+        else
+            success = false;
+    }
+    if (added)
+        SYSTEM_LOG_INFO("[Firewall] Added {} firewall rules", added);
+    if (!success)
+        SYSTEM_LOG_WARNING("[Firewall] Some firewall rules are missing. Connectivity may be limited.");
+
+    // Needed for some network discovery protocols, the adapter's network is Private so that's
+    // the only profile it's opened on
+    VARIANT_BOOL sharingEnabled = VARIANT_FALSE;
+    Bstr sharingGroup(FILE_SHARING_GROUP);
+    HRESULT hr = policy->IsRuleGroupEnabled(NET_FW_PROFILE2_PRIVATE, sharingGroup, &sharingEnabled);
+    if (SUCCEEDED(hr) && sharingEnabled != VARIANT_TRUE)
+        hr = policy->EnableRuleGroup(NET_FW_PROFILE2_PRIVATE, sharingGroup, VARIANT_TRUE);
+    if (FAILED(hr))
+        SYSTEM_LOG_WARNING("[Firewall] Failed to enable File and Printer Sharing. Network discovery may be limited.");
+
+    return success;
+}
+
+void removeRules()
+{
+    ComScope com;
+    if (!com.ok)
+        return;
+
+    ComRef<INetFwPolicy2> policy;
+    ComRef<INetFwRules> rules;
+    if (!openPolicy(policy, rules))
+        return;
+
+    for (const RuleSpec& spec : RULES)
+    {
+        if (hasRule(rules.get(), spec.name) && FAILED(rules->Remove(Bstr(spec.name))))
+            SYSTEM_LOG_WARNING("[Firewall] Failed to remove a firewall rule");
+    }
+    SYSTEM_LOG_INFO("[Firewall] Firewall rules removed");
+}
+
+bool setNetworkPrivate(const NET_LUID& luid, unsigned waitMs)
+{
+    GUID adapterGuid;
+    if (ConvertInterfaceLuidToGuid(&luid, &adapterGuid) != NO_ERROR)
+        return false;
+
+    ComScope com;
+    if (!com.ok)
+        return false;
+
+    ComRef<INetworkListManager> manager;
+    HRESULT hr = CoCreateInstance(CLSID_NetworkListManager, nullptr, CLSCTX_ALL,
+        IID_INetworkListManager, manager.putVoid());
+    if (FAILED(hr))
+        return false;
+
+    constexpr unsigned RETRY_MS = 250;
+    for (unsigned waited = 0;; waited += RETRY_MS)
+    {
+        ComRef<IEnumNetworkConnections> connections;
+        if (SUCCEEDED(manager->GetNetworkConnections(connections.put())))
+        {
+            ComRef<INetworkConnection> connection;
+            while (connections->Next(1, connection.put(), nullptr) == S_OK)
+            {
+                GUID connectionAdapter;
+                if (FAILED(connection->GetAdapterId(&connectionAdapter)) || connectionAdapter != adapterGuid)
+                    continue;
+
+                ComRef<INetwork> network;
+                if (FAILED(connection->GetNetwork(network.put())))
+                    break;
+
+                NLM_NETWORK_CATEGORY category;
+                if (SUCCEEDED(network->GetCategory(&category)) && category == NLM_NETWORK_CATEGORY_PRIVATE)
+                    return true;
+                return SUCCEEDED(network->SetCategory(NLM_NETWORK_CATEGORY_PRIVATE));
+            }
+        }
+
+        if (waited >= waitMs)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_MS));
+    }
+}
+}
@@ -0,0 +1,268 @@
+#include "GaloisField.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GF_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC / Clang need per-function target attributes to emit SSSE3 / AVX2 without global flags
+#if defined(GF_X86) && (defined(__GNUC__) || defined(__clang__))
+#define GF_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GF_TARGET(isa)
+#endif
+
+namespace
+{
+struct Tables
+{
+    std::array<uint8_t, 512> exp;
+    std::array<uint8_t, 256> log;
+    // Per coefficient: products with every low nibble, then every high nibble
+    alignas(32) uint8_t nibble[256][32];
+
+    Tables()
+    {
+        uint32_t x = 1;
+        for (int i = 0; i < 255; ++i)
+        {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100)
+                x ^= 0x11D;
+        }
+        for (int i = 255; i < 512; ++i)
+            exp[i] = exp[i - 255];
+        log[0] = 0;
+
+        for (int c = 0; c < 256; ++c)
+        {
+            for (int n = 0; n < 16; ++n)
+            {
+                nibble[c][n] = slowMul(static_cast<uint8_t>(c), static_cast<uint8_t>(n));
+                nibble[c][16 + n] = slowMul(static_cast<uint8_t>(c), static_cast<uint8_t>(n << 4));
+            }
+        }
+    }
+
+    uint8_t slowMul(uint8_t a, uint8_t b) const
+    {
+        if (!a || !b)
+            return 0;
+        return exp[log[a] + log[b]];
+    }
+};
+
+const Tables& tables()
+{
+    static const Tables instance;
+    return instance;
+}
+
+void mulAddScalar(uint8_t* dst, const uint8_t* src, const uint8_t* table, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        dst[i] ^= table[src[i] & 0x0F] ^ table[16 + (src[i] >> 4)];
+    }
+}
+
+void mulScalar(uint8_t* dst, const uint8_t* table, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        dst[i] = table[dst[i] & 0x0F] ^ table[16 + (dst[i] >> 4)];
+    }
+}
+
+#ifdef GF_X86
+GF_TARGET("ssse3")
+void mulAddSsse3(uint8_t* dst, const uint8_t* src, const uint8_t* table, size_t length)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(in, mask));
+        __m128i hi = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(out, _mm_xor_si128(lo, hi)));
+    }
+    mulAddScalar(dst + i, src + i, table, length - i);
+}
+
+GF_TARGET("ssse3")
+void mulSsse3(uint8_t* dst, const uint8_t* table, size_t length)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(in, mask));
+        __m128i hi = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(lo, hi));
+    }
+    mulScalar(dst + i, table, length - i);
+}
+
+GF_TARGET("avx2")
+void mulAddAvx2(uint8_t* dst, const uint8_t* src, const uint8_t* table, size_t length)
+{
+    // vpshufb looks up within each 128-bit lane, so both lanes get the same table
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16)));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(in, mask));
+        __m256i hi = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask));
+        __m256i out = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(out, _mm256_xor_si256(lo, hi)));
+    }
+    mulAddSsse3(dst + i, src + i, table, length - i);
+}
+
+GF_TARGET("avx2")
+void mulAvx2(uint8_t* dst, const uint8_t* table, size_t length)
+{
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16)));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(in, mask));
+        __m256i hi = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(lo, hi));
+    }
+    mulSsse3(dst + i, table, length - i);
+}
+#endif
+
+enum class Kernel { SCALAR, SSSE3, AVX2 };
+
+Kernel detectKernel()
+{
+#ifdef GF_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool ssse3 = (info[2] & (1 << 9)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool ssse3 = __builtin_cpu_supports("ssse3");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+        return Kernel::AVX2;
+    if (ssse3)
+        return Kernel::SSSE3;
+#endif
+    return Kernel::SCALAR;
+}
+
+Kernel kernel()
+{
+    static const Kernel selected = detectKernel();
+    return selected;
+}
+}
+
+namespace gf
+{
+uint8_t mul(uint8_t a, uint8_t b)
+{
+    return tables().slowMul(a, b);
+}
+
+uint8_t inv(uint8_t a)
+{
+    const Tables& t = tables();
+    return t.exp[255 - t.log[a]];
+}
+
+void mulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length)
+{
+    if (c == 0)
+        return;
+
+    const uint8_t* table = tables().nibble[c];
+    switch (kernel())
+    {
+#ifdef GF_X86
+        case Kernel::AVX2:
+            mulAddAvx2(dst, src, table, length);
+            return;
+        case Kernel::SSSE3:
+            mulAddSsse3(dst, src, table, length);
+            return;
+#endif
+        default:
+            mulAddScalar(dst, src, table, length);
+            return;
+    }
+}
+
+void mulRegion(uint8_t* dst, uint8_t c, size_t length)
+{
+    if (c == 0)
+    {
+        std::memset(dst, 0, length);
+        return;
+    }
+
+    const uint8_t* table = tables().nibble[c];
+    switch (kernel())
+    {
+#ifdef GF_X86
+        case Kernel::AVX2:
+            mulAvx2(dst, table, length);
+            return;
+        case Kernel::SSSE3:
+            mulSsse3(dst, table, length);
+            return;
+#endif
+        default:
+            mulScalar(dst, table, length);
+            return;
+    }
+}
+
+const char* kernelName()
+{
+    switch (kernel())
+    {
+        case Kernel::AVX2: return "avx2";
+        case Kernel::SSSE3: return "ssse3";
+        default: return "scalar";
+    }
+}
+}
@@ -0,0 +1,343 @@
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+namespace metrics
+{
+namespace
+{
+constexpr std::array<Descriptor, COUNTERS> COUNTER_DESCRIPTORS{{
+    {"peerbridge_udp_packets_total", "direction=\"tx\"", "Datagrams through the socket"},
+    {"peerbridge_udp_packets_total", "direction=\"rx\"", "Datagrams through the socket"},
+    {"peerbridge_udp_bytes_total", "direction=\"tx\"", "UDP payload bytes through the socket"},
+    {"peerbridge_udp_bytes_total", "direction=\"rx\"", "UDP payload bytes through the socket"},
+    {"peerbridge_tun_packets_total", "direction=\"rx\"", "IP packets through the adapter, rx read from it and tx written to it"},
+    {"peerbridge_tun_packets_total", "direction=\"tx\"", "IP packets through the adapter, rx read from it and tx written to it"},
+    {"peerbridge_tun_bytes_total", "direction=\"rx\"", "IP bytes through the adapter, rx read from it and tx written to it"},
+    {"peerbridge_tun_bytes_total", "direction=\"tx\"", "IP bytes through the adapter, rx read from it and tx written to it"},
+    {"peerbridge_heartbeats_received_total", "", "Heartbeats received from peers"},
+    {"peerbridge_retransmits_total", "", "Reliable channel retransmits"},
+    {"peerbridge_fec_recovered_total", "", "Packets rebuilt from parity"},
+    {"peerbridge_drops_total", "reason=\"unknown_sender\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"malformed\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"unencrypted\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"no_keys\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"decrypt\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"replay\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"pool_exhausted\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"send_buffer\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"send_error\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"no_route\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"tun_queue\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"tun_adapter\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"no_subscriber\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"duplicate_beacon\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"parity_oversize\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"queue_full\",class=\"control\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"queue_full\",class=\"interactive\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"queue_full\",class=\"standard\"", "Packets dropped, by reason"},
+    {"peerbridge_drops_total", "reason=\"queue_full\",class=\"bulk\"", "Packets dropped, by reason"},
+}};
+
+constexpr std::array<Descriptor, GAUGES> GAUGE_DESCRIPTORS{{
+    {"peerbridge_pacer_queued_packets", "class=\"control\"", "Packets waiting in the pacers"},
+    {"peerbridge_pacer_queued_packets", "class=\"interactive\"", "Packets waiting in the pacers"},
+    {"peerbridge_pacer_queued_packets", "class=\"standard\"", "Packets waiting in the pacers"},
+    {"peerbridge_pacer_queued_packets", "class=\"bulk\"", "Packets waiting in the pacers"},
+}};
+
+constexpr std::array<Descriptor, HISTOGRAMS> HISTOGRAM_DESCRIPTORS{{
+    {"peerbridge_ack_rtt_microseconds", "", "Round trip time measured from ACK frames"},
+    {"peerbridge_pacer_wait_microseconds", "", "Time packets waited in their pacer"},
+    {"peerbridge_tun_read_batch_packets", "", "Packets per adapter read"},
+    {"peerbridge_udp_send_batch_datagrams", "", "Datagrams per batched socket send"},
+}};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<ThreadBlock*> live;
+    std::vector<ThreadBlock*> spare;
+    // What exited threads recorded
+    Snapshot retired;
+    std::map<uint32_t, std::pair<Descriptor, Sampler>> samplers;
+    uint32_t nextSampler = 1;
+};
+
+// Never destroyed, threads may still detach during static destruction
+Registry& registry()
+{
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+void accumulate(const ThreadBlock& block, Snapshot& into)
+{
+    for (size_t i = 0; i < COUNTERS; ++i)
+        into.counters[i] += block.counters[i].load(std::memory_order_relaxed);
+    for (size_t i = 0; i < GAUGES; ++i)
+        into.gauges[i] += block.gauges[i].load(std::memory_order_relaxed);
+    for (size_t h = 0; h < HISTOGRAMS; ++h)
+    {
+        const ThreadBlock::HistogramCells& cells = block.histograms[h];
+        HistogramSnapshot& out = into.histograms[h];
+        for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+            out.buckets[b] += cells.buckets[b].load(std::memory_order_relaxed);
+        out.count += cells.count.load(std::memory_order_relaxed);
+        out.sum += cells.sum.load(std::memory_order_relaxed);
+        out.max = std::max(out.max, cells.max.load(std::memory_order_relaxed));
+    }
+}
+
+// Folds the block into the totals when its thread exits
+struct Detacher
+{
+    ThreadBlock* block = nullptr;
+
+    ~Detacher()
+    {
+        if (!block)
+            return;
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        accumulate(*block, r.retired);
+        block->reset();
+        r.live.erase(std::remove(r.live.begin(), r.live.end(), block), r.live.end());
+        r.spare.push_back(block);
+    }
+};
+
+std::string seriesName(const Descriptor& descriptor, const char* suffix, const std::string& extraLabel = {})
+{
+    std::string name = descriptor.name;
+    name += suffix;
+    std::string labels = descriptor.labels;
+    if (!extraLabel.empty())
+        labels += labels.empty() ? extraLabel : "," + extraLabel;
+    if (!labels.empty())
+        name += "{" + labels + "}";
+    return name;
+}
+
+std::string formatNumber(double value)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return buffer;
+}
+}
+
+uint64_t bucketFloor(size_t bucket)
+{
+    if (bucket < LINEAR_BUCKETS)
+        return bucket;
+    size_t exponent = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS + 4;
+    uint64_t sub = (bucket - LINEAR_BUCKETS) % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - 3);
+}
+
+ThreadBlock::ThreadBlock()
+{
+    reset();
+}
+
+void ThreadBlock::reset()
+{
+    for (std::atomic<uint64_t>& counter : counters)
+        counter.store(0, std::memory_order_relaxed);
+    for (std::atomic<int64_t>& gauge : gauges)
+        gauge.store(0, std::memory_order_relaxed);
+    for (HistogramCells& cells : histograms)
+    {
+        for (std::atomic<uint64_t>& bucket : cells.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        cells.count.store(0, std::memory_order_relaxed);
+        cells.sum.store(0, std::memory_order_relaxed);
+        cells.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+ThreadBlock& attach()
+{
+    thread_local Detacher detacher;
+
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    ThreadBlock* block;
+    if (!r.spare.empty())
+    {
+        block = r.spare.back();
+        r.spare.pop_back();
+    }
+    else
+    {
+        block = new ThreadBlock();
+    }
+    r.live.push_back(block);
+    detacher.block = block;
+    return *block;
+}
+
+const Descriptor& describe(Counter counter)
+{
+    return COUNTER_DESCRIPTORS[static_cast<size_t>(counter)];
+}
+
+const Descriptor& describe(Gauge gauge)
+{
+    return GAUGE_DESCRIPTORS[static_cast<size_t>(gauge)];
+}
+
+const Descriptor& describe(Histogram histogram)
+{
+    return HISTOGRAM_DESCRIPTORS[static_cast<size_t>(histogram)];
+}
+
+uint32_t addSampler(Descriptor descriptor, Sampler sampler)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    uint32_t id = r.nextSampler++;
+    r.samplers.emplace(id, std::make_pair(descriptor, std::move(sampler)));
+    return id;
+}
+
+void removeSampler(uint32_t id)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.samplers.erase(id);
+}
+
+uint64_t HistogramSnapshot::percentile(double quantile) const
+{
+    if (!count)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+    {
+        seen += buckets[b];
+        if (seen > rank)
+            return std::min(max, b + 1 < HISTOGRAM_BUCKETS ? bucketFloor(b + 1) - 1 : max);
+    }
+    return max;
+}
+
+Snapshot snapshot()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    Snapshot result = r.retired;
+    for (const ThreadBlock* block : r.live)
+        accumulate(*block, result);
+    for (auto& [id, sampler] : r.samplers)
+        result.sampled.emplace_back(sampler.first, sampler.second());
+    return result;
+}
+
+std::vector<std::string> formatText(const Snapshot& snapshot)
+{
+    auto counter = [&snapshot](Counter c) { return snapshot.counters[static_cast<size_t>(c)]; };
+    auto gauge = [&snapshot](Gauge g) { return snapshot.gauges[static_cast<size_t>(g)]; };
+
+    std::vector<std::string> lines;
+    char line[256];
+    std::snprintf(line, sizeof(line), "  UDP  tx %" PRIu64 " packets / %" PRIu64 " bytes, rx %" PRIu64 " packets / %" PRIu64 " bytes",
+        counter(Counter::UDP_TX_PACKETS), counter(Counter::UDP_TX_BYTES),
+        counter(Counter::UDP_RX_PACKETS), counter(Counter::UDP_RX_BYTES));
+    lines.emplace_back(line);
+    std::snprintf(line, sizeof(line), "  TUN  rx %" PRIu64 " packets / %" PRIu64 " bytes, tx %" PRIu64 " packets / %" PRIu64 " bytes",
+        counter(Counter::TUN_RX_PACKETS), counter(Counter::TUN_RX_BYTES),
+        counter(Counter::TUN_TX_PACKETS), counter(Counter::TUN_TX_BYTES));
+    lines.emplace_back(line);
+    std::snprintf(line, sizeof(line), "  Heartbeats %" PRIu64 ", retransmits %" PRIu64 ", FEC recovered %" PRIu64,
+        counter(Counter::HEARTBEATS_RX),
+        counter(Counter::RETRANSMITS), counter(Counter::FEC_RECOVERED));
+    lines.emplace_back(line);
+    std::snprintf(line, sizeof(line), "  Pacer queues: control %" PRId64 ", interactive %" PRId64 ", standard %" PRId64 ", bulk %" PRId64,
+        gauge(Gauge::QUEUED_CONTROL), gauge(Gauge::QUEUED_INTERACTIVE),
+        gauge(Gauge::QUEUED_STANDARD), gauge(Gauge::QUEUED_BULK));
+    lines.emplace_back(line);
+
+    // Only the reasons that happened
+    std::string drops = "  Drops:";
+    for (size_t i = static_cast<size_t>(Counter::DROP_UNKNOWN_SENDER); i < COUNTERS; ++i)
+    {
+        if (!snapshot.counters[i])
+            continue;
+        drops += " " + std::string(COUNTER_DESCRIPTORS[i].labels) + "=" + std::to_string(snapshot.counters[i]);
+    }
+    lines.emplace_back(drops.size() > 8 ? drops : drops + " none");
+
+    for (size_t h = 0; h < HISTOGRAMS; ++h)
+    {
+        const HistogramSnapshot& histogram = snapshot.histograms[h];
+        if (!histogram.count)
+            continue;
+        std::snprintf(line, sizeof(line), "  %s: n=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64 " p90=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64,
+            HISTOGRAM_DESCRIPTORS[h].name, histogram.count, histogram.sum / histogram.count,
+            histogram.percentile(0.5), histogram.percentile(0.9), histogram.percentile(0.99), histogram.max);
+        lines.emplace_back(line);
+    }
+
+    for (const auto& [descriptor, value] : snapshot.sampled)
+        lines.emplace_back("  " + seriesName(descriptor, "") + " " + formatNumber(value));
+    return lines;
+}
+
+std::string formatPrometheus(const Snapshot& snapshot)
+{
+    std::string out;
+    const char* lastFamily = "";
+    auto family = [&out, &lastFamily](const Descriptor& descriptor, const char* type)
+    {
+        // Series of one family are listed together, HELP / TYPE once
+        if (std::string(lastFamily) == descriptor.name)
+            return;
+        lastFamily = descriptor.name;
+        out += "# HELP " + std::string(descriptor.name) + " " + descriptor.help + "\n";
+        out += "# TYPE " + std::string(descriptor.name) + " " + type + "\n";
+    };
+
+    for (size_t i = 0; i < COUNTERS; ++i)
+    {
+        family(COUNTER_DESCRIPTORS[i], "counter");
+        out += seriesName(COUNTER_DESCRIPTORS[i], "") + " " + std::to_string(snapshot.counters[i]) + "\n";
+    }
+    for (size_t i = 0; i < GAUGES; ++i)
+    {
+        family(GAUGE_DESCRIPTORS[i], "gauge");
+        out += seriesName(GAUGE_DESCRIPTORS[i], "") + " " + std::to_string(snapshot.gauges[i]) + "\n";
+    }
+    for (const auto& [descriptor, value] : snapshot.sampled)
+    {
+        family(descriptor, "gauge");
+        out += seriesName(descriptor, "") + " " + formatNumber(value) + "\n";
+    }
+
+    // Cumulative buckets, only at bucket edges that hold samples to keep the page short
+    for (size_t h = 0; h < HISTOGRAMS; ++h)
+    {
+        const Descriptor& descriptor = HISTOGRAM_DESCRIPTORS[h];
+        const HistogramSnapshot& histogram = snapshot.histograms[h];
+        family(descriptor, "histogram");
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+        {
+            if (!histogram.buckets[b])
+                continue;
+            cumulative += histogram.buckets[b];
+            std::string le = "le=\"" + std::to_string(b + 1 < HISTOGRAM_BUCKETS ? bucketFloor(b + 1) - 1 : histogram.max) + "\"";
+            out += seriesName(descriptor, "_bucket", le) + " " + std::to_string(cumulative) + "\n";
+        }
+        out += seriesName(descriptor, "_bucket", "le=\"+Inf\"") + " " + std::to_string(histogram.count) + "\n";
+        out += seriesName(descriptor, "_sum") + " " + std::to_string(histogram.sum) + "\n";
+        out += seriesName(descriptor, "_count") + " " + std::to_string(histogram.count) + "\n";
+    }
+    return out;
+}
+}
@@ -0,0 +1,159 @@
+#include "MetricsServer.hpp"
+#include "Metrics.hpp"
+#include "Logger.hpp"
+
+namespace
+{
+// A request line and a few headers, anything bigger is not a scraper
+constexpr size_t MAX_REQUEST = 8192;
+// Whole exchange, a client that connects and sends nothing is closed after this
+constexpr std::chrono::seconds REQUEST_DEADLINE{5};
+}
+
+struct MetricsServer::Connection
+{
+    explicit Connection(boost::asio::io_context& context) : socket(context), deadline(context) {}
+
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::steady_timer deadline;
+    boost::asio::streambuf request{MAX_REQUEST};
+    std::string response;
+};
+
+MetricsServer::MetricsServer()
+    : acceptor(ioContext)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(uint16_t port)
+{
+    if (running)
+        return true;
+
+    try
+    {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+        acceptor.open(endpoint.protocol());
+#ifdef _WIN32
+        // SO_REUSEADDR on Windows lets another process bind over us, keep the port to ourselves
+        BOOL exclusive = TRUE;
+        if (setsockopt(acceptor.native_handle(), SOL_SOCKET, SO_EXCLUSIVEADDRUSE,
+                reinterpret_cast<const char*>(&exclusive), sizeof(exclusive)) != 0)
+        {
+            throw boost::system::system_error(WSAGetLastError(), boost::system::system_category());
+        }
+#else
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#endif
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+    catch (const std::exception& e)
+    {
+        SYSTEM_LOG_ERROR("[System] Metrics endpoint could not listen on port {}: {}", port, e.what());
+        boost::system::error_code ignored;
+        acceptor.close(ignored);
+        return false;
+    }
+
+    running = true;
+    ioContext.restart();
+    startAccept();
+    thread = std::thread([this]() { ioContext.run(); });
+    SYSTEM_LOG_INFO("[System] Metrics at http://127.0.0.1:{}/metrics", port);
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    ioContext.stop();
+    if (thread.joinable())
+        thread.join();
+    // Nothing runs on the context anymore
+    boost::system::error_code ignored;
+    acceptor.close(ignored);
+}
+
+void MetricsServer::startAccept()
+{
+    auto connection = std::make_shared<Connection>(ioContext);
+    acceptor.async_accept(connection->socket, [this, connection](const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            if (error != boost::asio::error::operation_aborted)
+                SYSTEM_LOG_WARNING("[System] Metrics endpoint accept failed: {}", error.message());
+            if (!running || !acceptor.is_open())
+                return;
+        }
+        else
+        {
+            handleRequest(connection);
+        }
+        startAccept();
+    });
+}
+
+void MetricsServer::handleRequest(const std::shared_ptr<Connection>& connection)
+{
+    // Closing the socket fails whatever read or write is still pending
+    connection->deadline.expires_after(REQUEST_DEADLINE);
+    connection->deadline.async_wait([connection](const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        boost::system::error_code ignored;
+        connection->socket.close(ignored);
+    });
+
+    boost::asio::async_read_until(connection->socket, connection->request, "\r\n\r\n",
+        [connection](const boost::system::error_code& error, std::size_t)
+        {
+            if (error)
+            {
+                connection->deadline.cancel();
+                return;
+            }
+
+            std::istream stream(&connection->request);
+            std::string method, target;
+            stream >> method >> target;
+
+            std::string status = "200 OK";
+            std::string body;
+            if (method != "GET")
+            {
+                status = "405 Method Not Allowed";
+            }
+            else if (target == "/metrics")
+            {
+                body = metrics::formatPrometheus(metrics::snapshot());
+            }
+            else
+            {
+                status = "404 Not Found";
+            }
+
+            connection->response =
+                "HTTP/1.1 " + status + "\r\n"
+                "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+
+            boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+                [connection](const boost::system::error_code&, std::size_t)
+                {
+                    connection->deadline.cancel();
+                    boost::system::error_code ignored;
+                    connection->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                });
+        });
+}
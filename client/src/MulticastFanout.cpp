@@ -0,0 +1,192 @@
+#include "MulticastFanout.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace
+{
+// IGMP message types, RFC 2236 / 3376
+constexpr uint8_t IGMP_V1_REPORT = 0x12;
+constexpr uint8_t IGMP_V2_REPORT = 0x16;
+constexpr uint8_t IGMP_V2_LEAVE = 0x17;
+constexpr uint8_t IGMP_V3_REPORT = 0x22;
+// IGMPv3 group record types
+constexpr uint8_t MODE_IS_INCLUDE = 1;
+constexpr uint8_t MODE_IS_EXCLUDE = 2;
+constexpr uint8_t CHANGE_TO_INCLUDE = 3;
+constexpr uint8_t CHANGE_TO_EXCLUDE = 4;
+constexpr uint8_t ALLOW_NEW_SOURCES = 5;
+
+uint32_t read32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+}
+
+void MulticastFanout::observe(size_t peer, const PacketBuffer& packet)
+{
+    if (packet.size() < 20 || (packet[0] >> 4) != 4 || packet[9] != IGMP_PROTOCOL)
+        return;
+    size_t offset = (packet[0] & 0x0F) * 4;
+    if (offset < 20 || offset + 8 > packet.size())
+        return;
+    const uint8_t* igmp = packet.data() + offset;
+    const uint8_t* end = packet.data() + packet.size();
+
+    switch (igmp[0])
+    {
+        case IGMP_V1_REPORT:
+        case IGMP_V2_REPORT:
+            join(peer, read32(igmp + 4));
+            break;
+
+        case IGMP_V2_LEAVE:
+            leave(peer, read32(igmp + 4));
+            break;
+
+        case IGMP_V3_REPORT:
+        {
+            // [type][reserved][checksum16][reserved16][records16], then the records
+            size_t records = (igmp[6] << 8) | igmp[7];
+            const uint8_t* record = igmp + 8;
+            for (size_t i = 0; i < records && record + 8 <= end; ++i)
+            {
+                uint8_t recordType = record[0];
+                size_t sources = (record[2] << 8) | record[3];
+                uint32_t group = read32(record + 4);
+
+                // Excluding nothing or including something is a member, including nothing has left
+                if (recordType == MODE_IS_EXCLUDE || recordType == CHANGE_TO_EXCLUDE ||
+                    (sources > 0 && (recordType == MODE_IS_INCLUDE || recordType == CHANGE_TO_INCLUDE ||
+                                     recordType == ALLOW_NEW_SOURCES)))
+                {
+                    join(peer, group);
+                }
+                else if (sources == 0 && (recordType == MODE_IS_INCLUDE || recordType == CHANGE_TO_INCLUDE))
+                {
+                    leave(peer, group);
+                }
+                // Auxiliary data is counted in 32-bit words
+                record += 8 + sources * 4 + record[1] * 4;
+            }
+            break;
+        }
+
+        default:
+            // Queries, only a querier sends them
+            break;
+    }
+}
+
+void MulticastFanout::join(size_t peer, uint32_t group)
+{
+    std::lock_guard<std::mutex> lock(membershipMutex);
+    reportingPeers |= PeerMask(1) << peer;
+    PeerMask& members = groups[group];
+    if (!(members & (PeerMask(1) << peer)))
+        NETWORK_LOG_DEBUG("[Multicast] Peer {} joined {}.{}.{}.{}", peer, group >> 24, (group >> 16) & 0xFF, (group >> 8) & 0xFF, group & 0xFF);
+    members |= PeerMask(1) << peer;
+}
+
+void MulticastFanout::leave(size_t peer, uint32_t group)
+{
+    std::lock_guard<std::mutex> lock(membershipMutex);
+    reportingPeers |= PeerMask(1) << peer;
+    auto it = groups.find(group);
+    if (it == groups.end())
+        return;
+    it->second &= ~(PeerMask(1) << peer);
+    if (!it->second)
+        groups.erase(it);
+    NETWORK_LOG_DEBUG("[Multicast] Peer {} left {}.{}.{}.{}", peer, group >> 24, (group >> 16) & 0xFF, (group >> 8) & 0xFF, group & 0xFF);
+}
+
+void MulticastFanout::forgetPeer(size_t peer)
+{
+    std::lock_guard<std::mutex> lock(membershipMutex);
+    PeerMask bit = PeerMask(1) << peer;
+    reportingPeers &= ~bit;
+    for (auto it = groups.begin(); it != groups.end();)
+    {
+        it->second &= ~bit;
+        if (!it->second)
+            it = groups.erase(it);
+        else
+            ++it;
+    }
+}
+
+void MulticastFanout::clear()
+{
+    std::lock_guard<std::mutex> lock(membershipMutex);
+    groups.clear();
+    reportingPeers = 0;
+}
+
+MulticastFanout::PeerMask MulticastFanout::targets(const PacketBuffer& packet, PeerMask routed, Clock::time_point now)
+{
+    bool ipv4 = (packet[0] >> 4) == 4;
+    // Membership reports must reach everyone, whatever group they are addressed to
+    if (ipv4 && packet[9] == IGMP_PROTOCOL)
+        return routed;
+
+    PeerMask candidates = routed;
+    uint32_t dstIp = ipv4 ? read32(packet.data() + 16) : 0;
+    bool multicast = ipv4 && (dstIp & 0xF0000000) == 0xE0000000;
+    if (multicast && (dstIp & LINK_LOCAL_NETMASK) != LINK_LOCAL_NETWORK)
+    {
+        std::lock_guard<std::mutex> lock(membershipMutex);
+        auto it = groups.find(dstIp);
+        PeerMask members = it == groups.end() ? 0 : it->second;
+        candidates &= members | ~reportingPeers;
+        if (!candidates)
+        {
+            metrics::add(metrics::Counter::DROP_NO_SUBSCRIBER);
+            return 0;
+        }
+    }
+
+    if (candidates && duplicate(packet, now))
+    {
+        metrics::add(metrics::Counter::DROP_DUPLICATE_BEACON);
+        return 0;
+    }
+    return candidates;
+}
+
+bool MulticastFanout::duplicate(const PacketBuffer& packet, Clock::time_point now)
+{
+    std::chrono::microseconds window(duplicateWindowMicros.load(std::memory_order_relaxed));
+    if (window.count() <= 0)
+        return false;
+
+    // FNV-1a over the destination, protocol and everything past the IP header; the IPv4 id and
+    // checksum differ between otherwise identical beacons, as does the IPv6 flow label.
+    // IPv6 extension headers are hashed as payload, they repeat along with it.
+    bool ipv4 = (packet[0] >> 4) == 4;
+    size_t offset = ipv4 ? (packet[0] & 0x0F) * 4 : IPV6_HEADER_SIZE;
+    if ((ipv4 && offset < 20) || offset > packet.size())
+        return false;
+    const uint8_t* dst = packet.data() + (ipv4 ? 16 : 24);
+    size_t dstSize = ipv4 ? 4 : 16;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto mix = [&hash](uint8_t byte)
+    {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    };
+    for (size_t i = 0; i < dstSize; ++i)
+        mix(dst[i]);
+    mix(ipv4 ? packet[9] : packet[6]);
+    for (size_t i = offset; i < packet.size(); ++i)
+        mix(packet[i]);
+
+    for (const Beacon& beacon : recent)
+    {
+        // Not refreshed on a hit, a beacon faster than the window still goes out once per window
+        if (beacon.hash == hash && now - beacon.sentAt < window)
+            return true;
+    }
+    recent[nextBeacon] = Beacon{hash, now};
+    nextBeacon = (nextBeacon + 1) % RECENT_BEACONS;
+    return false;
+}
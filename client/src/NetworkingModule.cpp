@@ -1,30 +1,180 @@
 #include "NetworkingModule.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
+#include "GaloisField.hpp"
 #include <iostream>
 #include <chrono>
 #include <random>
 #include <cstring>
+#include <algorithm>
 #include <boost/asio/ip/address_v6.hpp>
+#include <sodium/randombytes.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#include <netioapi.h>
+#elif defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+namespace
+{
+uint32_t readSessionId(const uint8_t* p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+void writeSessionId(uint8_t* p, uint32_t id)
+{
+    p[0] = (id >> 24) & 0xFF;
+    p[1] = (id >> 16) & 0xFF;
+    p[2] = (id >> 8) & 0xFF;
+    p[3] = id & 0xFF;
+}
+
+#ifdef _WIN32
+void NETIOAPI_API_ onInterfaceChange(PVOID context, PMIB_IPINTERFACE_ROW, MIB_NOTIFICATION_TYPE)
+{
+    static_cast<UDPNetwork*>(context)->notifyNetworkChange();
+}
+#endif
+}
 
 UDPNetwork::UDPNetwork(
     std::unique_ptr<boost::asio::ip::udp::socket> socket,
     boost::asio::io_context& context,
-    std::shared_ptr<SystemStateManager> state_manager) 
+    std::shared_ptr<SystemStateManager> state_manager,
+    std::shared_ptr<PacketPool> packet_pool,
+    UdpBackend udp_backend,
+    size_t workers) 
     : running(false)
     , localPort(0)
-    , nextSeqNumber(0)
     , socket(std::move(socket))
     , ioContext(context)
-    , stateManager(state_manager)
+    , shards(makeShards(workers))
     , keepAliveTimer(ioContext)
+    , disconnectTimer(ioContext)
+    , disconnectRoundsLeft(0)
+    , networkChangeTimer(ioContext)
+    , packetPool(std::move(packet_pool))
+    , receiveOverflow(std::make_unique<uint8_t[]>(MAX_PACKET_SIZE))
+    , receivedBatch(UDPBatchIO::MAX_BATCH)
+    , backend(udp_backend)
+    , peers(ioContext, shardContexts())
+    , compressionEnabled(false)
+    , aggregationDeadlineMicros(0)
+    , congestionMode(CongestionMode::BBR)
+    , pacerHandBack(false)
+    , fecAdaptive(false)
+    , encryptionRequired(true)
+    , stateManager(state_manager)
 {
+    if (this->socket)
+    {
+        batchIO = std::make_unique<UDPBatchIO>(*this->socket, packetPool);
+    }
+    outgoingBatch.reserve(UDPBatchIO::MAX_BATCH * 2); // Room for the parity of the batch
+    parityBatch.reserve(fec::MAX_PARITY * 4);
+
+    peersSampler = metrics::addSampler(
+        {"peerbridge_peers_connected", "", "Peers with a live session"},
+        [this]() { return static_cast<double>(peers.connectedCount()); });
 }
 
 UDPNetwork::~UDPNetwork()
 {
+    metrics::removeSampler(peersSampler);
     shutdown();
 }
 
+size_t UDPNetwork::defaultWorkers()
+{
+    size_t cores = std::thread::hardware_concurrency();
+    return std::clamp<size_t>(cores / 2, 1, 4);
+}
+
+std::vector<std::unique_ptr<UDPNetwork::Shard>> UDPNetwork::makeShards(size_t workers)
+{
+    workers = std::clamp<size_t>(workers, 1, MAX_WORKERS);
+    std::vector<std::unique_ptr<Shard>> created;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        created.push_back(std::make_unique<Shard>(i));
+        created.back()->inbox.reserve(UDPBatchIO::MAX_BATCH * MAX_RECEIVE_ROUNDS);
+        created.back()->processing.reserve(UDPBatchIO::MAX_BATCH * MAX_RECEIVE_ROUNDS);
+    }
+    return created;
+}
+
+std::vector<boost::asio::io_context*> UDPNetwork::shardContexts() const
+{
+    std::vector<boost::asio::io_context*> contexts;
+    for (const std::unique_ptr<Shard>& shard : shards)
+        contexts.push_back(&shard->context);
+    return contexts;
+}
+
+size_t UDPNetwork::workerCount() const
+{
+    return shards.size();
+}
+
+void UDPNetwork::startWorkers()
+{
+    size_t cores = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    for (std::unique_ptr<Shard>& owned : shards)
+    {
+        Shard& shard = *owned;
+        if (shard.thread.joinable())
+            continue;
+
+        if (shard.context.stopped())
+            shard.context.restart();
+        shard.work.emplace(shard.context.get_executor());
+
+        // Core 0 is left to the socket and TUN threads where there is more than one
+        size_t core = cores > 1 ? 1 + shard.index % (cores - 1) : 0;
+        shard.thread = std::thread([this, &shard, core]()
+        {
+            #ifdef _WIN32
+            SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+            SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core);
+            #endif
+            try
+            {
+                NETWORK_LOG_INFO("[Network] Worker {} started on core {}", shard.index, core);
+                shard.context.run();
+            }
+            catch (const std::exception& e)
+            {
+                NETWORK_LOG_ERROR("[Network] Worker {} error: {}", shard.index, e.what());
+            }
+            NETWORK_LOG_INFO("[Network] Worker {} finished running", shard.index);
+        });
+    }
+}
+
+void UDPNetwork::stopWorkers()
+{
+    for (std::unique_ptr<Shard>& shard : shards)
+    {
+        shard->work.reset();
+        shard->context.stop();
+    }
+    for (std::unique_ptr<Shard>& shard : shards)
+    {
+        if (shard->thread.joinable())
+            shard->thread.join();
+
+        std::lock_guard<std::mutex> lock(shard->inboxMutex);
+        shard->inbox.clear();
+    }
+}
+
 bool UDPNetwork::startListening(int port)
 {
     try
@@ -34,10 +184,29 @@ bool UDPNetwork::startListening(int port)
             NETWORK_LOG_INFO("[Network] IO context is stopped, restarting...");
             ioContext.restart();
         }
+        // Move the socket onto registered I/O before anything else touches its options
+        if (backend == UdpBackend::RIO && !rio)
+        {
+            rio = std::make_unique<RIOTransport>(ioContext, packetPool);
+            if (rio->open(*socket))
+            {
+                SYSTEM_LOG_INFO("[Network] Using registered I/O for UDP");
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("[Network] Registered I/O unavailable, falling back to Asio");
+                rio.reset();
+            }
+        }
+
         // Get local endpoint information
         boost::asio::ip::udp::endpoint local_endpoint = socket->local_endpoint();
         localAddress = local_endpoint.address().to_string();
         localPort = local_endpoint.port();
+        boost::asio::ip::v6_only v6Only(true);
+        if (local_endpoint.address().is_v6())
+            socket->get_option(v6Only);
+        dualStack = !v6Only.value();
         
         // Increase socket buffer sizes for high-throughput scenarios
         boost::asio::socket_base::send_buffer_size sendBufferOption(4 * 1024 * 1024); // 4MB
@@ -45,14 +214,45 @@ bool UDPNetwork::startListening(int port)
         socket->set_option(sendBufferOption);
         socket->set_option(recvBufferOption);
 
+        // Oversized datagrams fail instead of fragmenting, path MTU discovery keeps us below that
+        if (!setDontFragment())
+            NETWORK_LOG_WARNING("[Network] Could not set DF on the socket, path MTU probes may be fragmented");
+
+        // See what batching the platform offers on this socket
+        if (batchIO)
+        {
+            UDPBatchIO::Capabilities caps = batchIO->probe();
+            NETWORK_LOG_INFO("[Network] Batched I/O: send {}, segmentation offload {}, receive {}",
+                caps.multiSend, caps.segmentOffload, caps.multiReceive);
+        }
+        NETWORK_LOG_INFO("[Network] FEC kernel: {}", gf::kernelName());
+
         // Set running flag to true
         running = true;
 
         // Start async receiving
-        NETWORK_LOG_INFO("[Network] Starting async receive");
-        startAsyncReceive();
-        NETWORK_LOG_INFO("[Network] Async receive started");
+        if (rio)
+        {
+            NETWORK_LOG_INFO("[Network] Starting registered I/O receive");
+            rio->start([this](PacketBuffer packet, const boost::asio::ip::udp::endpoint& sender)
+            {
+                this->processReceivedData(std::move(packet), sender);
+            });
+        }
+        else
+        {
+            NETWORK_LOG_INFO("[Network] Starting async receive");
+            startAsyncReceive();
+            NETWORK_LOG_INFO("[Network] Async receive started");
+        }
         
+        // A network switch moves our sessions instead of timing them out
+        watchNetworkChanges();
+
+        // Workers first, the IO thread starts routing to them right away
+        startWorkers();
+        NETWORK_LOG_INFO("[Network] {} data plane worker(s)", shards.size());
+
         // Start IO thread to handle asynchronous operations
         if (!ioThread.joinable())
         {
@@ -86,544 +286,2747 @@ bool UDPNetwork::startListening(int port)
     }
 }
 
-bool UDPNetwork::connectToPeer(const std::string& ip, int port)
+std::optional<PeerId> UDPNetwork::connectToPeer(
+    const std::string& ip,
+    int port,
+    const std::optional<boost::asio::ip::udp::endpoint>& relay,
+    const std::optional<boost::asio::ip::udp::endpoint>& ipv6)
 {
-    if (peerConnection.isConnected())
-    {
-        std::cout << "[Network] Already connected to a peer." << std::endl;
-        return false;
-    }
-    
     try
     {
-        boost::asio::ip::address addr = boost::asio::ip::make_address(ip);
-        peerEndpoint = boost::asio::ip::udp::endpoint(addr, port);
-        currentPeerEndpoint = ip + ":" + std::to_string(port);
+        boost::asio::ip::udp::endpoint endpoint = socketEndpoint(boost::asio::ip::make_address(ip), static_cast<unsigned short>(port));
+        // IPv6 goes first when we can send it, IPv4 is the fallback punched right behind
+        boost::asio::ip::udp::endpoint alternate;
+        if (ipv6 && dualStack)
+        {
+            alternate = endpoint;
+            endpoint = *ipv6;
+        }
+        std::optional<boost::asio::ip::udp::endpoint> via;
+        if (relay)
+            via = socketEndpoint(relay->address(), relay->port());
+
+        // A relayed peer is found by the relay port it was given, each peer gets its own
+        std::optional<PeerId> id = peers.add(via ? *via : endpoint);
+        if (!id)
+            return std::nullopt;
+
+        PeerSession* session = peers.get(*id);
+        if (session->connection.isConnected())
+        {
+            NETWORK_LOG_INFO("[Network] Already connected to {}:{}", ip, port);
+            return id;
+        }
+
+        // New peers take the current FEC setting
+        session->fecEncoder.setParams(fecParams);
+        // Published to the shard by the post that starts hole punching
+        session->directEndpoint = endpoint;
+        session->alternateEndpoint = alternate;
+        session->relayed.store(via.has_value(), std::memory_order_relaxed);
 
-        NETWORK_LOG_INFO("[Network] Starting UDP hole punching to {}:{}", ip, port);
+        if (via)
+        {
+            NETWORK_LOG_INFO("[Network] Starting on relay {}:{} to {}:{}, probing the direct path",
+                relay->address().to_string(), relay->port(), ip, port);
+        }
+        else
+        {
+            // Whichever family answers first is found, the other stays indexed for its late packets
+            if (alternate.port() != 0)
+                peers.addEndpoint(*session, alternate);
+            NETWORK_LOG_INFO("[Network] Starting UDP hole punching to {}{}", session->endpointString(),
+                alternate.port() != 0 ? ", IPv4 " + ip + ":" + std::to_string(port) + " behind it" : "");
+        }
         running = true;
+
+        // Notices still repeating from the last session must not reach a peer we're coming back to
+        boost::asio::post(ioContext, [this]()
+        {
+            disconnectTimer.cancel();
+        });
         
-        // Update system state
-        stateManager->setState(SystemState::CONNECTING);
+        // Update system state, joining more peers keeps us connected
+        if (!stateManager->isInState(SystemState::CONNECTED))
+            stateManager->setState(SystemState::CONNECTING);
         
         // Start the hole punching process
-        startHolePunchingProcess(peerEndpoint);
+        startHolePunchingProcess(*session);
         
-        return true;
+        return id;
     } catch (const std::exception& e)
     {
         NETWORK_LOG_ERROR("[Network] Connect error: {}", e.what());
-        return false;
+        return std::nullopt;
     }
 }
 
-void UDPNetwork::startHolePunchingProcess(const boost::asio::ip::udp::endpoint& peer_endpoint)
+void UDPNetwork::startHolePunchingProcess(PeerSession& session)
 {
-    // Send initial hole punching packets
-    for (int i = 0; i < 5; i++) {
-        sendHolePunchPacket();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
+    // Send initial hole punching packets from the peer's shard, it owns the peer's timers
+    PeerId id = session.id;
+    boost::asio::post(shardOf(session).context, [this, id]()
+    {
+        PeerSession* session = peers.get(id);
+        if (!session)
+            return;
+
+        session->holePunchRemaining = HOLE_PUNCH_BURST;
+        session->holePunchStarted = std::chrono::steady_clock::now();
+        continueHolePunching(*session);
+    });
 
     // Start keep-alive timer
     startKeepAliveTimer();
 }
 
-void UDPNetwork::sendHolePunchPacket()
+void UDPNetwork::continueHolePunching(PeerSession& session)
 {
-    try
-    {
-        NETWORK_LOG_INFO("[Network] Sending hole-punch / keep-alive packet to peer: {}", peerEndpoint.address().to_string());
-        // Create hole-punch packet with shared ownership
-        auto packet = std::make_shared<std::vector<uint8_t>>(16);
+    if (!session.active || session.closing || session.holePunchRemaining <= 0)
+        return;
 
-        // Attach custom header
-        attachCustomHeader(packet, PacketType::HOLE_PUNCH);
-        
-        // Send packet asynchronously
-        // TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-        socket->async_send_to(
-            boost::asio::buffer(*packet), peerEndpoint,
-            [packet](const boost::system::error_code& error, std::size_t bytesSent)
-            {
-                if (error && error != boost::asio::error::operation_aborted && 
-                    error != boost::asio::error::would_block &&
-                    error.value() != 10035) // WSAEWOULDBLOCK
-                    {
-                    NETWORK_LOG_ERROR("[Network] Error sending hole-punch packet: {}, with error code: {}", error.message(), error.value());
-                }
-            });
+    sendHolePunchPacket(session);
+    // The other family joins once the preferred one had its head start, the first answer wins
+    if (session.alternateEndpoint.port() != 0 && !session.relayed &&
+        std::chrono::steady_clock::now() - session.holePunchStarted >= HAPPY_EYEBALLS_DELAY)
+    {
+        sendHolePunchPacket(session, session.alternateEndpoint);
     }
-    catch (const std::exception& e)
+    if (--session.holePunchRemaining > 0)
     {
-        SYSTEM_LOG_ERROR("[Network] Error preparing hole-punch packet: {}", e.what());
-        NETWORK_LOG_ERROR("[Network] Error preparing hole-punch packet: {}", e.what());
+        // Doubling from HOLE_PUNCH_INTERVAL for every packet sent so far
+        int sent = HOLE_PUNCH_BURST - session.holePunchRemaining;
+        session.holePunchTimer.expires_after(std::min(HOLE_PUNCH_INTERVAL * (1 << (sent - 1)), HOLE_PUNCH_MAX_INTERVAL));
+        session.holePunchTimer.async_wait([this, &session](const boost::system::error_code& error)
+        {
+            if (error != boost::asio::error::operation_aborted)
+                continueHolePunching(session);
+        });
     }
 }
 
-void UDPNetwork::checkAllConnections()
+bool UDPNetwork::setDontFragment()
 {
-    if (peerConnection.hasTimedOut(20))
+    // A dual-stack socket sends IPv4 too, it needs the IPv4 option as well as its own
+    bool ipv6 = socket->local_endpoint().address().is_v6();
+#ifdef _WIN32
+    DWORD value = TRUE;
+    bool set = ipv6 && !dualStack ? true : setsockopt(socket->native_handle(), IPPROTO_IP, IP_DONTFRAGMENT,
+        reinterpret_cast<const char*>(&value), sizeof(value)) == 0;
+    if (ipv6)
     {
-        // Time out peer after 20 seconds of inactivity
-        auto last_activity = peerConnection.getLastActivity();
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_activity).count();
-        
-        SYSTEM_LOG_ERROR("[Network] Connection timeout. No packets received for {} seconds (threshold: 20s).", elapsed);
-        NETWORK_LOG_ERROR("[Network] Connection timeout. No packets received for {} seconds (threshold: 20s).", elapsed);
-        
-        // Mark as disconnected
-        peerConnection.setConnected(false);
-        
-        // Notify ALL_PEERS_DISCONNECTED for single peer setup
-        notifyConnectionEvent(NetworkEvent::ALL_PEERS_DISCONNECTED);
-        
-        // TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-        // if (!hasActiveConnections()) {
-        //     notifyConnectionEvent(NetworkEvent::ALL_PEERS_DISCONNECTED);
-        // }
+        set = setsockopt(socket->native_handle(), IPPROTO_IPV6, IPV6_DONTFRAG,
+            reinterpret_cast<const char*>(&value), sizeof(value)) == 0 && set;
     }
+    return set;
+#elif defined(__linux__)
+    // Probe mode, DF set but the kernel doesn't clamp sends to its own cached path MTU
+    int value = IP_PMTUDISC_PROBE;
+    bool set = ipv6 && !dualStack ? true : setsockopt(socket->native_handle(), IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) == 0;
+    if (ipv6)
+    {
+        int value6 = IPV6_PMTUDISC_PROBE;
+        set = setsockopt(socket->native_handle(), IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value6, sizeof(value6)) == 0 && set;
+    }
+    return set;
+#else
+    return false;
+#endif
 }
 
-void UDPNetwork::notifyConnectionEvent(NetworkEvent event, const std::string& endpoint)
+void UDPNetwork::probePathMtu(PeerSession& session)
 {
-    SYSTEM_LOG_INFO("[Network] Queuing network event: {}", static_cast<int>(event));
-    if (endpoint.empty())
-    {
-        stateManager->queueEvent(NetworkEventData(event));
-    }
+    if (!session.active || session.closing || !session.connection.isConnected())
+        return;
+
+    std::optional<uint16_t> size = session.pathMtu.nextProbe();
+    if (size)
+        sendPathMtuProbe(session, *size);
     else
+        finishPathMtuSearch(session);
+
+    // Answers are looked at on the next tick, a settled search waits for the next round
+    session.pathMtuTimer.expires_after(size ? PATH_MTU_PROBE_INTERVAL : PATH_MTU_RESEARCH_INTERVAL);
+    session.pathMtuTimer.async_wait([this, &session](const boost::system::error_code& error)
     {
-        stateManager->queueEvent(NetworkEventData(event, endpoint));
-    }
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        if (session.pathMtu.searching())
+            session.pathMtu.onTimeout();
+        else
+            session.pathMtu.restart();
+        probePathMtu(session);
+    });
 }
 
-// TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-void UDPNetwork::stopConnection()
+void UDPNetwork::sendPathMtuProbe(PeerSession& session, uint16_t size)
 {
-    // Send disconnect notification to peer
-    sendDisconnectNotification();
+    // The datagram is the probed size whichever header it gets
+    wire::Header header = makeHeader(&session, PacketType::MTU_PROBE, size);
+    header.length = static_cast<uint32_t>(size - wire::encodedSize(header));
+    PacketBuffer packet = packetPool->acquire(header.length);
+    if (!packet)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build path MTU probe");
+        return;
+    }
 
-    peerConnection.setConnected(false);
-    running = false;
+    // A token the ack has to echo, then padding; slabs are recycled and the bytes go on the wire
+    uint32_t token;
+    randombytes_buf(&token, sizeof(token));
+    std::memset(packet.data(), 0, packet.size());
+    wire::store32(packet.data(), token);
+    attachCustomHeader(packet, header);
+    session.pathMtu.onSent(size, token);
 
-    stopKeepAliveTimer();
-    
-    stateManager->setState(SystemState::IDLE);
-    
-    SYSTEM_LOG_INFO("[Network] Stopped connection to peer");
-    NETWORK_LOG_INFO("[Network] Stopped connection to peer");
+    sendControlPacket(session, std::move(packet));
 }
 
-void UDPNetwork::shutdown()
+void UDPNetwork::sendPathMtuAck(PeerSession& session, uint16_t size, uint32_t token)
 {
-    // Stop any active connection
-    // TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-    if (peerConnection.isConnected()) {
-        stopConnection();
+    PacketBuffer packet = packetPool->acquire(MTU_TOKEN_SIZE);
+    if (!packet)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build path MTU ack");
+        return;
     }
-    
-    // Then shut down the network stack
-    running = false;
-    peerConnection.setConnected(false);
-    stateManager->setState(SystemState::SHUTTING_DOWN);
 
-    stopKeepAliveTimer();
+    wire::store32(packet.data(), token);
+    attachCustomHeader(packet, makeHeader(&session, PacketType::MTU_PROBE_ACK, size, MTU_TOKEN_SIZE));
 
-    if (socket)
+    sendControlPacket(session, std::move(packet));
+}
+
+void UDPNetwork::finishPathMtuSearch(PeerSession& session)
+{
+    uint16_t size = session.pathMtu.confirmedSize();
+    if (session.pathDatagram.exchange(size, std::memory_order_release) == size)
+        return;
+
+    bool parity = fecParams.enabled() || fecAdaptive;
+    SYSTEM_LOG_INFO("[Network] Path MTU to {} settled at {} byte datagrams, {} byte packets inside",
+        session.endpointString(), size, size - TUNNEL_OVERHEAD - (parity ? PARITY_OVERHEAD : 0));
+    NETWORK_LOG_INFO("[Network] Path MTU to {} settled at {} byte datagrams", session.endpointString(), size);
+    notifyConnectionEvent(NetworkEvent::PATH_MTU_CHANGED, session.endpointString(), session.id);
+}
+
+size_t UDPNetwork::datagramLimit(const PeerSession& session)
+{
+    uint16_t size = session.pathDatagram.load(std::memory_order_acquire);
+    return size ? size : PathMtuProber::BASE_DATAGRAM;
+}
+
+uint32_t UDPNetwork::tunnelMtu() const
+{
+    uint32_t datagram = 0;
+    peers.forEach([&datagram](const PeerSession& session)
     {
-        boost::system::error_code ec;
-        socket->cancel(ec);
-        socket->close(ec);
-    }
-    
-    // Stop io_context 
-    ioContext.stop();
+        uint16_t size = session.pathDatagram.load(std::memory_order_acquire);
+        if (size && session.connection.isConnected() && (!datagram || size < datagram))
+            datagram = size;
+    });
+    bool parity = fecParams.enabled() || fecAdaptive;
+    return (datagram ? datagram : PathMtuProber::BASE_DATAGRAM) - TUNNEL_OVERHEAD - (parity ? PARITY_OVERHEAD : 0);
+}
 
-    if (ioThread.joinable())
-        ioThread.join();
-    
-    SYSTEM_LOG_INFO("[Network] Network subsystem shut down");
+void UDPNetwork::sendControlPacket(PeerSession& session, PacketBuffer packet)
+{
+    sendControlPacket(session.endpoint(), std::move(packet));
 }
 
-// TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-void UDPNetwork::sendDisconnectNotification()
+void UDPNetwork::sendControlPacket(const boost::asio::ip::udp::endpoint& to, PacketBuffer packet)
 {
+    if (!packet)
+        return;
+
     try
     {
-        if (!peerConnection.isConnected() || !socket)
-        {
-            return; // No connection to notify
-        }
-
-        SYSTEM_LOG_INFO("[Network] Sending disconnect notification to peer");
-        NETWORK_LOG_INFO("[Network] Sending disconnect notification to peer");
-        
-        // Create disconnect packet
-        auto packet = std::make_shared<std::vector<uint8_t>>(16);
-        
-        // Attach custom header
-        attachCustomHeader(packet, PacketType::DISCONNECT);
-        
-        // Send packet - try multiple times to increase chance of delivery
-        for (int i = 0; i < 3; i++)
-        {
-            socket->async_send_to(
-                boost::asio::buffer(*packet), peerEndpoint,
-                [packet](const boost::system::error_code& error, std::size_t bytesSent)
+        auto buffer = boost::asio::buffer(packet.data(), packet.size());
+        socket->async_send_to(
+            buffer, to,
+            [packet = std::move(packet)](const boost::system::error_code& error, std::size_t bytesSent)
+            {
+                if (!error)
                 {
-                    // Ignore errors since we're disconnecting
-                });
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        }
+                    metrics::add(metrics::Counter::UDP_TX_PACKETS);
+                    metrics::add(metrics::Counter::UDP_TX_BYTES, bytesSent);
+                }
+                // Too big for the local link is an answer for a probe, not an error
+                else if (error != boost::asio::error::operation_aborted &&
+                    error != boost::asio::error::would_block &&
+                    error != boost::asio::error::message_size &&
+                    error.value() != 10035) // WSAEWOULDBLOCK
+                {
+                    NETWORK_LOG_ERROR_SUMMARY("[Network] Error sending control packet: {}, with error code: {}", error.message(), error.value());
+                }
+            });
     }
     catch (const std::exception& e)
     {
-        SYSTEM_LOG_ERROR("[Network] Error sending disconnect notification: {}", e.what());
-        NETWORK_LOG_ERROR("[Network] Error sending disconnect notification: {}", e.what());
+        NETWORK_LOG_ERROR("[Network] Control packet send error: {}", e.what());
     }
 }
 
-// TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-bool UDPNetwork::isConnected() const
+void UDPNetwork::sendHolePunchPacket(PeerSession& session)
 {
-    return peerConnection.isConnected();
+    sendHolePunchPacket(session, session.endpoint());
 }
 
-// TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-bool UDPNetwork::sendMessage(const std::vector<uint8_t>& dataToSend)
+void UDPNetwork::sendHolePunchPacket(PeerSession& session, const boost::asio::ip::udp::endpoint& to)
 {
-    if (!running || !socket)
-    {
-        SYSTEM_LOG_ERROR("[Network] Cannot send message: socket not available or system not running (disconnected)");
-        NETWORK_LOG_ERROR("[Network] Cannot send message: socket not available or system not running (disconnected)");
-        return false;
-    }
-    
     try
     {
-        // Calculate total packet size: header (16 bytes) + message
-        size_t packetSize = 16 + dataToSend.size();
-        if (packetSize > MAX_PACKET_SIZE)
+        NETWORK_LOG_DEBUG("[Network] Sending hole-punch / keep-alive packet to peer: {}:{}", to.address().to_string(), to.port());
+        // Create hole-punch packet, the handler keeps the pooled buffer alive.
+        // It tells the peer our session id and the highest header version we read, older builds
+        // ignore the payload; always v1, so they can read it at all.
+        PacketBuffer packet = packetPool->acquire(SESSION_ID_SIZE + 1);
+        if (!packet)
         {
-            NETWORK_LOG_ERROR("[Network] Message too large, max size is {}", (MAX_PACKET_SIZE - 16));
-            return false;
-        }
-        
-        /*
-        * SMALL CUSTOM PROTOCOL HEADER
-        */
-
-        // Create packet with shared ownership for async operation
-        auto packet = std::make_shared<std::vector<uint8_t>>(packetSize);
-
-        // Attach custom header
-        uint32_t seq = attachCustomHeader(packet, PacketType::MESSAGE);
-        
-        // Set message length
-        uint32_t msg_len = static_cast<uint32_t>(dataToSend.size());
-        (*packet)[12] = (msg_len >> 24) & 0xFF;
-        (*packet)[13] = (msg_len >> 16) & 0xFF;
-        (*packet)[14] = (msg_len >> 8) & 0xFF;
-        (*packet)[15] = msg_len & 0xFF;
-        
-        // Copy message content
-        std::memcpy(packet->data() + 16, dataToSend.data(), dataToSend.size());
-        
-        // Track for acknowledgment
-        {
-            std::lock_guard<std::mutex> ack_lock(pendingAcksMutex);
-            pendingAcks[seq] = std::chrono::steady_clock::now();
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build hole-punch packet");
+            return;
         }
+        writeSessionId(packet.data(), session.localSessionId.load(std::memory_order_relaxed));
+        packet.data()[SESSION_ID_SIZE] = WIRE_VERSION;
+        attachCustomHeader(packet, makeHeader(nullptr, PacketType::HOLE_PUNCH, 0, packet.size()));
+        auto buffer = boost::asio::buffer(packet.data(), packet.size());
         
         // Send packet asynchronously
         socket->async_send_to(
-            boost::asio::buffer(*packet), peerEndpoint,
-            [this, packet, seq](const boost::system::error_code& error, std::size_t bytesSent)
+            buffer, to,
+            [packet = std::move(packet)](const boost::system::error_code& error, std::size_t bytesSent)
             {
-                this->handleSendComplete(error, bytesSent, seq);
+                if (error && error != boost::asio::error::operation_aborted && 
+                    error != boost::asio::error::would_block &&
+                    error.value() != 10035) // WSAEWOULDBLOCK
+                    {
+                    NETWORK_LOG_ERROR_SUMMARY("[Network] Error sending hole-punch packet: {}, with error code: {}", error.message(), error.value());
+                }
             });
-        
-        return true;
     }
     catch (const std::exception& e)
     {
-        SYSTEM_LOG_ERROR("[Network] Send preparation error: {}", e.what());
-        NETWORK_LOG_ERROR("[Network] Send preparation error: {}", e.what());
-        return false;
+        SYSTEM_LOG_ERROR("[Network] Error preparing hole-punch packet: {}", e.what());
+        NETWORK_LOG_ERROR("[Network] Error preparing hole-punch packet: {}", e.what());
     }
 }
 
-void UDPNetwork::handleSendComplete(
-    const boost::system::error_code& error,
-    std::size_t bytesSent,
-    uint32_t seq)
+void UDPNetwork::sendMigrate(PeerSession& session)
 {
-    if (error)
-    {
-        if (error == boost::asio::error::would_block || 
-            error == boost::asio::error::try_again ||
-            error.value() == 10035) // WSAEWOULDBLOCK
-        {
-
-            NETWORK_LOG_INFO("[Network] Send buffer full");
-
-            boost::asio::post(ioContext, [this, seq]()
-            {
-                // No resend, just log that we're dropping the packet
-                NETWORK_LOG_INFO("[Network] Dropping packet due to send buffer limits: seq={}", seq);
-                
-                // Remove from pending acks
-                std::lock_guard<std::mutex> lock(pendingAcksMutex);
-                pendingAcks.erase(seq);
-            });
-        }
-        else
-        {
-            SYSTEM_LOG_ERROR("[Network] Send error: {}, with error code: {}", error.message(), error.value());
-            NETWORK_LOG_ERROR("[Network] Send error: {}, with error code: {}", error.message(), error.value());
-            
-            // Disconnect on fatal errors, not temporary ones
-            if (error != boost::asio::error::operation_aborted)
-            {
-                boost::asio::post(ioContext, [this]() {this->handleDisconnect(); });
-            }
-        }
-    }
+    sendMigrate(session, session.endpoint());
 }
 
-void UDPNetwork::processMessage(std::vector<uint8_t> message, const boost::asio::ip::udp::endpoint& sender)
+void UDPNetwork::sendMigrate(PeerSession& session, const boost::asio::ip::udp::endpoint& to)
 {
-    if (onMessageCallback)
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    uint32_t remoteId = session.remoteSessionId.load(std::memory_order_relaxed);
+    if (!cipher || remoteId == 0)
+        return;
+
+    // The peer's id in the clear routes it to the session, ours sealed proves it's us.
+    // Seqs of their own, the nonce space is per packet type.
+    uint32_t seq = ++session.migrateSent;
+    wire::Header header = sessionHeader(session, PacketType::MIGRATE, seq, remoteId, MIGRATE_SEALED_SIZE);
+    PacketBuffer packet = packetPool->acquire(header.length);
+    if (!packet)
     {
-        onMessageCallback(std::move(message));
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build migrate packet");
+        return;
     }
-}
+
+    uint8_t* payload = packet.data();
+    if (!header.sessionId)
+        writeSessionId(payload, remoteId);
+    uint8_t localId[SESSION_ID_SIZE];
+    writeSessionId(localId, session.localSessionId.load(std::memory_order_relaxed));
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    cipher->seal(payload + sealedOffset(header), localId, SESSION_ID_SIZE, static_cast<uint8_t>(PacketType::MIGRATE), seq,
+        ad.data(), ad.size());
+
+    attachCustomHeader(packet, header);
+
+    sendControlPacket(to, std::move(packet));
+}
+
+void UDPNetwork::handleMigrate(
+    PeerSession& peer,
+    const PacketBuffer& packet,
+    const wire::Header& header,
+    const boost::asio::ip::udp::endpoint& sender)
+{
+    const uint8_t* payload = packet.data() + header.size;
+    uint32_t seq = header.seq;
+    if (header.length != sealedOffset(header) + MIGRATE_SEALED_SIZE ||
+        receiverSessionId(header, payload) != peer.localSessionId.load(std::memory_order_relaxed))
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        return;
+    }
+
+    CipherPin pin(peer);
+    const PacketCipher* cipher = pin.get();
+    if (!cipher)
+    {
+        metrics::add(metrics::Counter::DROP_NO_KEYS);
+        return;
+    }
+
+    uint8_t remoteId[SESSION_ID_SIZE];
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    if (!cipher->open(remoteId, payload + sealedOffset(header), MIGRATE_SEALED_SIZE,
+            static_cast<uint8_t>(PacketType::MIGRATE), seq, ad.data(), ad.size()))
+    {
+        metrics::add(metrics::Counter::DROP_DECRYPT);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Migrate seq={} from {}:{} failed authentication", seq, sender.address().to_string(), sender.port());
+        return;
+    }
+
+    // A replayed MIGRATE from somewhere else must not pull the peer away
+    if (seq <= peer.migrateSeen)
+        return;
+    peer.migrateSeen = seq;
+    peer.remoteSessionId.store(readSessionId(remoteId), std::memory_order_relaxed);
+
+    // Keep-alive on the path we already use
+    if (sender == peer.endpoint())
+        return;
+
+    std::string previous = peer.endpointString();
+    peer.setEndpoint(sender);
+    peers.addEndpoint(peer, sender);
+    // The relay only ever forwards from the port we were given, anything else is the peer itself
+    peer.relayed.store(false, std::memory_order_relaxed);
+    SYSTEM_LOG_INFO("[Network] Peer {} moved to {}", previous, peer.endpointString());
+    NETWORK_LOG_INFO("[Network] Peer {} moved to {}", previous, peer.endpointString());
+
+    // A new path, its capacity and MTU are found again; the tunnel and its seqs carry on
+    peer.congestion.reset(congestionMode.load(std::memory_order_relaxed));
+    peer.pathMtu.reset();
+    probePathMtu(peer);
+
+    // Answer on the new path so its side sees us there within the round trip
+    sendMigrate(peer);
+}
+
+void UDPNetwork::probePeerAddress(PeerId id, const std::string& ip, int port)
+{
+    boost::system::error_code ec;
+    boost::asio::ip::address address = boost::asio::ip::make_address(ip, ec);
+    if (ec)
+        return;
+    boost::asio::ip::udp::endpoint to = socketEndpoint(address, static_cast<unsigned short>(port));
+
+    PeerSession* session = peers.get(id);
+    if (!session)
+        return;
+    uint32_t generation = session->generation.load(std::memory_order_relaxed);
+    boost::asio::post(shardOf(*session).context, [this, id, generation, to]()
+    {
+        PeerSession* session = peers.get(id);
+        if (!session || session->closing || session->generation.load(std::memory_order_relaxed) != generation ||
+            to == session->endpoint())
+        {
+            return;
+        }
+
+        if (session->relayed)
+        {
+            // Still on the relay, the new address has to win the race like the old one
+            session->directEndpoint = to;
+            session->directProbe = PeerSession::PathProbe{};
+            probePaths(*session);
+        }
+        else
+        {
+            // Whatever answers from there is moved to by its own MIGRATE
+            sendMigrate(*session, to);
+        }
+    });
+}
+
+void UDPNetwork::probePaths(PeerSession& session)
+{
+    if (!session.relayed || !session.connection.isConnected())
+        return;
+
+    // The last probe to the peer's preferred family went unanswered, its other address gets a turn
+    if (session.directProbe.seq != 0 && session.alternateEndpoint.port() != 0)
+    {
+        std::swap(session.directEndpoint, session.alternateEndpoint);
+        session.directProbe = PeerSession::PathProbe{};
+    }
+
+    // Both at once so the two round trips are measured under the same conditions
+    sendPathProbe(session, session.endpoint(), 0);
+    sendPathProbe(session, session.directEndpoint, 0);
+}
+
+void UDPNetwork::sendPathProbe(PeerSession& session, const boost::asio::ip::udp::endpoint& to, uint32_t answering)
+{
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    uint32_t remoteId = session.remoteSessionId.load(std::memory_order_relaxed);
+    if (!cipher || remoteId == 0)
+        return;
+
+    // Laid out like MIGRATE, with the seq of the probe this answers sealed along
+    uint32_t seq = ++session.probeSent;
+    wire::Header header = sessionHeader(session, PacketType::PATH_PROBE, seq, remoteId, PATH_PROBE_SEALED_SIZE);
+    PacketBuffer packet = packetPool->acquire(header.length);
+    if (!packet)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build path probe");
+        return;
+    }
+
+    uint8_t* payload = packet.data();
+    if (!header.sessionId)
+        writeSessionId(payload, remoteId);
+    uint8_t sealed[2 * SESSION_ID_SIZE];
+    writeSessionId(sealed, session.localSessionId.load(std::memory_order_relaxed));
+    writeSessionId(sealed + SESSION_ID_SIZE, answering);
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    cipher->seal(payload + sealedOffset(header), sealed, sizeof(sealed), static_cast<uint8_t>(PacketType::PATH_PROBE), seq,
+        ad.data(), ad.size());
+
+    attachCustomHeader(packet, header);
+
+    if (answering == 0)
+    {
+        PeerSession::PathProbe& probe = to == session.endpoint() ? session.relayProbe : session.directProbe;
+        probe.seq = seq;
+        probe.sentAt = std::chrono::steady_clock::now();
+    }
+    sendControlPacket(to, std::move(packet));
+}
+
+void UDPNetwork::handlePathProbe(
+    PeerSession& peer,
+    const PacketBuffer& packet,
+    const wire::Header& header,
+    const boost::asio::ip::udp::endpoint& sender)
+{
+    const uint8_t* payload = packet.data() + header.size;
+    uint32_t seq = header.seq;
+    if (header.length != sealedOffset(header) + PATH_PROBE_SEALED_SIZE ||
+        receiverSessionId(header, payload) != peer.localSessionId.load(std::memory_order_relaxed))
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        return;
+    }
+
+    CipherPin pin(peer);
+    const PacketCipher* cipher = pin.get();
+    if (!cipher)
+    {
+        metrics::add(metrics::Counter::DROP_NO_KEYS);
+        return;
+    }
+
+    uint8_t opened[2 * SESSION_ID_SIZE];
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    if (!cipher->open(opened, payload + sealedOffset(header), PATH_PROBE_SEALED_SIZE,
+            static_cast<uint8_t>(PacketType::PATH_PROBE), seq, ad.data(), ad.size()))
+    {
+        metrics::add(metrics::Counter::DROP_DECRYPT);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Path probe seq={} from {}:{} failed authentication", seq, sender.address().to_string(), sender.port());
+        return;
+    }
+    peer.remoteSessionId.store(readSessionId(opened), std::memory_order_relaxed);
+
+    // A probe is answered on the path it took and moves nothing, so a replay only earns the
+    // replayer one packet of the same size
+    uint32_t answering = readSessionId(opened + SESSION_ID_SIZE);
+    if (answering == 0)
+    {
+        sendPathProbe(peer, sender, seq);
+        return;
+    }
+
+    if (!peer.relayed)
+        return;
+    bool viaRelay = sender == peer.endpoint();
+    PeerSession::PathProbe& probe = viaRelay ? peer.relayProbe : peer.directProbe;
+    if (probe.seq == 0 || answering != probe.seq)
+        return;
+    probe.seq = 0;
+    probe.rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - probe.sentAt);
+    // Answered from a remapped port, that's as good as the address signaling gave us
+    if (!viaRelay)
+        peer.directEndpoint = sender;
+
+    NETWORK_LOG_DEBUG("[Network] Path probe to {} answered in {}us", viaRelay ? "relay" : "peer", probe.rtt.count());
+    if (peer.directProbe.rtt.count() > 0 && peer.relayProbe.rtt.count() > 0 && peer.directProbe.rtt < peer.relayProbe.rtt)
+        leaveRelay(peer, peer.directEndpoint);
+}
+
+void UDPNetwork::leaveRelay(PeerSession& peer, const boost::asio::ip::udp::endpoint& direct)
+{
+    SYSTEM_LOG_INFO("[Network] Direct path to {}:{} answers in {}us against {}us through the relay, switching",
+        direct.address().to_string(), direct.port(), peer.directProbe.rtt.count(), peer.relayProbe.rtt.count());
+    NETWORK_LOG_INFO("[Network] Direct path to {}:{} answers in {}us against {}us through the relay, switching",
+        direct.address().to_string(), direct.port(), peer.directProbe.rtt.count(), peer.relayProbe.rtt.count());
+
+    // The relay stays indexed, whatever is still on the way through it is delivered as usual.
+    // Sending moves over right away, the peer follows on the MIGRATE.
+    peer.setEndpoint(direct);
+    peers.addEndpoint(peer, direct);
+    peer.relayed.store(false, std::memory_order_relaxed);
+
+    peer.congestion.reset(congestionMode.load(std::memory_order_relaxed));
+    peer.pathMtu.reset();
+    probePathMtu(peer);
+
+    sendMigrate(peer);
+}
+
+void UDPNetwork::setStunServer(const boost::asio::ip::udp::endpoint& server, const std::string& publicIp, int publicPort)
+{
+    boost::asio::post(ioContext, [this, server = socketEndpoint(server.address(), server.port()),
+        address = publicIp + ":" + std::to_string(publicPort)]()
+    {
+        stunServer = server;
+        publicAddress = address;
+    });
+}
+
+boost::asio::ip::udp::endpoint UDPNetwork::socketEndpoint(const boost::asio::ip::address& address, unsigned short port) const
+{
+    using namespace boost::asio::ip;
+    if (dualStack && address.is_v4())
+        return udp::endpoint(make_address_v6(v4_mapped, address.to_v4()), port);
+    if (!dualStack && address.is_v6() && address.to_v6().is_v4_mapped())
+        return udp::endpoint(make_address_v4(v4_mapped, address.to_v6()), port);
+    return udp::endpoint(address, port);
+}
+
+void UDPNetwork::watchNetworkChanges()
+{
+#ifdef _WIN32
+    if (networkChangeHandle)
+        return;
+
+    HANDLE handle = nullptr;
+    DWORD result = NotifyIpInterfaceChange(AF_UNSPEC, onInterfaceChange, this, FALSE, &handle);
+    if (result != NO_ERROR)
+    {
+        NETWORK_LOG_WARNING("[Network] Not watching for network changes, error: {}", result);
+        return;
+    }
+    networkChangeHandle = handle;
+#endif
+}
+
+void UDPNetwork::unwatchNetworkChanges()
+{
+#ifdef _WIN32
+    // Waits for a callback that's running, none comes after
+    if (networkChangeHandle)
+        CancelMibChangeNotify2(networkChangeHandle);
+#endif
+    networkChangeHandle = nullptr;
+
+    boost::system::error_code ec;
+    networkChangeTimer.cancel(ec);
+}
+
+void UDPNetwork::notifyNetworkChange()
+{
+    boost::asio::post(ioContext, [this]()
+    {
+        networkChangeTimer.expires_after(NETWORK_CHANGE_SETTLE);
+        networkChangeTimer.async_wait([this](const boost::system::error_code& error)
+        {
+            if (!error && running)
+                onNetworkChange();
+        });
+    });
+}
+
+void UDPNetwork::onNetworkChange()
+{
+    NETWORK_LOG_INFO("[Network] Local network changed, refreshing paths to {} peer(s)", peers.connectedCount());
+
+    // Every peer hears from wherever our packets leave now, it moves over on the first one
+    peers.forEach([this](PeerSession& session)
+    {
+        PeerId id = session.id;
+        uint32_t generation = session.generation.load(std::memory_order_relaxed);
+        boost::asio::post(shardOf(session).context, [this, id, generation]()
+        {
+            PeerSession* session = peers.get(id);
+            if (session && !session->closing && session->generation.load(std::memory_order_relaxed) == generation &&
+                session->connection.isConnected())
+            {
+                sendMigrate(*session);
+            }
+        });
+    });
+
+    // Our mapped address may have moved with it, ask the STUN server that answered at startup
+    if (!stunServer)
+        return;
+    StunClient::TransactionId transaction;
+    randombytes_buf(transaction.data(), transaction.size());
+    stunTransaction = transaction;
+
+    PacketBuffer request = packetPool->acquire(StunClient::HEADER_SIZE);
+    if (!request)
+        return;
+    std::array<uint8_t, StunClient::HEADER_SIZE> message = StunClient::bindingRequest(transaction);
+    std::memcpy(request.data(), message.data(), message.size());
+    sendControlPacket(*stunServer, std::move(request));
+}
+
+void UDPNetwork::handleStunResponse(const PacketBuffer& packet)
+{
+    std::optional<PublicAddress> mapped = StunClient::parseBindingResponse(packet.data(), packet.size(), *stunTransaction);
+    if (!mapped)
+        return;
+    stunTransaction.reset();
+
+    std::string address = mapped->ip + ":" + std::to_string(mapped->port);
+    if (address == publicAddress)
+        return;
+
+    SYSTEM_LOG_INFO("[Network] Public address moved from {} to {}", publicAddress, address);
+    publicAddress = address;
+    // Signaling passes it on, peers whose MIGRATE got lost on the way can still find us
+    notifyConnectionEvent(NetworkEvent::PUBLIC_ADDRESS_CHANGED, address);
+}
+
+void UDPNetwork::checkConnection(PeerSession& session)
+{
+    // Time out peers after 20 seconds of inactivity, pending ones after 20 seconds without an answer
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - session.connection.getLastActivity()).count();
+    if (elapsed <= PEER_TIMEOUT_SECONDS)
+        return;
+
+    if (session.connection.isConnected())
+    {
+        SYSTEM_LOG_ERROR("[Network] Connection timeout for {}. No packets received for {} seconds (threshold: {}s).",
+            session.endpointString(), elapsed, PEER_TIMEOUT_SECONDS);
+        NETWORK_LOG_ERROR("[Network] Connection timeout for {}. No packets received for {} seconds (threshold: {}s).",
+            session.endpointString(), elapsed, PEER_TIMEOUT_SECONDS);
+    }
+    else
+    {
+        SYSTEM_LOG_WARNING("[Network] Peer {} never answered, giving up", session.endpointString());
+    }
+    handleDisconnect(session);
+}
+
+void UDPNetwork::notifyConnectionEvent(NetworkEvent event, const std::string& endpoint, int peer)
+{
+    SYSTEM_LOG_INFO("[Network] Queuing network event: {}", static_cast<int>(event));
+    if (peer >= 0)
+    {
+        stateManager->queueEvent(NetworkEventData(event, endpoint, peer));
+    }
+    else if (endpoint.empty())
+    {
+        stateManager->queueEvent(NetworkEventData(event));
+    }
+    else
+    {
+        stateManager->queueEvent(NetworkEventData(event, endpoint));
+    }
+}
+
+void UDPNetwork::disconnectPeer(PeerId id)
+{
+    PeerSession* target = peers.get(id);
+    if (!target)
+        return;
+
+    boost::asio::post(shardOf(*target).context, [this, id]()
+    {
+        PeerSession* session = peers.get(id);
+        if (!session || session->closing)
+            return;
+
+        NETWORK_LOG_INFO("[Network] Disconnecting from peer {}", session->endpointString());
+        if (session->connection.isConnected())
+        {
+            PacketBuffer packet = makeSessionControl(*session, PacketType::DISCONNECT, 0, nullptr, 0);
+            if (packet)
+            {
+                auto buffer = boost::asio::buffer(packet.data(), packet.size());
+                socket->async_send_to(
+                    buffer, session->endpoint(),
+                    [packet = std::move(packet)](const boost::system::error_code&, std::size_t)
+                    {
+                        // Ignore errors since we're disconnecting
+                    });
+            }
+        }
+        session->connection.setConnected(false);
+        peers.remove(*session);
+    });
+}
+
+void UDPNetwork::stopConnection()
+{
+    // Send disconnect notification to every peer
+    sendDisconnectNotification();
+
+    running = false;
+    peers.forEach([](PeerSession& session) { session.connection.setConnected(false); });
+
+    stopKeepAliveTimer();
+
+    // Each peer is torn down on its shard, which owns its timers, the slot then goes back on the IO thread
+    peers.forEach([this](PeerSession& session)
+    {
+        boost::asio::post(shardOf(session).context, [this, &session]()
+        {
+            peers.remove(session);
+        });
+    });
+    
+    stateManager->setState(SystemState::IDLE);
+    
+    SYSTEM_LOG_INFO("[Network] Stopped connection to all peers");
+    NETWORK_LOG_INFO("[Network] Stopped connection to all peers");
+}
+
+void UDPNetwork::shutdown()
+{
+    // Stop any active connection
+    if (isConnected()) {
+        stopConnection();
+    }
+    
+    // Then shut down the network stack
+    running = false;
+    stateManager->setState(SystemState::SHUTTING_DOWN);
+
+    stopKeepAliveTimer();
+    unwatchNetworkChanges();
+
+    // Let the disconnect notices go out before the IO thread stops
+    for (int i = 0; disconnectRoundsLeft.load() > 0 && i < DISCONNECT_REPEATS * 2; ++i)
+        std::this_thread::sleep_for(DISCONNECT_INTERVAL);
+
+    if (socket)
+    {
+        boost::system::error_code ec;
+        socket->cancel(ec);
+        socket->close(ec);
+    }
+    
+    // Stop io_context 
+    ioContext.stop();
+
+    if (ioThread.joinable())
+        ioThread.join();
+    stopWorkers();
+
+    // Nothing runs on any context anymore, peers can be dropped from here
+    peers.clear();
+
+    // Queues and registrations go once nothing can complete on them anymore
+    if (rio)
+    {
+        rio->close();
+        rio.reset();
+    }
+    
+    SYSTEM_LOG_INFO("[Network] Network subsystem shut down");
+}
+
+void UDPNetwork::sendDisconnectNotification()
+{
+    try
+    {
+        if (!socket || !isConnected())
+        {
+            return; // No connection to notify
+        }
+
+        SYSTEM_LOG_INFO("[Network] Sending disconnect notification to {} peer(s)", connectedPeerCount());
+        NETWORK_LOG_INFO("[Network] Sending disconnect notification to {} peer(s)", connectedPeerCount());
+        
+        // Sessions are torn down right after this, each peer's notice is sealed now and goes
+        // to a copy of where it was
+        std::vector<DisconnectNotice> notices;
+        peers.forEach([this, &notices](PeerSession& session)
+        {
+            if (!session.connection.isConnected())
+                return;
+            PacketBuffer packet = makeSessionControl(session, PacketType::DISCONNECT, 0, nullptr, 0);
+            if (packet)
+                notices.push_back(DisconnectNotice{session.endpoint(), std::move(packet)});
+        });
+        if (notices.empty())
+            return;
+
+        disconnectRoundsLeft = DISCONNECT_REPEATS;
+        boost::asio::post(ioContext, [this, notices = std::move(notices)]() mutable
+        {
+            repeatDisconnectNotification(std::move(notices));
+        });
+    }
+    catch (const std::exception& e)
+    {
+        SYSTEM_LOG_ERROR("[Network] Error sending disconnect notification: {}", e.what());
+        NETWORK_LOG_ERROR("[Network] Error sending disconnect notification: {}", e.what());
+    }
+}
+
+void UDPNetwork::repeatDisconnectNotification(std::vector<DisconnectNotice> notices)
+{
+    for (const DisconnectNotice& notice : notices)
+    {
+        socket->async_send_to(
+            boost::asio::buffer(notice.packet.data(), notice.packet.size()), notice.to,
+            [packet = notice.packet.share()](const boost::system::error_code&, std::size_t)
+            {
+                // Ignore errors since we're disconnecting
+            });
+    }
+
+    if (--disconnectRoundsLeft <= 0)
+        return;
+
+    disconnectTimer.expires_after(DISCONNECT_INTERVAL);
+    disconnectTimer.async_wait(
+        [this, notices = std::move(notices)](const boost::system::error_code& error) mutable
+        {
+            if (error)
+            {
+                disconnectRoundsLeft = 0;
+                return;
+            }
+            repeatDisconnectNotification(std::move(notices));
+        });
+}
+
+bool UDPNetwork::isConnected() const
+{
+    return peers.connectedCount() > 0;
+}
+
+bool UDPNetwork::isPeerConnected(PeerId id) const
+{
+    return peers.connected(id) != nullptr;
+}
+
+bool UDPNetwork::hasPeer(PeerId id) const
+{
+    // A slot on its way out doesn't count, it's only waiting for the IO thread to release it
+    PeerSession* session = peers.get(id);
+    return session && !session->closing.load(std::memory_order_acquire);
+}
+
+size_t UDPNetwork::connectedPeerCount() const
+{
+    return peers.connectedCount();
+}
+
+bool UDPNetwork::sendMessage(PeerId peer, PacketBuffer dataToSend)
+{
+    if (!running || !socket)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        return false;
+    }
+
+    PeerSession* session = peers.connected(peer);
+    if (!session)
+        return false;
+
+    if (pacing())
+    {
+        bool queued = pace(*session, std::move(dataToSend), Pacer::Kind::MESSAGE);
+        servicePacer(*session, std::chrono::steady_clock::now());
+        return queued;
+    }
+    
+    try
+    {
+        bool compressed = compressPayload(dataToSend);
+        std::optional<uint32_t> seq = prepareMessage(*session, dataToSend, PacketType::MESSAGE, false, compressed);
+        if (!seq)
+            return false;
+
+        protectMessage(*session, dataToSend, *seq);
+        dispatchMessage(*session, std::move(dataToSend), *seq);
+        // A group that just filled up goes out right behind its last member
+        sendParity(*session);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        return false;
+    }
+}
+
+bool UDPNetwork::sendMessages(PeerId peer, PacketBatch& packets)
+{
+    if (!running || !socket)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        packets.clear();
+        return false;
+    }
+
+    PeerSession* session = peers.connected(peer);
+    if (!session)
+    {
+        packets.clear();
+        return false;
+    }
+
+    // Small packets wait for company, bundles that filled up or came due go out with this batch
+    if (aggregating(*session))
+        holdSmallPackets(*session, packets);
+
+    // Everything waits in the pacer, released below as far as tokens and window allow
+    if (pacing())
+    {
+        bool allQueued = true;
+        for (PacketBuffer& packet : packets)
+        {
+            if (packet)
+                allQueued &= pace(*session, std::move(packet), Pacer::Kind::MESSAGE);
+        }
+        packets.clear();
+        paceBundles(*session);
+        servicePacer(*session, std::chrono::steady_clock::now());
+        return allQueued;
+    }
+
+    if (!rio && (!batchIO || !batchIO->canSendBatch()))
+    {
+        bool allSent = true;
+        for (PacketBuffer& packet : packets)
+        {
+            allSent &= sendMessage(peer, std::move(packet));
+        }
+        packets.clear();
+
+        for (ReadyBundle& ready : readyBundles)
+        {
+            std::optional<uint32_t> seq = prepareBundle(*session, ready);
+            if (seq)
+                dispatchMessage(*session, std::move(ready.payload), *seq);
+            else
+                allSent = false;
+        }
+        readyBundles.clear();
+
+        // Don't hold a partial group past the batch, its members are already on the wire
+        session->fecEncoder.flush(*packetPool, parityBatch);
+        sendParity(*session);
+        return allSent;
+    }
+
+    try
+    {
+        // The TUN batch is the coalescing window, everything in it goes out in one submission
+        bool allSent = true;
+        for (PacketBuffer& packet : packets)
+        {
+            bool compressed = compressPayload(packet);
+            std::optional<uint32_t> seq = prepareMessage(*session, packet, PacketType::MESSAGE, false, compressed);
+            if (!seq)
+            {
+                allSent = false;
+                continue;
+            }
+            protectMessage(*session, packet, *seq);
+            outgoingBatch.push_back(OutgoingDatagram{std::move(packet), session->endpoint()});
+        }
+        packets.clear();
+
+        for (ReadyBundle& ready : readyBundles)
+        {
+            std::optional<uint32_t> seq = prepareBundle(*session, ready);
+            if (!seq)
+            {
+                allSent = false;
+                continue;
+            }
+            outgoingBatch.push_back(OutgoingDatagram{std::move(ready.payload), session->endpoint()});
+        }
+        readyBundles.clear();
+
+        // Parity rides in the same submission as the group it covers
+        session->fecEncoder.flush(*packetPool, parityBatch);
+        for (FecEncoder::Parity& parity : parityBatch)
+        {
+            if (prepareParity(*session, parity))
+                outgoingBatch.push_back(OutgoingDatagram{std::move(parity.payload), session->endpoint()});
+        }
+        parityBatch.clear();
+
+        size_t sent = rio
+            ? rio->send(outgoingBatch.data(), outgoingBatch.size())
+            : batchIO->sendBatch(outgoingBatch.data(), outgoingBatch.size());
+        if (sent)
+            metrics::record(metrics::Histogram::UDP_SEND_BATCH, sent);
+
+        // Socket buffer / send queue full or the batch path failed, queue the rest on the async path
+        for (size_t i = sent; i < outgoingBatch.size(); ++i)
+        {
+            // Seq is already in the header
+            uint32_t seq = sentSeq(outgoingBatch[i].packet);
+            transmitMessage(*session, std::move(outgoingBatch[i].packet), seq);
+        }
+        outgoingBatch.clear();
+        return allSent;
+    }
+    catch (const std::exception& e)
+    {
+        outgoingBatch.clear();
+        parityBatch.clear();
+        readyBundles.clear();
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        return false;
+    }
+}
+
+bool UDPNetwork::sendReliable(PeerId peer, PacketBuffer dataToSend)
+{
+    if (!running || !socket)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Cannot send message: socket not available or system not running (disconnected)");
+        return false;
+    }
+
+    PeerSession* session = peers.connected(peer);
+    if (!session)
+        return false;
+
+    if (pacing())
+    {
+        bool queued = pace(*session, std::move(dataToSend), Pacer::Kind::RELIABLE);
+        servicePacer(*session, std::chrono::steady_clock::now());
+        return queued;
+    }
+
+    try
+    {
+        std::optional<uint32_t> seq = prepareReliable(*session, dataToSend);
+        if (!seq)
+            return false;
+
+        dispatchMessage(*session, std::move(dataToSend), *seq);
+        // Sent as a MESSAGE when the window was full, that may have completed a group
+        sendParity(*session);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        return false;
+    }
+}
+
+std::optional<uint32_t> UDPNetwork::prepareReliable(PeerSession& session, PacketBuffer& dataToSend)
+{
+    if (dataToSend.headroom() < HEADER_SIZE + ReliableChannel::PREFIX_SIZE)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Message buffer has no headroom for the reliable header");
+        return std::nullopt;
+    }
+
+    // Compressed before it's tracked, retransmits reuse the frame
+    bool compressed = compressPayload(dataToSend);
+
+    // Window full, TCP recovers this one end to end
+    std::optional<uint32_t> reliableSeq = session.reliableChannel.track(dataToSend);
+    if (!reliableSeq)
+    {
+        std::optional<uint32_t> seq = prepareMessage(session, dataToSend, PacketType::MESSAGE, false, compressed);
+        if (seq)
+            protectMessage(session, dataToSend, *seq);
+        return seq;
+    }
+
+    uint8_t* prefix = dataToSend.push(ReliableChannel::PREFIX_SIZE);
+    prefix[0] = (*reliableSeq >> 24) & 0xFF;
+    prefix[1] = (*reliableSeq >> 16) & 0xFF;
+    prefix[2] = (*reliableSeq >> 8) & 0xFF;
+    prefix[3] = *reliableSeq & 0xFF;
+
+    // The tracked plaintext is what retransmits are built from, it's sealed into a copy
+    std::optional<uint32_t> seq = prepareMessage(session, dataToSend, PacketType::RELIABLE, true, compressed);
+    if (!seq)
+        return std::nullopt;
+
+    session.reliableChannel.onTransmit(*reliableSeq, *seq, std::chrono::steady_clock::now());
+    armReliableTimer(session);
+    return seq;
+}
+
+std::optional<uint32_t> UDPNetwork::prepareMessage(PeerSession& session, PacketBuffer& dataToSend, PacketType packetType, bool keepPlaintext, bool compressed)
+{
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    if (!cipher && encryptionRequired)
+    {
+        if (!session.warnedNoKeys.exchange(true))
+            NETWORK_LOG_WARNING("[Network] No keys with {} yet, holding back its data", session.endpointString());
+        return std::nullopt;
+    }
+
+    // The sealed copy below comes from a fresh slab, the trace stays with the packet
+    uint32_t trace = dataToSend.trace();
+
+    // Calculate total packet size: header (16 bytes at most) + message (+ descriptor and tag)
+    size_t plainSize = dataToSend.size();
+    size_t sealedSize = plainSize + (cipher ? SEAL_OVERHEAD : 0);
+    size_t packetSize = HEADER_SIZE + sealedSize;
+    if (packetSize > MAX_PACKET_SIZE)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Message too large, max size is {}", (MAX_PACKET_SIZE - HEADER_SIZE));
+        return std::nullopt;
+    }
+
+    // The plaintext has to survive (reliable retransmits), it's sealed in a copy of its own
+    if (cipher && keepPlaintext)
+    {
+        PacketBuffer copy = packetPool->acquire(plainSize);
+        if (!copy)
+        {
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot seal message");
+            return std::nullopt;
+        }
+        std::memcpy(copy.data(), dataToSend.data(), plainSize);
+        dataToSend = std::move(copy);
+    }
+    if (cipher && dataToSend.tailroom() < SEAL_OVERHEAD)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Message buffer has no tailroom for the tag");
+        return std::nullopt;
+    }
+    if (dataToSend.headroom() < HEADER_SIZE)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Message buffer has no headroom for the header");
+        return std::nullopt;
+    }
+
+    // All 64 bits go into the nonce, the wire carries the low 32
+    uint64_t packetNumber = session.nextSeqNumber++;
+    uint32_t seq = static_cast<uint32_t>(packetNumber);
+    
+    /*
+    * SMALL CUSTOM PROTOCOL HEADER
+    */
+
+    // Trailers are decided first, the header goes in front of the payload last, in the same slab.
+    // Sealed, what describes the payload is sealed with it: its flags go in the descriptor.
+    wire::Header header = makeHeader(&session, packetType, seq, plainSize);
+    uint8_t descriptor = 0;
+    uint8_t& flags = cipher ? descriptor : header.flags;
+    if (cipher)
+        header.flags |= FLAG_ENCRYPTED;
+    if (compressed)
+        flags |= FLAG_COMPRESSED;
+    size_t headerSize = wire::encodedSize(header);
+    size_t sealOverhead = cipher ? SEAL_OVERHEAD : 0;
+    // Sealed trailers grow the FEC symbol, they leave parity the room tunnelMtu kept for it
+    bool protectedMessage = packetType == PacketType::MESSAGE && session.fecEncoder.params().enabled();
+    size_t trailerLimit = datagramLimit(session) - (cipher && protectedMessage ? PARITY_OVERHEAD : 0);
+
+    // Piggyback a pending ACK after the payload, receivers only read `length` bytes of payload
+    if (session.ackTracker.ackPending() &&
+        dataToSend.tailroom() >= AckFrame::WIRE_SIZE + sealOverhead &&
+        headerSize + dataToSend.size() + AckFrame::WIRE_SIZE + sealOverhead <= trailerLimit)
+    {
+        AckFrame frame;
+        if (session.ackTracker.takeAck(frame))
+        {
+            size_t size = dataToSend.size();
+            dataToSend.resize(size + AckFrame::WIRE_SIZE);
+            frame.encode(dataToSend.data() + size);
+            flags |= FLAG_ACK_TRAILER;
+        }
+    }
+
+    // A sampled packet's stamps go last, peers that don't trace never read past the ack trailer.
+    // v2 has no flag bit to spare for them, in the clear they ride in the header as an extension instead.
+    // Published even if they don't fit, our own half of the trace is still worth having.
+    tracing::Trailer trailer;
+    uint8_t traceExtension[2 + tracing::Trailer::WIRE_SIZE];
+    if (trace && tracing::submit(trace, trailer))
+    {
+        if (!cipher && wire::versionOf(header) == wire::V2)
+        {
+            traceExtension[0] = EXT_TRACE;
+            traceExtension[1] = tracing::Trailer::WIRE_SIZE;
+            trailer.encode(traceExtension + 2);
+            size_t extendedSize = headerSize + 1 + sizeof(traceExtension);
+            if (dataToSend.headroom() >= extendedSize &&
+                extendedSize + dataToSend.size() <= datagramLimit(session))
+            {
+                header.extensions = traceExtension;
+                header.extensionsSize = sizeof(traceExtension);
+            }
+        }
+        else if (dataToSend.tailroom() >= tracing::Trailer::WIRE_SIZE + sealOverhead &&
+            headerSize + dataToSend.size() + tracing::Trailer::WIRE_SIZE + sealOverhead <= trailerLimit)
+        {
+            size_t size = dataToSend.size();
+            dataToSend.resize(size + tracing::Trailer::WIRE_SIZE);
+            trailer.encode(dataToSend.data() + size);
+            flags |= FLAG_TRACED;
+        }
+    }
+
+    // Seal in place, payload, trailers, descriptor and tag stay in the same slab. The header is
+    // final by now and authenticated with them, a flipped flag fails the tag like a flipped byte.
+    if (cipher)
+    {
+        size_t innerSize = dataToSend.size() + SEALED_DESCRIPTOR_SIZE;
+        dataToSend.resize(innerSize + crypto::TAG_SIZE);
+        dataToSend[innerSize - 1] = descriptor;
+        header.length = static_cast<uint32_t>(dataToSend.size());
+        std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+        cipher->seal(dataToSend.data(), dataToSend.data(), innerSize, static_cast<uint8_t>(packetType), packetNumber,
+            ad.data(), ad.size());
+    }
+    attachCustomHeader(dataToSend, header);
+    
+    // Track for acknowledgment
+    session.ackTracker.onSend(seq, std::chrono::steady_clock::now(), dataToSend.size());
+
+    return seq;
+}
+
+void UDPNetwork::protectMessage(PeerSession& session, const PacketBuffer& datagram, uint32_t seq)
+{
+    if (!session.fecEncoder.params().enabled())
+        return;
+
+    // Symbol is [len16][payload], the tail of our header already has exactly that in front
+    std::optional<wire::Header> header = wire::decode(datagram.data(), datagram.size());
+    PacketBuffer symbol = datagram.share();
+    symbol.pull(header->size - 2);
+    symbol.resize(header->length + 2);
+    session.fecEncoder.add(seq, std::move(symbol), *packetPool, parityBatch);
+}
+
+bool UDPNetwork::prepareParity(PeerSession& session, FecEncoder::Parity& parity)
+{
+    if (parity.payload.headroom() < HEADER_SIZE ||
+        HEADER_SIZE + parity.payload.size() > MAX_PACKET_SIZE)
+    {
+        return false;
+    }
+
+    // Parity doesn't take a seq of its own, the receiver finds its group by the base seq.
+    // The path's DF would drop it past the MTU (packets from before the adapter MTU came down).
+    wire::Header header = makeHeader(&session, PacketType::FEC_PARITY, parity.baseSeq, parity.payload.size());
+    if (wire::encodedSize(header) + parity.payload.size() > datagramLimit(session))
+    {
+        metrics::add(metrics::Counter::DROP_PARITY_OVERSIZE);
+        return false;
+    }
+    attachCustomHeader(parity.payload, header);
+    return true;
+}
+
+void UDPNetwork::sendParity(PeerSession& session)
+{
+    for (FecEncoder::Parity& parity : parityBatch)
+    {
+        if (prepareParity(session, parity))
+            dispatchMessage(session, std::move(parity.payload), parity.baseSeq);
+    }
+    parityBatch.clear();
+}
+
+void UDPNetwork::adaptFec(PeerSession& session)
+{
+    uint64_t sent = session.ackTracker.sentCount();
+    uint64_t lost = session.ackTracker.lostCount();
+    uint64_t sentDelta = sent - session.fecLastSent;
+    if (sentDelta < FEC_MIN_SAMPLE)
+        return;
+
+    // Recovered packets are never acked, so this is the raw path loss
+    double lossRate = static_cast<double>(lost - session.fecLastLost) / static_cast<double>(sentDelta);
+    session.fecLastSent = sent;
+    session.fecLastLost = lost;
+
+    FecParams current = session.fecEncoder.params();
+    FecParams next = fec::paramsForLoss(lossRate);
+    if (next.k != current.k || next.m != current.m)
+    {
+        NETWORK_LOG_INFO("[Network] Loss to {} {:.2f}%, FEC now {}:{}",
+            session.endpointString(), lossRate * 100.0, next.k, next.m);
+        session.fecEncoder.setParams(next);
+    }
+}
+
+void UDPNetwork::setFec(FecParams params, bool adaptive)
+{
+    fecAdaptive = adaptive;
+    fecParams = adaptive && !params.enabled() ? fec::paramsForLoss(0.0) : params;
+    peers.forEach([this](PeerSession& session) { session.fecEncoder.setParams(fecParams); });
+}
+
+void UDPNetwork::dispatchMessage(PeerSession& session, PacketBuffer packet, uint32_t seq)
+{
+    if (rio)
+    {
+        OutgoingDatagram datagram{std::move(packet), session.endpoint()};
+        if (rio->send(&datagram, 1) == 1)
+            return;
+        packet = std::move(datagram.packet);
+    }
+
+    transmitMessage(session, std::move(packet), seq);
+}
+
+void UDPNetwork::transmitMessage(PeerSession& session, PacketBuffer packet, uint32_t seq)
+{
+    // Send packet asynchronously, the handler owns the buffer until completion
+    auto buffer = boost::asio::buffer(packet.data(), packet.size());
+    PeerId peer = session.id;
+    socket->async_send_to(
+        buffer, session.endpoint(),
+        [this, packet = std::move(packet), seq, peer](const boost::system::error_code& error, std::size_t bytesSent) mutable
+        {
+            this->handleSendComplete(error, bytesSent, seq, peer, packet);
+        });
+}
+
+void UDPNetwork::handleSendComplete(
+    const boost::system::error_code& error,
+    std::size_t bytesSent,
+    uint32_t seq,
+    PeerId peer,
+    PacketBuffer& packet)
+{
+    if (error)
+    {
+        if (error == boost::asio::error::would_block || 
+            error == boost::asio::error::try_again ||
+            error == boost::asio::error::no_buffer_space ||
+            error.value() == 10035) // WSAEWOULDBLOCK
+        {
+            // Paced traffic waits at the head of its pacer until the socket drains
+            PeerSession* session = peers.get(peer);
+            if (pacing() && session && !session->closing)
+            {
+                session->pacer.handBack(std::move(packet));
+                pacerHandBack.store(true, std::memory_order_release);
+                return;
+            }
+
+            // No resend, the ack window counts it as lost once later seqs are acked
+            metrics::add(metrics::Counter::DROP_SEND_BUFFER);
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Send buffer full, dropping packet seq={}", seq);
+        }
+        else
+        {
+            metrics::add(metrics::Counter::DROP_SEND_ERROR);
+            SYSTEM_LOG_ERROR_SUMMARY("[Network] Send error: {}, with error code: {}", error.message(), error.value());
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Send error: {}, with error code: {}", error.message(), error.value());
+            
+            // Disconnect on fatal errors, not temporary ones
+            if (error != boost::asio::error::operation_aborted)
+            {
+                if (PeerSession* target = peers.get(peer))
+                {
+                    boost::asio::post(shardOf(*target).context, [this, peer]()
+                    {
+                        if (PeerSession* session = this->peers.get(peer))
+                            this->handleDisconnect(*session);
+                    });
+                }
+            }
+        }
+        return;
+    }
+
+    metrics::add(metrics::Counter::UDP_TX_PACKETS);
+    metrics::add(metrics::Counter::UDP_TX_BYTES, bytesSent);
+}
+
+void UDPNetwork::processMessage(PacketBuffer message, size_t lane)
+{
+    if (onMessageCallback)
+    {
+        onMessageCallback(std::move(message), lane);
+    }
+}
 
 void UDPNetwork::setMessageCallback(MessageCallback callback)
 {
-    onMessageCallback = std::move(callback);
+    onMessageCallback = std::move(callback);
+}
+
+void UDPNetwork::setMessageBatchCallback(MessageBatchCallback callback)
+{
+    onMessageBatchCallback = std::move(callback);
+}
+
+void UDPNetwork::processBundle(Shard& shard, PeerSession& session, const PacketBuffer& bundle)
+{
+    PacketBatch& packets = shard.bundleDeliveries;
+    if (!PacketAggregator::split(bundle, packets))
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping malformed bundle from {}", session.endpointString());
+        return;
+    }
+
+    // Inner packets are views into the bundle, compressed ones inflate into buffers of their own
+    for (PacketBuffer& packet : packets)
+    {
+        if (compression::isFrame(packet) && !inflatePayload(session, packet))
+            packet = PacketBuffer();
+    }
+
+    if (onMessageBatchCallback)
+    {
+        onMessageBatchCallback(packets, shard.index);
+    }
+    else
+    {
+        for (PacketBuffer& packet : packets)
+        {
+            if (packet)
+                processMessage(std::move(packet), shard.index);
+        }
+    }
+    packets.clear();
+}
+
+int UDPNetwork::getLocalPort() const
+{
+    return localPort;
+}
+
+std::string UDPNetwork::getLocalAddress() const
+{
+    return localAddress;
+}
+
+void UDPNetwork::startAsyncReceive()
+{
+    if (!socket) {
+        NETWORK_LOG_ERROR("[Network] startAsyncReceive: socket is null!");
+        return;
+    }
+    
+    if (!socket->is_open()) {
+        NETWORK_LOG_ERROR("[Network] startAsyncReceive: socket is not open!");
+        return;
+    }
+    
+    // Receive straight into a pooled slab (header lands at offset 0, so it becomes headroom once parsed).
+    // Datagrams that don't fit the slab spill into the overflow buffer.
+    receiveBuffer = packetPool->acquire(PacketPool::SMALL_SLAB_SIZE, 0);
+    size_t slabBytes = receiveBuffer ? receiveBuffer.size() : 0;
+    std::array<boost::asio::mutable_buffer, 2> buffers = {
+        boost::asio::buffer(receiveBuffer ? receiveBuffer.data() : nullptr, slabBytes),
+        boost::asio::buffer(receiveOverflow.get(), MAX_PACKET_SIZE - slabBytes)
+    };
+    
+    socket->async_receive_from(
+        buffers, receiveEndpoint,
+        [this](const boost::system::error_code& error, std::size_t bytesTransferred)
+        {
+            this->handleReceiveFrom(error, bytesTransferred);
+        }
+    );
+}
+
+void UDPNetwork::handleReceiveFrom(
+    const boost::system::error_code& error,
+    std::size_t bytesTransferred)
+{
+    PacketBuffer packet = std::move(receiveBuffer);
+    boost::asio::ip::udp::endpoint sender = receiveEndpoint;
+
+    // Gather a spilled datagram before the next receive can overwrite the overflow buffer
+    if (!error)
+    {
+        size_t slabBytes = packet ? packet.size() : 0;
+        if (bytesTransferred > slabBytes)
+        {
+            PacketBuffer large = packetPool->acquire(bytesTransferred, 0);
+            if (large)
+            {
+                if (slabBytes)
+                    std::memcpy(large.data(), packet.data(), slabBytes);
+                std::memcpy(large.data() + slabBytes, receiveOverflow.get(), bytesTransferred - slabBytes);
+            }
+            else
+            {
+                metrics::add(metrics::Counter::DROP_POOL_EXHAUSTED);
+                NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, dropping {} byte datagram", bytesTransferred);
+            }
+            packet = std::move(large);
+        }
+        else
+        {
+            packet.resize(bytesTransferred);
+        }
+    }
+
+    // With batched receive the socket is drained before re-arming, so datagrams stay in arrival order
+    bool drainQueued = !error && batchIO && batchIO->canReceiveBatch();
+    bool rearm = socket && socket->is_open() && error != boost::asio::error::operation_aborted;
+
+    if (rearm && !drainQueued)
+    {
+        startAsyncReceive(); // Continuously queue up another startAsyncReceive
+    }
+
+    if (!error)
+    {
+        if (packet)
+            processReceivedData(std::move(packet), sender);
+
+        if (drainQueued)
+        {
+            drainReceiveQueue();
+            if (socket && socket->is_open())
+                startAsyncReceive();
+        }
+    }
+    else if (error != boost::asio::error::operation_aborted)
+    {
+        // Handle error but don't terminate unless it's fatal
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Receive error: {} (code: {})", error.message(), error.value());
+        
+        if (error == boost::asio::error::would_block || 
+            error == boost::asio::error::try_again ||
+            error.value() == 10035) // WSAEWOULDBLOCK
+        {
+            // Recoverable errors
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Recoverable receive error: {} (code: {}), continuing", error.message(), error.value());
+        }
+        else
+        {
+            // Fatal errors
+            NETWORK_LOG_ERROR("[Network] Fatal receive error: {} (code: {}), disconnecting", error.message(), error.value());
+            // The socket is shared, every peer goes with it
+            peers.forEach([this](PeerSession& session)
+            {
+                boost::asio::post(shardOf(session).context, [this, &session]() { handleDisconnect(session); });
+            });
+        }
+    }
+}
+
+void UDPNetwork::drainReceiveQueue()
+{
+    for (size_t round = 0; round < MAX_RECEIVE_ROUNDS; ++round)
+    {
+        size_t received = batchIO->receiveBatch(receivedBatch.data(), receivedBatch.size());
+        for (size_t i = 0; i < received; ++i)
+        {
+            processReceivedData(std::move(receivedBatch[i].packet), receivedBatch[i].sender);
+        }
+
+        if (received < receivedBatch.size())
+            break;
+    }
+}
+
+void UDPNetwork::processReceivedData(
+    PacketBuffer packet,
+    const boost::asio::ip::udp::endpoint& sender)
+{
+    std::size_t bytesTransferred = packet.size();
+    metrics::add(metrics::Counter::UDP_RX_PACKETS);
+    metrics::add(metrics::Counter::UDP_RX_BYTES, bytesTransferred);
+
+    // Skip if we don't have enough data for any header
+    if (bytesTransferred < wire::MIN_SIZE)
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Received packet too small: {} bytes", bytesTransferred);
+        return;
+    }
+    
+    const uint8_t* buffer = packet.data();
+
+    // Our own STUN check after a network change, answered to the tunnel socket
+    if (stunTransaction && !wire::isV2(buffer[0]) && StunClient::isStunMessage(buffer, bytesTransferred))
+    {
+        handleStunResponse(packet);
+        return;
+    }
+
+    /*
+    * SMALL CUSTOM PROTOCOL HEADER
+    */
+
+    // Either version, the payload length is checked against the datagram here
+    std::optional<wire::Header> header = wire::decode(buffer, bytesTransferred);
+    if (!header)
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Received packet with an invalid header from {}:{}", sender.address().to_string(), sender.port());
+        return;
+    }
+    
+    // Get packet type
+    PacketType packetType = static_cast<PacketType>(header->type);
+
+    // Find the sender's session, one hash lookup. A peer that moved names the session it belongs to,
+    // its shard checks the claim before anything follows the new address.
+    PeerSession* session = peers.find(sender);
+    if (!session && (packetType == PacketType::MIGRATE || packetType == PacketType::PATH_PROBE))
+    {
+        if (std::optional<uint32_t> claimed = receiverSessionId(*header, buffer + header->size))
+            session = peers.findBySession(*claimed);
+    }
+    if (!session && packetType != PacketType::DISCONNECT)
+        session = peers.adoptPending(sender);
+    if (!session)
+    {
+        metrics::add(metrics::Counter::DROP_UNKNOWN_SENDER);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping packet from unknown sender {}:{}", sender.address().to_string(), sender.port());
+        return;
+    }
+
+    // Peer is going away, its shard has already let go of it
+    if (session->closing.load(std::memory_order_acquire))
+        return;
+
+    routeToShard(*session, std::move(packet), *header, sender);
+}
+
+void UDPNetwork::routeToShard(
+    PeerSession& session,
+    PacketBuffer packet,
+    const wire::Header& header,
+    const boost::asio::ip::udp::endpoint& sender)
+{
+    Shard& shard = shardOf(session);
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(shard.inboxMutex);
+        wake = shard.inbox.empty();
+        shard.inbox.push_back(Shard::Inbound{
+            std::move(packet), header, sender, session.id, session.generation.load(std::memory_order_relaxed)});
+    }
+
+    // One wake-up per burst, the worker takes everything queued by the time it runs
+    if (wake)
+    {
+        boost::asio::post(shard.context, [this, &shard]()
+        {
+            drainInbox(shard);
+        });
+    }
+}
+
+void UDPNetwork::drainInbox(Shard& shard)
+{
+    {
+        std::lock_guard<std::mutex> lock(shard.inboxMutex);
+        shard.processing.swap(shard.inbox);
+    }
+    shard.now = std::chrono::steady_clock::now();
+
+    for (Shard::Inbound& inbound : shard.processing)
+    {
+        // Slot changed hands or is being torn down since the IO thread routed this
+        PeerSession* session = peers.get(inbound.peer);
+        if (!session || session->closing ||
+            session->generation.load(std::memory_order_relaxed) != inbound.generation)
+        {
+            continue;
+        }
+        processPeerPacket(shard, *session, std::move(inbound.packet), inbound.header, inbound.sender);
+    }
+    shard.processing.clear();
+}
+
+void UDPNetwork::processPeerPacket(
+    Shard& shard,
+    PeerSession& peer,
+    PacketBuffer packet,
+    const wire::Header& header,
+    const boost::asio::ip::udp::endpoint& sender)
+{
+    std::size_t bytesTransferred = packet.size();
+    const uint8_t* buffer = packet.data();
+    PacketType packetType = static_cast<PacketType>(header.type);
+    uint32_t seq = header.seq;
+    
+    // Update peer activity time
+    peer.connection.updateActivity(shard.now);
+
+    // This could probablt be structured better, lol
+    if (packetType != PacketType::DISCONNECT)
+    {
+        // Consume packet if network not running
+        if (!running)
+        {
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Received packet, but network not running");
+            return;
+        }
+
+        // First packet from this peer, it's reachable now
+        if (!peer.connection.isConnected())
+        {
+            // Answered from a remapped port, that's where we talk to it from now on.
+            // A relayed peer stays on the relay until the probes say otherwise.
+            if (sender != peer.endpoint() && !peer.relayed)
+            {
+                NETWORK_LOG_INFO("[Network] Peer {} answered from {}:{}, rebinding",
+                    peer.endpointString(), sender.address().to_string(), sender.port());
+                peer.setEndpoint(sender);
+            }
+
+            NETWORK_LOG_INFO("[Network] First valid packet received from peer {}, establishing connection", peer.endpointString());
+
+            // A new peer starts its seqs over
+            peer.ackTracker.resetReceive();
+            peer.reliableChannel.resetReceive();
+            peer.fecDecoder.reset();
+            peer.fecReceiving = false;
+            peer.holePunchRemaining = 0;
+            peer.holePunchTimer.cancel();
+            peer.congestion.reset(congestionMode.load(std::memory_order_relaxed));
+            peer.connection.setConnected(true);
+            
+            // Notify peer connected event
+            notifyConnectionEvent(NetworkEvent::PEER_CONNECTED, peer.endpointString(), peer.id);
+
+            // Find out how large our datagrams to it may get
+            peer.pathMtu.reset();
+            probePathMtu(peer);
+        }
+    }
+
+    // Process packet based on type
+    switch (packetType)
+    {
+        case PacketType::HOLE_PUNCH:
+        {
+            NETWORK_LOG_DEBUG("[Network] Received hole-punch packet from peer");
+            // Activity time was already updated above. Newer peers tell us their session id,
+            // it's what our MIGRATEs are addressed by; an authenticated MIGRATE has the final say.
+            const uint8_t* payload = buffer + header.size;
+            if (header.length >= SESSION_ID_SIZE && peer.remoteSessionId.load(std::memory_order_relaxed) == 0)
+                peer.remoteSessionId.store(readSessionId(payload), std::memory_order_relaxed);
+
+            // Then the highest header version it reads, every punch says it again. Peers without
+            // one are older builds and only read v1.
+            uint8_t version = header.length > SESSION_ID_SIZE && payload[SESSION_ID_SIZE] >= wire::V2 ? wire::V2 : wire::V1;
+            if (peer.wireVersion.exchange(version, std::memory_order_relaxed) != version)
+                NETWORK_LOG_INFO("[Network] Peer {} reads header v{}", peer.endpointString(), version);
+            break;
+        }
+
+        case PacketType::MIGRATE:
+            handleMigrate(peer, packet, header, sender);
+            break;
+
+        case PacketType::PATH_PROBE:
+            handlePathProbe(peer, packet, header, sender);
+            break;
+            
+        case PacketType::HEARTBEAT:
+            metrics::add(metrics::Counter::HEARTBEATS_RX);
+            // Activity time was already updated above
+            break;
+            
+        case PacketType::DISCONNECT:
+        {
+            // Peer wants to disconnect. It's the last thing it sends under these keys, nothing to replay.
+            uint8_t none[1];
+            if (!openSessionControl(peer, packet, header, none, 0))
+                break;
+            SYSTEM_LOG_INFO("[Network] Received disconnect notification from peer {}", peer.endpointString());
+            NETWORK_LOG_INFO("[Network] Received disconnect notification from peer {}", peer.endpointString());
+            handleDisconnect(peer);
+            break;
+        }
+            
+        case PacketType::MESSAGE:
+        case PacketType::RELIABLE:
+        case PacketType::AGGREGATE:
+        {
+            // Nothing in it counts before it authenticates. FEC symbols are the sealed bytes,
+            // so a datagram the decoder keeps a view of is opened into a buffer of its own.
+            bool keepSymbol = packetType == PacketType::MESSAGE && peer.fecReceiving;
+            // Already rebuilt from parity, this is the late original. Its number is taken, it wouldn't open again.
+            if (keepSymbol && peer.fecDecoder.wasRecovered(seq))
+                break;
+            PacketBuffer payload;
+            PayloadExtras extras;
+            if (!openPayload(peer, packet, header, keepSymbol, payload, extras))
+                break;
+            bool compressed = extras.compressed;
+            
+            // Acks are batched, sent on a short timer or with our next data packet
+            if (peer.ackTracker.onReceive(seq))
+                sendAck(peer);
+            else
+                scheduleAck(peer);
+
+            // The peer's ACK for our data may be riding on this packet
+            if (extras.ack)
+                handleAckFrame(peer, AckFrame::decode(extras.ack));
+
+            // A packet the peer sampled, our half of the trace starts here
+            uint32_t trace = 0;
+            if (extras.stamps)
+            {
+                std::chrono::microseconds oneWay = peer.ackTracker.smoothedRtt() / 2;
+                trace = tracing::beginRemote(tracing::Trailer::decode(extras.stamps), oneWay, payload.size());
+            }
+
+            if (keepSymbol)
+            {
+                PacketBuffer symbol = packet.share();
+                symbol.pull(header.size - 2);
+                symbol.resize(header.length + 2);
+                peer.fecDecoder.onData(seq, symbol, *packetPool, shard.fecRecovered);
+            }
+            packet = std::move(payload);
+            if (trace)
+                packet.setTrace(trace);
+
+            if (packetType == PacketType::AGGREGATE)
+            {
+                processBundle(shard, peer, packet);
+                break;
+            }
+
+            if (packetType == PacketType::RELIABLE)
+            {
+                if (packet.size() < ReliableChannel::PREFIX_SIZE)
+                {
+                    NETWORK_LOG_ERROR_SUMMARY("[Network] Reliable message too short for its header");
+                    return;
+                }
+
+                const uint8_t* prefix = packet.data();
+                uint32_t reliableSeq = (prefix[0] << 24) | (prefix[1] << 16) | (prefix[2] << 8) | prefix[3];
+                packet.pull(ReliableChannel::PREFIX_SIZE);
+                if (compressed && !inflatePayload(peer, packet))
+                    break;
+
+                // Held back until the gap in front of it fills or times out
+                peer.reliableChannel.onReceive(reliableSeq, std::move(packet), std::chrono::steady_clock::now(), shard.reliableDeliveries);
+                deliverReliable(peer);
+                if (peer.reliableChannel.hasHeld())
+                    armReliableTimer(peer);
+                break;
+            }
+            
+            // Process message, send to wintun interface
+            // Revert to boost::asio::post in case the following breaks the program
+            if (!compressed || inflatePayload(peer, packet))
+                this->processMessage(std::move(packet), shard.index);
+
+            // A late member can complete a group that was waiting on it
+            deliverRecovered(peer);
+            break;
+        }
+        case PacketType::FEC_PARITY:
+        {
+            // Symbols are only kept once the peer turns out to send parity, this group may be lost
+            peer.fecReceiving = true;
+
+            packet.pull(header.size);
+            packet.resize(header.length);
+            peer.fecDecoder.onParity(seq, packet, *packetPool, shard.fecRecovered);
+
+            // Rebuilt packets are not acked, the sender keeps seeing the real loss rate
+            deliverRecovered(peer);
+            break;
+        }
+        case PacketType::MTU_PROBE:
+        {
+            // Echo the size that actually got here and the probe's token, the peer learns it crossed unfragmented
+            if (bytesTransferred <= PathMtuProber::MAX_DATAGRAM && header.length >= MTU_TOKEN_SIZE)
+                sendPathMtuAck(peer, static_cast<uint16_t>(bytesTransferred), wire::load32(buffer + header.size));
+            break;
+        }
+        case PacketType::MTU_PROBE_ACK:
+        {
+            if (seq <= PathMtuProber::MAX_DATAGRAM && header.length >= MTU_TOKEN_SIZE)
+                peer.pathMtu.onAck(static_cast<uint16_t>(seq), wire::load32(buffer + header.size));
+            break;
+        }
+        case PacketType::ACK:
+        {
+            // Sealed ones count up, an older seq is a replay or overtaken by a newer ACK
+            bool sealed = (header.flags & FLAG_ENCRYPTED) != 0;
+            if (sealed && seq <= peer.ackSeen)
+                break;
+
+            // Peers on the old per-message scheme send header-only ACKs, those carry nothing we track
+            uint8_t frame[AckFrame::WIRE_SIZE];
+            std::optional<size_t> length = openSessionControl(peer, packet, header, frame, sizeof(frame));
+            if (!length)
+                break;
+            if (sealed)
+                peer.ackSeen = seq;
+            if (*length == AckFrame::WIRE_SIZE)
+                handleAckFrame(peer, AckFrame::decode(frame));
+            break;
+        }
+        default:
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Unknown packet type: {}", static_cast<int>(packetType));
+            break;
+    }
+}
+
+bool UDPNetwork::openPayload(
+    PeerSession& session,
+    const PacketBuffer& datagram,
+    const wire::Header& header,
+    bool keepDatagram,
+    PacketBuffer& payload,
+    PayloadExtras& extras)
+{
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    bool sealed = (header.flags & FLAG_ENCRYPTED) != 0;
+    uint32_t seq = header.seq;
+    uint32_t msgLen = header.length;
+
+    if (!sealed)
+    {
+        // Clear text is only taken from a peer we have no keys with, and only if allowed
+        if (cipher || encryptionRequired)
+        {
+            metrics::add(metrics::Counter::DROP_UNENCRYPTED);
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping unencrypted data packet from {}", session.endpointString());
+            return false;
+        }
+
+        // The trailers follow the payload, the stamps may be in the header instead
+        size_t trailers = header.size + msgLen;
+        extras.compressed = (header.flags & FLAG_COMPRESSED) != 0;
+        if ((header.flags & FLAG_ACK_TRAILER) && trailers + AckFrame::WIRE_SIZE <= datagram.size())
+        {
+            extras.ack = datagram.data() + trailers;
+            trailers += AckFrame::WIRE_SIZE;
+        }
+        std::optional<wire::Extension> traceExtension = wire::findExtension(header, EXT_TRACE);
+        if (traceExtension && traceExtension->length == tracing::Trailer::WIRE_SIZE)
+            extras.stamps = traceExtension->value;
+        else if ((header.flags & FLAG_TRACED) && trailers + tracing::Trailer::WIRE_SIZE <= datagram.size())
+            extras.stamps = datagram.data() + trailers;
+
+        // Strip our header in place, the wintun packet stays in the same slab
+        payload = datagram.share();
+        payload.pull(header.size);
+        payload.resize(msgLen);
+        return true;
+    }
+
+    if (!cipher || msgLen < SEAL_OVERHEAD)
+    {
+        metrics::add(metrics::Counter::DROP_NO_KEYS);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping encrypted packet from {}, no keys for it yet", session.endpointString());
+        return false;
+    }
+
+    // Everything describing the payload is sealed with it, nothing outside the tag is read
+    if (header.flags != FLAG_ENCRYPTED || header.extensionsSize)
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Sealed packet seq={} from {} has flags outside the seal", seq, session.endpointString());
+        return false;
+    }
+
+    size_t plainLength = msgLen - crypto::TAG_SIZE;
+    uint8_t type = header.type;
+    uint64_t packetNumber = crypto::widenSeq(session.rxPacketNumber, seq);
+    if (!session.replayWindow.fresh(packetNumber))
+    {
+        metrics::add(metrics::Counter::DROP_REPLAY);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Packet seq={} from {} was taken before", seq, session.endpointString());
+        return false;
+    }
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    if (keepDatagram)
+    {
+        payload = packetPool->acquire(plainLength);
+        if (!payload)
+        {
+            metrics::add(metrics::Counter::DROP_POOL_EXHAUSTED);
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, dropping {} byte datagram", msgLen);
+            return false;
+        }
+        if (!cipher->open(payload.data(), datagram.data() + header.size, msgLen, type, packetNumber, ad.data(), ad.size()))
+        {
+            metrics::add(metrics::Counter::DROP_DECRYPT);
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Packet seq={} from {} failed authentication", seq, session.endpointString());
+            payload = PacketBuffer();
+            return false;
+        }
+    }
+    else
+    {
+        // Decrypt where it lies, the wintun packet stays in the same slab
+        payload = datagram.share();
+        payload.pull(header.size);
+        if (!cipher->open(payload.data(), payload.data(), msgLen, type, packetNumber, ad.data(), ad.size()))
+        {
+            metrics::add(metrics::Counter::DROP_DECRYPT);
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Packet seq={} from {} failed authentication", seq, session.endpointString());
+            payload = PacketBuffer();
+            return false;
+        }
+        payload.resize(plainLength);
+    }
+    session.rxPacketNumber = std::max(session.rxPacketNumber, packetNumber);
+    session.replayWindow.mark(packetNumber);
+
+    // Authentic, but a descriptor this build doesn't know
+    if (!takeSealedTrailers(payload, extras))
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Sealed packet seq={} from {} has a malformed descriptor", seq, session.endpointString());
+        payload = PacketBuffer();
+        return false;
+    }
+    return true;
+}
+
+bool UDPNetwork::takeSealedTrailers(PacketBuffer& plain, PayloadExtras& extras)
+{
+    if (plain.size() < SEALED_DESCRIPTOR_SIZE)
+        return false;
+    size_t size = plain.size() - SEALED_DESCRIPTOR_SIZE;
+    uint8_t descriptor = plain[size];
+    if (descriptor & ~(FLAG_ACK_TRAILER | FLAG_COMPRESSED | FLAG_TRACED))
+        return false;
+
+    // Taken off the end, in the reverse of the order they were appended in
+    if (descriptor & FLAG_TRACED)
+    {
+        if (size < tracing::Trailer::WIRE_SIZE)
+            return false;
+        size -= tracing::Trailer::WIRE_SIZE;
+        extras.stamps = plain.data() + size;
+    }
+    if (descriptor & FLAG_ACK_TRAILER)
+    {
+        if (size < AckFrame::WIRE_SIZE)
+            return false;
+        size -= AckFrame::WIRE_SIZE;
+        extras.ack = plain.data() + size;
+    }
+    extras.compressed = (descriptor & FLAG_COMPRESSED) != 0;
+    plain.resize(size);
+    return true;
+}
+
+void UDPNetwork::deliverRecovered(PeerSession& session)
+{
+    Shard& shard = shardOf(session);
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    for (FecDecoder::Recovered& recovered : shard.fecRecovered)
+    {
+        PacketBuffer plain;
+        bool compressed;
+        if (!cipher)
+        {
+            if (encryptionRequired)
+                continue;
+            plain = std::move(recovered.payload);
+            // The header flag went down with the datagram, the frame tag stands in for it
+            compressed = compression::isFrame(plain);
+        }
+        else
+        {
+            // The decoder keeps the rebuilt symbol for later groups, open it into a buffer of its own.
+            // Only a sealed MESSAGE is protected, its header is rebuilt from what that implies.
+            size_t sealedLength = recovered.payload.size();
+            uint64_t packetNumber = crypto::widenSeq(session.rxPacketNumber, recovered.seq);
+            if (!session.replayWindow.fresh(packetNumber))
+            {
+                metrics::add(metrics::Counter::DROP_REPLAY);
+                continue;
+            }
+            wire::Header header;
+            header.type = static_cast<uint8_t>(PacketType::MESSAGE);
+            header.flags = FLAG_ENCRYPTED;
+            header.seq = recovered.seq;
+            header.length = static_cast<uint32_t>(sealedLength);
+            std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+            plain = packetPool->acquire(sealedLength >= crypto::TAG_SIZE ? sealedLength - crypto::TAG_SIZE : 0);
+            if (!plain || !cipher->open(plain.data(), recovered.payload.data(), sealedLength,
+                    header.type, packetNumber, ad.data(), ad.size()))
+                continue;
+            session.rxPacketNumber = std::max(session.rxPacketNumber, packetNumber);
+            session.replayWindow.mark(packetNumber);
+
+            // Its ack and stamps are stale by now, only the payload is wanted
+            PayloadExtras extras;
+            if (!takeSealedTrailers(plain, extras))
+                continue;
+            compressed = extras.compressed;
+        }
+
+        if (compressed && !inflatePayload(session, plain))
+            continue;
+        metrics::add(metrics::Counter::FEC_RECOVERED);
+        this->processMessage(std::move(plain), shard.index);
+    }
+    shard.fecRecovered.clear();
+}
+
+bool UDPNetwork::setPeerCipher(PeerId id, CipherSuite suite, const uint8_t* rxKey, const uint8_t* txKey)
+{
+    PeerSession* session = peers.get(id);
+    if (!session || suite == CipherSuite::NONE)
+        return false;
+
+    // Not the slot in use, but a seal that loaded it two installs ago may still be running
+    PacketCipher& slot = session->cipherSlots[session->nextCipherSlot];
+    session->nextCipherSlot ^= 1;
+    session->waitForCipherReaders();
+    slot.init(suite, rxKey, txKey);
+    session->cipher.store(&slot, std::memory_order_seq_cst);
+
+    NETWORK_LOG_INFO("[Network] Traffic with {} sealed with {}", session->endpointString(), crypto::suiteName(suite));
+
+    // Path probes are sealed, a relayed peer can start racing its direct path now
+    uint32_t generation = session->generation.load(std::memory_order_relaxed);
+    boost::asio::post(shardOf(*session).context, [this, id, generation]()
+    {
+        PeerSession* session = peers.get(id);
+        if (session && !session->closing && session->generation.load(std::memory_order_relaxed) == generation)
+            probePaths(*session);
+    });
+    return true;
+}
+
+void UDPNetwork::setEncryptionRequired(bool required)
+{
+    encryptionRequired = required;
+}
+
+void UDPNetwork::setCompression(bool enabled)
+{
+    compressionEnabled = enabled;
+}
+
+bool UDPNetwork::compressPayload(PacketBuffer& payload)
+{
+    // A frame handed back in (reliable window full) is already compressed
+    if (compression::isFrame(payload))
+        return true;
+    return compressionEnabled.load(std::memory_order_relaxed) && compressor.compress(payload, *packetPool);
+}
+
+void UDPNetwork::setAggregation(std::chrono::microseconds deadline)
+{
+    aggregationDeadlineMicros = std::max<int64_t>(deadline.count(), 0);
+}
+
+bool UDPNetwork::aggregating(const PeerSession& session) const
+{
+    return aggregationDeadlineMicros.load(std::memory_order_relaxed) > 0 && !session.fecEncoder.params().enabled();
+}
+
+void UDPNetwork::holdSmallPackets(PeerSession& session, PacketBatch& packets)
+{
+    auto now = PacketAggregator::Clock::now();
+    session.aggregator.setCapacity(datagramLimit(session) - HEADER_SIZE - SEAL_OVERHEAD);
+
+    // Large packets stay in the batch in their order, small ones may overtake them by up to the deadline
+    size_t kept = 0;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        PacketBuffer& packet = packets[i];
+        if (!packet)
+            continue;
+
+        if (!PacketAggregator::accepts(packet))
+        {
+            if (kept != i)
+                packets[kept] = std::move(packet);
+            ++kept;
+            continue;
+        }
+
+        // Inner packets are compressed one by one, the frame tag marks them inside the bundle
+        compressPayload(packet);
+        if (session.aggregator.full(packet))
+            releaseAggregate(session);
+        session.aggregator.add(std::move(packet), now);
+    }
+    packets.resize(kept);
+
+    std::chrono::microseconds deadline(aggregationDeadlineMicros.load(std::memory_order_relaxed));
+    if (session.aggregator.due(now, deadline))
+        releaseAggregate(session);
+}
+
+void UDPNetwork::releaseAggregate(PeerSession& session)
+{
+    ReadyBundle ready;
+    ready.payload = session.aggregator.take(*packetPool, ready.bundled);
+    if (!ready.payload)
+    {
+        metrics::add(metrics::Counter::DROP_POOL_EXHAUSTED);
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, dropping bundle");
+        return;
+    }
+    readyBundles.push_back(std::move(ready));
+}
+
+std::optional<uint32_t> UDPNetwork::prepareBundle(PeerSession& session, ReadyBundle& ready)
+{
+    if (ready.bundled)
+        return prepareMessage(session, ready.payload, PacketType::AGGREGATE);
+
+    // A lone packet goes out as the MESSAGE it would have been
+    bool compressed = compression::isFrame(ready.payload);
+    std::optional<uint32_t> seq = prepareMessage(session, ready.payload, PacketType::MESSAGE, false, compressed);
+    if (seq)
+        protectMessage(session, ready.payload, *seq);
+    return seq;
+}
+
+bool UDPNetwork::flushAggregates()
+{
+    if (!running || !socket)
+        return false;
+
+    auto now = PacketAggregator::Clock::now();
+    std::chrono::microseconds deadline(aggregationDeadlineMicros.load(std::memory_order_relaxed));
+    bool holding = false;
+
+    try
+    {
+        peers.forEach([&](PeerSession& session)
+        {
+            if (session.aggregator.empty())
+                return;
+
+            // Peer went away while its packets waited
+            if (session.closing || !session.connection.isConnected())
+            {
+                session.aggregator.clear();
+                return;
+            }
+
+            if (!session.aggregator.due(now, deadline))
+            {
+                holding = true;
+                return;
+            }
+
+            releaseAggregate(session);
+            if (pacing())
+            {
+                paceBundles(session);
+                servicePacer(session, now);
+                return;
+            }
+            for (ReadyBundle& ready : readyBundles)
+            {
+                std::optional<uint32_t> seq = prepareBundle(session, ready);
+                if (seq)
+                    dispatchMessage(session, std::move(ready.payload), *seq);
+            }
+            readyBundles.clear();
+            sendParity(session);
+        });
+    }
+    catch (const std::exception& e)
+    {
+        readyBundles.clear();
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+    }
+    return holding;
 }
 
-int UDPNetwork::getLocalPort() const
+void UDPNetwork::setCongestionControl(CongestionMode mode)
 {
-    return localPort;
+    congestionMode = mode;
 }
 
-std::string UDPNetwork::getLocalAddress() const
+bool UDPNetwork::pace(PeerSession& session, PacketBuffer packet, Pacer::Kind kind)
 {
-    return localAddress;
+    session.pacer.adopt(session.generation.load(std::memory_order_relaxed));
+    // Reliable entries are tunnelled TCP, classed like the rest; the reliable seq goes on when they're staged
+    return session.pacer.enqueue(classifyTraffic(packet), Pacer::Entry{std::move(packet), kind});
 }
 
-void UDPNetwork::startAsyncReceive()
+void UDPNetwork::paceBundles(PeerSession& session)
 {
-    if (!socket) {
-        NETWORK_LOG_ERROR("[Network] startAsyncReceive: socket is null!");
-        return;
-    }
-    
-    if (!socket->is_open()) {
-        NETWORK_LOG_ERROR("[Network] startAsyncReceive: socket is not open!");
-        return;
+    session.pacer.adopt(session.generation.load(std::memory_order_relaxed));
+    for (ReadyBundle& ready : readyBundles)
+    {
+        // A bundle is made of small packets, so interactive; a lone packet is classed like any other
+        Pacer::Kind kind = ready.bundled ? Pacer::Kind::AGGREGATE : Pacer::Kind::MESSAGE;
+        TrafficClass trafficClass = ready.bundled ? TrafficClass::INTERACTIVE : classifyTraffic(ready.payload);
+        session.pacer.enqueue(trafficClass, Pacer::Entry{std::move(ready.payload), kind});
     }
-    
-    // Create buffer for each receive operation
-    auto receiveBuffer = std::make_shared<std::vector<uint8_t>>(MAX_PACKET_SIZE);
-    auto senderEndpoint = std::make_shared<boost::asio::ip::udp::endpoint>();
-    
-    socket->async_receive_from(
-        boost::asio::buffer(*receiveBuffer), *senderEndpoint,
-        [this, receiveBuffer, senderEndpoint](const boost::system::error_code& error, std::size_t bytesTransferred)
-        {
-            this->handleReceiveFrom(error, bytesTransferred, receiveBuffer, senderEndpoint);
-        }
-    );
+    readyBundles.clear();
 }
 
-void UDPNetwork::handleReceiveFrom(
-    const boost::system::error_code& error,
-    std::size_t bytesTransferred,
-    std::shared_ptr<std::vector<uint8_t>> receiveBuffer,
-    std::shared_ptr<boost::asio::ip::udp::endpoint> senderEndpoint)
+std::optional<std::chrono::microseconds> UDPNetwork::servicePacers()
 {
-    if (socket && socket->is_open() && error != boost::asio::error::operation_aborted)
+    if (!pacing() || !running || !socket)
+        return std::nullopt;
+
+    auto now = std::chrono::steady_clock::now();
+
+    // Datagrams the socket refused get another go once it had a moment to drain
+    if (pacerHandBack.exchange(false, std::memory_order_acquire))
     {
-        startAsyncReceive(); // Continuously queue up another startAsyncReceive
+        peers.forEach([this, now](PeerSession& session)
+        {
+            if (session.pacer.scheduled)
+                return;
+            session.pacer.scheduled = true;
+            pacingWheel.schedule(session.id, PACER_STALL_RETRY, now);
+        });
     }
 
-    if (!error)
+    pacingWheel.advance(now, [this, now](uint8_t id)
+    {
+        // The peer may be gone, its pacer still gets cleaned up
+        PeerSession& session = peers.slot(id);
+        session.pacer.scheduled = false;
+        servicePacer(session, now);
+    });
+    return pacingWheel.nextDue(now);
+}
+
+void UDPNetwork::servicePacer(PeerSession& session, std::chrono::steady_clock::time_point now)
+{
+    Pacer& pacer = session.pacer;
+    uint32_t generation = session.generation.load(std::memory_order_relaxed);
+    if (!session.active || session.closing || !session.connection.isConnected() || pacer.generation != generation)
     {
-        processReceivedData(bytesTransferred, receiveBuffer, senderEndpoint);
+        // Peer went away while its packets waited
+        pacer.clear(generation);
+        return;
     }
-    else if (error != boost::asio::error::operation_aborted)
+
+    bool windowFull = false;
+    try
     {
-        // Handle error but don't terminate unless it's fatal
-        NETWORK_LOG_ERROR("[Network] Receive error: {} (code: {})", error.message(), error.value());
-        
-        if (error == boost::asio::error::would_block || 
-            error == boost::asio::error::try_again ||
-            error.value() == 10035) // WSAEWOULDBLOCK
+        pacer.takeHandedBack();
+        uint64_t rate = session.congestion.pacingRate();
+        pacer.refill(now, rate);
+
+        // Refused by the socket earlier, sealed and paid for already
+        for (PacketBuffer& datagram : pacer.stalled())
+            outgoingBatch.push_back(OutgoingDatagram{std::move(datagram), session.endpoint()});
+        pacer.stalled().clear();
+
+        while (pacer.mayRelease() && outgoingBatch.size() < UDPBatchIO::MAX_BATCH)
         {
-            // Recoverable errors
-            NETWORK_LOG_WARNING("[Network] Recoverable receive error: {} (code: {}), continuing", error.message(), error.value());
+            Pacer::Entry* next = pacer.front();
+            if (!next)
+                break;
+
+            // Past a full window only once per RTO without acks, the ack for that one shows what was lost
+            uint64_t inFlight = session.ackTracker.bytesInFlight();
+            if (inFlight && inFlight + next->packet.size() > session.congestion.congestionWindow())
+            {
+                auto rto = ReliableChannel::retransmitTimeout(session.ackTracker.smoothedRtt(), session.ackTracker.rttVariance());
+                if (!pacer.windowBlockedSince)
+                    pacer.windowBlockedSince = now;
+                if (now - *pacer.windowBlockedSince < rto)
+                {
+                    windowFull = true;
+                    break;
+                }
+                pacer.windowBlockedSince = now;
+            }
+            else
+            {
+                pacer.windowBlockedSince.reset();
+            }
+
+            Pacer::Entry entry = std::move(*next);
+            pacer.pop();
+            metrics::record(metrics::Histogram::PACER_WAIT_US,
+                static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(now - entry.queuedAt).count())));
+            size_t first = outgoingBatch.size();
+            std::optional<uint32_t> seq = stagePaced(session, entry);
+
+            // Nothing else was waiting, what this one measures is our rate rather than the path's
+            if (seq && pacer.empty())
+                session.ackTracker.markAppLimited(*seq);
+            for (size_t i = first; i < outgoingBatch.size(); ++i)
+                pacer.charge(outgoingBatch[i].packet.size());
         }
-        else
+
+        // Don't hold a partial group once the queue ran dry, its members are already out
+        if (pacer.empty())
         {
-            // Fatal errors
-            NETWORK_LOG_ERROR("[Network] Fatal receive error: {} (code: {}), disconnecting", error.message(), error.value());
-            handleDisconnect();
+            session.fecEncoder.flush(*packetPool, parityBatch);
+            for (FecEncoder::Parity& parity : parityBatch)
+            {
+                if (!prepareParity(session, parity))
+                    continue;
+                pacer.charge(parity.payload.size());
+                outgoingBatch.push_back(OutgoingDatagram{std::move(parity.payload), session.endpoint()});
+            }
+            parityBatch.clear();
         }
+
+        submitPaced(session);
+    }
+    catch (const std::exception& e)
+    {
+        outgoingBatch.clear();
+        parityBatch.clear();
+        SYSTEM_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Send preparation error: {}", e.what());
     }
+
+    if (pacer.empty() || pacer.scheduled)
+        return;
+
+    // Back when the bucket has a token again, or shortly to see whether acks opened the window
+    std::chrono::microseconds wait = windowFull ? PACER_WINDOW_RECHECK : pacer.delay(session.congestion.pacingRate());
+    pacer.scheduled = true;
+    pacingWheel.schedule(session.id, wait, now);
 }
 
-void UDPNetwork::processReceivedData(
-    std::size_t bytesTransferred,
-    std::shared_ptr<std::vector<uint8_t>> receiveBuffer,
-    std::shared_ptr<boost::asio::ip::udp::endpoint> senderEndpoint)
+std::optional<uint32_t> UDPNetwork::stagePaced(PeerSession& session, Pacer::Entry& entry)
 {
-    // Skip if we don't have enough data for header
-    if (bytesTransferred < 16)
+    std::optional<uint32_t> seq;
+    switch (entry.kind)
     {
-        NETWORK_LOG_ERROR("[Network] Received packet too small: {} bytes", bytesTransferred);
-        return;
+    case Pacer::Kind::RELIABLE:
+        seq = prepareReliable(session, entry.packet);
+        break;
+    case Pacer::Kind::AGGREGATE:
+        seq = prepareMessage(session, entry.packet, PacketType::AGGREGATE);
+        break;
+    case Pacer::Kind::MESSAGE:
+    {
+        bool compressed = compressPayload(entry.packet);
+        seq = prepareMessage(session, entry.packet, PacketType::MESSAGE, false, compressed);
+        if (seq)
+            protectMessage(session, entry.packet, *seq);
+        break;
+    }
     }
-    
-    const std::vector<uint8_t>& buffer = *receiveBuffer;
 
-    /*
-    * SMALL CUSTOM PROTOCOL HEADER
-    */
+    if (seq)
+        outgoingBatch.push_back(OutgoingDatagram{std::move(entry.packet), session.endpoint()});
 
-    // Validate magic number
-    uint32_t magic = (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
-    if (magic != MAGIC_NUMBER)
+    // Parity right behind the group it covers
+    for (FecEncoder::Parity& parity : parityBatch)
     {
-        NETWORK_LOG_WARNING("[Network] Received packet with invalid magic number: {}", magic);
-        return;
+        if (prepareParity(session, parity))
+            outgoingBatch.push_back(OutgoingDatagram{std::move(parity.payload), session.endpoint()});
     }
-    
-    // Validate protocol version
-    uint16_t version = (buffer[4] << 8) | buffer[5];
-    if (version != PROTOCOL_VERSION)
+    parityBatch.clear();
+    return seq;
+}
+
+void UDPNetwork::submitPaced(PeerSession& session)
+{
+    size_t sent = 0;
+    if (rio)
+        sent = rio->send(outgoingBatch.data(), outgoingBatch.size());
+    else if (batchIO && batchIO->canSendBatch())
+        sent = batchIO->sendBatch(outgoingBatch.data(), outgoingBatch.size());
+    if (sent)
+        metrics::record(metrics::Histogram::UDP_SEND_BATCH, sent);
+
+    // The async path queues the rest, a datagram the socket refuses there comes back through handBack()
+    for (size_t i = sent; i < outgoingBatch.size(); ++i)
     {
-        NETWORK_LOG_ERROR("[Network] Unsupported protocol version: {}", version);
-        return;
+        uint32_t seq = sentSeq(outgoingBatch[i].packet);
+        transmitMessage(session, std::move(outgoingBatch[i].packet), seq);
     }
-    
-    // Get packet type
-    PacketType packetType = static_cast<PacketType>(buffer[6]);
-    
-    // Get sequence number
-    uint32_t seq = (buffer[8] << 24) | (buffer[9] << 16) | (buffer[10] << 8) | buffer[11];
-    
-    // Update peer activity time
-    peerConnection.updateActivity();
+    outgoingBatch.clear();
+}
 
-    // This could probablt be structured better, lol
-    if (packetType != PacketType::DISCONNECT)
+bool UDPNetwork::inflatePayload(PeerSession& session, PacketBuffer& payload)
+{
+    PacketBuffer packet = shardOf(session).decompressor.decompress(payload, *packetPool);
+    if (!packet)
     {
-        // Consume packet if network not running
-        if (!running)
-        {
-            NETWORK_LOG_ERROR("[Network] Received packet, but network not running");
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping corrupt compressed packet from {}", session.endpointString());
+        return false;
+    }
+    packet.setTrace(payload.trace());
+    payload = std::move(packet);
+    return true;
+}
+
+void UDPNetwork::scheduleAck(PeerSession& session)
+{
+    if (session.ackTimerArmed)
+        return;
+
+    session.ackTimerArmed = true;
+    session.ackTimer.expires_after(ACK_DELAY);
+    session.ackTimer.async_wait([this, &session](const boost::system::error_code& error)
+    {
+        session.ackTimerArmed = false;
+        if (error == boost::asio::error::operation_aborted)
             return;
-        }
 
-        // Store peer endpoint if not already connected
-        if (!peerConnection.isConnected())
+        // Nothing to do if a data packet already took it
+        sendAck(session);
+    });
+}
+
+void UDPNetwork::sendAck(PeerSession& session)
+{
+    AckFrame frame;
+    if (!socket || !session.active || session.closing || !session.ackTracker.takeAck(frame))
+        return;
+
+    // Frame goes in the payload, length field says so
+    uint8_t encoded[AckFrame::WIRE_SIZE];
+    frame.encode(encoded);
+    PacketBuffer ack = makeSessionControl(session, PacketType::ACK, frame.largest, encoded, sizeof(encoded));
+    if (!ack)
+        return;
+
+    auto ackBuffer = boost::asio::buffer(ack.data(), ack.size());
+    socket->async_send_to(
+        ackBuffer, session.endpoint(),
+        [ack = std::move(ack)](const boost::system::error_code& error, std::size_t sent)
         {
-            NETWORK_LOG_INFO("[Network] First valid packet received from peer, establishing connection");
-            peerEndpoint = *senderEndpoint;
-            currentPeerEndpoint = senderEndpoint->address().to_string() + ":" + std::to_string(senderEndpoint->port());
-            peerConnection.setConnected(true);
-            
-            // Notify peer connected event
-            notifyConnectionEvent(NetworkEvent::PEER_CONNECTED, currentPeerEndpoint);
-        }
+            if (!error)
+            {
+                metrics::add(metrics::Counter::UDP_TX_PACKETS);
+                metrics::add(metrics::Counter::UDP_TX_BYTES, sent);
+            }
+            else if (error != boost::asio::error::operation_aborted)
+            {
+                NETWORK_LOG_ERROR_SUMMARY("[Network] Error sending ACK: {} (code: {})", error.message(), error.value());
+            }
+        });
+}
+
+void UDPNetwork::handleAckFrame(PeerSession& session, const AckFrame& frame)
+{
+    auto now = std::chrono::steady_clock::now();
+    AckResult result = session.ackTracker.onAck(frame, now);
+    if (result.rttSample)
+        metrics::record(metrics::Histogram::ACK_RTT_US, static_cast<uint64_t>(result.rttSample->count()));
+    session.congestion.onAck(result, session.ackTracker.bytesInFlight(), now);
+    if (result.newlyLost)
+    {
+        NETWORK_LOG_INFO("[Network] {} packet(s) lost to {}, srtt {} us",
+            result.newlyLost, session.endpointString(), session.ackTracker.smoothedRtt().count());
+
+        // Fast retransmit, don't wait for the next tick
+        if (session.reliableChannel.hasInFlight())
+            sendRetransmits(session);
     }
+}
 
-    // Process packet based on type
-    switch (packetType)
+void UDPNetwork::armReliableTimer(PeerSession& session)
+{
+    if (session.reliableTimerArmed.exchange(true))
+        return;
+
+    // May be called from the TUN thread, the timer lives on the peer's shard
+    boost::asio::post(shardOf(session).context, [this, &session]()
     {
-        case PacketType::HOLE_PUNCH:
-            NETWORK_LOG_INFO("[Network] Received hole-punch packet from peer");
-            // Activity time was already updated above
-            break;
-            
-        case PacketType::HEARTBEAT:
-            NETWORK_LOG_INFO("[Network] Received heartbeat packet from peer");
-            // Activity time was already updated above
-            break;
-            
-        case PacketType::DISCONNECT:
-            // Peer wants to disconnect
-            SYSTEM_LOG_INFO("[Network] Received disconnect notification from peer");
-            NETWORK_LOG_INFO("[Network] Received disconnect notification from peer");
-            handleDisconnect();
-            break;
-            
-        case PacketType::MESSAGE:
+        session.reliableTimer.expires_after(RELIABLE_TICK);
+        session.reliableTimer.async_wait([this, &session](const boost::system::error_code& error)
         {
-            // Get message length
-            uint32_t msgLen = (buffer[12] << 24) | (buffer[13] << 16) | (buffer[14] << 8) | buffer[15];
-            
-            // Validate message length
-            if (16 + msgLen > bytesTransferred)
-            {
-                NETWORK_LOG_ERROR("[Network] Message length exceeds packet size");
-                return;
-            }
-            
-            // Create ACK packet
-            auto ack = std::make_shared<std::vector<uint8_t>>(16);
+            handleReliableTimer(session, error);
+        });
+    });
+}
 
-            // Attach custom header
-            attachCustomHeader(ack, PacketType::ACK, std::make_optional(seq));
-            
-            // Send ACK
-            socket->async_send_to(
-                boost::asio::buffer(*ack), *senderEndpoint,
-                [this, ack](const boost::system::error_code& error, std::size_t sent)
-                {
-                    if (error && error != boost::asio::error::operation_aborted)
-                    {
-                        NETWORK_LOG_ERROR("[Network] Error sending ACK: {} (code: {})", error.message(), error.value());
-                    }
-                });
+void UDPNetwork::handleReliableTimer(PeerSession& session, const boost::system::error_code& error)
+{
+    session.reliableTimerArmed = false;
+    if (error == boost::asio::error::operation_aborted || !running || !session.active || session.closing)
+        return;
 
-            // Extract wintun packet
-            std::vector<uint8_t> tunPacket(msgLen);
-            std::memcpy(tunPacket.data(), buffer.data() + 16, msgLen);
-            
-            // Process message, send to wintun interface
-            auto sender_copy = *senderEndpoint;
-            // Revert to boost::asio::post in case the following breaks the program
-            this->processMessage(std::move(tunPacket), sender_copy);
-            break;
-        }
-        case PacketType::ACK:
+    sendRetransmits(session);
+    session.reliableChannel.flushExpired(std::chrono::steady_clock::now(), shardOf(session).reliableDeliveries);
+    deliverReliable(session);
+
+    if (session.reliableChannel.hasInFlight() || session.reliableChannel.hasHeld())
+        armReliableTimer(session);
+}
+
+void UDPNetwork::sendRetransmits(PeerSession& session)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto rto = ReliableChannel::retransmitTimeout(session.ackTracker.smoothedRtt(), session.ackTracker.rttVariance());
+    std::vector<ReliableChannel::Retransmit>& retransmitBatch = shardOf(session).retransmitBatch;
+    session.reliableChannel.collectRetransmits(now, rto, retransmitBatch);
+
+    // The original may still be with the kernel, so every retransmit gets its own copy
+    for (ReliableChannel::Retransmit& retransmit : retransmitBatch)
+    {
+        PacketBuffer copy = packetPool->acquire(retransmit.payload.size());
+        if (!copy)
         {
-            // Remove from pending acks
-            std::lock_guard<std::mutex> lock(pendingAcksMutex);
-            pendingAcks.erase(seq);
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, retransmit deferred");
             break;
         }
-        default:
-            NETWORK_LOG_ERROR("[Network] Unknown packet type: {}", static_cast<int>(packetType));
-            break;
+        std::memcpy(copy.data(), retransmit.payload.data(), retransmit.payload.size());
+
+        uint8_t* prefix = copy.push(ReliableChannel::PREFIX_SIZE);
+        prefix[0] = (retransmit.reliableSeq >> 24) & 0xFF;
+        prefix[1] = (retransmit.reliableSeq >> 16) & 0xFF;
+        prefix[2] = (retransmit.reliableSeq >> 8) & 0xFF;
+        prefix[3] = retransmit.reliableSeq & 0xFF;
+
+        bool compressed = compression::isFrame(retransmit.payload);
+        std::optional<uint32_t> seq = prepareMessage(session, copy, PacketType::RELIABLE, false, compressed);
+        if (!seq)
+            continue;
+
+        session.reliableChannel.onTransmit(retransmit.reliableSeq, *seq, now);
+        metrics::add(metrics::Counter::RETRANSMITS);
+        transmitMessage(session, std::move(copy), *seq);
     }
+    retransmitBatch.clear();
 }
 
-// TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-void UDPNetwork::handleDisconnect()
+void UDPNetwork::deliverReliable(PeerSession& session)
 {
-    if (!peerConnection.isConnected()) return;
-    
-    peerConnection.setConnected(false);
-    
-    // Notify ALL_PEERS_DISCONNECTED for single peer setup
-    notifyConnectionEvent(NetworkEvent::ALL_PEERS_DISCONNECTED);
+    Shard& shard = shardOf(session);
+    for (PacketBuffer& packet : shard.reliableDeliveries)
+    {
+        processMessage(std::move(packet), shard.index);
+    }
+    shard.reliableDeliveries.clear();
+}
+
+void UDPNetwork::handleDisconnect(PeerSession& session)
+{
+    if (!session.active || session.closing) return;
+
+    std::string endpoint = session.endpointString();
+    PeerId id = session.id;
+    peers.remove(session);
+    notifyConnectionEvent(NetworkEvent::PEER_DISCONNECTED, endpoint, id);
+
+    // Last one out
+    if (peers.connectedCount() == 0)
+        notifyConnectionEvent(NetworkEvent::ALL_PEERS_DISCONNECTED);
 }
 
 void UDPNetwork::startKeepAliveTimer()
@@ -664,41 +3067,188 @@ void UDPNetwork::handleKeepAlive(const boost::system::error_code& error)
         return;
     }
 
-    // TODO: REFACTOR FOR *1, FOR MULTIPLE PEERS
-    NETWORK_LOG_INFO("[Network] Running keep-alive functionality");
-    sendHolePunchPacket(); // Send hole punch packet
-    if (peerConnection.isConnected())
+    // One sweep over every peer, nothing here runs per packet; each peer's share runs on its shard
+    NETWORK_LOG_DEBUG("[Network] Running keep-alive functionality");
+    peers.forEach([this](PeerSession& session)
     {
-        checkAllConnections(); // Check connection status
-    }
+        PeerId id = session.id;
+        uint32_t generation = session.generation.load(std::memory_order_relaxed);
+        boost::asio::post(shardOf(session).context, [this, id, generation]()
+        {
+            PeerSession* session = peers.get(id);
+            if (session && !session->closing && session->generation.load(std::memory_order_relaxed) == generation)
+                keepAlivePeer(*session);
+        });
+    });
+
+    // Log sites whose burst ended inside its first second, nothing else would report the rest
+    LogSummary::flushPending();
 
     startKeepAliveTimer(); // Restart timer
 }
 
-uint32_t UDPNetwork::attachCustomHeader(
-    const std::shared_ptr<std::vector<uint8_t>>& packet,
+void UDPNetwork::keepAlivePeer(PeerSession& session)
+{
+    // Peers we share keys and session ids with get a MIGRATE, a NAT that remapped us is noticed
+    // within one sweep. Everyone else keeps getting hole punches.
+    if (session.connection.isConnected() && session.cipher.load(std::memory_order_acquire) &&
+        session.remoteSessionId.load(std::memory_order_relaxed) != 0)
+    {
+        sendMigrate(session);
+    }
+    else
+    {
+        sendHolePunchPacket(session);
+    }
+    probePaths(session);
+    if (fecAdaptive && session.connection.isConnected())
+        adaptFec(session);
+    checkConnection(session); // Check connection status
+}
+
+wire::Header UDPNetwork::makeHeader(
+    const PeerSession* session,
     PacketType packetType,
-    std::optional<uint32_t> seqOpt)
+    uint32_t seq,
+    size_t length,
+    uint8_t flags)
 {
-    // Set magic number
-    (*packet)[0] = (MAGIC_NUMBER >> 24) & 0xFF;
-    (*packet)[1] = (MAGIC_NUMBER >> 16) & 0xFF;
-    (*packet)[2] = (MAGIC_NUMBER >> 8) & 0xFF;
-    (*packet)[3] = MAGIC_NUMBER & 0xFF;
-    
-    // Set protocol version
-    (*packet)[4] = (PROTOCOL_VERSION >> 8) & 0xFF;
-    (*packet)[5] = PROTOCOL_VERSION & 0xFF;
-    
-    // Set packet type
-    (*packet)[6] = static_cast<uint8_t>(packetType);
-    
-    // Set sequence number
-    uint32_t seq = seqOpt.value_or(nextSeqNumber++);
-    (*packet)[8] = (seq >> 24) & 0xFF;
-    (*packet)[9] = (seq >> 16) & 0xFF;
-    (*packet)[10] = (seq >> 8) & 0xFF;
-    (*packet)[11] = seq & 0xFF;
+    wire::Header header;
+    header.version = session ? session->wireVersion.load(std::memory_order_relaxed) : wire::V1;
+    header.type = static_cast<uint8_t>(packetType);
+    header.flags = flags;
+    header.seq = seq;
+    header.length = static_cast<uint32_t>(length);
+    return header;
+}
 
-    return seq;
+wire::Header UDPNetwork::sessionHeader(
+    const PeerSession& session,
+    PacketType packetType,
+    uint32_t seq,
+    uint32_t remoteId,
+    size_t sealedSize)
+{
+    wire::Header header = makeHeader(&session, packetType, seq, 0, FLAG_ENCRYPTED);
+    if (wire::versionOf(header) == wire::V2)
+        header.sessionId = remoteId;
+    header.length = static_cast<uint32_t>(sealedOffset(header) + sealedSize);
+    return header;
+}
+
+std::optional<uint32_t> UDPNetwork::receiverSessionId(const wire::Header& header, const uint8_t* payload)
+{
+    if (header.sessionId)
+        return header.sessionId;
+    if (header.length < SESSION_ID_SIZE)
+        return std::nullopt;
+    return readSessionId(payload);
+}
+
+void UDPNetwork::attachCustomHeader(PacketBuffer& packet, const wire::Header& header)
+{
+    wire::encode(packet.push(wire::encodedSize(header)), header);
+}
+
+std::array<uint8_t, wire::V1_SIZE> UDPNetwork::sealedAd(const wire::Header& header)
+{
+    wire::Header canonical;
+    canonical.type = header.type;
+    canonical.flags = header.flags;
+    canonical.seq = header.seq;
+    canonical.length = header.length;
+
+    std::array<uint8_t, wire::V1_SIZE> ad;
+    wire::encode(ad.data(), canonical);
+    return ad;
+}
+
+uint32_t UDPNetwork::sentSeq(const PacketBuffer& datagram)
+{
+    std::optional<wire::Header> header = wire::decode(datagram.data(), datagram.size());
+    return header ? header->seq : 0;
+}
+
+PacketBuffer UDPNetwork::makeSessionControl(
+    PeerSession& session,
+    PacketType packetType,
+    uint32_t clearSeq,
+    const uint8_t* payload,
+    size_t length)
+{
+    CipherPin pin(session);
+    const PacketCipher* cipher = pin.get();
+    size_t sealedLength = length + (cipher ? crypto::TAG_SIZE : 0);
+    PacketBuffer packet = packetPool->acquire(sealedLength);
+    if (!packet)
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, cannot build control packet");
+        return packet;
+    }
+
+    // Control packets stay out of the MESSAGE seq space, so SACK gaps only ever mean loss
+    if (!cipher)
+    {
+        if (length)
+            std::memcpy(packet.data(), payload, length);
+        attachCustomHeader(packet, makeHeader(&session, packetType, clearSeq, length));
+        return packet;
+    }
+
+    // Seqs of their own under the keys, the nonce space is per packet type
+    uint32_t seq = packetType == PacketType::ACK ? ++session.ackSent :
+        session.disconnectSent.fetch_add(1, std::memory_order_relaxed) + 1;
+    wire::Header header = makeHeader(&session, packetType, seq, sealedLength, FLAG_ENCRYPTED);
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    cipher->seal(packet.data(), payload, length, static_cast<uint8_t>(packetType), seq, ad.data(), ad.size());
+    attachCustomHeader(packet, header);
+    return packet;
+}
+
+std::optional<size_t> UDPNetwork::openSessionControl(
+    PeerSession& peer,
+    const PacketBuffer& packet,
+    const wire::Header& header,
+    uint8_t* out,
+    size_t capacity)
+{
+    const uint8_t* payload = packet.data() + header.size;
+    CipherPin pin(peer);
+    const PacketCipher* cipher = pin.get();
+    if (!(header.flags & FLAG_ENCRYPTED))
+    {
+        // Anyone could send these, a forged ACK releases reliable data and a forged DISCONNECT ends the session
+        if (cipher)
+        {
+            metrics::add(metrics::Counter::DROP_UNENCRYPTED);
+            NETWORK_LOG_WARNING_SUMMARY("[Network] Dropping unencrypted control packet type {} from {}",
+                static_cast<int>(header.type), peer.endpointString());
+            return std::nullopt;
+        }
+        size_t length = std::min<size_t>(header.length, capacity);
+        if (length)
+            std::memcpy(out, payload, length);
+        return length;
+    }
+
+    if (!cipher)
+    {
+        metrics::add(metrics::Counter::DROP_NO_KEYS);
+        return std::nullopt;
+    }
+    if (header.length < crypto::TAG_SIZE || header.length - crypto::TAG_SIZE > capacity)
+    {
+        metrics::add(metrics::Counter::DROP_MALFORMED);
+        return std::nullopt;
+    }
+
+    std::array<uint8_t, wire::V1_SIZE> ad = sealedAd(header);
+    if (!cipher->open(out, payload, header.length, header.type, header.seq, ad.data(), ad.size()))
+    {
+        metrics::add(metrics::Counter::DROP_DECRYPT);
+        NETWORK_LOG_WARNING_SUMMARY("[Network] Control packet type {} seq={} from {} failed authentication",
+            static_cast<int>(header.type), header.seq, peer.endpointString());
+        return std::nullopt;
+    }
+    return header.length - crypto::TAG_SIZE;
 }
\ No newline at end of file
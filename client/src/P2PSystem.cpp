@@ -1,9 +1,13 @@
 #include "Utils.hpp"
 #include "P2PSystem.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <cstring>
+#include <cstddef>
 
 namespace {
 // REMOVE LATER
@@ -52,13 +56,43 @@ struct IPPacket
     // uint32_t Options
 };
 
+// Fixed IPv6 header, extension headers follow it and are never walked
+struct IPv6Packet
+{
+    uint32_t version4__trafficClass8__flowLabel20;
+    uint16_t payloadLength;
+    uint8_t nextHeader;
+    uint8_t hopLimit;
+    uint8_t sourceIp[16];
+    uint8_t destIp[16];
+};
+
 P2PSystem::P2PSystem() 
     : running(false)
     , publicPort(0)
+    , publicPort6(0)
     , peerPort(0)
     , isHost(false)
+    , udpBackend(UdpBackend::ASIO)
+    , dataPlaneWorkers(0)
+    , reliableTcp(true)
+    , fecAdaptive(false)
+    , encryption(true)
+    , compression(false)
+    , aggregationDeadline(0)
+    , congestionMode(CongestionMode::BBR)
+    , metricsPort(0)
+    , localVirtualAddr(0)
+    , localIndex(0)
+    , interfaceConfigured(false)
+    , routedPeers(0)
 {
     stateManager = std::make_shared<SystemStateManager>();
+    packetPool = std::make_shared<PacketPool>();
+    for (PacketBatch& batch : forwardBatches)
+        batch.reserve(UDPBatchIO::MAX_BATCH);
+    for (std::atomic<PeerId>& route : routes)
+        route.store(NO_PEER, std::memory_order_relaxed);
 }
 
 P2PSystem::~P2PSystem()
@@ -72,16 +106,47 @@ bool P2PSystem::initialize(const std::string& serverUrl, const std::string& self
     running = true;
     stateManager->setState(SystemState::IDLE);
 
+    if (init_crypto() < 0)
+    {
+        SYSTEM_LOG_ERROR("[System] Failed to initialize libsodium");
+        return false;
+    }
+
+    // Not fatal, the tunnel works the same without it
+    if (metricsPort)
+        metricsServer.start(metricsPort);
+
+    // Nothing else depends on it, so it runs while STUN and signaling do their round trips
+    firewallSetup = std::async(std::launch::async, [this]()
+    {
+        networkConfigManager.setupFirewall();
+    });
+
     /*
     *   STUN PROCEDURE SETUP
     */
 
-    // Discover public address for NAT traversal
-    if (!discoverPublicAddress())
+    // Discover public address for NAT traversal, signaling and the adapter come up meanwhile
+    std::future<bool> stunDiscovery = std::async(std::launch::async, [this]()
     {
-        SYSTEM_LOG_ERROR("[System] Failed to do STUN and discover public address.");
-        return false;
-    }
+        return discoverPublicAddress();
+    });
+
+    /*
+    *   TUN INTERFACE SETUP
+    */
+
+    // Data plane workers, each one feeds its own TUN injection queue
+    size_t workers = dataPlaneWorkers ? dataPlaneWorkers : UDPNetwork::defaultWorkers();
+    TunSessionOptions tunOptions;
+    tunOptions.sendQueues = workers;
+
+    // Creating the adapter is the slowest step here, it overlaps the other two
+    tunInterface = std::make_unique<TunInterface>(packetPool);
+    std::future<bool> tunSetup = std::async(std::launch::async, [this, tunOptions]()
+    {
+        return tunInterface->initialize("PeerBridge", tunOptions);
+    });
 
     /*
     *   SIGNALING SERVER CONNECTION SETUP
@@ -105,38 +170,54 @@ bool P2PSystem::initialize(const std::string& serverUrl, const std::string& self
         this->handlePeerInfo(username, ip, port);
     });
     
-    signalingClient.setChatInitCallback([this](const std::string& username, const std::string& ip, int port)
+    signalingClient.setChatInitCallback([this](const std::string& username, const std::string& ip, int port, int selfIndex, int peerIndex,
+        const std::string& relayIp, int relayPort, const std::string& ip6, int port6)
     {
-        this->handleConnectionInit(username, ip, port);
+        this->handleConnectionInit(username, ip, port, selfIndex, peerIndex, relayIp, relayPort, ip6, port6);
     });
 
-    // Connect to signaling server
-    if (!signalingClient.connect(serverUrl)) {
-        SYSTEM_LOG_ERROR("[System] Failed to connect to signaling server");
-        return false;
-    }
+    signalingClient.setKeyExchangeCallback([this](const std::string& from, const std::string& publicKey, bool aes)
+    {
+        this->handleKeyExchange(from, publicKey, aes);
+    });
 
-    // Register with the signaling server
-    signalingClient.registerUser(username, publicIp, publicPort);
+    signalingClient.setPeerMovedCallback([this](const std::string& username, const std::string& ip, int port)
+    {
+        this->handlePeerMoved(username, ip, port);
+    });
 
-    /*
-    *   TUN INTERFACE SETUP
-    */
+    // Connect to signaling server, registration waits for the public address
+    bool signalingConnected = signalingClient.connect(serverUrl);
+    bool tunReady = tunSetup.get();
+    bool stunReady = stunDiscovery.get();
 
-    // Initialize TUN interface
-    tunInterface = std::make_unique<TunInterface>();
-    if (!tunInterface->initialize("PeerBridge"))
+    if (!signalingConnected) {
+        SYSTEM_LOG_ERROR("[System] Failed to connect to signaling server");
+        return false;
+    }
+    if (!stunReady)
+    {
+        SYSTEM_LOG_ERROR("[System] Failed to do STUN and discover public address.");
+        return false;
+    }
+    if (!tunReady)
     {
         SYSTEM_LOG_ERROR("[System] Failed to initialize TUN interface");
         return false;
     }
     
     // Register packet callback from TUN interface
-    tunInterface->setPacketCallback([this](const std::vector<uint8_t>& packet) {
-        this->handlePacketFromTun(packet);
+    tunInterface->setPacketCallback([this](PacketBatch& packets) {
+        this->handlePacketsFromTun(packets);
     });
 
-    networkConfigManager.setNarrowAlias(tunInterface->getNarrowAlias());
+    NET_LUID adapterLuid;
+    if (!tunInterface->getLuid(adapterLuid))
+    {
+        SYSTEM_LOG_ERROR("[System] Failed to identify TUN interface");
+        return false;
+    }
+    networkConfigManager.setInterfaceLuid(adapterLuid);
 
     /*
     *   UDP NETWORK SERVICE SETUP
@@ -146,13 +227,40 @@ bool P2PSystem::initialize(const std::string& serverUrl, const std::string& self
     networkModule = std::make_unique<UDPNetwork>(
         std::move(stunService.getSocket()),
         stunService.getContext(),
-        stateManager);
+        stateManager,
+        packetPool,
+        udpBackend,
+        workers);
+    networkModule->setFec(fecParams, fecAdaptive);
+    networkModule->setEncryptionRequired(encryption);
+    networkModule->setCompression(compression);
+    networkModule->setAggregation(aggregationDeadline);
+    networkModule->setCongestionControl(congestionMode);
+    // Asked again over the tunnel socket when the local network changes
+    if (std::optional<boost::asio::ip::udp::endpoint> stunServer = stunService.answeredBy())
+        networkModule->setStunServer(*stunServer, publicIp, publicPort);
     
     // Set up network callbacks for P2P connection
-    networkModule->setMessageCallback([this](std::vector<uint8_t> packet)
+    networkModule->setMessageCallback([this](PacketBuffer packet, size_t lane)
     {
         // Convert message to binary data
-        this->handleNetworkData(std::move(packet));
+        this->handleNetworkData(std::move(packet), lane);
+    });
+
+    networkModule->setMessageBatchCallback([this](PacketBatch& packets, size_t lane)
+    {
+        this->handleNetworkBatch(packets, lane);
+    });
+
+    // Bundles waiting on their deadline and paced packets are sent from the TUN thread in between its batches
+    tunInterface->setIdleCallback([this]() -> std::optional<std::chrono::microseconds>
+    {
+        if (!networkModule)
+            return std::nullopt;
+        // Bundle deadlines are far below the wait's granularity, poll until they're out
+        if (networkModule->flushAggregates())
+            return std::chrono::microseconds(0);
+        return networkModule->servicePacers();
     });
     
     // Start UDP network
@@ -161,15 +269,16 @@ bool P2PSystem::initialize(const std::string& serverUrl, const std::string& self
         SYSTEM_LOG_ERROR("[System] Failed to start UDP network");
         return false;
     }
+
+    // Register with the signaling server, peers can reach us from here on
+    signalingClient.registerUser(username, publicIp, publicPort, publicIp6, publicPort6);
     
-    // Start monitoring loop
-    monitorThread = std::thread([this]()
+    // Network events drive the state machine from here on, each one handled as soon as it's queued.
+    // Peer timeouts come from the network module's keep-alive sweep, nothing here needs polling.
+    stateManager->startDispatcher([this](const NetworkEventData& event)
     {
-        while (running && !stateManager->isInState(SystemState::SHUTTING_DOWN))
-        {
-            this->monitorLoop();
-            std::this_thread::sleep_for(std::chrono::milliseconds(250));
-        }
+        if (running && !stateManager->isInState(SystemState::SHUTTING_DOWN))
+            this->handleNetworkEvent(event);
     });
 
     SYSTEM_LOG_INFO("[System] P2P System initialized successfully");
@@ -177,17 +286,6 @@ bool P2PSystem::initialize(const std::string& serverUrl, const std::string& self
     return true;
 }
 
-void P2PSystem::monitorLoop()
-{
-    // Process all pending events
-    while (auto event = stateManager->getNextEvent())
-    {
-        handleNetworkEvent(*event);
-    }
-    
-    // Add a additional health checks if necessary
-}
-
 void P2PSystem::handleNetworkEvent(const NetworkEventData& event)
 {
     SystemState currentState = stateManager->getState();
@@ -205,10 +303,46 @@ void P2PSystem::handleNetworkEvent(const NetworkEventData& event)
                 stateManager->setState(SystemState::CONNECTED);
                 SYSTEM_LOG_INFO("[System] Peer connected successfully");
             }
+            else if (currentState == SystemState::CONNECTED)
+            {
+                SYSTEM_LOG_INFO("[System] Peer {} joined the session", std::get<std::string>(event.data));
+            }
+            break;
+
+        case NetworkEvent::PEER_DISCONNECTED:
+            if (event.peer >= 0)
+            {
+                SYSTEM_LOG_INFO("[System] Peer {} left the session", std::get<std::string>(event.data));
+                removeMeshPeer(static_cast<PeerId>(event.peer));
+
+                // The narrowest path may just have left
+                if (interfaceConfigured && networkModule)
+                    networkConfigManager.setInterfaceMtu(networkModule->tunnelMtu());
+            }
             break;
             
+        case NetworkEvent::PATH_MTU_CHANGED:
+            // One adapter for the whole mesh, it follows the narrowest path
+            if (interfaceConfigured && networkModule)
+                networkConfigManager.setInterfaceMtu(networkModule->tunnelMtu());
+            break;
+
+        case NetworkEvent::PUBLIC_ADDRESS_CHANGED:
+        {
+            // Sessions already moved with our MIGRATEs, new peers and lost ones need the new address
+            const std::string& address = std::get<std::string>(event.data);
+            size_t colon = address.rfind(':');
+            if (colon == std::string::npos)
+                break;
+            publicIp = address.substr(0, colon);
+            publicPort = std::stoi(address.substr(colon + 1));
+            SYSTEM_LOG_INFO("[System] Public address is now {}", address);
+            signalingClient.updateAddress(publicIp, publicPort);
+            break;
+        }
+
         case NetworkEvent::ALL_PEERS_DISCONNECTED:
-            if (currentState == SystemState::CONNECTED)
+            if (currentState == SystemState::CONNECTED || currentState == SystemState::CONNECTING)
             {
                 SYSTEM_LOG_WARNING("[System] All peers disconnected");
                 stopConnection();
@@ -235,6 +369,15 @@ bool P2PSystem::discoverPublicAddress()
     publicPort = publicAddr->port;
 
     SYSTEM_LOG_INFO("[System] Public address: {}:{}", publicIp, std::to_string(publicPort));
+
+    // Dual-stack hosts hand peers both, they race them when punching
+    std::optional<PublicAddress> publicAddr6 = stunService.publicAddress6();
+    if (publicAddr6 && !publicAddr->ipv6)
+    {
+        publicIp6 = publicAddr6->ip;
+        publicPort6 = publicAddr6->port;
+        SYSTEM_LOG_INFO("[System] Public IPv6 address: [{}]:{}", publicIp6, std::to_string(publicPort6));
+    }
     
     return true;
 }
@@ -247,6 +390,13 @@ bool P2PSystem::startNetworkInterface()
         return false;
     }
     
+    // Usually long done, hole punching takes at least a round trip
+    if (interfaceReady.valid() && !interfaceReady.get())
+    {
+        SYSTEM_LOG_ERROR("[System] Failed to set up virtual interface");
+        return false;
+    }
+
     // Start packet processing
     if (!tunInterface->startPacketProcessing()) {
         SYSTEM_LOG_ERROR("[System] Failed to start packet processing");
@@ -254,25 +404,131 @@ bool P2PSystem::startNetworkInterface()
     }
     
     SYSTEM_LOG_INFO("[System] Network interface started with IP {}", localVirtualIp);
-    SYSTEM_LOG_INFO("[System] Peer has IP {}", peerVirtualIp);
+    {
+        std::lock_guard<std::mutex> lock(meshMutex);
+        for (const MeshPeer& peer : meshPeers)
+        {
+            if (peer.used)
+                SYSTEM_LOG_INFO("[System] Peer {} has IP {}", peer.username, peer.virtualIp);
+        }
+    }
 
     clog.setLoggingEnabled(false);
     
     return true;
 }
 
-// TODO: TO BE MODIFIED FOR *1, this can be removed as peer info parsing will be done elsewhere
-void P2PSystem::assignIPAddresses()
+std::string P2PSystem::virtualIpFor(uint8_t hostIndex)
+{
+    return utils::uint32ToIp(VIRTUAL_NETWORK_ADDR | hostIndex);
+}
+
+void P2PSystem::addMeshPeer(PeerId id, const std::string& username, uint8_t hostIndex)
+{
+    std::lock_guard<std::mutex> lock(meshMutex);
+    MeshPeer& peer = meshPeers[id];
+
+    // Slot came back for someone new before the old occupant's disconnect got here
+    if (peer.used && peer.hostIndex != hostIndex)
+        routes[peer.hostIndex].store(NO_PEER, std::memory_order_relaxed);
+
+    peer.used = true;
+    peer.username = username;
+    peer.hostIndex = hostIndex;
+    peer.virtualIp = virtualIpFor(hostIndex);
+
+    routes[hostIndex].store(id, std::memory_order_release);
+    routedPeers.fetch_or(1u << id, std::memory_order_release);
+}
+
+void P2PSystem::removeMeshPeer(PeerId id)
+{
+    // A disconnect racing a reconnect into the same slot, the new peer stays
+    if (networkModule && networkModule->hasPeer(id))
+        return;
+
+    std::lock_guard<std::mutex> lock(meshMutex);
+    MeshPeer& peer = meshPeers[id];
+    if (!peer.used)
+        return;
+
+    routedPeers.fetch_and(~(1u << id), std::memory_order_release);
+    multicast.forgetPeer(id);
+    if (routes[peer.hostIndex].load(std::memory_order_relaxed) == id)
+        routes[peer.hostIndex].store(NO_PEER, std::memory_order_release);
+    networkConfigManager.removePeerRoute(peer.virtualIp);
+    pendingKeys.erase(peer.username);
+    peer = MeshPeer{};
+}
+
+void P2PSystem::clearMesh()
+{
+    std::lock_guard<std::mutex> lock(meshMutex);
+    routedPeers.store(0, std::memory_order_release);
+    multicast.clear();
+    for (std::atomic<PeerId>& route : routes)
+        route.store(NO_PEER, std::memory_order_relaxed);
+    for (MeshPeer& peer : meshPeers)
+        peer = MeshPeer{};
+    pendingKeys.clear();
+}
+
+void P2PSystem::startKeyExchange(PeerId id)
 {
-    if (isHost) {
-        localVirtualIp = HOST_IP;
-        peerVirtualIp = CLIENT_IP;
-    } else {
-        localVirtualIp = CLIENT_IP;
-        peerVirtualIp = HOST_IP;
+    std::string peerName;
+    std::string publicKey;
+    {
+        std::lock_guard<std::mutex> lock(meshMutex);
+        MeshPeer& peer = meshPeers[id];
+        if (!peer.used)
+            return;
+
+        // Fresh pair for every connection, seqs start over and so must the keys
+        peer.keyExchange = std::make_unique<KeyExchange>();
+        peerName = peer.username;
+        publicKey = crypto::toHex(peer.keyExchange->publicKey.data(), peer.keyExchange->publicKey.size());
+    }
+
+    signalingClient.sendKeyExchange(peerName, publicKey, crypto::aesAvailable());
+
+    // The peer's half may have come in before its chat-init did
+    std::lock_guard<std::mutex> lock(meshMutex);
+    auto pending = pendingKeys.find(peerName);
+    if (pending != pendingKeys.end() && meshPeers[id].keyExchange)
+    {
+        completeKeyExchange(id, pending->second.first, pending->second.second);
+        pendingKeys.erase(pending);
     }
 }
 
+void P2PSystem::completeKeyExchange(PeerId id, const std::string& publicKeyHex, bool peerAes)
+{
+    MeshPeer& peer = meshPeers[id];
+
+    uint8_t peerKey[crypto::PUBLIC_KEY_SIZE];
+    if (!crypto::fromHex(publicKeyHex, peerKey, sizeof(peerKey)))
+    {
+        SYSTEM_LOG_WARNING("[System] Malformed public key from {}", peer.username);
+        return;
+    }
+
+    uint8_t rxKey[crypto::KEY_SIZE];
+    uint8_t txKey[crypto::KEY_SIZE];
+    if (!peer.keyExchange->deriveSessionKeys(peerKey, rxKey, txKey))
+    {
+        SYSTEM_LOG_ERROR("[System] Key exchange with {} failed", peer.username);
+        return;
+    }
+
+    CipherSuite suite = crypto::negotiate(crypto::aesAvailable(), peerAes);
+    networkModule->setPeerCipher(id, suite, rxKey, txKey);
+    sodium_memzero(rxKey, sizeof(rxKey));
+    sodium_memzero(txKey, sizeof(txKey));
+
+    // Secret isn't needed past this point, dropping it keeps recorded traffic sealed
+    peer.keyExchange.reset();
+}
+
 bool P2PSystem::isConnected() const
 {
     return networkModule ? networkModule->isConnected() : false;
@@ -288,7 +544,54 @@ void P2PSystem::setRunning()
     running = false;
 }
 
-// !! *1 SCHEDULED FOR REMOVAL WHEN INTEGRATING
+void P2PSystem::setUdpBackend(UdpBackend backend)
+{
+    udpBackend = backend;
+}
+
+void P2PSystem::setDataPlaneWorkers(size_t workers)
+{
+    dataPlaneWorkers = std::min(workers, UDPNetwork::MAX_WORKERS);
+}
+
+void P2PSystem::setReliableTcp(bool enabled)
+{
+    reliableTcp = enabled;
+}
+
+void P2PSystem::setFec(FecParams params, bool adaptive)
+{
+    fecParams = params;
+    fecAdaptive = adaptive;
+}
+
+void P2PSystem::setEncryption(bool enabled)
+{
+    encryption = enabled;
+}
+
+void P2PSystem::setCompression(bool enabled)
+{
+    compression = enabled;
+}
+
+void P2PSystem::setAggregation(std::chrono::microseconds deadline)
+{
+    aggregationDeadline = deadline;
+}
+
+void P2PSystem::setCongestionControl(CongestionMode mode)
+{
+    congestionMode = mode;
+}
+
+void P2PSystem::setMetricsPort(uint16_t port)
+{
+    metricsPort = port;
+}
+
+// Whether we accepted the request that started the session; addresses only follow from it when
+// the signaling server doesn't assign them
 bool P2PSystem::getIsHost() const
 {
     return isHost;
@@ -296,17 +599,20 @@ bool P2PSystem::getIsHost() const
 
 bool P2PSystem::connectToPeer(const std::string& peerUsername_)
 {
-    if (isConnected())
+    if (networkModule && networkModule->connectedPeerCount() >= PeerTable::MAX_PEERS)
     {
-        SYSTEM_LOG_WARNING("[System] Attempted to connect to peer while already connected to a peer");
+        SYSTEM_LOG_WARNING("[System] Session is full, {} peers max", PeerTable::MAX_PEERS);
         return false;
     }
     
     peerUsername = peerUsername_;
-    isHost = false;
     
-    // Update system state
-    stateManager->setState(SystemState::CONNECTING);
+    // Update system state, a running session stays connected while it grows
+    if (!interfaceConfigured)
+    {
+        isHost = false;
+        stateManager->setState(SystemState::CONNECTING);
+    }
     
     // Request peer info from signaling server
     signalingClient.requestPeerInfo(peerUsername);
@@ -328,8 +634,9 @@ void P2PSystem::acceptIncomingRequest()
         return;
     }
     
-    // We are the host
-    isHost = true;
+    // We are the host, unless we're already part of a session
+    if (!interfaceConfigured)
+        isHost = true;
     
     signalingClient.acceptChatRequest();
     SYSTEM_LOG_INFO("[System] Accepted connection request from {}", pendingRequestFrom);
@@ -369,7 +676,16 @@ void P2PSystem::handlePeerInfo(const std::string& username, const std::string& i
 
 }
 
-void P2PSystem::handleConnectionInit(const std::string& username, const std::string& ip, int port)
+void P2PSystem::handleConnectionInit(
+    const std::string& username,
+    const std::string& ip,
+    int port,
+    int selfIndex,
+    int peerIndex,
+    const std::string& relayIp,
+    int relayPort,
+    const std::string& ip6,
+    int port6)
 {
     peerUsername = username;
     peerIp = ip;
@@ -377,27 +693,119 @@ void P2PSystem::handleConnectionInit(const std::string& username, const std::str
 
     SYSTEM_LOG_INFO("[System] Connection initialized with {}, connecting...", username);
 
-    // Set state to CONNECTING (actual connection will be confirmed via events)
-    stateManager->setState(SystemState::CONNECTING);
+    // Older signaling servers don't assign addresses, fall back to host / client
+    if (selfIndex <= 0 || selfIndex > 254 || peerIndex <= 0 || peerIndex > 254 || selfIndex == peerIndex)
+    {
+        selfIndex = isHost ? HOST_INDEX : CLIENT_INDEX;
+        peerIndex = isHost ? CLIENT_INDEX : HOST_INDEX;
+    }
+    std::string peerVirtualIp = virtualIpFor(static_cast<uint8_t>(peerIndex));
 
-    // Assign IP addresses based on host/client role
-    assignIPAddresses();
-    uint8_t selfIndex = isHost ? 1 : 2;
-    
-    NetworkConfigManager::ConnectionConfig cfg{selfIndex, peerVirtualIp};
-    // Set up virtual interface
-    if (!networkConfigManager.configureInterface(cfg))
+    if (!interfaceConfigured)
     {
-        SYSTEM_LOG_ERROR("[System] Failed to set up virtual interface");
-        return;
+        // Set state to CONNECTING (actual connection will be confirmed via events)
+        stateManager->setState(SystemState::CONNECTING);
+
+        localIndex = static_cast<uint8_t>(selfIndex);
+        localVirtualIp = virtualIpFor(localIndex);
+        localVirtualAddr.store(VIRTUAL_NETWORK_ADDR | localIndex, std::memory_order_release);
+        
+        NetworkConfigManager::ConnectionConfig cfg{localIndex, peerVirtualIp};
+        // Start at the size every path carries, raised once path MTU discovery settles
+        uint32_t mtu = networkModule->tunnelMtu();
+
+        // Set up virtual interface while hole punching runs, checked before the interface starts
+        std::promise<bool> ready;
+        interfaceReady = ready.get_future().share();
+        interfaceSetup = std::async(std::launch::async, [this, cfg, mtu, ready = std::move(ready)]() mutable
+        {
+            bool configured = networkConfigManager.configureInterface(cfg);
+            if (configured)
+                networkConfigManager.setInterfaceMtu(mtu);
+            ready.set_value(configured);
+            if (configured)
+                networkConfigManager.setupNetworkCategory();
+        });
+        interfaceConfigured = true;
+    }
+    else
+    {
+        // Joining peers share the interface that's already up
+        if (selfIndex != localIndex)
+        {
+            SYSTEM_LOG_WARNING("[System] Session assigned us {}, keeping {} already on the interface",
+                virtualIpFor(static_cast<uint8_t>(selfIndex)), localVirtualIp);
+        }
+        // Its route depends on how the first one went
+        if (interfaceReady.valid())
+            interfaceReady.wait();
+        networkConfigManager.addPeerRoute(peerVirtualIp);
     }
     
+    // Traffic goes through the relay from the start when there is one, the direct path is probed
+    // behind it and takes over once it's faster
+    std::optional<boost::asio::ip::udp::endpoint> relay;
+    boost::system::error_code ec;
+    boost::asio::ip::address relayAddress = boost::asio::ip::make_address(relayIp, ec);
+    if (!relayIp.empty() && !ec && relayPort > 0 && relayPort <= 0xFFFF)
+        relay.emplace(relayAddress, static_cast<unsigned short>(relayPort));
+    else if (!relayIp.empty())
+        SYSTEM_LOG_WARNING("[System] Ignoring relay {}:{} for {}, connecting directly", relayIp, relayPort, username);
+
+    // Peers with IPv6 are raced on both families, CGNAT'd IPv4 often loses to a native IPv6 path
+    std::optional<boost::asio::ip::udp::endpoint> ipv6;
+    boost::asio::ip::address ipv6Address = boost::asio::ip::make_address(ip6, ec);
+    if (!ip6.empty() && !ec && ipv6Address.is_v6() && port6 > 0 && port6 <= 0xFFFF)
+        ipv6.emplace(ipv6Address, static_cast<unsigned short>(port6));
+
     // Start UDP hole punching process
-    if (!networkModule->connectToPeer(ip, port))
+    std::optional<PeerId> peer = networkModule->connectToPeer(ip, port, relay, ipv6);
+    if (!peer)
     {
         SYSTEM_LOG_ERROR("[System] Failed to initiate UDP hole punching");
-        stateManager->setState(SystemState::IDLE);
+        if (!isConnected())
+            stateManager->setState(SystemState::IDLE);
+        return;
+    }
+
+    addMeshPeer(*peer, username, static_cast<uint8_t>(peerIndex));
+    if (encryption)
+        startKeyExchange(*peer);
+}
+
+void P2PSystem::handleKeyExchange(const std::string& from, const std::string& publicKey, bool aes)
+{
+    if (!encryption || !networkModule)
+        return;
+
+    std::lock_guard<std::mutex> lock(meshMutex);
+    for (size_t id = 0; id < meshPeers.size(); ++id)
+    {
+        if (meshPeers[id].used && meshPeers[id].username == from && meshPeers[id].keyExchange)
+        {
+            completeKeyExchange(static_cast<PeerId>(id), publicKey, aes);
+            return;
+        }
+    }
+
+    // Not introduced to us yet, picked up when its chat-init arrives
+    pendingKeys[from] = {publicKey, aes};
+}
+
+void P2PSystem::handlePeerMoved(const std::string& username, const std::string& ip, int port)
+{
+    if (!networkModule)
         return;
+
+    std::lock_guard<std::mutex> lock(meshMutex);
+    for (size_t id = 0; id < meshPeers.size(); ++id)
+    {
+        if (meshPeers[id].used && meshPeers[id].username == username)
+        {
+            SYSTEM_LOG_INFO("[System] Peer {} moved to {}:{}", username, ip, port);
+            networkModule->probePeerAddress(static_cast<PeerId>(id), ip, port);
+            return;
+        }
     }
 }
 
@@ -405,81 +813,248 @@ void P2PSystem::handleConnectionInit(const std::string& username, const std::str
 * Network flow
 */
 
-void P2PSystem::handlePacketFromTun(const std::vector<uint8_t>& packet)
+void P2PSystem::handlePacketsFromTun(PacketBatch& packets)
 {
-    // We received a packet from our TUN interface, forward to peer
-    // Minimum IPv4 header size and version check
-    if (packet.size() >= sizeof(IPPacket) && (packet[0] >> 4) == 4)
+    // Sort the batch by destination peer and send each peer's share as one batch
+    for (PacketBuffer& packet : packets)
+    {
+        if (!isIpPacket(packet))
+        {
+            metrics::add(metrics::Counter::DROP_MALFORMED);
+            continue;
+        }
+
+        PeerId peer = routeFor(packet);
+        tracing::stamp(packet.trace(), tracing::Stage::FILTER);
+        if (peer != NO_PEER)
+        {
+            queueForPeer(peer, std::move(packet));
+        }
+        else if (isFlooded(packet))
+        {
+            // Broadcast / multicast goes to whoever wants it, each peer's copy is sealed with its own
+            // keys so all but the last get one from the pool
+            uint32_t targets = multicast.targets(packet, routedPeers.load(std::memory_order_acquire));
+            while (targets)
+            {
+                PeerId target = static_cast<PeerId>(__builtin_ctz(targets));
+                targets &= targets - 1;
+                queueForPeer(target, targets ? copyPacket(packet) : std::move(packet));
+            }
+        }
+        else
+        {
+            metrics::add(metrics::Counter::DROP_NO_ROUTE);
+        }
+    }
+    packets.clear();
+
+    for (size_t peer = 0; peer < forwardBatches.size(); ++peer)
     {
-        forwardPacketToPeer(packet);
+        if (!forwardBatches[peer].empty())
+            networkModule->sendMessages(static_cast<PeerId>(peer), forwardBatches[peer]);
     }
 }
 
-bool P2PSystem::forwardPacketToPeer(const std::vector<uint8_t>& packet)
+void P2PSystem::handlePacketFromTun(PacketBuffer packet)
 {
-    // Extract source and destination IPs for filtering
-    uint32_t srcIp = (packet[12] << 24) | (packet[13] << 16) | (packet[14] << 8) | packet[15];
-    uint32_t dstIp = (packet[16] << 24) | (packet[17] << 16) | (packet[18] << 8) | packet[19];
-
-    std::string srcIpStr = utils::uint32ToIp(srcIp);
-    std::string dstIpStr = utils::uint32ToIp(dstIp);
+    // We received a packet from our TUN interface, forward to peer
+    // Minimum header size for its version
+    if (isIpPacket(packet))
+    {
+        forwardPacketToPeer(std::move(packet));
+    }
+}
 
-    // Forward packets that are meant for  peer OR are broadcast/multicast packets
-    bool isForPeer = (dstIpStr == peerVirtualIp);
-    bool isBroadcast = (dstIpStr == "10.0.0.255" || dstIpStr == "255.255.255.255");
-    bool isMulticast = (dstIp >> 28) == 14; // 224.0.0.0/4 (first octet 224-239)
+bool P2PSystem::forwardPacketToPeer(PacketBuffer packet)
+{
+    PeerId peer = routeFor(packet);
+    tracing::stamp(packet.trace(), tracing::Stage::FILTER);
+    if (peer != NO_PEER)
+        return networkModule->sendMessage(peer, std::move(packet));
 
-    if (!isForPeer && !isBroadcast && !isMulticast)
+    if (!isFlooded(packet))
     {
-        // Drop packet not meant for peer
+        // Drop packet not meant for any peer
+        metrics::add(metrics::Counter::DROP_NO_ROUTE);
         return false;
     }
 
     // if (isMulticast) dumpMulticastPacket(packet, "[TX] Sending");
 
-    // Send the packet to the peer
-    return networkModule->sendMessage(packet);
+    bool sent = false;
+    uint32_t targets = multicast.targets(packet, routedPeers.load(std::memory_order_acquire));
+    while (targets)
+    {
+        PeerId target = static_cast<PeerId>(__builtin_ctz(targets));
+        targets &= targets - 1;
+        sent |= networkModule->sendMessage(target, targets ? copyPacket(packet) : std::move(packet));
+    }
+    return sent;
+}
+
+void P2PSystem::observeMembership(const PacketBuffer& packet)
+{
+    // IGMP from a peer's host, it's the sender's memberships that change
+    if ((packet[0] >> 4) != 4 || packet[9] != 2)
+        return;
+    uint32_t srcIp = (packet[12] << 24) | (packet[13] << 16) | (packet[14] << 8) | packet[15];
+    PeerId peer = routeFor(srcIp);
+    if (peer != NO_PEER)
+        multicast.observe(peer, packet);
+}
+
+bool P2PSystem::isIpPacket(const PacketBuffer& packet)
+{
+    if (packet.size() < sizeof(IPPacket))
+        return false;
+    uint8_t version = packet[0] >> 4;
+    return version == 4 || (version == 6 && packet.size() >= sizeof(IPv6Packet));
+}
+
+PeerId P2PSystem::routeFor(const PacketBuffer& packet) const
+{
+    if ((packet[0] >> 4) == 4)
+        return routeFor((packet[16] << 24) | (packet[17] << 16) | (packet[18] << 8) | packet[19]);
+
+    // Inside the virtual /64 the last byte is the host index, the 15 ahead of it are fixed
+    const uint8_t* dstIp = packet.data() + offsetof(IPv6Packet, destIp);
+    if (std::memcmp(dstIp, VIRTUAL_NETWORK6_ADDR.data(), VIRTUAL_NETWORK6_ADDR.size() - 1) != 0)
+        return NO_PEER;
+    return routes[dstIp[15]].load(std::memory_order_acquire);
+}
+
+PeerId P2PSystem::routeFor(uint32_t dstIp) const
+{
+    // Peers only ever own addresses inside the virtual /24
+    if ((dstIp & VIRTUAL_NETMASK_ADDR) != VIRTUAL_NETWORK_ADDR)
+        return NO_PEER;
+    return routes[dstIp & 0xFF].load(std::memory_order_acquire);
+}
+
+bool P2PSystem::isFlooded(const PacketBuffer& packet)
+{
+    if ((packet[0] >> 4) == 4)
+        return isFlooded((packet[16] << 24) | (packet[17] << 16) | (packet[18] << 8) | packet[19]);
+    // IPv6 has no broadcast, multicast stands in for it
+    return packet[offsetof(IPv6Packet, destIp)] == MULTICAST6_PREFIX;
+}
+
+bool P2PSystem::isFlooded(uint32_t dstIp)
+{
+    // Broadcast / multicast go to every peer
+    bool isBroadcast = (dstIp == VIRTUAL_BROADCAST_ADDR || dstIp == LIMITED_BROADCAST_ADDR);
+    bool isMulticast = (dstIp & MULTICAST_NETMASK_ADDR) == MULTICAST_NETWORK_ADDR;
+
+    return isBroadcast || isMulticast;
+}
+
+bool P2PSystem::isLocal(const PacketBuffer& packet) const
+{
+    if ((packet[0] >> 4) == 4)
+        return isLocal((packet[16] << 24) | (packet[17] << 16) | (packet[18] << 8) | packet[19]);
+
+    // Our host index is the low byte of the IPv4 address, 0 until we have one
+    uint32_t local = localVirtualAddr.load(std::memory_order_relaxed);
+    const uint8_t* dstIp = packet.data() + offsetof(IPv6Packet, destIp);
+    return local != 0 && dstIp[15] == (local & 0xFF) &&
+        std::memcmp(dstIp, VIRTUAL_NETWORK6_ADDR.data(), VIRTUAL_NETWORK6_ADDR.size() - 1) == 0;
+}
+
+bool P2PSystem::isLocal(uint32_t dstIp) const
+{
+    return dstIp == localVirtualAddr.load(std::memory_order_relaxed);
+}
+
+void P2PSystem::queueForPeer(PeerId peer, PacketBuffer packet)
+{
+    if (!packet)
+        return;
+
+    // TCP reads loss as congestion, recover it on the link instead; the rest stays best-effort
+    if (needsReliableDelivery(packet))
+        networkModule->sendReliable(peer, std::move(packet));
+    else
+        forwardBatches[peer].push_back(std::move(packet));
 }
 
-void P2PSystem::handleNetworkData(std::vector<uint8_t> data)
+PacketBuffer P2PSystem::copyPacket(const PacketBuffer& packet)
+{
+    PacketBuffer copy = packetPool->acquire(packet.size());
+    if (copy)
+        std::memcpy(copy.data(), packet.data(), packet.size());
+    return copy;
+}
+
+bool P2PSystem::needsReliableDelivery(const PacketBuffer& packet) const
+{
+    // IPv4 protocol field, or the IPv6 next header; TCP behind IPv6 extension headers stays best-effort
+    uint8_t protocol = (packet[0] >> 4) == 4 ? packet[9] : packet[offsetof(IPv6Packet, nextHeader)];
+    return reliableTcp && protocol == 6; // TCP
+}
+
+void P2PSystem::handleNetworkData(PacketBuffer data, size_t lane)
 {
     // We received a packet from peer, forward to TUN
-    // Minimum IPv4 header size and version check
-    if (data.size() >= sizeof(IPPacket) && (data[0] >> 4) == 4) 
+    // Minimum header size for its version
+    if (isIpPacket(data))
     {
-        deliverPacketToTun(std::move(data));
+        deliverPacketToTun(std::move(data), lane);
     }
 }
 
-bool P2PSystem::deliverPacketToTun(std::vector<uint8_t> packet) {
-    // Basic check for TUN interface availability
+void P2PSystem::handleNetworkBatch(PacketBatch& packets, size_t lane)
+{
     if (!tunInterface || !tunInterface->isRunning())
     {
-        return false;
+        packets.clear();
+        return;
     }
 
-    // Extract source and destination IPs for filtering
-    uint32_t srcIp = (packet[12] << 24) | (packet[13] << 16) | (packet[14] << 8) | packet[15];
-    uint32_t dstIp = (packet[16] << 24) | (packet[17] << 16) | (packet[18] << 8) | packet[19];
+    // Same filter as one by one, what passes goes to the TUN queue in one push
+    for (PacketBuffer& packet : packets)
+    {
+        if (!packet || !isIpPacket(packet))
+        {
+            if (packet)
+                metrics::add(metrics::Counter::DROP_MALFORMED);
+            packet = PacketBuffer();
+            continue;
+        }
+
+        if (!isLocal(packet) && !isFlooded(packet))
+        {
+            metrics::add(metrics::Counter::DROP_NO_ROUTE);
+            packet = PacketBuffer();
+        }
+        else
+        {
+            observeMembership(packet);
+        }
+    }
+    tunInterface->sendPackets(packets, lane);
+}
 
-    std::string srcIpStr = utils::uint32ToIp(srcIp);
-    std::string dstIpStr = utils::uint32ToIp(dstIp);
+bool P2PSystem::deliverPacketToTun(PacketBuffer packet, size_t lane) {
+    // Basic check for TUN interface availability
+    if (!tunInterface || !tunInterface->isRunning())
+    {
+        return false;
+    }
 
     // Only deliver packets that are meant for us OR are broadcast/multicast packets
-    bool isForUs = (dstIpStr == localVirtualIp);
-    bool isBroadcast = (dstIpStr == "10.0.0.255" || dstIpStr == "255.255.255.255");
-    bool isMulticast = (dstIp >> 28) == 14; // 224.0.0.0/4 (first octet 224-239)
-
-    if (!isForUs && !isBroadcast && !isMulticast)
+    if (!isLocal(packet) && !isFlooded(packet))
     {
         // Drop packet not meant for us
+        metrics::add(metrics::Counter::DROP_NO_ROUTE);
         return false;
     }
+    observeMembership(packet);
 
     // if (isMulticast) dumpMulticastPacket(packet, "[RX] Receiving");
 
     // Send the packet to the TUN interface
-    return tunInterface->sendPacket(std::move(packet));
+    return tunInterface->sendPacket(std::move(packet), lane);
 }
 
 /*
@@ -488,10 +1063,14 @@ bool P2PSystem::deliverPacketToTun(std::vector<uint8_t> packet) {
 
 void P2PSystem::stopNetworkInterface()
 {
+    // A reset must not interleave with a configuration still running
+    if (interfaceSetup.valid())
+        interfaceSetup.wait();
+
     if (tunInterface && tunInterface->isRunning())
     {
         tunInterface->stopPacketProcessing();
-        networkConfigManager.resetInterfaceConfiguration(peerVirtualIp);
+        networkConfigManager.resetInterfaceConfiguration();
         SYSTEM_LOG_INFO("[System] Network interface stopped and configuration reset");
     }
 }
@@ -505,6 +1084,12 @@ void P2PSystem::stopConnection()
     
     // Stop the network interface
     stopNetworkInterface();
+    interfaceConfigured = false;
+    interfaceReady = {};
+
+    // Drop every route and leave the session on the server
+    clearMesh();
+    signalingClient.leaveSession();
     
     // Reset peer info
     peerUsername = "";
@@ -535,7 +1120,6 @@ void P2PSystem::shutdown()
     
     // Stop the network interface
     stopNetworkInterface();
-    tunInterface->close();
     
     // Stop the network
     if (networkModule)
@@ -552,10 +1136,13 @@ void P2PSystem::shutdown()
     // Clean up signaling connection
     signalingClient.disconnect();
 
-    if (monitorThread.joinable())
-    {
-        monitorThread.join();
-    }
+    // Returns right away when the shutdown came in as an event
+    stateManager->stopDispatcher();
+
+    metricsServer.stop();
+
+    if (firewallSetup.valid())
+        firewallSetup.wait();
     
     SYSTEM_LOG_INFO("[System] System shut down successfully");
 }
\ No newline at end of file
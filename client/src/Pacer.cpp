@@ -0,0 +1,127 @@
+#include "Pacer.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+
+namespace
+{
+metrics::Gauge queuedGauge(TrafficClass trafficClass)
+{
+    return static_cast<metrics::Gauge>(static_cast<size_t>(metrics::Gauge::QUEUED_CONTROL) + static_cast<size_t>(trafficClass));
+}
+
+metrics::Counter dropCounter(TrafficClass trafficClass)
+{
+    return static_cast<metrics::Counter>(static_cast<size_t>(metrics::Counter::DROP_QUEUE_CONTROL) + static_cast<size_t>(trafficClass));
+}
+}
+
+bool Pacer::enqueue(TrafficClass trafficClass, Entry entry)
+{
+    entry.queuedAt = Clock::now();
+    uint64_t dropsBefore = scheduler.dropped(trafficClass);
+    bool queued = scheduler.enqueue(trafficClass, std::move(entry));
+    bool evicted = queued && scheduler.dropped(trafficClass) != dropsBefore;
+    if (!queued || evicted)
+        metrics::add(dropCounter(trafficClass));
+    if (queued && !evicted)
+        metrics::adjust(queuedGauge(trafficClass), 1);
+    return queued;
+}
+
+void Pacer::pop()
+{
+    if (scheduler.empty())
+        return;
+    metrics::adjust(queuedGauge(scheduler.pop()), -1);
+}
+
+void Pacer::handBack(PacketBuffer datagram)
+{
+    std::lock_guard<std::mutex> lock(handBackMutex);
+    handedBack.push_back(std::move(datagram));
+    hasHandedBack.store(true, std::memory_order_release);
+}
+
+void Pacer::takeHandedBack()
+{
+    // Rare, the lock is only taken when something is there
+    if (!hasHandedBack.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(handBackMutex);
+    for (PacketBuffer& datagram : handedBack)
+        stalledDatagrams.push_back(std::move(datagram));
+    handedBack.clear();
+    hasHandedBack.store(false, std::memory_order_relaxed);
+}
+
+void Pacer::refill(Clock::time_point now, uint64_t rate)
+{
+    double capacity = std::max(static_cast<double>(MIN_BURST), static_cast<double>(rate) * BURST.count() / 1e6);
+    if (lastRefill == Clock::time_point())
+    {
+        tokens = capacity;
+    }
+    else
+    {
+        double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+        tokens = std::min(capacity, tokens + elapsed * static_cast<double>(rate));
+    }
+    lastRefill = now;
+}
+
+std::chrono::microseconds Pacer::delay(uint64_t rate) const
+{
+    if (tokens > 0.0 || !rate)
+        return std::chrono::microseconds(0);
+    return std::chrono::microseconds(static_cast<int64_t>(-tokens * 1e6 / static_cast<double>(rate)) + 1);
+}
+
+void Pacer::clear(uint32_t session_generation)
+{
+    for (size_t i = 0; i < static_cast<size_t>(TrafficClass::COUNT); ++i)
+    {
+        TrafficClass trafficClass = static_cast<TrafficClass>(i);
+        if (size_t queuedPackets = scheduler.queued(trafficClass))
+            metrics::adjust(queuedGauge(trafficClass), -static_cast<int64_t>(queuedPackets));
+    }
+    scheduler.clear();
+    stalledDatagrams.clear();
+    {
+        std::lock_guard<std::mutex> lock(handBackMutex);
+        handedBack.clear();
+        hasHandedBack.store(false, std::memory_order_relaxed);
+    }
+    windowBlockedSince.reset();
+    lastRefill = Clock::time_point();
+    tokens = 0.0;
+    generation = session_generation;
+}
+
+void TimingWheel::schedule(uint8_t id, std::chrono::microseconds delay, Clock::time_point now)
+{
+    if (!count)
+        cursorTime = now;
+
+    // Measured from the cursor's slot, which may lag behind now. Rounded up, never early.
+    auto ahead = std::chrono::duration_cast<std::chrono::microseconds>(now - cursorTime) + delay;
+    int64_t due = (ahead.count() + TICK.count() - 1) / TICK.count();
+    size_t ticks = std::min<size_t>(SLOTS - 1, static_cast<size_t>(std::max<int64_t>(0, due)));
+    slots[(cursor + ticks) % SLOTS].push_back(id);
+    ++count;
+}
+
+std::optional<std::chrono::microseconds> TimingWheel::nextDue(Clock::time_point now) const
+{
+    if (!count)
+        return std::nullopt;
+
+    for (size_t i = 0; i < SLOTS; ++i)
+    {
+        if (slots[(cursor + i) % SLOTS].empty())
+            continue;
+        auto due = std::chrono::duration_cast<std::chrono::microseconds>(cursorTime + i * TICK - now);
+        return std::max(due, std::chrono::microseconds(0));
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,76 @@
+#include "PacketAggregator.hpp"
+#include <cstring>
+
+void PacketAggregator::add(PacketBuffer packet, Clock::time_point now)
+{
+    if (held.empty())
+        firstHeld = now;
+    bundleSize += LENGTH_SIZE + packet.size();
+    held.push_back(std::move(packet));
+}
+
+PacketBuffer PacketAggregator::take(PacketPool& pool, bool& bundled)
+{
+    bundled = held.size() > 1;
+    if (!bundled)
+    {
+        // Alone, no point in the length prefix
+        PacketBuffer single = held.empty() ? PacketBuffer() : std::move(held.front());
+        clear();
+        return single;
+    }
+
+    PacketBuffer bundle = pool.acquire(bundleSize);
+    if (bundle)
+    {
+        uint8_t* out = bundle.data();
+        for (const PacketBuffer& packet : held)
+        {
+            out[0] = (packet.size() >> 8) & 0xFF;
+            out[1] = packet.size() & 0xFF;
+            std::memcpy(out + LENGTH_SIZE, packet.data(), packet.size());
+            out += LENGTH_SIZE + packet.size();
+            // The bundle's trace stands for the first sampled packet in it
+            if (!bundle.trace())
+                bundle.setTrace(packet.trace());
+        }
+    }
+    clear();
+    return bundle;
+}
+
+void PacketAggregator::clear()
+{
+    held.clear();
+    bundleSize = 0;
+}
+
+bool PacketAggregator::split(const PacketBuffer& bundle, std::vector<PacketBuffer>& packets)
+{
+    size_t offset = 0;
+    size_t first = packets.size();
+    while (offset < bundle.size())
+    {
+        if (bundle.size() - offset < LENGTH_SIZE)
+            break;
+
+        size_t length = (bundle[offset] << 8) | bundle[offset + 1];
+        offset += LENGTH_SIZE;
+        if (length == 0 || length > bundle.size() - offset)
+            break;
+
+        PacketBuffer packet = bundle.share();
+        packet.pull(offset);
+        packet.resize(length);
+        packets.push_back(std::move(packet));
+        offset += length;
+    }
+
+    // All or nothing, a bundle that doesn't parse to its end wasn't built by us
+    if (offset != bundle.size())
+    {
+        packets.resize(first);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,125 @@
+#include "PacketPool.hpp"
+
+PacketPool::PacketPool(size_t smallSlabs, size_t largeSlabs)
+{
+    initClass(classes[0], 0, SMALL_SLAB_SIZE, smallSlabs);
+    initClass(classes[1], 1, LARGE_SLAB_SIZE, largeSlabs);
+}
+
+PacketPool::~PacketPool() = default;
+
+void PacketPool::initClass(SizeClass& sizeClass, uint8_t classIndex, size_t slabSize, size_t slabCount)
+{
+    sizeClass.slabSize = slabSize;
+    sizeClass.slabCount = slabCount;
+    sizeClass.memory = std::make_unique<uint8_t[]>(slabSize * slabCount);
+    sizeClass.slabs = std::make_unique<PacketSlab[]>(slabCount);
+    sizeClass.next = std::make_unique<std::atomic<uint32_t>[]>(slabCount);
+
+    // Chain every slab into the free list, lowest index on top
+    for (size_t i = 0; i < slabCount; ++i)
+    {
+        PacketSlab& slab = sizeClass.slabs[i];
+        slab.pool = this;
+        slab.base = sizeClass.memory.get() + i * slabSize;
+        slab.capacity = static_cast<uint32_t>(slabSize);
+        slab.index = static_cast<uint32_t>(i);
+        slab.sizeClass = classIndex;
+        slab.refs.store(0, std::memory_order_relaxed);
+        slab.trace = 0;
+        sizeClass.next[i].store(
+            i + 1 < slabCount ? static_cast<uint32_t>(i + 1) : NO_SLAB,
+            std::memory_order_relaxed);
+    }
+    sizeClass.freeHead.store(slabCount ? 0 : NO_SLAB, std::memory_order_release);
+    sizeClass.freeCount.store(slabCount, std::memory_order_release);
+}
+
+PacketSlab* PacketPool::pop(SizeClass& sizeClass)
+{
+    uint64_t head = sizeClass.freeHead.load(std::memory_order_acquire);
+    for (;;)
+    {
+        uint32_t index = static_cast<uint32_t>(head);
+        if (index == NO_SLAB)
+            return nullptr;
+
+        uint32_t next = sizeClass.next[index].load(std::memory_order_relaxed);
+        uint64_t tag = (head >> 32) + 1;
+        if (sizeClass.freeHead.compare_exchange_weak(
+                head, (tag << 32) | next,
+                std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            sizeClass.freeCount.fetch_sub(1, std::memory_order_relaxed);
+            return &sizeClass.slabs[index];
+        }
+    }
+}
+
+void PacketPool::push(SizeClass& sizeClass, PacketSlab* slab)
+{
+    uint64_t head = sizeClass.freeHead.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        sizeClass.next[slab->index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        uint64_t tag = (head >> 32) + 1;
+        if (sizeClass.freeHead.compare_exchange_weak(
+                head, (tag << 32) | slab->index,
+                std::memory_order_release, std::memory_order_relaxed))
+        {
+            sizeClass.freeCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+PacketBuffer PacketPool::acquire(size_t size, size_t headroom)
+{
+    PacketBuffer buffer;
+    size_t needed = headroom + size;
+
+    PacketSlab* slab = nullptr;
+    for (SizeClass& sizeClass : classes)
+    {
+        if (needed > sizeClass.slabSize)
+            continue;
+        // Fall through to the large class if all small slabs are in flight
+        if ((slab = pop(sizeClass)))
+            break;
+    }
+
+    if (!slab)
+    {
+        exhausted.fetch_add(1, std::memory_order_relaxed);
+        return buffer;
+    }
+
+    slab->refs.store(1, std::memory_order_relaxed);
+    slab->trace = 0;
+    buffer.slab = slab;
+    buffer.offset = static_cast<uint32_t>(headroom);
+    buffer.length = static_cast<uint32_t>(size);
+    return buffer;
+}
+
+void PacketPool::release(PacketSlab* slab)
+{
+    push(classes[slab->sizeClass], slab);
+}
+
+PacketPool::Region PacketPool::region(size_t index) const
+{
+    const SizeClass& sizeClass = classes[index];
+    return Region{sizeClass.memory.get(), sizeClass.slabSize * sizeClass.slabCount};
+}
+
+size_t PacketPool::available() const
+{
+    return classes[0].freeCount.load(std::memory_order_relaxed) +
+           classes[1].freeCount.load(std::memory_order_relaxed);
+}
+
+uint64_t PacketPool::exhaustedCount() const
+{
+    return exhausted.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,76 @@
+#include "PathMtu.hpp"
+#include <algorithm>
+#include <iterator>
+
+void PathMtuProber::reset()
+{
+    confirmed = BASE_DATAGRAM;
+    for (Probe& probe : sent)
+        probe = Probe{};
+    restart();
+}
+
+void PathMtuProber::restart()
+{
+    ceiling = MAX_DATAGRAM;
+    probing = 0;
+    attempts = 0;
+}
+
+std::optional<uint16_t> PathMtuProber::nextProbe()
+{
+    if (!searching())
+        return std::nullopt;
+
+    // Upper middle, so the search always moves even with the bounds a step apart
+    if (!probing)
+    {
+        probing = static_cast<uint16_t>(confirmed + (ceiling - confirmed + 1) / 2);
+        attempts = 0;
+    }
+    ++attempts;
+    return probing;
+}
+
+void PathMtuProber::onSent(uint16_t size, uint32_t token)
+{
+    sent[nextSent] = Probe{size, token};
+    nextSent = (nextSent + 1) % HISTORY;
+}
+
+bool PathMtuProber::onAck(uint16_t size, uint32_t token)
+{
+    if (size <= confirmed || size > MAX_DATAGRAM)
+        return false;
+
+    // Only sizes we probed, someone spoofing the peer's address can't talk the path up
+    Probe* probe = std::find_if(std::begin(sent), std::end(sent), [size, token](const Probe& candidate)
+    {
+        return candidate.size == size && candidate.token == token;
+    });
+    if (probe == std::end(sent))
+        return false;
+    *probe = Probe{};
+
+    // A late answer to an earlier probe counts just the same
+    confirmed = size;
+    if (ceiling < confirmed)
+        ceiling = confirmed;
+    if (probing && probing <= size)
+    {
+        probing = 0;
+        attempts = 0;
+    }
+    return true;
+}
+
+void PathMtuProber::onTimeout()
+{
+    if (!probing || attempts < MAX_ATTEMPTS)
+        return;
+
+    // Too big, everything from here up is off the table
+    ceiling = static_cast<uint16_t>(probing - 1);
+    probing = 0;
+    attempts = 0;
+}
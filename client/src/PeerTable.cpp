@@ -0,0 +1,309 @@
+#include "PeerTable.hpp"
+#include "Logger.hpp"
+#include <sodium/randombytes.h>
+#include <thread>
+
+namespace
+{
+// Counted around one copy out of an address slot, before the slot is picked, like a CipherPin
+class AddressReader
+{
+public:
+    explicit AddressReader(std::atomic<uint32_t>& count) : readers(count) { readers.fetch_add(1, std::memory_order_seq_cst); }
+    ~AddressReader() { readers.fetch_sub(1, std::memory_order_release); }
+    AddressReader(const AddressReader&) = delete;
+    AddressReader& operator=(const AddressReader&) = delete;
+
+private:
+    std::atomic<uint32_t>& readers;
+};
+}
+
+PeerSession::PeerSession(PeerId peer_id, uint8_t shard_index, boost::asio::io_context& context)
+    : id(peer_id)
+    , shard(shard_index)
+    , ackTimer(context)
+    , reliableTimer(context)
+    , pathMtuTimer(context)
+    , holePunchTimer(context)
+{
+    // Datagram acks / losses drive the reliable channel's retransmits
+    ackTracker.setResolveCallback([this](uint32_t seq, bool acked)
+    {
+        if (reliableChannel.hasInFlight())
+            reliableChannel.onResolved(seq, acked);
+    });
+}
+
+void PeerSession::waitForCipherReaders() const
+{
+    // Pins last one seal or open, so this is short
+    while (cipherReaders.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+}
+
+boost::asio::ip::udp::endpoint PeerSession::endpoint() const
+{
+    AddressReader reading(addressReaders);
+    return addresses[addressSlot.load(std::memory_order_seq_cst)].endpoint;
+}
+
+std::string PeerSession::endpointString() const
+{
+    AddressReader reading(addressReaders);
+    return addresses[addressSlot.load(std::memory_order_seq_cst)].text;
+}
+
+void PeerSession::setEndpoint(const boost::asio::ip::udp::endpoint& to)
+{
+    // Readers that picked the other slot before the last move may still be copying from it
+    uint8_t next = addressSlot.load(std::memory_order_relaxed) ^ 1;
+    while (addressReaders.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+    addresses[next].endpoint = to;
+    // v4-mapped peers on a dual-stack socket read as the IPv4 address they are
+    boost::asio::ip::address address = to.address();
+    if (address.is_v6() && address.to_v6().is_v4_mapped())
+        address = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+    addresses[next].text = address.is_v6() ?
+        "[" + address.to_string() + "]:" + std::to_string(to.port()) :
+        address.to_string() + ":" + std::to_string(to.port());
+    addressSlot.store(next, std::memory_order_seq_cst);
+}
+
+PeerTable::PeerTable(boost::asio::io_context& control, const std::vector<boost::asio::io_context*>& shards)
+    : ioContext(control)
+{
+    for (size_t i = 0; i < MAX_PEERS; ++i)
+    {
+        size_t shard = i % shards.size();
+        sessions[i] = std::make_unique<PeerSession>(
+            static_cast<PeerId>(i), static_cast<uint8_t>(shard), *shards[shard]);
+    }
+    byEndpoint.reserve(MAX_PEERS * 2);
+}
+
+size_t PeerTable::EndpointHash::operator()(const boost::asio::ip::udp::endpoint& endpoint) const
+{
+    size_t hash = endpoint.port();
+    if (endpoint.address().is_v4())
+    {
+        hash ^= static_cast<size_t>(endpoint.address().to_v4().to_uint()) << 16;
+    }
+    else
+    {
+        for (uint8_t byte : endpoint.address().to_v6().to_bytes())
+            hash = hash * 31 + byte;
+    }
+    return hash;
+}
+
+std::optional<PeerId> PeerTable::add(const boost::asio::ip::udp::endpoint& endpoint)
+{
+    std::lock_guard<std::mutex> lock(slotMutex);
+
+    PeerSession* freeSlot = nullptr;
+    for (const std::unique_ptr<PeerSession>& session : sessions)
+    {
+        if (!session->active.load(std::memory_order_relaxed))
+        {
+            if (!freeSlot)
+                freeSlot = session.get();
+        }
+        else if (session->endpoint() == endpoint)
+        {
+            return session->id;
+        }
+    }
+
+    if (!freeSlot)
+    {
+        NETWORK_LOG_ERROR("[Network] Peer table full, {} peers max", MAX_PEERS);
+        return std::nullopt;
+    }
+
+    freeSlot->setEndpoint(endpoint);
+    // Never 0, that's "unknown" on the wire
+    uint32_t sessionId = 0;
+    while (sessionId == 0)
+        randombytes_buf(&sessionId, sizeof(sessionId));
+    freeSlot->localSessionId.store(sessionId, std::memory_order_relaxed);
+    freeSlot->remoteSessionId.store(0, std::memory_order_relaxed);
+    freeSlot->wireVersion.store(wire::V1, std::memory_order_relaxed);
+    freeSlot->migrateSent = 0;
+    freeSlot->migrateSeen = 0;
+    freeSlot->ackSent = 0;
+    freeSlot->ackSeen = 0;
+    freeSlot->disconnectSent.store(0, std::memory_order_relaxed);
+    freeSlot->relayed.store(false, std::memory_order_relaxed);
+    freeSlot->directEndpoint = boost::asio::ip::udp::endpoint();
+    freeSlot->alternateEndpoint = boost::asio::ip::udp::endpoint();
+    freeSlot->relayProbe = PeerSession::PathProbe{};
+    freeSlot->directProbe = PeerSession::PathProbe{};
+    freeSlot->probeSent = 0;
+    // New keys come with the claim, numbering under them starts over
+    freeSlot->nextSeqNumber.store(0, std::memory_order_relaxed);
+    freeSlot->rxPacketNumber = 0;
+    freeSlot->replayWindow.reset();
+    freeSlot->connection.setConnected(false);
+    freeSlot->connection.updateActivity();
+    freeSlot->generation.fetch_add(1, std::memory_order_relaxed);
+    freeSlot->closing.store(false, std::memory_order_relaxed);
+    freeSlot->active.store(true, std::memory_order_release);
+
+    // The endpoint index belongs to the IO thread
+    PeerId id = freeSlot->id;
+    boost::asio::post(ioContext, [this, endpoint, id]()
+    {
+        byEndpoint[endpoint] = id;
+    });
+    return id;
+}
+
+void PeerTable::remove(PeerSession& session)
+{
+    if (session.closing.exchange(true))
+        return;
+
+    teardown(session);
+
+    // The endpoint index and the slot go back on the IO thread, after any packet it already routed here
+    PeerSession* released = &session;
+    boost::asio::post(ioContext, [this, released]()
+    {
+        release(*released);
+    });
+}
+
+void PeerTable::clear()
+{
+    for (const std::unique_ptr<PeerSession>& session : sessions)
+    {
+        if (!session->active.load(std::memory_order_relaxed))
+            continue;
+        session->closing.store(true, std::memory_order_relaxed);
+        teardown(*session);
+        release(*session);
+    }
+}
+
+void PeerTable::teardown(PeerSession& session)
+{
+    boost::system::error_code ec;
+    session.ackTimer.cancel(ec);
+    session.reliableTimer.cancel(ec);
+    session.holePunchTimer.cancel(ec);
+    session.holePunchRemaining = 0;
+    session.pathMtuTimer.cancel(ec);
+    session.pathMtu.reset();
+    session.pathDatagram = 0;
+
+    // Receive state is reset once the next occupant answers, send seqs start over in add()
+    session.ackTracker.resetSend();
+    session.congestion.reset();
+    session.reliableChannel.resetSend();
+    session.reliableChannel.resetReceive();
+    session.fecDecoder.reset();
+    session.fecReceiving = false;
+
+    // Keys belong to the connection, the next occupant exchanges its own. The sending thread may
+    // have loaded them just before, they're wiped once it's done with them.
+    session.cipher.store(nullptr, std::memory_order_seq_cst);
+    session.waitForCipherReaders();
+    session.cipherSlots[0].clear();
+    session.cipherSlots[1].clear();
+    session.warnedNoKeys = false;
+
+    session.connection.setConnected(false);
+}
+
+void PeerTable::release(PeerSession& session)
+{
+    std::lock_guard<std::mutex> lock(slotMutex);
+
+    // A rebound peer may be indexed under more than one endpoint
+    for (auto it = byEndpoint.begin(); it != byEndpoint.end();)
+    {
+        if (it->second == session.id)
+            it = byEndpoint.erase(it);
+        else
+            ++it;
+    }
+
+    session.active.store(false, std::memory_order_release);
+}
+
+PeerSession* PeerTable::find(const boost::asio::ip::udp::endpoint& endpoint) const
+{
+    auto it = byEndpoint.find(endpoint);
+    if (it == byEndpoint.end())
+        return nullptr;
+    return get(it->second);
+}
+
+PeerSession* PeerTable::adoptPending(const boost::asio::ip::udp::endpoint& endpoint)
+{
+    // Goes by the index keys, the session's own endpoint belongs to its shard
+    PeerSession* pending = nullptr;
+    for (const auto& [known, id] : byEndpoint)
+    {
+        PeerSession* session = get(id);
+        if (session && !session->connection.isConnected() && !session->relayed.load(std::memory_order_relaxed) &&
+            known.address() == endpoint.address())
+        {
+            pending = session;
+            break;
+        }
+    }
+
+    // Old mapping stays alongside, a late answer from there still finds the peer
+    if (pending)
+        byEndpoint[endpoint] = pending->id;
+    return pending;
+}
+
+PeerSession* PeerTable::findBySession(uint32_t localSessionId) const
+{
+    if (localSessionId == 0)
+        return nullptr;
+    for (const std::unique_ptr<PeerSession>& session : sessions)
+    {
+        if (session->active.load(std::memory_order_acquire) &&
+            session->localSessionId.load(std::memory_order_relaxed) == localSessionId)
+        {
+            return session.get();
+        }
+    }
+    return nullptr;
+}
+
+void PeerTable::addEndpoint(PeerSession& session, const boost::asio::ip::udp::endpoint& endpoint)
+{
+    // Old address stays indexed too, packets still on their way from there aren't dropped
+    PeerId id = session.id;
+    uint32_t generation = session.generation.load(std::memory_order_relaxed);
+    boost::asio::post(ioContext, [this, endpoint, id, generation]()
+    {
+        PeerSession* session = get(id);
+        if (session && session->generation.load(std::memory_order_relaxed) == generation)
+            byEndpoint[endpoint] = id;
+    });
+}
+
+size_t PeerTable::activeCount() const
+{
+    size_t count = 0;
+    forEach([&count](const PeerSession&) { ++count; });
+    return count;
+}
+
+size_t PeerTable::connectedCount() const
+{
+    size_t count = 0;
+    forEach([&count](const PeerSession& session)
+    {
+        if (session.connection.isConnected())
+            ++count;
+    });
+    return count;
+}
@@ -0,0 +1,507 @@
+#include "RIOTransport.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+
+namespace
+{
+// Receive slots come first in the address arena, send slots after them
+constexpr size_t ADDRESS_SLOTS = RIOTransport::RECEIVE_DEPTH + RIOTransport::SEND_DEPTH;
+
+void endpointToAddress(const boost::asio::ip::udp::endpoint& endpoint, SOCKADDR_INET& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    std::memcpy(&address, endpoint.data(), endpoint.size());
+}
+
+void addressToEndpoint(const SOCKADDR_INET& address, boost::asio::ip::udp::endpoint& endpoint)
+{
+    size_t length = address.si_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    std::memcpy(endpoint.data(), &address, length);
+    endpoint.resize(length);
+}
+}
+
+struct RIOTransport::Impl
+{
+    RIO_EXTENSION_FUNCTION_TABLE rio{};
+    SOCKET socket = INVALID_SOCKET;
+
+    // One registration per pool region, plus the address arena
+    std::array<RIO_BUFFERID, PacketPool::REGION_COUNT> poolBuffers;
+    RIO_BUFFERID addressBuffer = RIO_INVALID_BUFFERID;
+    std::unique_ptr<SOCKADDR_INET[]> addresses;
+
+    RIO_CQ receiveQueue = RIO_INVALID_CQ;
+    RIO_CQ sendQueue = RIO_INVALID_CQ;
+    RIO_RQ requestQueue = RIO_INVALID_RQ;
+
+    // Owns the event the receive queue signals
+    std::unique_ptr<boost::asio::windows::object_handle> receiveWait;
+
+    // Buffers the kernel currently owns, indexed by the request context
+    std::array<PacketBuffer, RECEIVE_DEPTH> receiveSlots;
+    std::vector<uint32_t> idleReceiveSlots;
+    std::array<PacketBuffer, SEND_DEPTH> sendSlots;
+    std::vector<uint32_t> freeSendSlots;
+
+    // Staging for one dequeue round, receive side runs on the IO thread and send side on the sender
+    std::array<RIORESULT, UDPBatchIO::MAX_BATCH> receiveResults;
+    std::array<RIORESULT, UDPBatchIO::MAX_BATCH> sendResults;
+    std::vector<ReceivedDatagram> received;
+
+    // Calls on one request queue must not overlap, sends come from the TUN thread
+    // and receive reposts from the IO thread
+    std::mutex requestQueueMutex;
+
+    RIO_BUF bufferFor(const PacketBuffer& packet) const
+    {
+        RIO_BUF buffer;
+        buffer.BufferId = poolBuffers[packet.regionIndex()];
+        buffer.Offset = static_cast<ULONG>(packet.regionOffset());
+        buffer.Length = static_cast<ULONG>(packet.size());
+        return buffer;
+    }
+
+    RIO_BUF addressFor(size_t slot) const
+    {
+        RIO_BUF buffer;
+        buffer.BufferId = addressBuffer;
+        buffer.Offset = static_cast<ULONG>(slot * sizeof(SOCKADDR_INET));
+        buffer.Length = sizeof(SOCKADDR_INET);
+        return buffer;
+    }
+};
+
+RIOTransport::RIOTransport(boost::asio::io_context& context, std::shared_ptr<PacketPool> packet_pool)
+    : ioContext(context)
+    , packetPool(std::move(packet_pool))
+    , impl(std::make_unique<Impl>())
+{
+    impl->poolBuffers.fill(RIO_INVALID_BUFFERID);
+    impl->addresses = std::make_unique<SOCKADDR_INET[]>(ADDRESS_SLOTS);
+    impl->received.resize(UDPBatchIO::MAX_BATCH);
+    impl->idleReceiveSlots.reserve(RECEIVE_DEPTH);
+    impl->freeSendSlots.reserve(SEND_DEPTH);
+    for (uint32_t i = SEND_DEPTH; i > 0; --i)
+    {
+        impl->freeSendSlots.push_back(i - 1);
+    }
+}
+
+RIOTransport::~RIOTransport()
+{
+    close();
+}
+
+bool RIOTransport::open(boost::asio::ip::udp::socket& socket)
+{
+    if (opened)
+        return true;
+
+    boost::system::error_code ec;
+    boost::asio::ip::udp::endpoint local = socket.local_endpoint(ec);
+    if (ec)
+    {
+        NETWORK_LOG_ERROR("[RIO] Socket has no local endpoint: {}", ec.message());
+        return false;
+    }
+    bool nonBlocking = socket.non_blocking();
+
+    SOCKET s = WSASocketW(
+        local.protocol().family(), SOCK_DGRAM, IPPROTO_UDP, nullptr, 0,
+        WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (s == INVALID_SOCKET)
+    {
+        NETWORK_LOG_ERROR("[RIO] Failed to create registered I/O socket, error code: {}", WSAGetLastError());
+        return false;
+    }
+
+    // Everything that doesn't need the bound socket is set up first, so failing here
+    // leaves the original socket untouched
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    if (WSAIoctl(s, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+            &functionTableId, sizeof(functionTableId),
+            &impl->rio, sizeof(impl->rio), &bytes, nullptr, nullptr) != 0)
+    {
+        NETWORK_LOG_ERROR("[RIO] Registered I/O not available, error code: {}", WSAGetLastError());
+        closesocket(s);
+        return false;
+    }
+
+    for (size_t i = 0; i < PacketPool::REGION_COUNT; ++i)
+    {
+        PacketPool::Region region = packetPool->region(i);
+        impl->poolBuffers[i] = impl->rio.RIORegisterBuffer(
+            reinterpret_cast<PCHAR>(region.base), static_cast<DWORD>(region.size));
+    }
+    impl->addressBuffer = impl->rio.RIORegisterBuffer(
+        reinterpret_cast<PCHAR>(impl->addresses.get()),
+        static_cast<DWORD>(ADDRESS_SLOTS * sizeof(SOCKADDR_INET)));
+
+    HANDLE receiveEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    RIO_NOTIFICATION_COMPLETION notification{};
+    notification.Type = RIO_EVENT_COMPLETION;
+    notification.Event.EventHandle = receiveEvent;
+    notification.Event.NotifyReset = TRUE;
+
+    if (receiveEvent)
+    {
+        impl->receiveWait = std::make_unique<boost::asio::windows::object_handle>(ioContext, receiveEvent);
+        impl->receiveQueue = impl->rio.RIOCreateCompletionQueue(RECEIVE_DEPTH, &notification);
+    }
+    impl->sendQueue = impl->rio.RIOCreateCompletionQueue(SEND_DEPTH, nullptr);
+
+    bool registered = impl->addressBuffer != RIO_INVALID_BUFFERID &&
+        impl->receiveQueue != RIO_INVALID_CQ &&
+        impl->sendQueue != RIO_INVALID_CQ;
+    for (RIO_BUFFERID id : impl->poolBuffers)
+    {
+        registered &= id != RIO_INVALID_BUFFERID;
+    }
+    if (!registered)
+    {
+        NETWORK_LOG_ERROR("[RIO] Failed to register buffers or create completion queues, error code: {}", WSAGetLastError());
+        closesocket(s);
+        close();
+        return false;
+    }
+
+    // Hand the port over, the NAT mapping from STUN is keyed on it
+    socket.close(ec);
+    if (bind(s, local.data(), static_cast<int>(local.size())) == SOCKET_ERROR)
+    {
+        NETWORK_LOG_ERROR("[RIO] Failed to bind registered I/O socket to port {}, error code: {}", local.port(), WSAGetLastError());
+        closesocket(s);
+        close();
+        socket.open(local.protocol(), ec);
+        socket.bind(local, ec);
+        socket.non_blocking(nonBlocking, ec);
+        return false;
+    }
+
+    impl->requestQueue = impl->rio.RIOCreateRequestQueue(
+        s, RECEIVE_DEPTH, 1, SEND_DEPTH, 1,
+        impl->receiveQueue, impl->sendQueue, nullptr);
+    if (impl->requestQueue == RIO_INVALID_RQ)
+    {
+        NETWORK_LOG_ERROR("[RIO] Failed to create request queue, error code: {}", WSAGetLastError());
+        closesocket(s);
+        close();
+        socket.open(local.protocol(), ec);
+        socket.bind(local, ec);
+        socket.non_blocking(nonBlocking, ec);
+        return false;
+    }
+
+    // Asio keeps using the handle for control packets
+    socket.assign(local.protocol(), s, ec);
+    if (ec)
+    {
+        NETWORK_LOG_ERROR("[RIO] Failed to attach registered I/O socket to Asio: {}", ec.message());
+        closesocket(s);
+        close();
+        socket.open(local.protocol(), ec);
+        socket.bind(local, ec);
+        socket.non_blocking(nonBlocking, ec);
+        return false;
+    }
+    socket.non_blocking(nonBlocking, ec);
+
+    impl->socket = s;
+    opened = true;
+    NETWORK_LOG_INFO("[RIO] Registered I/O socket bound to port {}", local.port());
+    return true;
+}
+
+void RIOTransport::start(ReceiveHandler handler)
+{
+    if (!opened)
+        return;
+
+    onReceive = std::move(handler);
+
+    {
+        std::lock_guard<std::mutex> lock(impl->requestQueueMutex);
+        for (uint32_t slot = 0; slot < RECEIVE_DEPTH; ++slot)
+        {
+            postReceive(slot, RIO_MSG_DEFER);
+        }
+        impl->rio.RIOReceiveEx(impl->requestQueue, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+    }
+
+    armReceiveNotification();
+}
+
+bool RIOTransport::postReceive(uint32_t slot, unsigned long flags)
+{
+    // Receives use small slabs, larger datagrams come back truncated and are dropped.
+    // Our datagrams are at most the TUN MTU plus the header, well within a small slab.
+    PacketBuffer buffer = packetPool->acquire(PacketPool::SMALL_SLAB_SIZE, 0);
+    if (!buffer)
+    {
+        impl->idleReceiveSlots.push_back(slot);
+        return false;
+    }
+
+    RIO_BUF data = impl->bufferFor(buffer);
+    RIO_BUF address = impl->addressFor(slot);
+    impl->receiveSlots[slot] = std::move(buffer);
+
+    if (!impl->rio.RIOReceiveEx(
+            impl->requestQueue, &data, 1, nullptr, &address, nullptr, nullptr,
+            flags, reinterpret_cast<PVOID>(static_cast<uintptr_t>(slot))))
+    {
+        NETWORK_LOG_ERROR_SUMMARY("[RIO] Failed to post receive, error code: {}", WSAGetLastError());
+        impl->receiveSlots[slot].reset();
+        impl->idleReceiveSlots.push_back(slot);
+        return false;
+    }
+    return true;
+}
+
+void RIOTransport::armReceiveNotification()
+{
+    if (!opened)
+        return;
+
+    impl->rio.RIONotify(impl->receiveQueue);
+    impl->receiveWait->async_wait([this](const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        if (error)
+        {
+            NETWORK_LOG_ERROR_SUMMARY("[RIO] Receive notification error: {}", error.message());
+            return;
+        }
+
+        handleReceiveCompletions();
+        armReceiveNotification();
+    });
+}
+
+void RIOTransport::handleReceiveCompletions()
+{
+    for (;;)
+    {
+        ULONG count = impl->rio.RIODequeueCompletion(
+            impl->receiveQueue, impl->receiveResults.data(), static_cast<ULONG>(impl->receiveResults.size()));
+        if (count == 0 || count == RIO_CORRUPT_CQ)
+        {
+            if (count == RIO_CORRUPT_CQ)
+                NETWORK_LOG_ERROR("[RIO] Receive completion queue corrupt");
+            break;
+        }
+
+        // Take the buffers out and give the kernel fresh ones before processing
+        size_t ready = 0;
+        for (ULONG i = 0; i < count; ++i)
+        {
+            const RIORESULT& result = impl->receiveResults[i];
+            uint32_t slot = static_cast<uint32_t>(result.RequestContext);
+            PacketBuffer packet = std::move(impl->receiveSlots[slot]);
+
+            if (result.Status != 0)
+            {
+                if (result.Status != WSAEMSGSIZE)
+                    NETWORK_LOG_WARNING_SUMMARY("[RIO] Receive failed with error code: {}", result.Status);
+                else
+                    NETWORK_LOG_WARNING_SUMMARY("[RIO] Dropping datagram larger than {} bytes", PacketPool::SMALL_SLAB_SIZE);
+                continue;
+            }
+
+            packet.resize(result.BytesTransferred);
+            ReceivedDatagram& datagram = impl->received[ready++];
+            datagram.packet = std::move(packet);
+            addressToEndpoint(impl->addresses[slot], datagram.sender);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(impl->requestQueueMutex);
+            for (ULONG i = 0; i < count; ++i)
+            {
+                postReceive(static_cast<uint32_t>(impl->receiveResults[i].RequestContext), RIO_MSG_DEFER);
+            }
+
+            // Slots that ran dry while the pool was exhausted get another go
+            std::vector<uint32_t> idle;
+            idle.swap(impl->idleReceiveSlots);
+            for (uint32_t slot : idle)
+            {
+                postReceive(slot, RIO_MSG_DEFER);
+            }
+            impl->rio.RIOReceiveEx(impl->requestQueue, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+        }
+
+        for (size_t i = 0; i < ready; ++i)
+        {
+            if (onReceive)
+                onReceive(std::move(impl->received[i].packet), impl->received[i].sender);
+        }
+
+        if (count < impl->receiveResults.size())
+            break;
+    }
+}
+
+void RIOTransport::reclaimSendSlots()
+{
+    for (;;)
+    {
+        ULONG count = impl->rio.RIODequeueCompletion(
+            impl->sendQueue, impl->sendResults.data(), static_cast<ULONG>(impl->sendResults.size()));
+        if (count == 0 || count == RIO_CORRUPT_CQ)
+            break;
+
+        for (ULONG i = 0; i < count; ++i)
+        {
+            const RIORESULT& result = impl->sendResults[i];
+            uint32_t slot = static_cast<uint32_t>(result.RequestContext);
+            if (result.Status != 0)
+            {
+                NETWORK_LOG_WARNING_SUMMARY("[RIO] Send failed with error code: {}", result.Status);
+            }
+            impl->sendSlots[slot].reset();
+            impl->freeSendSlots.push_back(slot);
+        }
+
+        if (count < impl->sendResults.size())
+            break;
+    }
+}
+
+size_t RIOTransport::send(OutgoingDatagram* datagrams, size_t count)
+{
+    if (!opened)
+        return 0;
+
+    reclaimSendSlots();
+
+    size_t sent = 0;
+    std::lock_guard<std::mutex> lock(impl->requestQueueMutex);
+    for (; sent < count && !impl->freeSendSlots.empty(); ++sent)
+    {
+        uint32_t slot = impl->freeSendSlots.back();
+        size_t addressSlot = RECEIVE_DEPTH + slot;
+        endpointToAddress(datagrams[sent].endpoint, impl->addresses[addressSlot]);
+
+        RIO_BUF data = impl->bufferFor(datagrams[sent].packet);
+        RIO_BUF address = impl->addressFor(addressSlot);
+        if (!impl->rio.RIOSendEx(
+                impl->requestQueue, &data, 1, nullptr, &address, nullptr, nullptr,
+                RIO_MSG_DEFER, reinterpret_cast<PVOID>(static_cast<uintptr_t>(slot))))
+        {
+            NETWORK_LOG_WARNING_SUMMARY("[RIO] Failed to queue send, error code: {}", WSAGetLastError());
+            break;
+        }
+
+        // The kernel reads from the slab until the completion comes back
+        metrics::add(metrics::Counter::UDP_TX_PACKETS);
+        metrics::add(metrics::Counter::UDP_TX_BYTES, datagrams[sent].packet.size());
+        impl->freeSendSlots.pop_back();
+        impl->sendSlots[slot] = std::move(datagrams[sent].packet);
+    }
+
+    if (sent)
+    {
+        impl->rio.RIOSendEx(impl->requestQueue, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+    }
+    return sent;
+}
+
+void RIOTransport::close()
+{
+    if (impl->receiveWait)
+    {
+        boost::system::error_code ec;
+        impl->receiveWait->cancel(ec);
+        impl->receiveWait.reset();
+    }
+
+    // The request queue goes away with the socket, which Asio owns
+    impl->requestQueue = RIO_INVALID_RQ;
+    impl->socket = INVALID_SOCKET;
+
+    if (impl->receiveQueue != RIO_INVALID_CQ)
+    {
+        impl->rio.RIOCloseCompletionQueue(impl->receiveQueue);
+        impl->receiveQueue = RIO_INVALID_CQ;
+    }
+    if (impl->sendQueue != RIO_INVALID_CQ)
+    {
+        impl->rio.RIOCloseCompletionQueue(impl->sendQueue);
+        impl->sendQueue = RIO_INVALID_CQ;
+    }
+
+    for (RIO_BUFFERID& id : impl->poolBuffers)
+    {
+        if (id != RIO_INVALID_BUFFERID)
+        {
+            impl->rio.RIODeregisterBuffer(id);
+            id = RIO_INVALID_BUFFERID;
+        }
+    }
+    if (impl->addressBuffer != RIO_INVALID_BUFFERID)
+    {
+        impl->rio.RIODeregisterBuffer(impl->addressBuffer);
+        impl->addressBuffer = RIO_INVALID_BUFFERID;
+    }
+
+    // Nothing is in flight once the socket is closed, the slabs go back to the pool
+    for (PacketBuffer& buffer : impl->receiveSlots)
+    {
+        buffer.reset();
+    }
+    impl->freeSendSlots.clear();
+    for (uint32_t i = SEND_DEPTH; i > 0; --i)
+    {
+        impl->sendSlots[i - 1].reset();
+        impl->freeSendSlots.push_back(i - 1);
+    }
+    impl->idleReceiveSlots.clear();
+
+    opened = false;
+}
+
+#else
+
+// Registered I/O is Windows only, UDPNetwork stays on Asio elsewhere
+struct RIOTransport::Impl
+{
+};
+
+RIOTransport::RIOTransport(boost::asio::io_context& context, std::shared_ptr<PacketPool> packet_pool)
+    : ioContext(context)
+    , packetPool(std::move(packet_pool))
+    , impl(std::make_unique<Impl>())
+{
+}
+
+RIOTransport::~RIOTransport() = default;
+
+bool RIOTransport::open(boost::asio::ip::udp::socket&)
+{
+    NETWORK_LOG_WARNING("[RIO] Registered I/O is only available on Windows");
+    return false;
+}
+
+void RIOTransport::start(ReceiveHandler) {}
+size_t RIOTransport::send(OutgoingDatagram*, size_t) { return 0; }
+void RIOTransport::close() {}
+void RIOTransport::armReceiveNotification() {}
+void RIOTransport::handleReceiveCompletions() {}
+bool RIOTransport::postReceive(uint32_t, unsigned long) { return false; }
+void RIOTransport::reclaimSendSlots() {}
+
+#endif
@@ -0,0 +1,242 @@
+#include "ReliableChannel.hpp"
+#include <algorithm>
+
+namespace
+{
+// Signed distance a - b, correct across seq wraparound
+inline int32_t seqDiff(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b);
+}
+}
+
+ReliableChannel::ReliableChannel()
+    : sendEntries(std::make_unique<SendEntry[]>(SEND_WINDOW))
+    , seqMap(std::make_unique<SeqMapping[]>(AckTracker::WINDOW_SIZE))
+    , held(std::make_unique<HeldPacket[]>(REORDER_WINDOW))
+{
+}
+
+std::optional<uint32_t> ReliableChannel::track(const PacketBuffer& payload)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (nextReliableSeq - sendBase >= SEND_WINDOW)
+        return std::nullopt;
+
+    uint32_t reliableSeq = nextReliableSeq++;
+    SendEntry& entry = sendEntries[reliableSeq & (SEND_WINDOW - 1)];
+    entry.payload = payload.share();
+    entry.reliableSeq = reliableSeq;
+    entry.transmissions = 0;
+    entry.inUse = true;
+    entry.lost = false;
+    inFlight.store(nextReliableSeq - sendBase, std::memory_order_relaxed);
+    return reliableSeq;
+}
+
+void ReliableChannel::onTransmit(uint32_t reliableSeq, uint32_t seq, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    SendEntry& entry = sendEntries[reliableSeq & (SEND_WINDOW - 1)];
+    if (!entry.inUse || entry.reliableSeq != reliableSeq)
+        return;
+
+    entry.lastSeq = seq;
+    entry.lastSent = now;
+    entry.lost = false;
+    ++entry.transmissions;
+
+    SeqMapping& mapping = seqMap[seq & (AckTracker::WINDOW_SIZE - 1)];
+    mapping.seq = seq;
+    mapping.reliableSeq = reliableSeq;
+    mapping.valid = true;
+}
+
+void ReliableChannel::onResolved(uint32_t seq, bool acked)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    SeqMapping& mapping = seqMap[seq & (AckTracker::WINDOW_SIZE - 1)];
+    if (!mapping.valid || mapping.seq != seq)
+        return; // Best-effort datagram
+    mapping.valid = false;
+
+    SendEntry& entry = sendEntries[mapping.reliableSeq & (SEND_WINDOW - 1)];
+    if (!entry.inUse || entry.reliableSeq != mapping.reliableSeq)
+        return;
+
+    if (acked)
+    {
+        // Any copy arriving is enough
+        releaseEntry(entry);
+        advanceSendBase();
+    }
+    else if (entry.lastSeq == seq)
+    {
+        // Only the latest copy counts, an older copy being lost says nothing new
+        entry.lost = true;
+    }
+}
+
+void ReliableChannel::collectRetransmits(
+    Clock::time_point now,
+    std::chrono::microseconds rto,
+    std::vector<Retransmit>& out)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    for (uint32_t reliableSeq = sendBase; reliableSeq != nextReliableSeq; ++reliableSeq)
+    {
+        SendEntry& entry = sendEntries[reliableSeq & (SEND_WINDOW - 1)];
+        if (!entry.inUse || entry.transmissions == 0)
+            continue;
+
+        // Fast retransmit on a SACK gap, otherwise wait out the RTO
+        if (!entry.lost && now - entry.lastSent < rto)
+            continue;
+
+        if (entry.transmissions >= MAX_TRANSMISSIONS)
+        {
+            releaseEntry(entry);
+            ++abandoned;
+            continue;
+        }
+
+        entry.lost = false;
+        entry.lastSent = now; // Keeps the RTO from firing again before onTransmit
+        out.push_back(Retransmit{reliableSeq, entry.payload.share()});
+        ++retransmits;
+    }
+    advanceSendBase();
+}
+
+void ReliableChannel::resetSend()
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    for (uint32_t i = 0; i < SEND_WINDOW; ++i)
+    {
+        releaseEntry(sendEntries[i]);
+    }
+    for (uint32_t i = 0; i < AckTracker::WINDOW_SIZE; ++i)
+    {
+        seqMap[i].valid = false;
+    }
+    sendBase = nextReliableSeq;
+    inFlight.store(0, std::memory_order_relaxed);
+}
+
+void ReliableChannel::releaseEntry(SendEntry& entry)
+{
+    entry.payload.reset();
+    entry.inUse = false;
+}
+
+void ReliableChannel::advanceSendBase()
+{
+    while (sendBase != nextReliableSeq && !sendEntries[sendBase & (SEND_WINDOW - 1)].inUse)
+        ++sendBase;
+    inFlight.store(nextReliableSeq - sendBase, std::memory_order_relaxed);
+}
+
+void ReliableChannel::onReceive(
+    uint32_t reliableSeq,
+    PacketBuffer payload,
+    Clock::time_point now,
+    std::vector<PacketBuffer>& deliver)
+{
+    if (!haveExpected)
+    {
+        haveExpected = true;
+        expected = reliableSeq;
+    }
+
+    int32_t distance = seqDiff(reliableSeq, expected);
+    if (distance < 0)
+        return; // Duplicate, a retransmit raced the ACK
+
+    if (distance == 0)
+    {
+        deliver.push_back(std::move(payload));
+        ++expected;
+        deliverInOrder(deliver);
+        return;
+    }
+
+    // Too far ahead, skip the oldest gaps until it fits
+    while (seqDiff(reliableSeq, expected) >= static_cast<int32_t>(REORDER_WINDOW))
+    {
+        HeldPacket& slot = held[expected & (REORDER_WINDOW - 1)];
+        if (slot.payload)
+        {
+            deliver.push_back(std::move(slot.payload));
+            --heldCount;
+        }
+        ++expected;
+        deliverInOrder(deliver);
+    }
+
+    if (reliableSeq == expected)
+    {
+        deliver.push_back(std::move(payload));
+        ++expected;
+        deliverInOrder(deliver);
+        return;
+    }
+
+    HeldPacket& slot = held[reliableSeq & (REORDER_WINDOW - 1)];
+    if (!slot.payload)
+    {
+        slot.payload = std::move(payload);
+        slot.arrived = now;
+        ++heldCount;
+    }
+}
+
+void ReliableChannel::deliverInOrder(std::vector<PacketBuffer>& deliver)
+{
+    while (heldCount > 0)
+    {
+        HeldPacket& slot = held[expected & (REORDER_WINDOW - 1)];
+        if (!slot.payload)
+            break;
+        deliver.push_back(std::move(slot.payload));
+        --heldCount;
+        ++expected;
+    }
+}
+
+void ReliableChannel::flushExpired(Clock::time_point now, std::vector<PacketBuffer>& deliver)
+{
+    // Oldest held packet decides, everything in front of it is given up on
+    while (heldCount > 0)
+    {
+        uint32_t firstHeld = expected;
+        while (!held[firstHeld & (REORDER_WINDOW - 1)].payload)
+            ++firstHeld;
+
+        if (now - held[firstHeld & (REORDER_WINDOW - 1)].arrived < HOLD_TIMEOUT)
+            break;
+
+        expected = firstHeld;
+        deliverInOrder(deliver);
+    }
+}
+
+void ReliableChannel::resetReceive()
+{
+    for (uint32_t i = 0; i < REORDER_WINDOW; ++i)
+    {
+        held[i].payload.reset();
+    }
+    heldCount = 0;
+    haveExpected = false;
+}
+
+std::chrono::microseconds ReliableChannel::retransmitTimeout(
+    std::chrono::microseconds srtt,
+    std::chrono::microseconds rttVar)
+{
+    if (srtt.count() == 0)
+        return std::chrono::duration_cast<std::chrono::microseconds>(MAX_RTO) / 4;
+
+    std::chrono::microseconds rto = srtt + 4 * rttVar;
+    return std::clamp<std::chrono::microseconds>(rto, MIN_RTO, MAX_RTO);
+}
@@ -1,5 +1,7 @@
 #include "TUNInterface.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
 #include <Windows.h>
 #include <iostream>
 #include <string>
@@ -8,10 +10,17 @@
 #include <iphlpapi.h>
 #include <random>
 #include <netioapi.h>
+#include <mmsystem.h>
+#include <cstring>
+#include <algorithm>
 
 #pragma comment(lib, "iphlpapi.lib")
+#pragma comment(lib, "winmm.lib")
 
-TunInterface::TunInterface() {}
+TunInterface::TunInterface(std::shared_ptr<PacketPool> packet_pool)
+    : packetPool(std::move(packet_pool))
+{
+}
 
 TunInterface::~TunInterface()
 {
@@ -51,8 +60,10 @@ bool TunInterface::loadWintunFunctions(HMODULE wintunModule)
            pWintunCloseAdapter && pWintunGetAdapterLUID && pWintunGetReadWaitEvent;
 }
 
-bool TunInterface::initialize(const std::string& deviceName)
+bool TunInterface::initialize(const std::string& deviceName, const TunSessionOptions& options)
 {
+    sessionOptions = options;
+
     // Load wintun.dll
     std::wstring wideWintunPath = L"wintun.dll";
     wintunModule = LoadLibraryW(wideWintunPath.c_str());
@@ -96,8 +107,7 @@ bool TunInterface::initialize(const std::string& deviceName)
     }
 
     // Start a Wintun session
-    const DWORD WINTUN_RING_CAPACITY = 0x800000; // 8 MiB
-    session = pWintunStartSession(adapter, WINTUN_RING_CAPACITY);
+    session = pWintunStartSession(adapter, sessionOptions.ringCapacity);
     if (!session)
     {
         SYSTEM_LOG_ERROR("[TunInterface] Failed to start Wintun session. Error: {}", GetLastError());
@@ -108,6 +118,18 @@ bool TunInterface::initialize(const std::string& deviceName)
         return false;
     }
 
+    // Bounded injection queues and their shared wake-up event (auto-reset)
+    outgoingPackets.clear();
+    for (size_t i = 0; i < std::max<size_t>(1, sessionOptions.sendQueues); ++i)
+    {
+        outgoingPackets.push_back(std::make_unique<SpscRing<PacketBuffer>>(
+            sessionOptions.sendQueueCapacity, sessionOptions.sendQueueOverflow));
+    }
+    if (!sendWakeEvent)
+    {
+        sendWakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    }
+
     SYSTEM_LOG_INFO("[TunInterface] WinTun adapter initialized successfully.");
     return true;
 }
@@ -126,7 +148,24 @@ bool TunInterface::startPacketProcessing()
         return false;
     }
     
+    if (outgoingPackets.empty() || !sendWakeEvent)
+    {
+        SYSTEM_LOG_ERROR("[TunInterface] Send queue not initialized");
+        return false;
+    }
+    
     running = true;
+
+    // Read whenever metrics are, the rings' sizes are safe to look at from any thread
+    queueSampler = metrics::addSampler(
+        {"peerbridge_tun_queue_packets", "", "Packets waiting to be written to the adapter"},
+        [this]()
+        {
+            size_t queued = 0;
+            for (const std::unique_ptr<SpscRing<PacketBuffer>>& queue : outgoingPackets)
+                queued += queue->size();
+            return static_cast<double>(queued);
+        });
     
     // Start receive thread
     receiveThread = std::thread(&TunInterface::receiveThreadFunc, this);
@@ -139,6 +178,17 @@ bool TunInterface::startPacketProcessing()
 void TunInterface::stopPacketProcessing()
 {
     running = false;
+    if (queueSampler)
+    {
+        metrics::removeSampler(queueSampler);
+        queueSampler = 0;
+    }
+
+    // Wake the send thread so it notices the shutdown
+    if (sendWakeEvent)
+    {
+        SetEvent(sendWakeEvent);
+    }
     
     // Wait for threads to finish
     if (receiveThread.joinable())
@@ -151,9 +201,11 @@ void TunInterface::stopPacketProcessing()
         sendThread.join();
     }
 
-    // In theory, it's possible this could cause problems :)
-    // Classic race condition moment
-    outgoingPackets = {};
+    // Drop anything left over, the consumer side is gone so this is safe
+    for (std::unique_ptr<SpscRing<PacketBuffer>>& queue : outgoingPackets)
+    {
+        queue->clear();
+    }
     
     SYSTEM_LOG_INFO("[TunInterface] Packet processing stopped");
 }
@@ -167,32 +219,73 @@ void TunInterface::receiveThreadFunc() {
         return;
     }
     
+    const size_t batchSize = std::max<size_t>(1, sessionOptions.receiveBatchSize);
+    PacketBatch batch;
+    batch.reserve(batchSize);
+
+    // Millisecond waits below, the default timer tick would stretch them to ~15.6 ms
+    timeBeginPeriod(1);
+    
     while (running)
     {
-        DWORD packetSize;
-        WINTUN_PACKET* packet = pWintunReceivePacket(session, &packetSize);
-        
-        if (packet)
+        // Drain up to batchSize packets from the ring in one pass
+        size_t drained = 0;
+        while (drained < batchSize)
         {
-            // Copy packet data, cast to uint8_t* to copy to vector
-            const uint8_t* packetDataPtr = reinterpret_cast<const uint8_t*>(packet);
-            std::vector<uint8_t> packetData(packetDataPtr, packetDataPtr + packetSize);
+            DWORD packetSize;
+            WINTUN_PACKET* packet = pWintunReceivePacket(session, &packetSize);
+            if (!packet)
+                break;
+            ++drained;
+
+            // Copy packet data into a pooled buffer, leaving headroom for our header
+            PacketBuffer packetData = packetPool->acquire(packetSize);
+            if (packetData)
+            {
+                std::memcpy(packetData.data(), reinterpret_cast<const void*>(packet), packetSize);
+                packetData.setTrace(tracing::begin(packetSize));
+                batch.push_back(std::move(packetData));
+                metrics::add(metrics::Counter::TUN_RX_PACKETS);
+                metrics::add(metrics::Counter::TUN_RX_BYTES, packetSize);
+            }
+            else
+            {
+                metrics::add(metrics::Counter::DROP_POOL_EXHAUSTED);
+            }
             
-            // Release the packet
+            // Release the packet, it's dropped if the pool ran dry
             pWintunReleaseReceivePacket(session, packet);
-            
-            // Process the packet
-            if (packetCallback)
+        }
+
+        if (drained > 0)
+        {
+            metrics::record(metrics::Histogram::TUN_READ_BATCH, drained);
+
+            // Process the batch
+            if (!batch.empty() && packetCallback)
             {
-                packetCallback(packetData);
+                packetCallback(batch);
             }
+            batch.clear();
+
+            // Ring may still hold packets, go again before waiting
+            continue;
+        }
 
+        // Held packets due sooner than the wait's granularity, poll until they're out
+        std::optional<std::chrono::microseconds> due = idleCallback ? idleCallback() : std::nullopt;
+        if (due && *due < IDLE_SPIN_LIMIT)
+        {
+            YieldProcessor();
             continue;
         }
         
         // Wait for "packet ready" event signal from wintun or timeout via Windows API
         // In high-level terms, this is like waiting on a kernel-level condition variable / signal
-        DWORD waitResult = WaitForSingleObject(readWaitEvent, 5); // 5ms timeout for gaming responsiveness
+        DWORD timeout = 5; // 5ms timeout for gaming responsiveness
+        if (due)
+            timeout = static_cast<DWORD>(std::clamp<int64_t>(due->count() / 1000, 1, timeout));
+        DWORD waitResult = WaitForSingleObject(readWaitEvent, timeout);
         
         if (waitResult == WAIT_TIMEOUT)
         {
@@ -207,65 +300,146 @@ void TunInterface::receiveThreadFunc() {
             break;
         }
     }
+
+    timeEndPeriod(1);
 }
 
 void TunInterface::sendThreadFunc()
 {
-    while (running)
+    const size_t batchSize = std::max<size_t>(1, sessionOptions.sendBatchSize);
+    std::vector<WINTUN_PACKET*> reserved;
+    reserved.reserve(batchSize * outgoingPackets.size());
+    bool ringFull = false;
+
+    // Reserve ring space and copy, packets are committed together once the batch is built
+    auto reservePacket = [this, &reserved, &ringFull](PacketBuffer&& packetData)
     {
-        std::vector<uint8_t> packetData;
-        
-        // Wait for packet or timeout
+        if (packetData.empty())
+            return;
+        if (ringFull)
         {
-            std::unique_lock<std::mutex> lock(packetQueueMutex);
-            
-            if (packetConditionVariable.wait_for(lock, std::chrono::milliseconds(1), 
-                [this] { return !outgoingPackets.empty() || !running; })) 
-            {
-                // Got signaled - packet available or shutting down
-                if (!running) break;
-                
-                if (!outgoingPackets.empty()) {
-                    packetData = std::move(outgoingPackets.front());
-                    outgoingPackets.pop();
-                }
-            }
+            metrics::add(metrics::Counter::DROP_TUN_ADAPTER);
+            return;
         }
+
+        // Allocate a packet
+        WINTUN_PACKET* packet = pWintunAllocateSendPacket(session, packetData.size());
         
-        if (!packetData.empty())
+        if (packet) {
+            // Copy the data, cast to void* to copy to packet
+            memcpy(reinterpret_cast<void*>(packet), 
+                   reinterpret_cast<const void*>(packetData.data()), 
+                   packetData.size());
+            reserved.push_back(packet);
+            tracing::finish(packetData.trace(), tracing::Stage::TUN_INJECT);
+            metrics::add(metrics::Counter::TUN_TX_PACKETS);
+            metrics::add(metrics::Counter::TUN_TX_BYTES, packetData.size());
+        }
+        else
         {
-            // Allocate a packet
-            WINTUN_PACKET* packet = pWintunAllocateSendPacket(session, packetData.size());
-            
-            if (packet) {
-                // Copy the data, cast to void* to copy to packet
-                memcpy(reinterpret_cast<void*>(packet), 
-                       reinterpret_cast<const void*>(packetData.data()), 
-                       packetData.size());
-                
-                // Send the packet
+            // Adapter ring is full, drop the rest of this batch
+            metrics::add(metrics::Counter::DROP_TUN_ADAPTER);
+            ringFull = true;
+        }
+    };
+
+    // Any queue holding packets
+    auto pending = [this]()
+    {
+        for (const std::unique_ptr<SpscRing<PacketBuffer>>& queue : outgoingPackets)
+        {
+            if (!queue->empty())
+                return true;
+        }
+        return false;
+    };
+
+    while (running)
+    {
+        // Drain the queues a batch at a time each before considering sleep, no worker waits behind another
+        size_t drained = 0;
+        for (std::unique_ptr<SpscRing<PacketBuffer>>& queue : outgoingPackets)
+        {
+            drained += queue->drain(reservePacket, batchSize);
+        }
+        if (drained > 0)
+        {
+            // Wintun sends in allocation order, commit the whole batch
+            for (WINTUN_PACKET* packet : reserved)
+            {
                 pWintunSendPacket(session, packet);
             }
+            reserved.clear();
+            ringFull = false;
+            continue;
         }
+
+        // Announce we're going idle, then re-check so a push racing with us isn't missed
+        sendThreadIdle.store(true, std::memory_order_seq_cst);
+        if (pending() || !running)
+        {
+            sendThreadIdle.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Timeout is only a safety net, producers signal the event
+        WaitForSingleObject(sendWakeEvent, 100);
+        sendThreadIdle.store(false, std::memory_order_relaxed);
     }
 }
 
-bool TunInterface::sendPacket(std::vector<uint8_t> packet)
+bool TunInterface::sendPacket(PacketBuffer packet, size_t queue)
 {
     if (!running)
     {
-        SYSTEM_LOG_ERROR("[TunInterface] Packet processing not running");
+        SYSTEM_LOG_ERROR_SUMMARY("[TunInterface] Packet processing not running");
         return false;
     }
     
-    // Add the packet to the queue and notify the send thread
+    // Add the packet to the queue, overflow is handled by the ring's policy
+    auto result = outgoingPackets[queue % outgoingPackets.size()]->push(std::move(packet));
+    if (result != SpscRing<PacketBuffer>::PushResult::PUSHED)
+        metrics::add(metrics::Counter::DROP_TUN_QUEUE);
+
+    // Only pay for a wake-up when the send thread is actually asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sendThreadIdle.load(std::memory_order_relaxed))
     {
-        std::lock_guard<std::mutex> lock(packetQueueMutex);
-        outgoingPackets.push(std::move(packet));
+        SetEvent(sendWakeEvent);
     }
-    packetConditionVariable.notify_one();
     
-    return true;
+    return result != SpscRing<PacketBuffer>::PushResult::DROPPED_NEWEST;
+}
+
+bool TunInterface::sendPackets(PacketBatch& packets, size_t queue)
+{
+    if (!running)
+    {
+        SYSTEM_LOG_ERROR_SUMMARY("[TunInterface] Packet processing not running");
+        packets.clear();
+        return false;
+    }
+
+    bool allQueued = true;
+    SpscRing<PacketBuffer>& ring = *outgoingPackets[queue % outgoingPackets.size()];
+    for (PacketBuffer& packet : packets)
+    {
+        if (!packet)
+            continue;
+        auto result = ring.push(std::move(packet));
+        if (result != SpscRing<PacketBuffer>::PushResult::PUSHED)
+            metrics::add(metrics::Counter::DROP_TUN_QUEUE);
+        allQueued &= result != SpscRing<PacketBuffer>::PushResult::DROPPED_NEWEST;
+    }
+    packets.clear();
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sendThreadIdle.load(std::memory_order_relaxed))
+    {
+        SetEvent(sendWakeEvent);
+    }
+
+    return allQueued;
 }
 
 void TunInterface::setPacketCallback(PacketCallback callback)
@@ -273,6 +447,11 @@ void TunInterface::setPacketCallback(PacketCallback callback)
     packetCallback = std::move(callback);
 }
 
+void TunInterface::setIdleCallback(IdleCallback callback)
+{
+    idleCallback = std::move(callback);
+}
+
 bool TunInterface::isRunning() const
 {
     return running;
@@ -293,6 +472,12 @@ void TunInterface::close()
         session = nullptr;
     }
     
+    if (sendWakeEvent)
+    {
+        CloseHandle(sendWakeEvent);
+        sendWakeEvent = nullptr;
+    }
+    
     // Close adapter
     if (adapter)
     {
@@ -310,14 +495,21 @@ void TunInterface::close()
     SYSTEM_LOG_INFO("[TunInterface] TUN interface closed");
 }
 
-std::string TunInterface::getNarrowAlias() const
+bool TunInterface::getLuid(NET_LUID& luid) const
 {
-    NET_LUID adapterLuid;
-    if (!pWintunGetAdapterLUID(adapter, &adapterLuid))
+    if (!adapter || !pWintunGetAdapterLUID(adapter, &luid))
     {
         SYSTEM_LOG_ERROR("[TunInterface] Failed to get adapter LUID. Error: {}", GetLastError());
-        return "";
+        return false;
     }
+    return true;
+}
+
+std::string TunInterface::getNarrowAlias() const
+{
+    NET_LUID adapterLuid;
+    if (!getLuid(adapterLuid))
+        return "";
 
     // Get interface alias (friendly name) from LUID
     WCHAR interfaceAlias[IF_MAX_STRING_SIZE + 1] = { 0 };
@@ -0,0 +1,377 @@
+#include "Tracing.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+
+namespace tracing
+{
+namespace
+{
+// Traces between their first and last stamp, indexed by id. A slot is taken over by a newer
+// id if a packet never finishes (dropped), the id check then throws that packet's stamps away.
+constexpr size_t ACTIVE_SLOTS = 1024;
+// Finished traces kept for a dump
+constexpr size_t RING_SIZE = 4096;
+
+struct Active
+{
+    std::atomic<uint32_t> id;
+    std::atomic<uint32_t> remote;
+    std::atomic<uint32_t> bytes;
+    std::array<std::atomic<int64_t>, STAGES> at;
+};
+
+// Seqlock per entry: odd while written, 2 * (index + 1) once complete
+struct Finished
+{
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint32_t> id;
+    std::atomic<uint32_t> remote;
+    std::atomic<uint32_t> bytes;
+    std::array<std::atomic<int64_t>, STAGES> at;
+};
+
+// Static storage, zeroed before anything runs
+std::atomic<uint32_t> everyN{0};
+std::atomic<uint32_t> nextId{1};
+Active active[ACTIVE_SLOTS];
+Finished ring[RING_SIZE];
+std::atomic<uint64_t> published{0};
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Active& slotOf(uint32_t id)
+{
+    return active[id & (ACTIVE_SLOTS - 1)];
+}
+
+uint32_t allocate(uint32_t remote, size_t bytes)
+{
+    uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+    if (id == 0)
+        id = nextId.fetch_add(1, std::memory_order_relaxed);
+
+    Active& slot = slotOf(id);
+    slot.id.store(0, std::memory_order_relaxed);
+    slot.remote.store(remote, std::memory_order_relaxed);
+    slot.bytes.store(static_cast<uint32_t>(bytes), std::memory_order_relaxed);
+    for (std::atomic<int64_t>& at : slot.at)
+        at.store(0, std::memory_order_relaxed);
+    slot.id.store(id, std::memory_order_release);
+    return id;
+}
+
+// Takes the trace out of the table, only one caller gets it (views of a bundle share the id)
+bool claim(uint32_t id, Active*& slot)
+{
+    if (!id)
+        return false;
+    slot = &slotOf(id);
+    uint32_t expected = id;
+    return slot->id.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+}
+
+void publish(uint32_t id, const Active& slot)
+{
+    uint64_t index = published.fetch_add(1, std::memory_order_relaxed);
+    Finished& entry = ring[index & (RING_SIZE - 1)];
+
+    entry.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.id.store(id, std::memory_order_relaxed);
+    entry.remote.store(slot.remote.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    entry.bytes.store(slot.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (size_t i = 0; i < STAGES; ++i)
+        entry.at[i].store(slot.at[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    entry.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+uint32_t microsBetween(int64_t from, int64_t to)
+{
+    if (!from || to <= from)
+        return 0;
+    return static_cast<uint32_t>(std::min<int64_t>((to - from) / 1000, std::numeric_limits<uint32_t>::max()));
+}
+
+void put32(uint8_t* out, uint32_t value)
+{
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+uint32_t get32(const uint8_t* in)
+{
+    return (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+// Stretches between stages a trace reached, [from, to) in stage order
+struct Stretch
+{
+    size_t from;
+    size_t to;
+};
+
+std::vector<Stretch> stretchesOf(const Trace& trace)
+{
+    std::vector<Stretch> stretches;
+    size_t last = STAGES;
+    for (size_t i = 0; i < STAGES; ++i)
+    {
+        if (!trace.at[i])
+            continue;
+        if (last != STAGES)
+            stretches.push_back({last, i});
+        last = i;
+    }
+    return stretches;
+}
+
+std::string stretchName(size_t from, size_t to)
+{
+    return std::string(stageName(static_cast<Stage>(from))) + " -> " + stageName(static_cast<Stage>(to));
+}
+
+// The network stretch of a received trace is half the RTT, not a measurement
+bool estimated(const Trace& trace, size_t to)
+{
+    return trace.remote && to == static_cast<size_t>(Stage::PEER_RECEIVE);
+}
+}
+
+const char* stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::TUN_DEQUEUE: return "tun_dequeue";
+    case Stage::FILTER: return "filter";
+    case Stage::UDP_SUBMIT: return "udp_submit";
+    case Stage::PEER_RECEIVE: return "peer_receive";
+    case Stage::TUN_INJECT: return "tun_inject";
+    default: return "unknown";
+    }
+}
+
+void Trailer::encode(uint8_t* out) const
+{
+    put32(out, id);
+    put32(out + 4, filterMicros);
+    put32(out + 8, submitMicros);
+}
+
+Trailer Trailer::decode(const uint8_t* in)
+{
+    Trailer trailer;
+    trailer.id = get32(in);
+    trailer.filterMicros = get32(in + 4);
+    trailer.submitMicros = get32(in + 8);
+    return trailer;
+}
+
+void setSampleRate(uint32_t rate)
+{
+    everyN.store(rate, std::memory_order_relaxed);
+}
+
+uint32_t sampleRate()
+{
+    return everyN.load(std::memory_order_relaxed);
+}
+
+uint32_t begin(size_t bytes)
+{
+    uint32_t rate = everyN.load(std::memory_order_relaxed);
+    if (!rate)
+        return 0;
+
+    thread_local uint32_t skipped = 0;
+    if (++skipped < rate)
+        return 0;
+    skipped = 0;
+
+    uint32_t id = allocate(0, bytes);
+    slotOf(id).at[static_cast<size_t>(Stage::TUN_DEQUEUE)].store(now(), std::memory_order_relaxed);
+    return id;
+}
+
+void stamp(uint32_t id, Stage stage)
+{
+    if (!id)
+        return;
+    Active& slot = slotOf(id);
+    if (slot.id.load(std::memory_order_acquire) != id)
+        return;
+    slot.at[static_cast<size_t>(stage)].store(now(), std::memory_order_relaxed);
+}
+
+bool submit(uint32_t id, Trailer& trailer)
+{
+    Active* slot;
+    if (!claim(id, slot))
+        return false;
+
+    int64_t submitted = now();
+    slot->at[static_cast<size_t>(Stage::UDP_SUBMIT)].store(submitted, std::memory_order_relaxed);
+
+    int64_t dequeued = slot->at[static_cast<size_t>(Stage::TUN_DEQUEUE)].load(std::memory_order_relaxed);
+    int64_t filtered = slot->at[static_cast<size_t>(Stage::FILTER)].load(std::memory_order_relaxed);
+    trailer.id = id;
+    trailer.filterMicros = microsBetween(dequeued, filtered);
+    trailer.submitMicros = microsBetween(dequeued, submitted);
+
+    publish(id, *slot);
+    return true;
+}
+
+uint32_t beginRemote(const Trailer& trailer, std::chrono::microseconds oneWay, size_t bytes)
+{
+    uint32_t id = allocate(trailer.id, bytes);
+    Active& slot = slotOf(id);
+
+    // The sender's stamps, moved onto our clock through the estimated network stretch
+    int64_t received = now();
+    int64_t submitted = received - oneWay.count() * 1000;
+    int64_t dequeued = submitted - static_cast<int64_t>(trailer.submitMicros) * 1000;
+    slot.at[static_cast<size_t>(Stage::TUN_DEQUEUE)].store(dequeued, std::memory_order_relaxed);
+    slot.at[static_cast<size_t>(Stage::FILTER)].store(
+        dequeued + static_cast<int64_t>(trailer.filterMicros) * 1000, std::memory_order_relaxed);
+    slot.at[static_cast<size_t>(Stage::UDP_SUBMIT)].store(submitted, std::memory_order_relaxed);
+    slot.at[static_cast<size_t>(Stage::PEER_RECEIVE)].store(received, std::memory_order_relaxed);
+    return id;
+}
+
+void finish(uint32_t id, Stage stage)
+{
+    Active* slot;
+    if (!claim(id, slot))
+        return;
+    slot->at[static_cast<size_t>(stage)].store(now(), std::memory_order_relaxed);
+    publish(id, *slot);
+}
+
+std::vector<Trace> collect()
+{
+    std::vector<Trace> traces;
+    uint64_t end = published.load(std::memory_order_acquire);
+    uint64_t start = end > RING_SIZE ? end - RING_SIZE : 0;
+    traces.reserve(static_cast<size_t>(end - start));
+
+    for (uint64_t index = start; index < end; ++index)
+    {
+        const Finished& entry = ring[index & (RING_SIZE - 1)];
+        uint64_t sequence = entry.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * index + 2)
+            continue;
+
+        Trace trace;
+        trace.id = entry.id.load(std::memory_order_relaxed);
+        trace.remote = entry.remote.load(std::memory_order_relaxed);
+        trace.bytes = entry.bytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < STAGES; ++i)
+            trace.at[i] = entry.at[i].load(std::memory_order_relaxed);
+
+        // Overwritten while we read it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+        traces.push_back(trace);
+    }
+    return traces;
+}
+
+std::string formatChromeTrace(const std::vector<Trace>& traces)
+{
+    // Timestamps relative to the earliest stamp, the steady clock epoch means nothing to a viewer
+    int64_t origin = std::numeric_limits<int64_t>::max();
+    for (const Trace& trace : traces)
+    {
+        for (int64_t at : trace.at)
+        {
+            if (at)
+                origin = std::min(origin, at);
+        }
+    }
+
+    std::string out =
+        "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Sent\"}},\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"Received\"}}";
+
+    char event[320];
+    for (const Trace& trace : traces)
+    {
+        for (const Stretch& stretch : stretchesOf(trace))
+        {
+            std::snprintf(event, sizeof(event),
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%" PRIu32 ","
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"trace\":%" PRIu32 ",\"peer_trace\":%" PRIu32 ",\"bytes\":%" PRIu32 "}}",
+                stretchName(stretch.from, stretch.to).c_str(),
+                estimated(trace, stretch.to) ? "estimated" : "measured",
+                trace.remote ? 2 : 1, trace.id,
+                (trace.at[stretch.from] - origin) / 1000.0,
+                (trace.at[stretch.to] - trace.at[stretch.from]) / 1000.0,
+                trace.id, trace.remote, trace.bytes);
+            out += event;
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool dumpChromeTrace(const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    file << formatChromeTrace(collect());
+    return static_cast<bool>(file);
+}
+
+std::vector<std::string> formatSummary(const std::vector<Trace>& traces)
+{
+    std::vector<std::string> lines;
+    char line[256];
+    for (bool received : {false, true})
+    {
+        // Durations in microseconds per stretch, a stage a trace skipped makes a longer stretch
+        std::map<std::pair<size_t, size_t>, std::vector<double>> durations;
+        size_t count = 0;
+        for (const Trace& trace : traces)
+        {
+            if ((trace.remote != 0) != received)
+                continue;
+            ++count;
+            for (const Stretch& stretch : stretchesOf(trace))
+                durations[{stretch.from, stretch.to}].push_back((trace.at[stretch.to] - trace.at[stretch.from]) / 1000.0);
+        }
+        if (!count)
+            continue;
+
+        std::snprintf(line, sizeof(line), "%s (%zu traces)", received ? "Received" : "Sent", count);
+        lines.emplace_back(line);
+        for (auto& [stretch, samples] : durations)
+        {
+            std::sort(samples.begin(), samples.end());
+            std::snprintf(line, sizeof(line), "  %-28s n=%zu p50=%.1fus p99=%.1fus max=%.1fus%s",
+                stretchName(stretch.first, stretch.second).c_str(),
+                samples.size(),
+                samples[samples.size() / 2],
+                samples[std::min(samples.size() - 1, samples.size() * 99 / 100)],
+                samples.back(),
+                received && stretch.second == static_cast<size_t>(Stage::PEER_RECEIVE) ? " (estimated)" : "");
+            lines.emplace_back(line);
+        }
+    }
+    if (lines.empty())
+        lines.emplace_back("No traces recorded");
+    return lines;
+}
+}
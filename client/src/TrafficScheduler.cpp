@@ -0,0 +1,144 @@
+#include "TrafficScheduler.hpp"
+
+namespace
+{
+constexpr uint8_t PROTOCOL_ICMP = 1;
+constexpr uint8_t PROTOCOL_TCP = 6;
+constexpr uint8_t PROTOCOL_UDP = 17;
+constexpr uint8_t PROTOCOL_ICMPV6 = 58;
+
+// Unmarked packets this small are TCP acks / handshakes, keepalives and game state updates
+constexpr size_t SMALL_PACKET = 256;
+
+struct PortRange
+{
+    uint16_t first;
+    uint16_t last;
+    TrafficClass trafficClass;
+};
+
+// Either end of the flow matching is enough, the list is short and walked in order
+constexpr PortRange UDP_PORTS[] = {
+    {53, 53, TrafficClass::INTERACTIVE},        // DNS
+    {123, 123, TrafficClass::INTERACTIVE},      // NTP
+    {3074, 3074, TrafficClass::INTERACTIVE},    // Xbox Live
+    {3478, 3479, TrafficClass::INTERACTIVE},    // STUN / TURN, voice and video calls
+    {5060, 5061, TrafficClass::INTERACTIVE},    // SIP
+    {6112, 6119, TrafficClass::INTERACTIVE},    // Battle.net and older LAN games
+    {27000, 27050, TrafficClass::INTERACTIVE},  // Steam game servers
+};
+
+constexpr PortRange TCP_PORTS[] = {
+    {20, 21, TrafficClass::BULK},               // FTP
+    {22, 22, TrafficClass::INTERACTIVE},        // SSH, only its big packets get this far
+    {445, 445, TrafficClass::BULK},             // SMB file shares
+    {873, 873, TrafficClass::BULK},             // rsync
+    {3389, 3389, TrafficClass::INTERACTIVE},    // Remote desktop
+    {6881, 6889, TrafficClass::BULK},           // BitTorrent
+};
+
+// RFC 4594 service classes by DSCP, STANDARD for code points that say nothing either way
+TrafficClass classForDscp(uint8_t dscp)
+{
+    switch (dscp)
+    {
+    case 48:    // CS6
+    case 56:    // CS7
+        return TrafficClass::CONTROL;
+    case 32:    // CS4
+    case 34:    // AF41
+    case 36:    // AF42
+    case 38:    // AF43
+    case 40:    // CS5
+    case 44:    // VOICE-ADMIT
+    case 46:    // EF
+        return TrafficClass::INTERACTIVE;
+    case 1:     // LE
+    case 8:     // CS1
+    case 10:    // AF11
+    case 12:    // AF12
+    case 14:    // AF13
+        return TrafficClass::BULK;
+    default:
+        return TrafficClass::STANDARD;
+    }
+}
+
+template <size_t N>
+bool matchPorts(const PortRange (&ranges)[N], uint16_t source, uint16_t destination, TrafficClass& out)
+{
+    for (const PortRange& range : ranges)
+    {
+        if ((source >= range.first && source <= range.last) ||
+            (destination >= range.first && destination <= range.last))
+        {
+            out = range.trafficClass;
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+const char* trafficClassName(TrafficClass trafficClass)
+{
+    switch (trafficClass)
+    {
+    case TrafficClass::CONTROL: return "control";
+    case TrafficClass::INTERACTIVE: return "interactive";
+    case TrafficClass::STANDARD: return "standard";
+    case TrafficClass::BULK: return "bulk";
+    default: return "unknown";
+    }
+}
+
+TrafficClass classifyTraffic(const PacketBuffer& packet)
+{
+    const uint8_t* ip = packet.data();
+    size_t size = packet.size();
+    if (size < 20)
+        return TrafficClass::INTERACTIVE;
+
+    // Traffic class byte, protocol and where the transport header starts
+    uint8_t tos;
+    uint8_t protocol;
+    size_t transport;
+    bool firstFragment = true;
+    if ((ip[0] >> 4) == 6)
+    {
+        if (size < 40)
+            return TrafficClass::INTERACTIVE;
+        tos = static_cast<uint8_t>(((ip[0] & 0x0F) << 4) | (ip[1] >> 4));
+        // Extension headers aren't walked, such packets are classed by DSCP and size alone
+        protocol = ip[6];
+        transport = 40;
+    }
+    else
+    {
+        tos = ip[1];
+        protocol = ip[9];
+        transport = static_cast<size_t>(ip[0] & 0x0F) * 4;
+        firstFragment = ((ip[6] & 0x1F) | ip[7]) == 0;
+    }
+
+    TrafficClass marked = classForDscp(static_cast<uint8_t>(tos >> 2));
+    if (marked != TrafficClass::STANDARD)
+        return marked;
+
+    if (protocol == PROTOCOL_ICMP || protocol == PROTOCOL_ICMPV6)
+        return TrafficClass::INTERACTIVE;
+
+    if (size <= SMALL_PACKET)
+        return TrafficClass::INTERACTIVE;
+
+    if (firstFragment && transport + 4 <= size && (protocol == PROTOCOL_TCP || protocol == PROTOCOL_UDP))
+    {
+        uint16_t source = static_cast<uint16_t>((ip[transport] << 8) | ip[transport + 1]);
+        uint16_t destination = static_cast<uint16_t>((ip[transport + 2] << 8) | ip[transport + 3]);
+        TrafficClass byPort;
+        if (protocol == PROTOCOL_UDP ? matchPorts(UDP_PORTS, source, destination, byPort)
+                                     : matchPorts(TCP_PORTS, source, destination, byPort))
+            return byPort;
+    }
+    return TrafficClass::STANDARD;
+}
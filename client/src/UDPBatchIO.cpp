@@ -0,0 +1,410 @@
+#include "UDPBatchIO.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+// Older MinGW headers lack the USO option
+#ifndef UDP_SEND_MSG_SIZE
+#define UDP_SEND_MSG_SIZE 2
+#endif
+#elif defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cerrno>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
+
+namespace
+{
+// Larger than any UDP payload
+constexpr size_t SPILL_REGION_SIZE = 65536;
+
+#ifdef __linux__
+constexpr size_t SPILL_REGIONS = UDPBatchIO::MAX_BATCH;
+#else
+constexpr size_t SPILL_REGIONS = 1;
+#endif
+
+// Move a datagram that ran past its small slab into one large enough
+PacketBuffer gatherSpilled(PacketPool& pool, PacketBuffer slab, const uint8_t* spill, size_t bytes)
+{
+    size_t slabBytes = slab.size();
+    if (bytes <= slabBytes)
+    {
+        slab.resize(bytes);
+        return slab;
+    }
+
+    PacketBuffer large = pool.acquire(bytes, 0);
+    if (large)
+    {
+        std::memcpy(large.data(), slab.data(), slabBytes);
+        std::memcpy(large.data() + slabBytes, spill, bytes - slabBytes);
+    }
+    return large;
+}
+}
+
+#if defined(_WIN32)
+struct UDPBatchIO::Platform
+{
+    std::array<WSABUF, MAX_SEGMENTS> buffers;
+};
+#elif defined(__linux__)
+struct UDPBatchIO::Platform
+{
+    std::array<mmsghdr, MAX_BATCH> messages;
+    std::array<iovec, MAX_BATCH * 2> iovecs;
+    std::array<sockaddr_storage, MAX_BATCH> addresses;
+    std::array<std::array<char, CMSG_SPACE(sizeof(uint16_t))>, MAX_BATCH> controls;
+    std::array<size_t, MAX_BATCH> datagramsPerMessage;
+    std::array<PacketBuffer, MAX_BATCH> slabs;
+};
+#else
+struct UDPBatchIO::Platform
+{
+};
+#endif
+
+UDPBatchIO::UDPBatchIO(boost::asio::ip::udp::socket& socket, std::shared_ptr<PacketPool> packet_pool)
+    : socket(socket)
+    , packetPool(std::move(packet_pool))
+    , spillArena(std::make_unique<uint8_t[]>(SPILL_REGION_SIZE * SPILL_REGIONS))
+    , platform(std::make_unique<Platform>())
+{
+}
+
+UDPBatchIO::~UDPBatchIO() = default;
+
+size_t UDPBatchIO::segmentRun(const OutgoingDatagram* datagrams, size_t count) const
+{
+    // Same destination, same size, only the last one may be shorter
+    size_t segment = datagrams[0].packet.size();
+    size_t total = segment;
+    size_t run = 1;
+    while (run < count && run < MAX_SEGMENTS)
+    {
+        const OutgoingDatagram& next = datagrams[run];
+        if (next.endpoint != datagrams[0].endpoint ||
+            next.packet.size() > segment ||
+            total + next.packet.size() > MAX_SEGMENTED_BYTES)
+        {
+            break;
+        }
+
+        total += next.packet.size();
+        ++run;
+        if (next.packet.size() < segment)
+            break;
+    }
+    return run;
+}
+
+#if defined(_WIN32)
+
+UDPBatchIO::Capabilities UDPBatchIO::probe()
+{
+    caps = Capabilities{};
+    if (!socket.is_open())
+        return caps;
+
+    SOCKET s = socket.native_handle();
+
+    // WSASendMsg / WSARecvFrom without an OVERLAPPED complete inline and never hit the IOCP
+    caps.multiSend = true;
+    caps.multiReceive = true;
+
+    // USO is there from Windows 10 2004 / Server 2022 on, the option only reads back if supported
+    DWORD value = 0;
+    int length = sizeof(value);
+    caps.segmentOffload = getsockopt(
+        s, IPPROTO_UDP, UDP_SEND_MSG_SIZE, reinterpret_cast<char*>(&value), &length) == 0;
+
+    return caps;
+}
+
+size_t UDPBatchIO::sendBatch(OutgoingDatagram* datagrams, size_t count)
+{
+    if (!caps.multiSend)
+        return 0;
+
+    SOCKET s = socket.native_handle();
+    size_t sent = 0;
+    while (sent < count)
+    {
+        OutgoingDatagram* first = datagrams + sent;
+        size_t run = caps.segmentOffload ? segmentRun(first, count - sent) : 1;
+
+        for (size_t i = 0; i < run; ++i)
+        {
+            platform->buffers[i].buf = reinterpret_cast<CHAR*>(first[i].packet.data());
+            platform->buffers[i].len = static_cast<ULONG>(first[i].packet.size());
+        }
+
+        WSAMSG msg{};
+        msg.name = const_cast<LPSOCKADDR>(reinterpret_cast<const sockaddr*>(first->endpoint.data()));
+        msg.namelen = static_cast<INT>(first->endpoint.size());
+        msg.lpBuffers = platform->buffers.data();
+        msg.dwBufferCount = static_cast<DWORD>(run);
+
+        // Tell the stack to cut the buffers back into segment sized datagrams
+        char control[WSA_CMSG_SPACE(sizeof(DWORD))] = {};
+        if (run > 1)
+        {
+            msg.Control.buf = control;
+            msg.Control.len = sizeof(control);
+            WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEND_MSG_SIZE;
+            cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+            *reinterpret_cast<DWORD*>(WSA_CMSG_DATA(cmsg)) = static_cast<DWORD>(first->packet.size());
+        }
+
+        DWORD bytesSent = 0;
+        if (WSASendMsg(s, &msg, 0, &bytesSent, nullptr, nullptr) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK)
+            {
+                NETWORK_LOG_WARNING_SUMMARY("[Network] Batched send failed with error code: {}, falling back", error);
+            }
+            break;
+        }
+
+        // Data is in the kernel, hand the slabs back
+        metrics::add(metrics::Counter::UDP_TX_PACKETS, run);
+        metrics::add(metrics::Counter::UDP_TX_BYTES, bytesSent);
+        for (size_t i = 0; i < run; ++i)
+        {
+            first[i].packet.reset();
+        }
+        sent += run;
+    }
+    return sent;
+}
+
+size_t UDPBatchIO::receiveBatch(ReceivedDatagram* out, size_t max)
+{
+    if (!caps.multiReceive)
+        return 0;
+
+    SOCKET s = socket.native_handle();
+    size_t received = 0;
+    while (received < max)
+    {
+        PacketBuffer slab = packetPool->acquire(PacketPool::SMALL_SLAB_SIZE, 0);
+        if (!slab)
+            break;
+
+        WSABUF buffers[2];
+        buffers[0].buf = reinterpret_cast<CHAR*>(slab.data());
+        buffers[0].len = static_cast<ULONG>(slab.size());
+        buffers[1].buf = reinterpret_cast<CHAR*>(spillArena.get());
+        buffers[1].len = static_cast<ULONG>(SPILL_REGION_SIZE);
+
+        sockaddr_storage from{};
+        INT fromLength = sizeof(from);
+        DWORD bytes = 0;
+        DWORD flags = 0;
+        if (WSARecvFrom(s, buffers, 2, &bytes, &flags,
+                reinterpret_cast<sockaddr*>(&from), &fromLength, nullptr, nullptr) == SOCKET_ERROR)
+        {
+            // Would-block means drained, anything else is left to the async receive to report
+            break;
+        }
+
+        PacketBuffer packet = gatherSpilled(*packetPool, std::move(slab), spillArena.get(), bytes);
+        if (!packet)
+        {
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, dropping {} byte datagram", bytes);
+            continue;
+        }
+
+        ReceivedDatagram& datagram = out[received++];
+        datagram.packet = std::move(packet);
+        std::memcpy(datagram.sender.data(), &from, fromLength);
+        datagram.sender.resize(fromLength);
+    }
+    return received;
+}
+
+#elif defined(__linux__)
+
+UDPBatchIO::Capabilities UDPBatchIO::probe()
+{
+    caps = Capabilities{};
+    if (!socket.is_open())
+        return caps;
+
+    int fd = socket.native_handle();
+    caps.multiSend = true;
+    caps.multiReceive = true;
+
+    // GSO is there from Linux 4.18 on
+    int value = 0;
+    socklen_t length = sizeof(value);
+    caps.segmentOffload = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &value, &length) == 0;
+
+    return caps;
+}
+
+size_t UDPBatchIO::sendBatch(OutgoingDatagram* datagrams, size_t count)
+{
+    if (!caps.multiSend)
+        return 0;
+
+    int fd = socket.native_handle();
+    Platform& p = *platform;
+    size_t sent = 0;
+    while (sent < count)
+    {
+        // Pack as many datagrams as fit into one sendmmsg, runs become one segmented message
+        size_t messageCount = 0;
+        size_t queued = 0;
+        while (sent + queued < count && messageCount < MAX_BATCH)
+        {
+            OutgoingDatagram* first = datagrams + sent + queued;
+            size_t run = caps.segmentOffload ? segmentRun(first, count - sent - queued) : 1;
+            if (queued + run > p.iovecs.size())
+                break;
+
+            for (size_t i = 0; i < run; ++i)
+            {
+                p.iovecs[queued + i].iov_base = first[i].packet.data();
+                p.iovecs[queued + i].iov_len = first[i].packet.size();
+            }
+
+            mmsghdr& message = p.messages[messageCount];
+            std::memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = const_cast<sockaddr*>(reinterpret_cast<const sockaddr*>(first->endpoint.data()));
+            message.msg_hdr.msg_namelen = static_cast<socklen_t>(first->endpoint.size());
+            message.msg_hdr.msg_iov = &p.iovecs[queued];
+            message.msg_hdr.msg_iovlen = run;
+
+            if (run > 1)
+            {
+                message.msg_hdr.msg_control = p.controls[messageCount].data();
+                message.msg_hdr.msg_controllen = p.controls[messageCount].size();
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = static_cast<uint16_t>(first->packet.size());
+                std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+
+            p.datagramsPerMessage[messageCount++] = run;
+            queued += run;
+        }
+
+        int accepted = sendmmsg(fd, p.messages.data(), static_cast<unsigned int>(messageCount), MSG_DONTWAIT);
+        if (accepted <= 0)
+        {
+            if (accepted < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                NETWORK_LOG_WARNING_SUMMARY("[Network] Batched send failed with error code: {}, falling back", errno);
+            }
+            break;
+        }
+
+        // Data is in the kernel, hand the slabs back
+        for (int m = 0; m < accepted; ++m)
+        {
+            for (size_t i = 0; i < p.datagramsPerMessage[m]; ++i)
+            {
+                metrics::add(metrics::Counter::UDP_TX_PACKETS);
+                metrics::add(metrics::Counter::UDP_TX_BYTES, datagrams[sent].packet.size());
+                datagrams[sent++].packet.reset();
+            }
+        }
+
+        if (static_cast<size_t>(accepted) < messageCount)
+            break;
+    }
+    return sent;
+}
+
+size_t UDPBatchIO::receiveBatch(ReceivedDatagram* out, size_t max)
+{
+    if (!caps.multiReceive)
+        return 0;
+
+    int fd = socket.native_handle();
+    Platform& p = *platform;
+    size_t wanted = std::min(max, MAX_BATCH);
+
+    // Every message gets a small slab plus its own spill region
+    size_t prepared = 0;
+    for (; prepared < wanted; ++prepared)
+    {
+        p.slabs[prepared] = packetPool->acquire(PacketPool::SMALL_SLAB_SIZE, 0);
+        if (!p.slabs[prepared])
+            break;
+
+        p.iovecs[2 * prepared].iov_base = p.slabs[prepared].data();
+        p.iovecs[2 * prepared].iov_len = p.slabs[prepared].size();
+        p.iovecs[2 * prepared + 1].iov_base = spillArena.get() + prepared * SPILL_REGION_SIZE;
+        p.iovecs[2 * prepared + 1].iov_len = SPILL_REGION_SIZE;
+
+        mmsghdr& message = p.messages[prepared];
+        std::memset(&message, 0, sizeof(message));
+        message.msg_hdr.msg_name = &p.addresses[prepared];
+        message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        message.msg_hdr.msg_iov = &p.iovecs[2 * prepared];
+        message.msg_hdr.msg_iovlen = 2;
+    }
+
+    int count = prepared ? recvmmsg(fd, p.messages.data(), static_cast<unsigned int>(prepared), MSG_DONTWAIT, nullptr) : 0;
+    size_t received = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const mmsghdr& message = p.messages[i];
+        PacketBuffer packet = gatherSpilled(
+            *packetPool, std::move(p.slabs[i]), spillArena.get() + i * SPILL_REGION_SIZE, message.msg_len);
+        if (!packet)
+        {
+            NETWORK_LOG_ERROR_SUMMARY("[Network] Packet pool exhausted, dropping {} byte datagram", message.msg_len);
+            continue;
+        }
+
+        ReceivedDatagram& datagram = out[received++];
+        datagram.packet = std::move(packet);
+        std::memcpy(datagram.sender.data(), &p.addresses[i], message.msg_hdr.msg_namelen);
+        datagram.sender.resize(message.msg_hdr.msg_namelen);
+    }
+
+    // Unused slabs go back to the pool
+    for (size_t i = 0; i < prepared; ++i)
+    {
+        p.slabs[i].reset();
+    }
+    return received;
+}
+
+#else
+
+UDPBatchIO::Capabilities UDPBatchIO::probe()
+{
+    caps = Capabilities{};
+    return caps;
+}
+
+size_t UDPBatchIO::sendBatch(OutgoingDatagram*, size_t)
+{
+    return 0;
+}
+
+size_t UDPBatchIO::receiveBatch(ReceivedDatagram*, size_t)
+{
+    return 0;
+}
+
+#endif
@@ -173,5 +173,45 @@ void initLogging()
     netLogObject = Frontend::create_or_get_logger("net", netSink, shortLogFormat());
 }
 
+std::atomic<LogSummary*>& LogSummary::sites() noexcept
+{
+    static std::atomic<LogSummary*> head{nullptr};
+    return head;
+}
+
+void LogSummary::flushPending() noexcept
+{
+    int64_t now = nowNs();
+    for (LogSummary* site = sites().load(std::memory_order_acquire); site; site = site->next)
+    {
+        if (site->pending.load(std::memory_order_relaxed) == 0)
+            continue;
+        if (uint64_t count = site->take(now))
+            site->flush(site->format, count);
+    }
+}
+
 quill::Logger* sysLogger() { return sysLogObject; }
 quill::Logger* netLogger() { return netLogObject; }
+
+void setLogLevel(LogSubsystem subsystem, quill::LogLevel level)
+{
+    quill::Logger* logger = subsystem == LogSubsystem::SYSTEM ? sysLogObject : netLogObject;
+    if (logger)
+        logger->set_log_level(level);
+}
+
+std::optional<quill::LogLevel> parseLogLevel(const std::string& name)
+{
+    if (name == "debug")
+        return quill::LogLevel::Debug;
+    if (name == "info")
+        return quill::LogLevel::Info;
+    if (name == "warning")
+        return quill::LogLevel::Warning;
+    if (name == "error")
+        return quill::LogLevel::Error;
+    if (name == "none")
+        return quill::LogLevel::None;
+    return std::nullopt;
+}
@@ -1,5 +1,8 @@
 #include "P2PSystem.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
+#include "FirewallRules.hpp"
 #include <iostream>
 #include <string>
 #include <thread>
@@ -7,6 +10,7 @@
 #include <mutex>
 #include <signal.h>
 #include <csignal>
+#include <cstdio>
 #include <boost/stacktrace.hpp>
 
 // Global variables
@@ -78,6 +82,9 @@ void inputThreadFunc()
             SYSTEM_LOG_INFO("  /accept - Accept incoming connection request");
             SYSTEM_LOG_INFO("  /reject - Reject incoming connection request");
             SYSTEM_LOG_INFO("  /status - Display connection status");
+            SYSTEM_LOG_INFO("  /stats - Show traffic counters, drops and latencies");
+            SYSTEM_LOG_INFO("  /trace - Show per stage latencies of sampled packets");
+            SYSTEM_LOG_INFO("  /trace save [file] - Write sampled packets as Chrome trace JSON (default: trace.json)");
             SYSTEM_LOG_INFO("  /ip - Show current virtual IP addresses");
             SYSTEM_LOG_INFO("  /logs - Toggle logging output (default: disabled)");
             SYSTEM_LOG_INFO("  /quit or /exit - Exit the application");
@@ -107,6 +114,23 @@ void inputThreadFunc()
                 SYSTEM_LOG_INFO("[Status] Not connected");
             }
         }
+        else if (line == "/stats") {
+            SYSTEM_LOG_INFO("[Stats]");
+            for (const std::string& statsLine : metrics::formatText(metrics::snapshot()))
+                SYSTEM_LOG_INFO("{}", statsLine);
+        }
+        else if (line == "/trace") {
+            SYSTEM_LOG_INFO("[Trace] Sampling 1 in {} packets", tracing::sampleRate());
+            for (const std::string& traceLine : tracing::formatSummary(tracing::collect()))
+                SYSTEM_LOG_INFO("{}", traceLine);
+        }
+        else if (line == "/trace save" || line.substr(0, 12) == "/trace save ") {
+            std::string path = line.size() > 12 ? line.substr(12) : "trace.json";
+            if (tracing::dumpChromeTrace(path))
+                SYSTEM_LOG_INFO("[Trace] Written to {}, open it in chrome://tracing or ui.perfetto.dev", path);
+            else
+                SYSTEM_LOG_ERROR("[Trace] Could not write {}", path);
+        }
         else if (line == "/ip") {
             if (p2pSystem->isConnected()) {
                 SYSTEM_LOG_INFO("[IP] Your virtual IP: {}", (p2pSystem->getIsHost() ? "10.0.0.1" : "10.0.0.2"));
@@ -132,9 +156,41 @@ int main(int argc, char* argv[])
     std::signal(SIGILL, onSignal);
     std::signal(SIGTERM, onSignal);
     
-    // TODO: Disable network traffic logging in prod
-    setShouldLogTraffic(true);
-    NETWORK_TRAFFIC_LOG("TEST");
+    // Uninstall: --remove-firewall-rules drops the rules kept between sessions and exits
+    // Logging: --log-level=LEVEL for both logs, or --log-level=system:LEVEL / network:LEVEL, with LEVEL
+    // one of debug, info (default), warning, error, none. --log-traffic samples packets into net.log.
+    // Levels below what the build compiled in (PEERBRIDGE_LOG_LEVEL) stay off.
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--remove-firewall-rules")
+        {
+            firewall::removeRules();
+            return 0;
+        }
+        else if (arg == "--log-traffic")
+        {
+            setShouldLogTraffic(true);
+        }
+        else if (arg.rfind("--log-level=", 0) == 0)
+        {
+            std::string spec = arg.substr(12);
+            size_t colon = spec.find(':');
+            std::string subsystem = colon == std::string::npos ? "" : spec.substr(0, colon);
+            std::optional<quill::LogLevel> level = parseLogLevel(colon == std::string::npos ? spec : spec.substr(colon + 1));
+            if (level && (subsystem.empty() || subsystem == "system" || subsystem == "network"))
+            {
+                if (subsystem != "network")
+                    setLogLevel(LogSubsystem::SYSTEM, *level);
+                if (subsystem != "system")
+                    setLogLevel(LogSubsystem::NETWORK, *level);
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid log level {}, expected [system:|network:]debug|info|warning|error|none", arg);
+            }
+        }
+    }
 
     std::string username;
     SYSTEM_LOG_INFO("Enter your username: ");
@@ -145,9 +201,167 @@ int main(int argc, char* argv[])
         return 1;
     }
     
+    // Transport switch: --transport=rio or --transport=asio (default)
+    // Link-level recovery for TCP: --reliable-tcp=off to send it best-effort like everything else
+    // Parity for best-effort traffic: --fec=off (default), --fec=auto or a fixed --fec=K:M, e.g. --fec=10:2
+    // Data plane threads: --workers=N, picked from the core count when not given (each peer uses one)
+    // Payload sealing: --encryption=off to exchange cleartext with peers that also run without it
+    // Payload compression for our uplink: --compression=on, skips flows that don't compress
+    // Small packet bundling: --aggregate=US holds packets up to US microseconds, e.g. --aggregate=250 (default off)
+    // Send pacing: --cc=bbr (default), --cc=ledbat to yield to other traffic, --cc=off to send unpaced
+    // Prometheus endpoint: --metrics-port=PORT serves http://127.0.0.1:PORT/metrics (default off)
+    // Latency tracing: --trace=N samples 1 in N packets from the adapter, e.g. --trace=100 (default off)
+    UdpBackend udpBackend = UdpBackend::ASIO;
+    size_t workers = 0;
+    bool reliableTcp = true;
+    FecParams fecParams;
+    bool fecAdaptive = false;
+    bool encryption = true;
+    bool compression = false;
+    unsigned aggregateMicros = 0;
+    CongestionMode congestionMode = CongestionMode::BBR;
+    unsigned metricsPort = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--transport=rio")
+        {
+            udpBackend = UdpBackend::RIO;
+        }
+        else if (arg == "--transport=asio")
+        {
+            udpBackend = UdpBackend::ASIO;
+        }
+        else if (arg == "--reliable-tcp=off")
+        {
+            reliableTcp = false;
+        }
+        else if (arg == "--reliable-tcp=on")
+        {
+            reliableTcp = true;
+        }
+        else if (arg == "--encryption=off")
+        {
+            encryption = false;
+        }
+        else if (arg == "--encryption=on")
+        {
+            encryption = true;
+        }
+        else if (arg == "--compression=on")
+        {
+            compression = true;
+        }
+        else if (arg == "--compression=off")
+        {
+            compression = false;
+        }
+        else if (arg.rfind("--aggregate=", 0) == 0)
+        {
+            unsigned micros = 0;
+            if (std::sscanf(arg.c_str() + 12, "%u", &micros) == 1 && micros <= 100000)
+            {
+                aggregateMicros = micros;
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid aggregation deadline {}, expected 0 to 100000 microseconds", arg);
+            }
+        }
+        else if (arg == "--cc=bbr")
+        {
+            congestionMode = CongestionMode::BBR;
+        }
+        else if (arg == "--cc=ledbat")
+        {
+            congestionMode = CongestionMode::LEDBAT;
+        }
+        else if (arg == "--cc=off")
+        {
+            congestionMode = CongestionMode::OFF;
+        }
+        else if (arg.rfind("--metrics-port=", 0) == 0)
+        {
+            unsigned port = 0;
+            if (std::sscanf(arg.c_str() + 15, "%u", &port) == 1 && port > 0 && port <= 65535)
+            {
+                metricsPort = port;
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid metrics port {}, expected 1 to 65535", arg);
+            }
+        }
+        else if (arg.rfind("--trace=", 0) == 0)
+        {
+            unsigned everyN = 0;
+            if (std::sscanf(arg.c_str() + 8, "%u", &everyN) == 1)
+            {
+                tracing::setSampleRate(everyN);
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid trace sampling {}, expected 1 in N packets", arg);
+            }
+        }
+        else if (arg == "--fec=off")
+        {
+            fecParams = FecParams{};
+            fecAdaptive = false;
+        }
+        else if (arg == "--fec=auto")
+        {
+            fecAdaptive = true;
+        }
+        else if (arg.rfind("--fec=", 0) == 0)
+        {
+            unsigned k = 0, m = 0;
+            if (std::sscanf(arg.c_str() + 6, "%u:%u", &k, &m) == 2 &&
+                k > 0 && k <= fec::MAX_DATA && m > 0 && m <= fec::MAX_PARITY)
+            {
+                fecParams = FecParams{static_cast<uint8_t>(k), static_cast<uint8_t>(m)};
+                fecAdaptive = false;
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid FEC setting {}, expected K:M with K <= {} and M <= {}",
+                    arg, fec::MAX_DATA, fec::MAX_PARITY);
+            }
+        }
+        else if (arg.rfind("--workers=", 0) == 0)
+        {
+            unsigned count = 0;
+            if (std::sscanf(arg.c_str() + 10, "%u", &count) == 1 && count > 0 && count <= UDPNetwork::MAX_WORKERS)
+            {
+                workers = count;
+            }
+            else
+            {
+                SYSTEM_LOG_WARNING("Invalid worker count {}, expected 1 to {}", arg, UDPNetwork::MAX_WORKERS);
+            }
+        }
+        else if (arg == "--log-traffic" || arg.rfind("--log-level=", 0) == 0)
+        {
+            // Applied before the prompt
+        }
+        else
+        {
+            SYSTEM_LOG_WARNING("Unknown argument: {}", arg);
+        }
+    }
+
     const std::string serverUrl = "wss://sector-classic-ear-ecommerce.trycloudflare.com";
     int localPort = 0; // Let system automatically choose a port
     p2pSystem = std::make_unique<P2PSystem>();
+    p2pSystem->setUdpBackend(udpBackend);
+    p2pSystem->setDataPlaneWorkers(workers);
+    p2pSystem->setReliableTcp(reliableTcp);
+    p2pSystem->setFec(fecParams, fecAdaptive);
+    p2pSystem->setEncryption(encryption);
+    p2pSystem->setCompression(compression);
+    p2pSystem->setAggregation(std::chrono::microseconds(aggregateMicros));
+    p2pSystem->setCongestionControl(congestionMode);
+    p2pSystem->setMetricsPort(static_cast<uint16_t>(metricsPort));
     
     // Initialize the application
     if (!p2pSystem->initialize(serverUrl, username, localPort))
@@ -1,9 +1,69 @@
 #include "Utils.hpp"
 #include "NetworkConfigManager.hpp"
 #include "Logger.hpp"
+#include "FirewallRules.hpp"
+#include <algorithm>
+#include <cstdio>
 
 #pragma comment(lib, "iphlpapi.lib")
 
+namespace
+{
+SOCKADDR_INET toSockaddr(const std::string& ip)
+{
+    SOCKADDR_INET addr{};
+    if (ip.find(':') != std::string::npos)
+    {
+        addr.Ipv6.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, ip.c_str(), &addr.Ipv6.sin6_addr);
+        return addr;
+    }
+    addr.Ipv4.sin_family = AF_INET;
+    addr.Ipv4.sin_addr.s_addr = htonl(utils::ipToUint32(ip));
+    return addr;
+}
+
+std::string ipv6HostAddress(uint8_t hostIndex)
+{
+    char suffix[3] = {};
+    std::snprintf(suffix, sizeof(suffix), "%x", hostIndex);
+    return std::string(NetworkConstants::IPV6_PREFIX) + suffix;
+}
+
+// Family's MTU on the adapter, the one it had before comes back through `original` the first time
+DWORD setFamilyMtu(const NET_LUID& luid, ADDRESS_FAMILY family, uint32_t mtu, uint32_t* original)
+{
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+    row.Family = family;
+    row.InterfaceLuid = luid;
+    DWORD result = GetIpInterfaceEntry(&row);
+    if (result != NO_ERROR)
+        return result;
+    if (original && !*original)
+        *original = row.NlMtu;
+    row.NlMtu = mtu;
+    // IPv4 rows are rejected with anything else
+    if (family == AF_INET)
+        row.SitePrefixLength = 0;
+    return SetIpInterfaceEntry(&row);
+}
+
+// On-link: no next hop, the destination is reached through the adapter itself
+MIB_IPFORWARD_ROW2 routeRow(const NET_LUID& luid, const std::string& prefix, uint8_t prefixLength)
+{
+    MIB_IPFORWARD_ROW2 route;
+    InitializeIpForwardEntry(&route);
+    route.InterfaceLuid = luid;
+    route.DestinationPrefix.Prefix = toSockaddr(prefix);
+    route.DestinationPrefix.PrefixLength = prefixLength;
+    route.NextHop.si_family = route.DestinationPrefix.Prefix.si_family;
+    route.Metric = 1;
+    route.Protocol = MIB_IPPROTO_NETMGMT;
+    return route;
+}
+}
+
 NetworkConfigManager::SetupConfig NetworkConfigManager::SetupConfig::loadConfig()
 {
     // TODO: Later, set GUID here and send it to tun->initialize
@@ -18,17 +78,16 @@ NetworkConfigManager::NetworkConfigManager() : setupConfig{SetupConfig::loadConf
 
 bool NetworkConfigManager::configureInterface(const ConnectionConfig& connectionConfig)
 {
+    std::lock_guard<std::mutex> lock(configMutex);
     routeApproach = RouteConfigApproach::GENERIC_ROUTE;
 
-    bool configurationSuccess;
     bool routeConfigSuccess = setupRouting(connectionConfig);
     if (!routeConfigSuccess)
     {
         SYSTEM_LOG_ERROR("[Network Config Manager] Interface configuration failed, removing any routes that succeded");
-        removeRouting(connectionConfig.peerVirtualIp);
+        removeRouting();
         return false;
     }
-    setupFirewall();
     SYSTEM_LOG_INFO("[Network Config Manager] Interface configuration successful");
     return true;
 }
@@ -43,52 +102,40 @@ bool NetworkConfigManager::setupRouting(const ConnectionConfig& connectionConfig
 
     // Count mask bits for CIDR notation
     uint32_t mask = utils::ipToUint32(NetworkConstants::NET_MASK);
-    int maskBits = __builtin_popcount(mask);
+    uint8_t maskBits = static_cast<uint8_t>(__builtin_popcount(mask));
 
     SYSTEM_LOG_INFO("[Network Config Manager] Setting up routing on private IP Space: {}", networkAddr);
     SYSTEM_LOG_INFO("[Netowrk Config Manager] Setting self (static) ip as: {}", selfVirtualIp);
     SYSTEM_LOG_INFO("[Network Config Manager] Setting up routing on subnet: {}, with bits masked: {}", netmask, maskBits);
 
-    std::ostringstream command;
-    command << "netsh interface ip set address \"" << narrowAlias 
-            << "\" static " << selfVirtualIp << " " << netmask;
-    
-    if (!executeNetshCommand(command.str()))
+    // Whatever a previous session or DHCP left behind
+    clearAddresses();
+    if (!setAddress(selfVirtualIp, maskBits))
     {
         SYSTEM_LOG_ERROR("[Network Config Manager] Failed to set up self ip, cancelling connection");
         routeApproach = RouteConfigApproach::FAILED;
         return false;
     }
 
-    // Approach 1: Add route using netsh with CIDR Notation
-    command.str("");
-    command << "netsh interface ipv4 add route " 
-            << networkAddr << "/" << maskBits
-            << " \"" << narrowAlias << "\""
-            << " metric=1";
-    
-    bool success = executeNetshCommand(command.str());
+    // Approach 1: One route for the whole subnet
+    bool success = addRoute(networkAddr, maskBits);
 
     if (!success)
     {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Second route command failed, trying to add direct routes...");
+        SYSTEM_LOG_WARNING("[Network Config Manager] Subnet route failed, trying to add direct routes...");
         routeApproach = RouteConfigApproach::FALLBACK_ROUTE_ALL;
         
         // Approach 2: Try adding a specific route to peer IP
         // This ensures at least basic connectivity even if subnet routing fails
-        command.str("");
-        
-        // TODO: REFACTORIZE FOR *1 FOR MULTIPLE PEERS
-        // Get peer IP
+        // Get peer IP, peers joining later get their own route through addPeerRoute
         std::string peerIP = connectionConfig.peerVirtualIp;
-        
-        command << "netsh interface ipv4 add route " 
-                << peerIP << "/32"
-                << " \"" << narrowAlias << "\""
-                << " metric=1";
-        success = executeNetshCommand(command.str());
+        success = addRoute(peerIP, 32);
 
-        if (!success)
+        if (success)
+        {
+            peerRoutes.push_back(peerIP);
+        }
+        else
         {
             SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route for virtual network, connection may be limited");
             routeApproach = RouteConfigApproach::FAILED;
@@ -96,24 +143,22 @@ bool NetworkConfigManager::setupRouting(const ConnectionConfig& connectionConfig
     }
     
     // Enable forwarding on the interface
-    command.str("");
-    command << "netsh interface ipv4 set interface \"" << narrowAlias << "\" forwarding=enabled metric=1";
-    
-    if (!executeNetshCommand(command.str()))
+    if (!setForwarding(true))
     {
         SYSTEM_LOG_ERROR("[Network Config Manager] Failed to enable forwarding on interface");
         return false;
     }
 
     // Multicast route, for discovery
-    command.str("");
-    command << "netsh interface ipv4 add route "
-            << "prefix=" << NetworkConstants::MULTICAST_SUBNET_RANGE
-            << " interface=\"" << narrowAlias << "\" "
-            << "metric=1";
-    if (!executeNetshCommand(command.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route for multicast traffic. Route may already exist, or discovery may be limited.");
+    if (!addRoute(NetworkConstants::MULTICAST_PREFIX, NetworkConstants::MULTICAST_PREFIX_LENGTH))
+    {
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route for multicast traffic, discovery may be limited.");
     }
+
+    // Peers reach each other over IPv4 either way, IPv6 inside the tunnel is extra
+    ipv6Configured = setupIpv6(connectionConfig.selfIndex);
+    if (!ipv6Configured)
+        SYSTEM_LOG_WARNING("[Network Config Manager] IPv6 unavailable on the virtual network, IPv4 only");
     
     SYSTEM_LOG_INFO("[Network Config Manager] Routing configured for virtual network");
     return true;
@@ -121,117 +166,113 @@ bool NetworkConfigManager::setupRouting(const ConnectionConfig& connectionConfig
 
 void NetworkConfigManager::setupFirewall()
 {
-    SYSTEM_LOG_INFO("[Network Config Manager] Setting up firewall rules");
-    // Add firewall rule to allow traffic on the virtual network
-    std::ostringstream firewallCmd;
-    firewallCmd << "netsh advfirewall firewall add rule "
-                << "name=\"PeerBridge IN\" "
-                << "dir=in "
-                << "action=allow "
-                << "protocol=any "
-                << "remoteip=10.0.0.0/24";
-    
-    // Execute firewall command (using our TUN interface's command helper)
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add inbound firewall rule. Connectivity may be limited.");
-    }
-    
-    // Add outbound rule too
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall add rule "
-                << "name=\"PeerBridge OUT\" "
-                << "dir=out "
-                << "action=allow "
-                << "protocol=any "
-                << "remoteip=10.0.0.0/24";
-    
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add outbound firewall rule. Connectivity may be limited.");
-    }
-    
-    // Add specific rule for ICMP (ping)
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall add rule "
-                << "name=\"PeerBridge ICMP\" "
-                << "dir=in "
-                << "action=allow "
-                << "protocol=icmpv4 "
-                << "remoteip=10.0.0.0/24";
-    
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add ICMP firewall rule. Ping may not work.");
-    }
-    
-    // Enable File and Printer Sharing (needed for some network discovery protocols)
-    // TODO: Investigate if it's a good idea to have this
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall set rule "
-                << "group=\"File and Printer Sharing\" "
-                << "new enable=Yes";
-    
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to enable File and Printer Sharing. Network discovery may be limited.");
+    SYSTEM_LOG_INFO("[Network Config Manager] Checking firewall rules");
+    if (!firewall::ensureRules())
+        SYSTEM_LOG_WARNING("[Network Config Manager] Firewall rules incomplete. Connectivity may be limited.");
+}
+
+void NetworkConfigManager::setupNetworkCategory()
+{
+    NET_LUID luid;
+    {
+        std::lock_guard<std::mutex> lock(configMutex);
+        luid = interfaceLuid;
     }
 
-    // Add specific rule for IGMP (inbound)
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall add rule "
-                << "name=\"PeerBridge IGMP IN\" "
-                << "dir=in "
-                << "action=allow "
-                << "protocol=2 "
-                << "remoteip=10.0.0.0/24";
-
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add inbound IGMP firewall rule. Multicast may not work.");
+    // Unlocked, this can wait a few seconds for Windows to classify the network
+    if (!firewall::setNetworkPrivate(luid))
+    {
+        SYSTEM_LOG_WARNING(
+            "[Network Config Manager] Failed to set network category to Private. LAN functionality may be limited");
     }
+}
+
+bool NetworkConfigManager::addPeerRoute(const std::string& peerVirtualIp)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    // The subnet route already covers every peer
+    if (routeApproach != RouteConfigApproach::FALLBACK_ROUTE_ALL)
+        return true;
 
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall add rule "
-                << "name=\"PeerBridge IGMP OUT\" "
-                << "dir=out "
-                << "action=allow "
-                << "protocol=2 "
-                << "remoteip=10.0.0.0/24";
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add outbound IGMP firewall rule. Multicast may not work.");
+    if (!addRoute(peerVirtualIp, 32))
+    {
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route for peer {}, connection may be limited", peerVirtualIp);
+        return false;
     }
+    peerRoutes.push_back(peerVirtualIp);
+    return true;
+}
 
-    std::ostringstream netCategoryCmd;
-    netCategoryCmd << "powershell -Command \"Set-NetConnectionProfile -InterfaceAlias "
-                   << "'" << narrowAlias << "'"
-                   <<" -NetworkCategory Private\"";
+void NetworkConfigManager::removePeerRoute(const std::string& peerVirtualIp)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
 
-    if (!executeNetshCommand(netCategoryCmd.str())) {
-        SYSTEM_LOG_WARNING(
-            "[Network Config Manager] Failed to set network category to Private or adapter is already set to Private. LAN functionality may be limited");
+    auto it = std::find(peerRoutes.begin(), peerRoutes.end(), peerVirtualIp);
+    if (it == peerRoutes.end())
+        return;
+
+    if (!deleteRoute(peerVirtualIp, 32))
+        SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove route for peer {}", peerVirtualIp);
+    peerRoutes.erase(it);
+}
+
+bool NetworkConfigManager::setInterfaceMtu(uint32_t mtu)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    if (mtu == interfaceMtu)
+        return true;
+
+    DWORD result = setFamilyMtu(interfaceLuid, AF_INET, mtu, &originalMtu);
+    if (result != NO_ERROR)
+    {
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to set interface MTU to {}. Error: {}", mtu, result);
+        return false;
     }
+
+    // Below the minimum Windows turns IPv6 off on the adapter. Packets between the tunnel's MTU
+    // and 1280 fail to send until path MTU discovery raises it, which it does on most paths.
+    if (ipv6Configured)
+    {
+        uint32_t mtu6 = std::max(mtu, NetworkConstants::IPV6_MIN_MTU);
+        result = setFamilyMtu(interfaceLuid, AF_INET6, mtu6, &originalMtu6);
+        if (result != NO_ERROR)
+            SYSTEM_LOG_WARNING("[Network Config Manager] Failed to set IPv6 interface MTU to {}. Error: {}", mtu6, result);
+    }
+
+    SYSTEM_LOG_INFO("[Network Config Manager] Interface MTU set to {}", mtu);
+    interfaceMtu = mtu;
+    return true;
 }
 
-// TODO: Consider using ConnectionConfig
-void NetworkConfigManager::resetInterfaceConfiguration(const std::string& peerVirtualIp)
+void NetworkConfigManager::resetInterfaceConfiguration()
 {
-    bool success = removeRouting(peerVirtualIp);
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    bool success = removeRouting();
     if (!success)
         SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove routing");
-    removeFirewall();
-    
+
+    // The adapter is ours for the session only, it goes back to what it had
+    if (originalMtu && interfaceMtu != originalMtu &&
+        setFamilyMtu(interfaceLuid, AF_INET, originalMtu, nullptr) != NO_ERROR)
+    {
+        SYSTEM_LOG_INFO("[Network Config Manager] Failed to restore interface MTU");
+    }
+    if (originalMtu6 && setFamilyMtu(interfaceLuid, AF_INET6, originalMtu6, nullptr) != NO_ERROR)
+        SYSTEM_LOG_INFO("[Network Config Manager] Failed to restore IPv6 interface MTU");
+    interfaceMtu = 0;
 }
 
-// TODO: Consider using ConnectionConfig
-bool NetworkConfigManager::removeRouting(const std::string& peerVirtualIp)
+bool NetworkConfigManager::removeRouting()
 {
     std::string networkAddr = setupConfig.IP_SPACE + std::to_string(NetworkConstants::BASE_IP_INDEX);
     std::string netmask = NetworkConstants::NET_MASK;
 
     // Count mask bits for CIDR notation
     uint32_t mask = utils::ipToUint32(NetworkConstants::NET_MASK);
-    uint32_t tempMask = mask;
-    int maskBits = 0;
-    while (tempMask) {
-        maskBits += (tempMask & 1);
-        tempMask >>= 1;
-    }
+    uint8_t maskBits = static_cast<uint8_t>(__builtin_popcount(mask));
 
     SYSTEM_LOG_INFO("[Network Config Manager] Removing routing on private IP Space: {}", networkAddr);
     SYSTEM_LOG_INFO("[Netowrk Config Manager] Removing self (static) ip");
@@ -239,26 +280,22 @@ bool NetworkConfigManager::removeRouting(const std::string& peerVirtualIp)
 
     bool success = true;
 
-    std::ostringstream command;
     switch (routeApproach)
     {
         case RouteConfigApproach::GENERIC_ROUTE:
         {
-            command << "netsh interface ipv4 delete route " 
-            << networkAddr << "/" << maskBits
-            << " \"" << narrowAlias << "\"";
-            if (!(success = executeNetshCommand(command.str())))
+            if (!(success = deleteRoute(networkAddr, maskBits)))
                 SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove generic route");
             break;
         }
         case RouteConfigApproach::FALLBACK_ROUTE_ALL:
         {
-            // TODO: TO BE MODIFIED FOR *1
-            command << "netsh interface ipv4 delete route " 
-                << peerVirtualIp << "/32"
-                << " \"" << narrowAlias << "\"";
-            if (!(success = executeNetshCommand(command.str())))
-                SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove per-peer specific routes");
+            for (const std::string& peerVirtualIp : peerRoutes)
+            {
+                if (!(success = deleteRoute(peerVirtualIp, 32)))
+                    SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove per-peer specific routes");
+            }
+            peerRoutes.clear();
             break;
         }
         case RouteConfigApproach::FAILED:
@@ -266,127 +303,132 @@ bool NetworkConfigManager::removeRouting(const std::string& peerVirtualIp)
             break;
     }
 
-    //netsh interface ip set address "wintun-mesh" dhcp
-    command.str("");
-    command << "netsh interface ip set address "
-            << " \"" << narrowAlias << "\" "
-            << "dhcp";
-    
-    if (!(success = executeNetshCommand(command.str())))
+    if (!(success = clearAddresses()))
         SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove self (static) routing");
     
-    command.str("");
-    command << "netsh interface ipv4 delete route "
-            << "prefix= " << NetworkConstants::MULTICAST_SUBNET_RANGE
-            << " interface =\"" << narrowAlias << "\"";
-
-    if (!(success = executeNetshCommand(command.str())))
+    if (!(success = deleteRoute(NetworkConstants::MULTICAST_PREFIX, NetworkConstants::MULTICAST_PREFIX_LENGTH)))
         SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove multicast routing");
     
-    command.str("");
-    command << "netsh interface ipv4 set interface \"" << narrowAlias << "\" forwarding=disabled";
+    if (!(success = setForwarding(false)))
+        SYSTEM_LOG_INFO("[Network Config Manager] Failed to disable forwarding");
 
-    if (!(success = executeNetshCommand(command.str())))
-        SYSTEM_LOG_INFO("[Network Config Manager] Failed to remove multicast routing");
+    // The address went with clearAddresses, its routes and forwarding are left
+    if (ipv6Configured)
+    {
+        deleteRoute(NetworkConstants::IPV6_PREFIX, NetworkConstants::IPV6_PREFIX_LENGTH);
+        deleteRoute(NetworkConstants::IPV6_MULTICAST_PREFIX, NetworkConstants::IPV6_MULTICAST_PREFIX_LENGTH);
+        if (!setForwarding(false, AF_INET6))
+            SYSTEM_LOG_INFO("[Network Config Manager] Failed to disable IPv6 forwarding");
+        ipv6Configured = false;
+    }
 
     return success;
 }
 
 void NetworkConfigManager::removeFirewall()
 {
-    SYSTEM_LOG_INFO("[Network Config Manager] Setting up firewall rules");
+    SYSTEM_LOG_INFO("[Network Config Manager] Removing firewall rules");
+    firewall::removeRules();
+}
 
-    std::ostringstream firewallCmd;
-    firewallCmd << "netsh advfirewall firewall delete rule "
-                << "name=\"PeerBridge IN\"";
+void NetworkConfigManager::setInterfaceLuid(const NET_LUID& luid)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    interfaceLuid = luid;
+}
 
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to remove inbound firewall rule");
+bool NetworkConfigManager::setAddress(const std::string& ip, uint8_t prefixLength)
+{
+    MIB_UNICASTIPADDRESS_ROW row;
+    InitializeUnicastIpAddressEntry(&row);
+    row.InterfaceLuid = interfaceLuid;
+    row.Address = toSockaddr(ip);
+    row.OnLinkPrefixLength = prefixLength;
+    // Static address on a link of our own, no duplicate detection to wait out
+    row.DadState = IpDadStatePreferred;
+
+    DWORD result = CreateUnicastIpAddressEntry(&row);
+    if (result != NO_ERROR && result != ERROR_OBJECT_ALREADY_EXISTS)
+    {
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add address {}. Error: {}", ip, result);
+        return false;
     }
+    return true;
+}
 
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall delete rule "
-                << "name=\"PeerBridge OUT\"";
-    
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to remove outbound firewall rule");
-    }
+bool NetworkConfigManager::clearAddresses()
+{
+    PMIB_UNICASTIPADDRESS_TABLE table = nullptr;
+    if (GetUnicastIpAddressTable(AF_UNSPEC, &table) != NO_ERROR)
+        return false;
 
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall delete rule "
-                << "name=\"PeerBridge ICMP\"";
-    
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to remove ICMP firewall rule");
+    bool success = true;
+    for (ULONG i = 0; i < table->NumEntries; ++i)
+    {
+        MIB_UNICASTIPADDRESS_ROW& row = table->Table[i];
+        if (row.InterfaceLuid.Value != interfaceLuid.Value)
+            continue;
+        DWORD result = DeleteUnicastIpAddressEntry(&row);
+        if (result != NO_ERROR && result != ERROR_NOT_FOUND)
+            success = false;
     }
+    FreeMibTable(table);
+    return success;
+}
 
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall delete rule "
-                << "name=\"PeerBridge IGMP IN\"";
-
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add inbound IGMP firewall rule.");
+bool NetworkConfigManager::addRoute(const std::string& prefix, uint8_t prefixLength)
+{
+    MIB_IPFORWARD_ROW2 route = routeRow(interfaceLuid, prefix, prefixLength);
+    DWORD result = CreateIpForwardEntry2(&route);
+    if (result != NO_ERROR && result != ERROR_OBJECT_ALREADY_EXISTS)
+    {
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route {}/{}. Error: {}", prefix, prefixLength, result);
+        return false;
     }
+    return true;
+}
 
-    firewallCmd.str("");
-    firewallCmd << "netsh advfirewall firewall delete rule "
-                << "name=\"PeerBridge IGMP OUT\"";
-
-    if (!executeNetshCommand(firewallCmd.str())) {
-        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add outbound IGMP firewall rule");
-    }
+bool NetworkConfigManager::deleteRoute(const std::string& prefix, uint8_t prefixLength)
+{
+    MIB_IPFORWARD_ROW2 route = routeRow(interfaceLuid, prefix, prefixLength);
+    DWORD result = DeleteIpForwardEntry2(&route);
+    return result == NO_ERROR || result == ERROR_NOT_FOUND;
 }
 
-bool NetworkConfigManager::executeNetshCommand(const std::string& command) {
-    STARTUPINFOW si;
-    PROCESS_INFORMATION pi;
-    
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
+bool NetworkConfigManager::setupIpv6(uint8_t selfIndex)
+{
+    std::string selfVirtualIp = ipv6HostAddress(selfIndex);
+    SYSTEM_LOG_INFO("[Network Config Manager] Setting self (static) IPv6 address as: {}", selfVirtualIp);
 
-    std::string fullCommand = "cmd /c " + command;
-    
-    SYSTEM_LOG_INFO("[Netsh] Executing: {}", fullCommand);
-    
-    // Convert to wide string for CreateProcessW
-    int size = MultiByteToWideChar(CP_UTF8, 0, fullCommand.c_str(), -1, NULL, 0);
-    std::vector<wchar_t> wideCommand(size);
-    MultiByteToWideChar(CP_UTF8, 0, fullCommand.c_str(), -1, wideCommand.data(), size);
-    
-    // Create the process
-    if (!CreateProcessW(NULL, wideCommand.data(), NULL, NULL, FALSE, 
-                      CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
-        SYSTEM_LOG_WARNING("[Netsh] Failed to execute command: {}", command);
-        SYSTEM_LOG_WARNING("[Netsh] Windows error: {}", GetLastError());
-        return false;
-    }
-    
-    // Wait for the process to finish
-    WaitForSingleObject(pi.hProcess, INFINITE);
-    
-    // Get the exit code
-    DWORD exitCode;
-    if (!GetExitCodeProcess(pi.hProcess, &exitCode)) {
-        SYSTEM_LOG_WARNING("[Netsh] Failed to get process exit code");
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
+    // The /64 covers every peer, no per-peer fallback here
+    if (!setAddress(selfVirtualIp, NetworkConstants::IPV6_PREFIX_LENGTH) ||
+        !addRoute(NetworkConstants::IPV6_PREFIX, NetworkConstants::IPV6_PREFIX_LENGTH))
+    {
         return false;
     }
-    
-    // Clean up handles
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
-    
-    if (exitCode != 0) {
-        SYSTEM_LOG_WARNING("[Netsh] Command failed with exit code: {}", exitCode);
-        SYSTEM_LOG_WARNING("[Netsh] Windows error: {}", GetLastError());
-    }
-    
-    return exitCode == 0;
+    if (!setForwarding(true, AF_INET6))
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to enable IPv6 forwarding on interface");
+    if (!addRoute(NetworkConstants::IPV6_MULTICAST_PREFIX, NetworkConstants::IPV6_MULTICAST_PREFIX_LENGTH))
+        SYSTEM_LOG_WARNING("[Network Config Manager] Failed to add route for IPv6 multicast traffic, discovery may be limited.");
+    return true;
 }
 
-void NetworkConfigManager::setNarrowAlias(const std::string& nAlias)
+bool NetworkConfigManager::setForwarding(bool enabled, ADDRESS_FAMILY family)
 {
-    narrowAlias = nAlias;
-}
\ No newline at end of file
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+    row.Family = family;
+    row.InterfaceLuid = interfaceLuid;
+    DWORD result = GetIpInterfaceEntry(&row);
+    if (result != NO_ERROR)
+        return false;
+
+    row.ForwardingEnabled = enabled;
+    // Metric 1 so the virtual network wins over anything overlapping it while we're up
+    row.UseAutomaticMetric = !enabled;
+    row.Metric = enabled ? 1 : 0;
+    // IPv4 rows are rejected with anything else
+    if (family == AF_INET)
+        row.SitePrefixLength = 0;
+    return SetIpInterfaceEntry(&row) == NO_ERROR;
+}
@@ -8,6 +8,7 @@ using json = nlohmann::json;
 
 SignalingClient::SignalingClient() 
     : connected_(false)
+    , binary_(false)
 {
     ws_ = std::make_unique<ix::WebSocket>();
 }
@@ -26,9 +27,9 @@ bool SignalingClient::connect(const std::string& server_url) {
     ws_->start();
 
     // Wait for connection with timeout
-    int retries = 50;
-    for (int i = 0; i < retries && !connected_; ++i) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        connectedCv_.wait_for(lock, std::chrono::seconds(5), [this]() { return connected_.load(); });
     }
 
     if (!connected_) {
@@ -60,7 +61,11 @@ void SignalingClient::setupMessageHandlers() {
 void SignalingClient::handleMessage(const ix::WebSocketMessagePtr& msg) {
     if (msg->type == ix::WebSocketMessageType::Message) {
         try {
-            auto data = json::parse(msg->str);
+            // Same messages either way, binary frames are MessagePack maps into the same DOM
+            auto data = msg->binary ? json::from_msgpack(msg->str) : json::parse(msg->str);
+            if (msg->binary) {
+                binary_ = true;
+            }
             handleJsonMessage(data);
         }
         catch (const std::exception& e) {
@@ -70,7 +75,13 @@ void SignalingClient::handleMessage(const ix::WebSocketMessagePtr& msg) {
     }
     else if (msg->type == ix::WebSocketMessageType::Open) {
         clog << "[Client] Connected to server." << std::endl;
-        connected_ = true;
+        // A new server may not know the binary format, start over in JSON
+        binary_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connected_ = true;
+        }
+        connectedCv_.notify_all();
         if (onConnect_) {
             onConnect_(true);
         }
@@ -94,7 +105,13 @@ void SignalingClient::handleMessage(const ix::WebSocketMessagePtr& msg) {
 void SignalingClient::handleJsonMessage(const nlohmann::json& data) {
     std::string type = data.value("type", "");
     
-    if (type == "greet-back") {
+    if (type == "batch") {
+        // Everything the server had queued for us, in order
+        for (const auto& message : data.value("messages", json::array())) {
+            handleJsonMessage(message);
+        }
+    }
+    else if (type == "greet-back") {
         clog << "[Server -> Client] " << data["message"] << std::endl;
     }
     else if (type == "register-ack") {
@@ -113,6 +130,16 @@ void SignalingClient::handleJsonMessage(const nlohmann::json& data) {
             onPeerInfo_(peerName, ip, port);
         }
     }
+    else if (type == "peers-info") {
+        for (const auto& peer : data.value("peers", json::array())) {
+            handleJsonMessage(peer);
+        }
+    }
+    else if (type == "presence") {
+        std::string peer_username = data.value("username", "");
+        bool online = data.value("online", false);
+        clog << "[Server] " << peer_username << (online ? " is online" : " left the session") << std::endl;
+    }
     else if (type == "chat-request") {
         std::string from = data["from"];
         clog << "[Request] " << from << " wants to chat." << std::endl;
@@ -127,10 +154,37 @@ void SignalingClient::handleJsonMessage(const nlohmann::json& data) {
         std::string peer_ip = data["ip"];
         int peer_port = data["port"];
         std::string peer_username = data["username"];
+        // Mesh-aware servers assign every member of a session its own address
+        int self_index = data.value("self_index", 0);
+        int peer_index = data.value("peer_index", 0);
+        // Servers with a relay give every pair its own port on it
+        std::string relay_ip = data.value("relay_ip", "");
+        int relay_port = data.value("relay_port", 0);
+        // Only there when the peer registered one
+        std::string peer_ip6 = data.value("ip6", "");
+        int peer_port6 = data.value("port6", 0);
         clog << "[Server] Chat initialized with " << peer_username << std::endl;
         
         if (onChatInit_) {
-            onChatInit_(peer_username, peer_ip, peer_port);
+            onChatInit_(peer_username, peer_ip, peer_port, self_index, peer_index, relay_ip, relay_port, peer_ip6, peer_port6);
+        }
+    }
+    else if (type == "key-exchange") {
+        std::string from = data.value("from", "");
+        std::string public_key = data.value("public_key", "");
+        bool aes = data.value("aes", false);
+        
+        if (onKeyExchange_ && !from.empty()) {
+            onKeyExchange_(from, public_key, aes);
+        }
+    }
+    else if (type == "peer-moved") {
+        std::string peer_username = data.value("username", "");
+        std::string ip = data.value("ip", "");
+        int port = data.value("port", 0);
+
+        if (onPeerMoved_ && !peer_username.empty() && !ip.empty()) {
+            onPeerMoved_(peer_username, ip, port);
         }
     }
     else if (type == "error") {
@@ -150,10 +204,11 @@ void SignalingClient::sendGreeting() {
     json js = {
         {"type", "greeting"}
     };
-    ws_->send(js.dump());
+    send(js);
 }
 
-void SignalingClient::registerUser(const std::string& username, const std::string& ip, int port) {
+void SignalingClient::registerUser(const std::string& username, const std::string& ip, int port,
+                                   const std::string& ip6, int port6) {
     if (!isConnected()) {
         clog << "[Client] Not connected.\n";
         return;
@@ -163,9 +218,15 @@ void SignalingClient::registerUser(const std::string& username, const std::strin
         {"type", "register"},
         {"username", username},
         {"ip", ip},
-        {"port", port}
+        {"port", port},
+        // Older servers ignore this and keep to JSON, one message per frame
+        {"features", {"binary", "batch"}}
     };
-    ws_->send(js.dump());
+    if (!ip6.empty() && port6 > 0) {
+        js["ip6"] = ip6;
+        js["port6"] = port6;
+    }
+    send(js);
 }
 
 void SignalingClient::requestUsername() {
@@ -177,7 +238,7 @@ void SignalingClient::requestUsername() {
     json js = {
         {"type", "get-name"}
     };
-    ws_->send(js.dump());
+    send(js);
 }
 
 void SignalingClient::requestPeerInfo(const std::string& username) {
@@ -190,7 +251,20 @@ void SignalingClient::requestPeerInfo(const std::string& username) {
         {"type", "get-peer"},
         {"username", username}
     };
-    ws_->send(j.dump());
+    send(j);
+}
+
+void SignalingClient::requestPeerInfo(const std::vector<std::string>& usernames) {
+    if (!isConnected()) {
+        clog << "[Client] Not connected.\n";
+        return;
+    }
+    
+    json j = {
+        {"type", "get-peers"},
+        {"usernames", usernames}
+    };
+    send(j);
 }
 
 void SignalingClient::sendChatRequest(const std::string& username) {
@@ -203,7 +277,7 @@ void SignalingClient::sendChatRequest(const std::string& username) {
         {"type", "start-chat"},
         {"target", username}
     };
-    ws_->send(j.dump());
+    send(j);
 }
 
 void SignalingClient::acceptChatRequest() {
@@ -213,7 +287,7 @@ void SignalingClient::acceptChatRequest() {
     }
     
     json j = { {"type", "chat-accept"} };
-    ws_->send(j.dump());
+    send(j);
 }
 
 void SignalingClient::declineChatRequest() {
@@ -223,7 +297,56 @@ void SignalingClient::declineChatRequest() {
     }
     
     json j = { {"type", "chat-decline"} };
-    ws_->send(j.dump());
+    send(j);
+}
+
+void SignalingClient::leaveSession() {
+    if (!isConnected()) {
+        clog << "[Client] Not connected.\n";
+        return;
+    }
+    
+    json j = { {"type", "leave-session"} };
+    send(j);
+}
+
+void SignalingClient::sendKeyExchange(const std::string& username, const std::string& publicKey, bool aes) {
+    if (!isConnected()) {
+        clog << "[Client] Not connected.\n";
+        return;
+    }
+    
+    json j = {
+        {"type", "key-exchange"},
+        {"to", username},
+        {"public_key", publicKey},
+        {"aes", aes}
+    };
+    send(j);
+}
+
+void SignalingClient::updateAddress(const std::string& ip, int port) {
+    if (!isConnected()) {
+        clog << "[Client] Not connected.\n";
+        return;
+    }
+    
+    json j = {
+        {"type", "update-address"},
+        {"ip", ip},
+        {"port", port}
+    };
+    send(j);
+}
+
+void SignalingClient::send(const json& message) {
+    if (binary_) {
+        std::vector<uint8_t> packed = json::to_msgpack(message);
+        ws_->sendBinary(std::string(packed.begin(), packed.end()));
+    }
+    else {
+        ws_->send(message.dump());
+    }
 }
 
 void SignalingClient::setConnectCallback(ConnectCallback callback) {
@@ -240,4 +363,12 @@ void SignalingClient::setPeerInfoCallback(PeerInfoCallback callback) {
 
 void SignalingClient::setChatInitCallback(ChatInitCallback callback) {
     onChatInit_ = std::move(callback);
+}
+
+void SignalingClient::setKeyExchangeCallback(KeyExchangeCallback callback) {
+    onKeyExchange_ = std::move(callback);
+}
+
+void SignalingClient::setPeerMovedCallback(PeerMovedCallback callback) {
+    onPeerMoved_ = std::move(callback);
 }
\ No newline at end of file
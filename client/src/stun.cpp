@@ -1,18 +1,119 @@
 #include "Stun.hpp"
 #include "Logger.hpp"
 #include <iostream>
+#include <array>
+#include <cstring>
+#include <functional>
 #include <sodium/randombytes.h>
 
-StunClient::StunClient(const std::string& server, const std::string& port)
-    : stunServer(server), stunPort(port)
+namespace
+{
+// Requests are resent to every server until one answers or we give up
+constexpr std::chrono::milliseconds RETRANSMIT_INTERVAL{250};
+constexpr std::chrono::seconds DISCOVERY_TIMEOUT{5};
+// How long the first answer waits for one over the other family
+constexpr std::chrono::milliseconds SECOND_FAMILY_WAIT{500};
+}
+
+// Build STUN binding request according to RFC 5389 protocol
+std::array<uint8_t, StunClient::HEADER_SIZE> StunClient::bindingRequest(const TransactionId& transaction)
+{
+    std::array<uint8_t, HEADER_SIZE> request{};
+    request[0] = 0x00; request[1] = 0x01;  // Bytes 0..1 Binding Request
+    request[2] = 0x00; request[3] = 0x00;  // Bytes 2..3 Message length
+    request[4] = 0x21; request[5] = 0x12; request[6] = 0xA4; request[7] = 0x42;  // Bytes 4..7 Magic Cookie
+    std::memcpy(&request[8], transaction.data(), transaction.size()); // Bytes 8..19 Transaction ID
+    return request;
+}
+
+bool StunClient::isStunMessage(const uint8_t* message, size_t len)
+{
+    return len >= HEADER_SIZE &&
+        message[4] == 0x21 && message[5] == 0x12 && message[6] == 0xA4 && message[7] == 0x42;
+}
+
+std::optional<PublicAddress> StunClient::parseBindingResponse(const uint8_t* response, size_t len, const TransactionId& transaction)
+{
+    // Check length is not smaller than header size
+    if (len < HEADER_SIZE)
+        return std::nullopt;
+
+    // Check length against reported message length
+    uint16_t msg_length = response[2] << 8 | response[3];
+    if (HEADER_SIZE + msg_length > len)
+        return std::nullopt;
+
+    // Check message type is binding success, and that it answers our request
+    uint16_t msg_type = response[0] << 8 | response[1];
+    if (msg_type != 0x0101 || std::memcmp(&response[8], transaction.data(), transaction.size()) != 0)
+        return std::nullopt;
+
+    // Parse XOR-MAPPED-ADDRESS attribute
+    size_t end = HEADER_SIZE + msg_length;
+    for (size_t i = HEADER_SIZE; i + 4 <= end;) {
+        uint16_t attr_type = (response[i] << 8) | response[i + 1];
+        uint16_t attr_len  = (response[i + 2] << 8) | response[i + 3];
+        i += 4;
+        if (i + attr_len > end)
+            break;
+        if (attr_type == 0x0020 && attr_len >= 8 && response[i + 1] == 0x01) {  // XOR-MAPPED-ADDRESS, IPv4
+            uint16_t xport = (response[i + 2] << 8) | response[i + 3];
+            uint32_t xip = (response[i + 4] << 24) | (response[i + 5] << 16) |
+                           (response[i + 6] << 8) | response[i + 7];
+
+            uint16_t port = xport ^ 0x2112;
+            uint32_t ip_raw = xip ^ 0x2112A442;
+
+            boost::asio::ip::address_v4::bytes_type ip_bytes {
+                static_cast<uint8_t>((ip_raw >> 24) & 0xFF),
+                static_cast<uint8_t>((ip_raw >> 16) & 0xFF),
+                static_cast<uint8_t>((ip_raw >> 8) & 0xFF),
+                static_cast<uint8_t>((ip_raw) & 0xFF)
+            };
+
+            std::string ip_str = boost::asio::ip::address_v4(ip_bytes).to_string();
+            return PublicAddress{ ip_str, port };
+        }
+        if (attr_type == 0x0020 && attr_len >= 20 && response[i + 1] == 0x02) {  // XOR-MAPPED-ADDRESS, IPv6
+            uint16_t port = ((response[i + 2] << 8) | response[i + 3]) ^ 0x2112;
+
+            // XORed with the magic cookie followed by the transaction id, bytes 4..19 of the header
+            boost::asio::ip::address_v6::bytes_type ip_bytes;
+            for (size_t b = 0; b < ip_bytes.size(); ++b)
+                ip_bytes[b] = response[i + 4 + b] ^ response[4 + b];
+
+            std::string ip_str = boost::asio::ip::address_v6(ip_bytes).to_string();
+            return PublicAddress{ ip_str, port, true };
+        }
+        // Attributes are padded to 4 bytes
+        i += (attr_len + 3) & ~size_t(3);
+    }
+    return std::nullopt;
+}
+
+StunClient::StunClient(std::vector<StunServer> servers)
+    : stunServers(std::move(servers))
     , ioContext()
 {
 }
 
+std::vector<StunServer> StunClient::defaultServers()
+{
+    return {
+        {"stun.l.google.com", "19302"},
+        {"stun1.l.google.com", "19302"},
+        {"stun.cloudflare.com", "3478"},
+    };
+}
+
 void StunClient::setStunServer(const std::string& server, const std::string& port)
 {
-    stunServer = server;
-    stunPort = port;
+    stunServers = {{server, port}};
+}
+
+void StunClient::addStunServer(const std::string& server, const std::string& port)
+{
+    stunServers.push_back({server, port});
 }
 
 std::optional<PublicAddress> StunClient::discoverPublicAddress()
@@ -20,112 +121,168 @@ std::optional<PublicAddress> StunClient::discoverPublicAddress()
     using boost::asio::ip::udp;
     try
     {
-        SYSTEM_LOG_INFO("[STUN] Discovering public address");
+        SYSTEM_LOG_INFO("[STUN] Discovering public address through {} server(s)", stunServers.size());
         scoket = std::make_unique<udp::socket>(ioContext);
-        // --- Setup socket, build and send STUN binding request --- //
-        udp::resolver resolver(ioContext);
-        udp::endpoint stun_endpoint = *resolver.resolve(stunServer, stunPort).begin();
-        scoket->open(udp::v4());
-
-        // Build STUN binding request according to RFC 5389 protocol
-        std::array<uint8_t, 20> request{};
-        request[0] = 0x00; request[1] = 0x01;  // Bytes 0..1 Binding Request
-        request[2] = 0x00; request[3] = 0x00;  // Bytes 2..3 Message length
-        request[4] = 0x21; request[5] = 0x12; request[6] = 0xA4; request[7] = 0x42;  // Bytes 4..7 Magic Cookie
-        randombytes_buf(&request[8], 12); // Bytes 8..19 Transaction ID
-
-        // Send request
-        scoket->send_to(boost::asio::buffer(request), stun_endpoint);
-
-        // Receive response
+        // Dual-stack, IPv4 peers show up as v4-mapped addresses; hosts without IPv6 stay on IPv4
+        boost::system::error_code open_error;
+        scoket->open(udp::v6(), open_error);
+        if (!open_error)
+            scoket->set_option(boost::asio::ip::v6_only(false), open_error);
+        bool dual_stack = !open_error;
+        if (!dual_stack) {
+            SYSTEM_LOG_INFO("[STUN] No dual-stack socket, IPv4 only");
+            scoket = std::make_unique<udp::socket>(ioContext);
+            scoket->open(udp::v4());
+        }
+        scoket->non_blocking(true);
+        lastAddress6.reset();
+
+        // One transaction for every server and every resend, whichever answers first is the one we keep
+        TransactionId transaction;
+        randombytes_buf(transaction.data(), transaction.size());
+        const std::array<uint8_t, HEADER_SIZE> request = bindingRequest(transaction);
+
+        std::vector<std::unique_ptr<udp::resolver>> resolvers;
+        std::vector<udp::endpoint> targets;
+        // The first answer of each family, kept until the other had its chance too
+        std::optional<PublicAddress> result;
+        std::optional<PublicAddress> result6;
+        std::optional<udp::endpoint> server6;
+        auto deadline = std::chrono::steady_clock::now() + DISCOVERY_TIMEOUT;
+
         std::array<uint8_t, 512> response{};
         udp::endpoint sender_endpoint;
-        
-        // Set timeout
-        scoket->non_blocking(true);
         boost::asio::steady_timer timer(ioContext);
-        timer.expires_after(std::chrono::seconds(5));
-        
-        boost::system::error_code ec;
-        size_t len = 0;
-        
-        bool received = false;
-
-        // Async receive with timeout
-        scoket->async_receive_from(
-            boost::asio::buffer(response), sender_endpoint,
-            [&](const boost::system::error_code& error, std::size_t bytes_recvd) {
-                if (!error) {
-                    len = bytes_recvd;
-                    received = true;
-                    timer.cancel(); // Cancel the timer if we received data
-                }
-            }
-        );
-        
-        // Set up async timeout
-        timer.async_wait([&](const boost::system::error_code& error) {
-            if (!error) {
-                scoket->cancel(); // Cancel receive if timeout
-            }
-        });
-        
-        // Run IO until one of them finishes
-        ioContext.run();
 
-        if (!received) {
-            SYSTEM_LOG_ERROR("[STUN] Response timeout or error");
-            return std::nullopt;
-        }
+        auto finish = [&]()
+        {
+            boost::system::error_code ec;
+            timer.cancel();
+            for (auto& resolver : resolvers)
+                resolver->cancel();
+            scoket->cancel(ec);
+        };
 
-        /* --- Validate STUN Response --- */
+        auto sendRequest = [&](const udp::endpoint& target)
+        {
+            boost::system::error_code ec;
+            scoket->send_to(boost::asio::buffer(request), target, 0, ec);
+        };
 
-        // Check length is not smaller than header size
-        if (len < 20) {
-            SYSTEM_LOG_ERROR("[STUN] Response too short.");
-            return std::nullopt;
+        // --- Resolve every server, each gets its request as soon as it has an address --- //
+        for (const StunServer& server : stunServers)
+        {
+            resolvers.push_back(std::make_unique<udp::resolver>(ioContext));
+            resolvers.back()->async_resolve(server.host, server.port,
+                [&, host = server.host](const boost::system::error_code& error, udp::resolver::results_type results)
+                {
+                    if (error || results.empty())
+                    {
+                        if (error != boost::asio::error::operation_aborted)
+                            SYSTEM_LOG_WARNING("[STUN] Failed to resolve {}", host);
+                        return;
+                    }
+                    // One address of each family the socket can reach
+                    bool have_v4 = false;
+                    bool have_v6 = false;
+                    for (const auto& entry : results)
+                    {
+                        boost::asio::ip::address address = entry.endpoint().address();
+                        if (address.is_v4() && !have_v4)
+                        {
+                            have_v4 = true;
+                            if (dual_stack)
+                                address = boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, address.to_v4());
+                        }
+                        else if (address.is_v6() && !have_v6 && dual_stack)
+                        {
+                            have_v6 = true;
+                        }
+                        else
+                        {
+                            continue;
+                        }
+                        targets.emplace_back(address, entry.endpoint().port());
+                        sendRequest(targets.back());
+                    }
+                });
         }
 
-        // Check length against reported message length
-        uint16_t msg_length = response[2] << 8 | response[3];
-        if (20 + msg_length > len) {
-            SYSTEM_LOG_ERROR("[STUN] Message length exceeds received size.");
-            return std::nullopt;
-        }
+        // --- Receive until an answer to our transaction arrives --- //
+        std::function<void()> receive = [&]()
+        {
+            scoket->async_receive_from(
+                boost::asio::buffer(response), sender_endpoint,
+                [&](const boost::system::error_code& error, std::size_t bytes_recvd) {
+                    if (error == boost::asio::error::operation_aborted)
+                        return;
+                    // ICMP errors from one server show up here, the others may still answer
+                    std::optional<PublicAddress> answer;
+                    if (!error)
+                        answer = parseBindingResponse(response.data(), bytes_recvd, transaction);
+                    if (answer && (answer->ipv6 ? !result6 : !result))
+                    {
+                        SYSTEM_LOG_INFO("[STUN] Answer from {}, mapped to {}", sender_endpoint.address().to_string(), answer->ip);
+                        if (answer->ipv6)
+                        {
+                            result6 = answer;
+                            server6 = sender_endpoint;
+                        }
+                        else
+                        {
+                            result = answer;
+                            lastServer = sender_endpoint;
+                        }
+                        // Both candidates, or the only family this socket has
+                        if ((result && result6) || !dual_stack)
+                        {
+                            finish();
+                            return;
+                        }
+                        deadline = std::min(deadline, std::chrono::steady_clock::now() + SECOND_FAMILY_WAIT);
+                    }
+                    receive();
+                }
+            );
+        };
+        receive();
 
-        // Check message type is binding success
-        uint16_t msg_type = response[0] << 8 | response[1];
-        if (msg_type != 0x0101) { // 0x0101 = Binding success response
-            SYSTEM_LOG_ERROR("[STUN] Not a Binding Success Response.");
-            return std::nullopt;
-        }
+        // --- Resend to every resolved server until the deadline --- //
+        std::function<void()> retransmit = [&]()
+        {
+            timer.expires_after(RETRANSMIT_INTERVAL);
+            timer.async_wait([&](const boost::system::error_code& error) {
+                if (error)
+                    return;
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    finish();
+                    return;
+                }
+                for (const udp::endpoint& target : targets)
+                    sendRequest(target);
+                retransmit();
+            });
+        };
+        retransmit();
+
+        // Run IO until we have an answer or time runs out
+        ioContext.run();
+        // The context is handed on to the networking module with the socket
+        ioContext.restart();
 
-        // Parse XOR-MAPPED-ADDRESS attribute
-        for (size_t i = 20; i + 4 < len;) {
-            uint16_t attr_type = (response[i] << 8) | response[i + 1];
-            uint16_t attr_len  = (response[i + 2] << 8) | response[i + 3];
-            i += 4;
-            if (attr_type == 0x0020) {  // XOR-MAPPED-ADDRESS
-                uint8_t family = response[i + 1];
-                uint16_t xport = (response[i + 2] << 8) | response[i + 3];
-                uint32_t xip = (response[i + 4] << 24) | (response[i + 5] << 16) |
-                               (response[i + 6] << 8) | response[i + 7];
-
-                uint16_t port = xport ^ 0x2112;
-                uint32_t ip_raw = xip ^ 0x2112A442;
-
-                boost::asio::ip::address_v4::bytes_type ip_bytes {
-                    static_cast<uint8_t>((ip_raw >> 24) & 0xFF),
-                    static_cast<uint8_t>((ip_raw >> 16) & 0xFF),
-                    static_cast<uint8_t>((ip_raw >> 8) & 0xFF),
-                    static_cast<uint8_t>((ip_raw) & 0xFF)
-                };
-
-                std::string ip_str = boost::asio::ip::address_v4(ip_bytes).to_string();
-                return PublicAddress{ ip_str, port };
-            }
-            i += attr_len;
+        if (result6)
+            lastAddress6 = result6;
+        // IPv6-only hosts, the IPv6 candidate is all there is
+        if (!result && result6) {
+            lastServer = server6;
+            return result6;
+        }
+        if (!result) {
+            SYSTEM_LOG_ERROR("[STUN] Response timeout or error");
+            return std::nullopt;
         }
+        return result;
     } catch (std::exception& e) {
         SYSTEM_LOG_ERROR("[STUN] Failed: {}", e.what());
     }
@@ -133,6 +290,16 @@ std::optional<PublicAddress> StunClient::discoverPublicAddress()
     return std::nullopt;
 }
 
+std::optional<boost::asio::ip::udp::endpoint> StunClient::answeredBy() const
+{
+    return lastServer;
+}
+
+std::optional<PublicAddress> StunClient::publicAddress6() const
+{
+    return lastAddress6;
+}
+
 std::unique_ptr<boost::asio::ip::udp::socket> StunClient::getSocket()
 {
     return std::move(scoket);
@@ -141,4 +308,4 @@ std::unique_ptr<boost::asio::ip::udp::socket> StunClient::getSocket()
 boost::asio::io_context& StunClient::getContext()
 {
     return ioContext;
-}
\ No newline at end of file
+}
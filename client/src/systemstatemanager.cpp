@@ -1,7 +1,20 @@
 #include "SystemStateManager.hpp"
 #include "Logger.hpp"
+#include <boost/asio/post.hpp>
 
-SystemStateManager::SystemStateManager() : currentState(SystemState::IDLE) {}
+SystemStateManager::SystemStateManager()
+    : currentState(SystemState::IDLE)
+    , dispatcher(1)
+{
+}
+
+SystemStateManager::~SystemStateManager()
+{
+    stopDispatcher();
+    // Last reference dropped by a handler, the thread unwinds on its own
+    if (dispatcherThread.joinable())
+        dispatcherThread.detach();
+}
 
 bool SystemStateManager::isValidTransition(SystemState from, SystemState to) const
 {
@@ -59,46 +72,65 @@ bool SystemStateManager::isInState(SystemState state) const
     return currentState.load(std::memory_order_acquire) == state;
 }
 
-void SystemStateManager::queueEvent(const NetworkEventData& event)
+void SystemStateManager::startDispatcher(EventHandler handler)
 {
-    SYSTEM_LOG_INFO("[StateManager] Queuing event: {}", static_cast<int>(event.event));
-    std::lock_guard<std::mutex> lock(eventMutex);
-    eventQueue.push(event);
+    if (dispatcherThread.joinable())
+        return;
+
+    eventHandler = std::move(handler);
+    dispatcherWork.emplace(boost::asio::make_work_guard(dispatcher));
+    dispatcherThread = std::thread([this]()
+    {
+        try
+        {
+            dispatcher.run();
+        }
+        catch (const std::exception& e)
+        {
+            SYSTEM_LOG_ERROR("[StateManager] Event dispatcher error: {}", e.what());
+        }
+    });
 }
 
-std::optional<NetworkEventData> SystemStateManager::getNextEvent()
+void SystemStateManager::stopDispatcher()
 {
-    std::lock_guard<std::mutex> lock(eventMutex);
-    if (eventQueue.empty())
-    {
-        return std::nullopt;
-    }
-    
-    SYSTEM_LOG_INFO("[StateManager] Getting next event");
-    NetworkEventData event = eventQueue.front();
-    eventQueue.pop();
-    return event;
+    dispatcherWork.reset();
+    dispatcher.stop();
+    if (dispatcherThread.joinable() && dispatcherThread.get_id() != std::this_thread::get_id())
+        dispatcherThread.join();
 }
 
-bool SystemStateManager::hasEvents() const
+void SystemStateManager::queueEvent(const NetworkEventData& event)
 {
-    std::lock_guard<std::mutex> lock(eventMutex);
-    return !eventQueue.empty();
+    SYSTEM_LOG_INFO("[StateManager] Queuing event: {}", static_cast<int>(event.event));
+    boost::asio::post(dispatcher, [this, event]()
+    {
+        if (eventHandler)
+            eventHandler(event);
+    });
 }
 
-PeerConnectionInfo::PeerConnectionInfo() : connected(false)
+PeerConnectionInfo::PeerConnectionInfo() : lastActivity(0), connected(false)
 {
     updateActivity();
 }
 
 void PeerConnectionInfo::updateActivity()
 {
-    lastActivity.store(std::chrono::steady_clock::now(), std::memory_order_release);
+    updateActivity(std::chrono::steady_clock::now());
+}
+
+void PeerConnectionInfo::updateActivity(std::chrono::steady_clock::time_point now)
+{
+    // Unchanged within a burst, the cache line isn't written again
+    std::chrono::steady_clock::rep ticks = now.time_since_epoch().count();
+    if (lastActivity.load(std::memory_order_relaxed) != ticks)
+        lastActivity.store(ticks, std::memory_order_relaxed);
 }
 
 bool PeerConnectionInfo::hasTimedOut(int timeoutSeconds) const
 {
-    auto lastActivity_ = lastActivity.load(std::memory_order_acquire);
+    auto lastActivity_ = getLastActivity();
     auto now = std::chrono::steady_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - lastActivity_).count();
     return (elapsed > timeoutSeconds) && connected.load(std::memory_order_acquire);
@@ -118,5 +150,6 @@ bool PeerConnectionInfo::isConnected() const {
 }
 
 std::chrono::steady_clock::time_point PeerConnectionInfo::getLastActivity() const {
-    return lastActivity.load(std::memory_order_acquire);
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(lastActivity.load(std::memory_order_relaxed)));
 } 
\ No newline at end of file